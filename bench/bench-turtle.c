@@ -0,0 +1,750 @@
+/*
+ * Copyright (C) 2017 Université Clermont Auvergne, CNRS/IN2P3, LPC
+ * Author: Valentin NIESS (niess@in2p3.fr)
+ *
+ * Topographic Utilities for tRansporting parTicules over Long rangEs (TURTLE)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/*
+ * Benchmarks for the Turtle C library.
+ *
+ * Synthetic elevation tiles are generated in a work directory, given as first
+ * argument (default: `bench-data`). An optional second argument scales the
+ * number of operations of each benchmark. Results are written to stdout, one
+ * JSON object per line, e.g. for tracking performance regressions.
+ */
+
+/* POSIX monotonic clock and directories */
+#define _POSIX_C_SOURCE 200112L
+
+/* C89 standard library */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+/* POSIX library */
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+/* The TURTLE library */
+#include "turtle.h"
+
+#ifndef M_PI
+/* Define pi, if unknown. */
+#define M_PI 3.14159265358979323846
+#endif
+
+/* Geometry of the synthetic data: 2x2 tiles of 1 deg^2 at (45N, 2E) */
+#define LATITUDE_0 45.
+#define LONGITUDE_0 2.
+#define TILE_SIZE 1201
+#define MAX_THREADS 8
+
+/* Scale factor for the number of operations */
+static double scale = 1.;
+
+/* Get a monotonic time stamp, in ns */
+static double now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1E+09 + ts.tv_nsec;
+}
+
+/* Scaled number of operations */
+static long n_ops(long n)
+{
+        const long m = (long)(n * scale);
+        return (m > 0) ? m : 1;
+}
+
+/* Report a benchmark result as a JSON line */
+static void report(const char * name, long ops, double ns, double bytes)
+{
+        if (ops <= 0) return;
+        fprintf(stdout, "{\"benchmark\": \"%s\", \"ops\": %ld, "
+                        "\"ns_per_op\": %.3f",
+            name, ops, ns / ops);
+        if (bytes > 0.)
+                fprintf(stdout, ", \"mb_per_s\": %.3f", 1E+03 * bytes / ns);
+        fputs("}\n", stdout);
+        fflush(stdout);
+}
+
+/* Reproducible pseudo random numbers, using xorshift64* */
+static uint64_t seed = 0x2545F4914F6CDD1DULL;
+
+static double uniform(void)
+{
+        seed ^= seed >> 12;
+        seed ^= seed << 25;
+        seed ^= seed >> 27;
+        return ((seed * 0x2545F4914F6CDD1DULL) >> 11) *
+            (1. / 9007199254740992.);
+}
+
+/* Synthetic relief, in m */
+static double relief(double latitude, double longitude)
+{
+        const double k = 2. * M_PI * 20.;
+        return 500. + 250. * sin(k * latitude) * cos(k * longitude) +
+            200. * sin(0.37 * k * (latitude + longitude));
+}
+
+/* Generate a synthetic tile */
+static struct turtle_map * tile_create(double latitude, double longitude)
+{
+        struct turtle_map * map;
+        struct turtle_map_info info = { TILE_SIZE, TILE_SIZE,
+                { longitude, longitude + 1. }, { latitude, latitude + 1. },
+                { 0., 1000. } };
+        turtle_map_create(&map, &info, NULL);
+        int i;
+        for (i = 0; i < TILE_SIZE; i++) {
+                int j;
+                for (j = 0; j < TILE_SIZE; j++) {
+                        double x, y;
+                        turtle_map_node(map, j, i, &x, &y, NULL);
+                        turtle_map_fill(map, j, i, relief(y, x));
+                }
+        }
+        return map;
+}
+
+/* Dump a tile in HGT format, i.e. as raw big endian 16 bit data */
+static int dump_hgt(const struct turtle_map * map, const char * path)
+{
+        FILE * fid = fopen(path, "wb");
+        if (fid == NULL) return EXIT_FAILURE;
+        int i;
+        for (i = TILE_SIZE - 1; i >= 0; i--) {
+                int j;
+                for (j = 0; j < TILE_SIZE; j++) {
+                        double z;
+                        turtle_map_node(map, j, i, NULL, NULL, &z);
+                        const int16_t iz = (int16_t)round(z);
+                        const unsigned char c[2] = { (iz >> 8) & 0xFF,
+                                iz & 0xFF };
+                        fwrite(c, 1, 2, fid);
+                }
+        }
+        fclose(fid);
+        return EXIT_SUCCESS;
+}
+
+/* Dump a tile in ASC or GRD format, as text with short lines */
+static int dump_text(const struct turtle_map * map, const char * path, int asc)
+{
+        FILE * fid = fopen(path, "w");
+        if (fid == NULL) return EXIT_FAILURE;
+        struct turtle_map_info info;
+        turtle_map_meta(map, &info, NULL);
+        const double d = (info.x[1] - info.x[0]) / (info.nx - 1);
+        if (asc) {
+                fprintf(fid,
+                    "ncols        %d\nnrows        %d\n"
+                    "xllcorner    %.12f\nyllcorner    %.12f\n"
+                    "cellsize     %.12f\nNODATA_value  -9999\n",
+                    info.nx, info.ny, info.x[0] - 0.5 * d,
+                    info.y[0] - 0.5 * d, d);
+        } else {
+                fprintf(fid, "%.12f %.12f %.12f %.12f %.12f %.12f\n",
+                    info.y[0], info.y[1], info.x[0], info.x[1], d, d);
+        }
+        int i;
+        for (i = 0; i < info.ny; i++) {
+                const int iy = asc ? info.ny - 1 - i : i;
+                int j;
+                for (j = 0; j < info.nx; j++) {
+                        double z;
+                        turtle_map_node(map, j, iy, NULL, NULL, &z);
+                        fprintf(fid, " %8.3f", z);
+                        if ((j % 8) == 7) fputs("\n", fid);
+                }
+                fputs("\n", fid);
+        }
+        fclose(fid);
+        return EXIT_SUCCESS;
+}
+
+/* Get the size of a file, in bytes */
+static double file_size(const char * path)
+{
+        struct stat st;
+        return (stat(path, &st) == 0) ? (double)st.st_size : 0.;
+}
+
+/* Generate the synthetic data set */
+static void setup_data(const char * directory)
+{
+        char path[1024];
+        mkdir(directory, 0755);
+        sprintf(path, "%s/png", directory);
+        mkdir(path, 0755);
+        sprintf(path, "%s/hgt", directory);
+        mkdir(path, 0755);
+        sprintf(path, "%s/formats", directory);
+        mkdir(path, 0755);
+
+        int k;
+        for (k = 0; k < 4; k++) {
+                const int latitude = (int)LATITUDE_0 + k % 2;
+                const int longitude = (int)LONGITUDE_0 + k / 2;
+                struct turtle_map * map = tile_create(latitude, longitude);
+                sprintf(path, "%s/png/%02dN_%03dE.png", directory, latitude,
+                    longitude);
+                turtle_map_dump(map, path);
+                sprintf(path, "%s/hgt/N%02dE%03d.bench.hgt", directory,
+                    latitude, longitude);
+                dump_hgt(map, path);
+
+                if (k == 0) {
+                        /* Dump the 1st tile in all formats */
+                        turtle_error_handler_t * handler =
+                            turtle_error_handler_get();
+                        turtle_error_handler_set(NULL);
+                        sprintf(path, "%s/formats/N%02dE%03d.bench.hgt",
+                            directory, latitude, longitude);
+                        dump_hgt(map, path);
+                        sprintf(path, "%s/formats/tile.png", directory);
+                        turtle_map_dump(map, path);
+                        sprintf(path, "%s/formats/tile.tif", directory);
+                        turtle_map_dump(map, path);
+                        sprintf(path, "%s/formats/tile.asc", directory);
+                        dump_text(map, path, 1);
+                        sprintf(path, "%s/formats/tile.grd", directory);
+                        dump_text(map, path, 0);
+                        turtle_error_handler_set(handler);
+                }
+                turtle_map_destroy(&map);
+        }
+}
+
+/* Random coordinates over the synthetic data set */
+static void random_coordinates(
+    long n, double size, double * latitude, double * longitude)
+{
+        long i;
+        for (i = 0; i < n; i++) {
+                latitude[i] = LATITUDE_0 + size * uniform();
+                longitude[i] = LONGITUDE_0 + size * uniform();
+        }
+}
+
+/* Coherent coordinates, i.e. a random walk over the synthetic data set */
+static void coherent_coordinates(long n, double * latitude, double * longitude)
+{
+        double la = LATITUDE_0 + 0.5, lo = LONGITUDE_0 + 0.5;
+        long i;
+        for (i = 0; i < n; i++) {
+                la += 1E-03 * (uniform() - 0.45);
+                lo += 1E-03 * (uniform() - 0.45);
+                if ((la < LATITUDE_0) || (la >= LATITUDE_0 + 2.))
+                        la = LATITUDE_0 + 2. * uniform();
+                if ((lo < LONGITUDE_0) || (lo >= LONGITUDE_0 + 2.))
+                        lo = LONGITUDE_0 + 2. * uniform();
+                latitude[i] = la;
+                longitude[i] = lo;
+        }
+}
+
+/* Random walk with isotropic steps of *step* deg, over a *size* deg square
+ * region. Walkers are reflected on the region boundaries
+ */
+static void random_walk(long n, double size, double step, double * latitude,
+    double * longitude)
+{
+        double la = 0.5 * size, lo = 0.5 * size;
+        long i;
+        for (i = 0; i < n; i++) {
+                const double phi = 2. * M_PI * uniform();
+                la += step * cos(phi);
+                lo += step * sin(phi);
+                if (la < 0.)
+                        la = -la;
+                else if (la >= size)
+                        la = 2. * size - la - 1E-09;
+                if (lo < 0.)
+                        lo = -lo;
+                else if (lo >= size)
+                        lo = 2. * size - lo - 1E-09;
+                latitude[i] = LATITUDE_0 + la;
+                longitude[i] = LONGITUDE_0 + lo;
+        }
+}
+
+/* Benchmark the interpolation of a map for a set of locations */
+static void bench_map_access(const struct turtle_map * map, const char * tag,
+    long n, const double * latitude, const double * longitude)
+{
+        char name[128];
+        double sum = 0.;
+        double t0 = now();
+        long i;
+        for (i = 0; i < n; i++) {
+                double z;
+                turtle_map_elevation(map, longitude[i], latitude[i], &z, NULL);
+                sum += z;
+        }
+        sprintf(name, "map_elevation%s", tag);
+        report(name, n, now() - t0, 0.);
+
+        t0 = now();
+        for (i = 0; i < n; i++) {
+                double gx, gy;
+                turtle_map_gradient(
+                    map, longitude[i], latitude[i], &gx, &gy, NULL);
+                sum += gx + gy;
+        }
+        sprintf(name, "map_gradient%s", tag);
+        report(name, n, now() - t0, 0.);
+
+        t0 = now();
+        for (i = 0; i < n; i++) {
+                double z, gx, gy;
+                turtle_map_elevation_gradient(
+                    map, longitude[i], latitude[i], &z, &gx, &gy, NULL);
+                sum += z + gx + gy;
+        }
+        sprintf(name, "map_elevation_gradient%s", tag);
+        report(name, n, now() - t0, 0.);
+
+        if (sum == 0.) fputs("", stderr); /* Prevent optimising away */
+}
+
+/* Benchmark the map interpolation, for row major and blocked layouts */
+static void bench_map(void)
+{
+        struct turtle_map * map = tile_create(LATITUDE_0, LONGITUDE_0);
+        const long n = n_ops(2000000);
+        double * latitude = malloc(n * sizeof(*latitude));
+        double * longitude = malloc(n * sizeof(*longitude));
+        double * walk_latitude = malloc(n * sizeof(*walk_latitude));
+        double * walk_longitude = malloc(n * sizeof(*walk_longitude));
+        random_coordinates(n, 1., latitude, longitude);
+        random_walk(n, 1., 5E-03, walk_latitude, walk_longitude);
+
+        bench_map_access(map, "", n, latitude, longitude);
+        bench_map_access(map, "_walk", n, walk_latitude, walk_longitude);
+        turtle_map_block(&map);
+        bench_map_access(map, "_blocked", n, latitude, longitude);
+        bench_map_access(
+            map, "_blocked_walk", n, walk_latitude, walk_longitude);
+
+        free(latitude);
+        free(longitude);
+        free(walk_latitude);
+        free(walk_longitude);
+        turtle_map_destroy(&map);
+}
+
+/* Benchmark the stack access */
+static void bench_stack(const char * directory)
+{
+        char path[1024];
+        sprintf(path, "%s/png", directory);
+
+        /* Time the stack creation, i.e. the scan of the tiles */
+        struct turtle_stack * stack;
+        long n = n_ops(200);
+        double t0 = now();
+        long i;
+        for (i = 0; i < n; i++) {
+                turtle_stack_create(&stack, path, 0, NULL, NULL);
+                turtle_stack_destroy(&stack);
+        }
+        report("stack_create", n, now() - t0, 0.);
+
+        turtle_stack_create(&stack, path, 0, NULL, NULL);
+        turtle_stack_index_dump(stack);
+        turtle_stack_destroy(&stack);
+        t0 = now();
+        for (i = 0; i < n; i++) {
+                turtle_stack_create(&stack, path, 0, NULL, NULL);
+                turtle_stack_destroy(&stack);
+        }
+        report("stack_create_indexed", n, now() - t0, 0.);
+        char index_path[1040];
+        sprintf(index_path, "%s/.turtle-index", path);
+        remove(index_path);
+
+        /* Time the elevation lookup with all tiles loaded */
+        n = n_ops(2000000);
+        double * latitude = malloc(n * sizeof(*latitude));
+        double * longitude = malloc(n * sizeof(*longitude));
+        double * elevation = malloc(n * sizeof(*elevation));
+        turtle_stack_create(&stack, path, 0, NULL, NULL);
+        turtle_stack_load(stack);
+
+        double sum = 0.;
+        random_coordinates(n, 2., latitude, longitude);
+        t0 = now();
+        for (i = 0; i < n; i++) {
+                double z;
+                turtle_stack_elevation(stack, latitude[i], longitude[i], &z,
+                    NULL);
+                sum += z;
+        }
+        report("stack_elevation_random", n, now() - t0, 0.);
+
+        coherent_coordinates(n, latitude, longitude);
+        t0 = now();
+        for (i = 0; i < n; i++) {
+                double z;
+                turtle_stack_elevation(stack, latitude[i], longitude[i], &z,
+                    NULL);
+                sum += z;
+        }
+        report("stack_elevation_coherent", n, now() - t0, 0.);
+
+        t0 = now();
+        turtle_stack_elevation_v(stack, n, latitude, longitude, elevation,
+            NULL);
+        report("stack_elevation_coherent_v", n, now() - t0, 0.);
+        turtle_stack_destroy(&stack);
+
+        /* Time the elevation lookup with tiles reloading, for a single tile
+         * stack
+         */
+        const long m = n_ops(100);
+        turtle_stack_create(&stack, path, 1, NULL, NULL);
+        random_coordinates(m, 2., latitude, longitude);
+        t0 = now();
+        for (i = 0; i < m; i++) {
+                double z;
+                turtle_stack_elevation(stack, latitude[i], longitude[i], &z,
+                    NULL);
+                sum += z;
+        }
+        report("stack_elevation_thrash", m, now() - t0, 0.);
+        turtle_stack_destroy(&stack);
+
+        if (sum == 0.) fputs("", stderr);
+        free(latitude);
+        free(longitude);
+        free(elevation);
+}
+
+/* Benchmark the bulk loading of stack tiles */
+static void bench_stack_load(const char * directory)
+{
+        const struct {
+                const char * name;
+                const char * format;
+                int mmap;
+        } modes[] = { { "stack_load_png", "png", 0 },
+                { "stack_load_hgt", "hgt", 0 },
+                { "stack_load_hgt_mmap", "hgt", 1 } };
+        const long n = n_ops(10);
+        int k;
+        for (k = 0; k < (int)(sizeof(modes) / sizeof(*modes)); k++) {
+                char path[1024];
+                sprintf(path, "%s/%s", directory, modes[k].format);
+                struct turtle_stack * stack;
+                turtle_stack_create(&stack, path, 0, NULL, NULL);
+                turtle_stack_mmap_set(stack, modes[k].mmap);
+                const double t0 = now();
+                long i;
+                for (i = 0; i < n; i++) {
+                        turtle_stack_load(stack);
+                        turtle_stack_clear(stack);
+                }
+                report(modes[k].name, 4 * n, now() - t0, 0.);
+                turtle_stack_destroy(&stack);
+        }
+
+        /* Parallel preloading of the PNG tiles */
+        char path[1024];
+        sprintf(path, "%s/png", directory);
+        struct turtle_stack * stack;
+        turtle_stack_create(&stack, path, 0, NULL, NULL);
+        const int threads[] = { 1, 2, 4 };
+        for (k = 0; k < (int)(sizeof(threads) / sizeof(*threads)); k++) {
+                const double t0 = now();
+                long i;
+                for (i = 0; i < n; i++) {
+                        turtle_stack_preload(
+                            stack, -90., 90., -180., 180., threads[k]);
+                        turtle_stack_clear(stack);
+                }
+                char name[64];
+                sprintf(name, "stack_preload_png_%d", threads[k]);
+                report(name, 4 * n, now() - t0, 0.);
+        }
+        turtle_stack_destroy(&stack);
+}
+
+/* Benchmark the map loading, for each format */
+static void bench_load(const char * directory)
+{
+        const char * files[] = { "N45E002.bench.hgt", "tile.png", "tile.tif",
+                "tile.asc", "tile.grd" };
+        const char * names[] = { "map_load_hgt", "map_load_png",
+                "map_load_tif", "map_load_asc", "map_load_grd" };
+        const long n[] = { 50, 10, 10, 1, 1 };
+
+        turtle_error_handler_t * handler = turtle_error_handler_get();
+        turtle_error_handler_set(NULL);
+        int k;
+        for (k = 0; k < (int)(sizeof(files) / sizeof(*files)); k++) {
+                char path[1024];
+                sprintf(path, "%s/formats/%s", directory, files[k]);
+                const double size = file_size(path);
+                if (size <= 0.) continue;
+
+                /* Skip formats that are not supported by this build */
+                struct turtle_map * map;
+                if (turtle_map_load(&map, path) != TURTLE_RETURN_SUCCESS)
+                        continue;
+                turtle_map_destroy(&map);
+
+                const long m = n_ops(n[k]);
+                const double t0 = now();
+                long i;
+                for (i = 0; i < m; i++) {
+                        turtle_map_load(&map, path);
+                        turtle_map_destroy(&map);
+                }
+                report(names[k], m, now() - t0, m * size);
+        }
+        turtle_error_handler_set(handler);
+}
+
+/* Multithreaded clients, with a pthread_rwlock_t as lock */
+struct thread_data {
+        pthread_t tid;
+        struct turtle_stack * stack;
+        long n;
+        double * latitude;
+        double * longitude;
+};
+
+static int exclusive_lock(void * context)
+{
+        return pthread_rwlock_wrlock(context);
+}
+
+static int shared_lock(void * context)
+{
+        return pthread_rwlock_rdlock(context);
+}
+
+static int unlock(void * context) { return pthread_rwlock_unlock(context); }
+
+static void * run_client(void * args)
+{
+        struct thread_data * data = args;
+        struct turtle_client * client;
+        turtle_client_create(&client, data->stack);
+        long i;
+        for (i = 0; i < data->n; i++) {
+                double z;
+                turtle_client_elevation(
+                    client, data->latitude[i], data->longitude[i], &z, NULL);
+        }
+        turtle_client_destroy(&client);
+        return NULL;
+}
+
+static void bench_client(const char * directory)
+{
+        char path[1024];
+        sprintf(path, "%s/png", directory);
+        const long n = n_ops(500000);
+        struct thread_data data[MAX_THREADS];
+        int i;
+        for (i = 0; i < MAX_THREADS; i++) {
+                data[i].n = n;
+                data[i].latitude = malloc(n * sizeof(*data[i].latitude));
+                data[i].longitude = malloc(n * sizeof(*data[i].longitude));
+                coherent_coordinates(n, data[i].latitude, data[i].longitude);
+        }
+
+        int shared;
+        for (shared = 0; shared < 2; shared++) {
+                int threads;
+                for (threads = 1; threads <= MAX_THREADS; threads *= 2) {
+                        pthread_rwlock_t rwlock;
+                        pthread_rwlock_init(&rwlock, NULL);
+                        struct turtle_stack * stack;
+                        turtle_stack_create(&stack, path, 0, NULL, NULL);
+                        turtle_stack_load(stack);
+                        turtle_stack_lock_set(stack, &exclusive_lock, &unlock,
+                            shared ? &shared_lock : NULL,
+                            shared ? &unlock : NULL, &rwlock);
+
+                        const double t0 = now();
+                        for (i = 0; i < threads; i++) {
+                                data[i].stack = stack;
+                                pthread_create(&data[i].tid, NULL, &run_client,
+                                    data + i);
+                        }
+                        for (i = 0; i < threads; i++)
+                                pthread_join(data[i].tid, NULL);
+                        char name[64];
+                        sprintf(name, "client_elevation_%s_%d",
+                            shared ? "shared" : "exclusive", threads);
+                        report(name, threads * n, now() - t0, 0.);
+
+                        turtle_stack_destroy(&stack);
+                        pthread_rwlock_destroy(&rwlock);
+                }
+        }
+
+        for (i = 0; i < MAX_THREADS; i++) {
+                free(data[i].latitude);
+                free(data[i].longitude);
+        }
+}
+
+/* Draw a random direction, in horizontal coordinates */
+static void random_direction(double latitude, double longitude,
+    double elevation_max, double * direction)
+{
+        const double azimuth = 360. * uniform();
+        const double elevation =
+            asin(-1. + (1. + sin(elevation_max * M_PI / 180.)) * uniform()) *
+            180. / M_PI;
+        turtle_ecef_from_horizontal(
+            latitude, longitude, azimuth, elevation, direction);
+}
+
+/* Benchmark the stepping through the topography, for straight rays or for
+ * scattering walks
+ */
+static void bench_stepper(const char * directory)
+{
+        char path[1024];
+        sprintf(path, "%s/png", directory);
+        struct turtle_stack * stack;
+        turtle_stack_create(&stack, path, 0, NULL, NULL);
+        turtle_stack_load(stack);
+        struct turtle_stepper * stepper;
+        turtle_stepper_create(&stepper);
+        turtle_stepper_add_layer(stepper);
+        turtle_stepper_add_stack(stepper, stack, 0.);
+
+        int scatter;
+        for (scatter = 0; scatter < 2; scatter++) {
+                const long n = n_ops(scatter ? 2000 : 1000);
+                long ops = 0;
+                double dt = 0.;
+                long i;
+                for (i = 0; i < n; i++) {
+                        double latitude = LATITUDE_0 + 0.5 + uniform();
+                        double longitude = LONGITUDE_0 + 0.5 + uniform();
+                        double position[3], direction[3];
+                        turtle_stepper_position(stepper, latitude, longitude,
+                            1., 0, position, NULL);
+                        random_direction(latitude, longitude,
+                            scatter ? 90. : 10., direction);
+
+                        int index0[2];
+                        turtle_stepper_step(stepper, position, NULL, NULL,
+                            NULL, NULL, NULL, NULL, index0);
+
+                        /* Step until the ground is hit */
+                        const double t0 = now();
+                        int j;
+                        for (j = 0; j < 100000; j++, ops++) {
+                                int index[2];
+                                turtle_stepper_step(stepper, position,
+                                    direction, &latitude, &longitude, NULL,
+                                    NULL, NULL, index);
+                                if (index[0] != index0[0]) break;
+                                if (scatter) {
+                                        random_direction(latitude, longitude,
+                                            90., direction);
+                                }
+                        }
+                        dt += now() - t0;
+                }
+                report(scatter ? "stepper_step_scatter" : "stepper_step_ray",
+                    ops, dt, 0.);
+        }
+
+        turtle_stepper_destroy(&stepper);
+        turtle_stack_destroy(&stack);
+}
+
+/* Benchmark the geographic projections */
+static void bench_projection(void)
+{
+        const char * tags[] = { "UTM 31N", "Lambert 93" };
+        const char * names[] = { "utm", "lambert" };
+        const long n = n_ops(1000000);
+        double * latitude = malloc(n * sizeof(*latitude));
+        double * longitude = malloc(n * sizeof(*longitude));
+        double * x = malloc(n * sizeof(*x));
+        double * y = malloc(n * sizeof(*y));
+        random_coordinates(n, 2., latitude, longitude);
+
+        int k;
+        for (k = 0; k < 2; k++) {
+                struct turtle_projection * projection;
+                turtle_projection_create(&projection, tags[k]);
+                char name[64];
+
+                double t0 = now();
+                long i;
+                for (i = 0; i < n; i++) {
+                        turtle_projection_project(projection, latitude[i],
+                            longitude[i], x + i, y + i);
+                }
+                sprintf(name, "projection_project_%s", names[k]);
+                report(name, n, now() - t0, 0.);
+
+                t0 = now();
+                for (i = 0; i < n; i++) {
+                        double la, lo;
+                        turtle_projection_unproject(
+                            projection, x[i], y[i], &la, &lo);
+                }
+                sprintf(name, "projection_unproject_%s", names[k]);
+                report(name, n, now() - t0, 0.);
+
+                t0 = now();
+                turtle_projection_project_v(
+                    projection, n, latitude, longitude, x, y);
+                sprintf(name, "projection_project_v_%s", names[k]);
+                report(name, n, now() - t0, 0.);
+
+                turtle_projection_destroy(&projection);
+        }
+
+        free(latitude);
+        free(longitude);
+        free(x);
+        free(y);
+}
+
+int main(int argc, char * argv[])
+{
+        const char * directory = (argc > 1) ? argv[1] : "bench-data";
+        if (argc > 2) scale = atof(argv[2]);
+
+        setup_data(directory);
+        bench_map();
+        bench_projection();
+        bench_stack(directory);
+        bench_stack_load(directory);
+        bench_load(directory);
+        bench_client(directory);
+        bench_stepper(directory);
+
+        exit(EXIT_SUCCESS);
+}
@@ -20,6 +20,10 @@
 
 #ifndef TURTLE_H
 #define TURTLE_H
+
+/* C89 standard library */
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -87,6 +91,51 @@ struct turtle_client;
  */
 struct turtle_stepper;
 
+/**
+ * Opaque structure for the stepping state of a particle
+ */
+struct turtle_stepper_state;
+
+/**
+ * Policies for evicting tiles from a stack
+ */
+enum turtle_stack_policy {
+        /** Evict the least recently used tiles first (default) */
+        TURTLE_STACK_POLICY_LRU = 0,
+        /** Evict the least frequently used tiles first */
+        TURTLE_STACK_POLICY_LFU,
+        /** Evict the tiles the farthest from the requested location first */
+        TURTLE_STACK_POLICY_DISTANCE,
+        /** The number of eviction policies */
+        N_TURTLE_STACK_POLICIES
+};
+
+/**
+ * Methods for locating a change of medium along a step
+ */
+enum turtle_stepper_refinement {
+        /** Bisection of the step (default) */
+        TURTLE_STEPPER_REFINEMENT_BISECTION = 0,
+        /** Regula falsi on the height above the crossed surface, using the
+         * Illinois variant. It falls back to bisection when more than one
+         * surface is crossed */
+        TURTLE_STEPPER_REFINEMENT_REGULA_FALSI,
+        /** The number of refinement methods */
+        N_TURTLE_STEPPER_REFINEMENTS
+};
+
+/**
+ * Events notified to a stack hook
+ */
+enum turtle_stack_event {
+        /** A tile has been loaded */
+        TURTLE_STACK_EVENT_LOAD = 0,
+        /** A tile is being evicted */
+        TURTLE_STACK_EVENT_EVICT,
+        /** The number of stack events */
+        N_TURTLE_STACK_EVENTS
+};
+
 /**
  * Meta data for elevation maps
  */
@@ -105,6 +154,69 @@ struct turtle_map_info {
         const char * encoding;
 };
 
+/**
+ * Runtime statistics of a stack or of a client
+ *
+ * Times are given in seconds, as measured by a monotonic clock.
+ */
+struct turtle_stats {
+        /** Number of accesses served by the most recently used tile */
+        unsigned long head_hits;
+        /** Number of accesses served by another tile pinned by a client */
+        unsigned long set_hits;
+        /** Number of accesses served by another loaded tile */
+        unsigned long grid_hits;
+        /** Number of accesses that required loading a tile */
+        unsigned long misses;
+        /** Number of accesses to locations without any data */
+        unsigned long missing;
+        /** Number of loaded tiles */
+        unsigned long loads;
+        /** Memory used by the loaded tiles, in bytes */
+        unsigned long long load_bytes;
+        /** Time spent loading tiles */
+        double load_time;
+        /** Number of evicted tiles */
+        unsigned long evictions;
+        /** Number of tiles left out of a preload by the memory budget */
+        unsigned long truncations;
+        /** Number of lock acquisitions */
+        unsigned long locks;
+        /** Time spent acquiring locks */
+        double lock_time;
+};
+
+/**
+ * Runtime statistics of a stepper
+ *
+ * These counters allow to tune the stepper parameters, e.g. the range of
+ * local transforms or the slope and resolution factors. Note that the
+ * average number of bisection iterations per change of medium is given by
+ * the ratio of *bisections* to *crossings*.
+ */
+struct turtle_stepper_stats {
+        /** Number of samplings of the geometry */
+        unsigned long samples;
+        /** Number of samplings served from the last sample */
+        unsigned long repeats;
+        /** Number of evaluations of a geometry data, i.e. of an elevation */
+        unsigned long evaluations;
+        /** Number of geographic coordinates from a local transform */
+        unsigned long transform_hits;
+        /** Number of local transforms (re)built */
+        unsigned long transform_rebuilds;
+        /** Number of full geographic computations, including projections */
+        unsigned long computations;
+        /** Number of changes of medium located by refinement */
+        unsigned long crossings;
+        /** Total number of refinement iterations, e.g. of bisection */
+        unsigned long bisections;
+        /** Number of steps lengthened using elevation bounds */
+        unsigned long skips;
+        /** Number of data sets skipped using their bounding box */
+        unsigned long culls;
+};
+
 /**
  * Generic function pointer
  *
@@ -148,6 +260,75 @@ typedef void turtle_error_handler_t(enum turtle_return code,
  */
 typedef int turtle_stack_locker_t(void);
 
+/**
+ * Callback for locking or unlocking critical sections, with a user context
+ *
+ * @param context    The user supplied context, e.g. a `pthread_rwlock_t`.
+ * @return `0` on success, any other value otherwise.
+ *
+ * This is a generalisation of `turtle_stack_locker_t` allowing several stacks
+ * to use independent locks, see `turtle_stack_lock_set`.
+ *
+ * __Warnings__
+ *
+ * The callback *must* return `0` if the (un)lock was successful.
+ */
+typedef int turtle_stack_context_locker_t(void * context);
+
+/**
+ * Callback for monitoring the tiles of a stack
+ *
+ * @param context    The user supplied context
+ * @param event      The stack event
+ * @param map        The tile being loaded or evicted
+ * @param path       The path of the tile file
+ *
+ * See `turtle_stack_hook_set`.
+ *
+ * __Warnings__
+ *
+ * The callback is called with the stack lock held, if any. It *must not* call
+ * any function of the stack, nor of its clients. On eviction, *map* is
+ * destroyed right after the callback returns.
+ */
+typedef void turtle_stack_hook_t(void * context,
+    enum turtle_stack_event event, const struct turtle_map * map,
+    const char * path);
+
+/**
+ * Callback for fetching an object of a tiles source
+ *
+ * @param context    The user supplied context, e.g. a storage bucket.
+ * @param name       The name of the object, relative to the source root.
+ * @param path       The local file where the object must be written.
+ * @return `0` on success, any other value otherwise.
+ *
+ * See `turtle_stack_create_remote`. The requested objects are the tiles
+ * index, `.turtle-index`, and the tile files listed in this index. Objects
+ * are always requested as a whole, and they must be written to *path* as
+ * regular files. There is no callback for listing the source.
+ *
+ * __Warnings__
+ *
+ * The callback might be called concurrently, from several threads, e.g. by
+ * `turtle_stack_preload`. It must be thread safe in this case.
+ */
+typedef int turtle_stack_fetcher_t(
+    void * context, const char * name, const char * path);
+
+/**
+ * Callback for providing the rows of a map being written
+ *
+ * @param context      The user supplied context, e.g. a set of source files.
+ * @param iy           The index of the requested row.
+ * @param elevation    The `nx` elevation values of the row, to fill in.
+ * @return `0` on success, any other value otherwise.
+ *
+ * See `turtle_map_write`. Rows are requested once each, by increasing
+ * index. Values outside of the map span are clamped to it.
+ */
+typedef int turtle_map_source_t(void * context, int iy, double * elevation);
+
 /**
  * Return a string describing a TURTLE library function
  *
@@ -185,7 +366,8 @@ TURTLE_API turtle_error_handler_t * turtle_error_handler_get(void);
  * Nevertheless, the TURTLE library functions will still return and error code.
  *
  * Note also that this function can be called before the library
- * initialisation.
+ * initialisation. Threads can override the library error handler with
+ * `turtle_error_thread_handler_set`.
  *
  * __Warnings__
  *
@@ -193,6 +375,45 @@ TURTLE_API turtle_error_handler_t * turtle_error_handler_get(void);
  */
 TURTLE_API void turtle_error_handler_set(turtle_error_handler_t * handler);
 
+/**
+ * Get the error handler of the calling thread
+ *
+ * @return The error handler in use by the calling thread
+ *
+ * This is the handler set with `turtle_error_thread_handler_set` if any,
+ * otherwise the library one. This function is thread safe.
+ */
+TURTLE_API turtle_error_handler_t * turtle_error_thread_handler_get(void);
+
+/**
+ * Set an error handler for the calling thread
+ *
+ * @param handler    The user supplied error handler, or `NULL`
+ *
+ * The handler overrides the library one, see `turtle_error_handler_set`, for
+ * errors occurring in the calling thread only. This function is thread safe.
+ * If the library was built without threads support, the handler applies to
+ * the whole process instead. **Note** that the per thread data are allocated
+ * on the first call. If this allocation fails, the library handler remains
+ * in use.
+ *
+ * Providing a `NULL` handler quiets the errors of the calling thread. The
+ * TURTLE library functions still return an error code. But, no error
+ * message is formatted nor allocated, and no handler is called. This is
+ * well suited for hot paths where failures are expected, e.g. queries
+ * outside of the topography data.
+ */
+TURTLE_API void turtle_error_thread_handler_set(
+    turtle_error_handler_t * handler);
+
+/**
+ * Restore the library error handler for the calling thread
+ *
+ * Errors occurring in the calling thread are handled again by the library
+ * error handler. This function is thread safe.
+ */
+TURTLE_API void turtle_error_thread_handler_clear(void);
+
 /**
  * Create a new geographic projection
  *
@@ -332,6 +553,59 @@ TURTLE_API enum turtle_return turtle_projection_unproject(
     const struct turtle_projection * projection, double x, double y,
     double * latitude, double * longitude);
 
+/**
+ * Apply a geographic projection to arrays of geodetic coordinates
+ *
+ * @param projection    The projection object
+ * @param n             The number of points
+ * @param latitude      The input geodetic latitudes
+ * @param longitude     The input geodetic longitudes
+ * @param x             The output X-coordinates
+ * @param y             The output Y-coordinates
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * Vectorized version of `turtle_projection_project`. The projection type is
+ * resolved once for all the *n* points. The results are identical to the
+ * scalar version.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_ADDRESS       The projection is `NULL`
+ *
+ *    TURTLE_RETURN_BAD_PROJECTION    The projection isn't supported
+ */
+TURTLE_API enum turtle_return turtle_projection_project_v(
+    const struct turtle_projection * projection, int n,
+    const double * latitude, const double * longitude, double * x,
+    double * y);
+
+/**
+ * Unfold a geographic projection for arrays of projected coordinates
+ *
+ * @param projection    The projection object
+ * @param n             The number of points
+ * @param x             The input X-coordinates
+ * @param y             The input Y-coordinates
+ * @param latitude      The output geodetic latitudes
+ * @param longitude     The output geodetic longitudes
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * Vectorized version of `turtle_projection_unproject`. The projection type
+ * is resolved once for all the *n* points. The results are identical to the
+ * scalar version.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_ADDRESS       The projection is `NULL`
+ *
+ *    TURTLE_RETURN_BAD_PROJECTION    The provided projection isn't supported
+ */
+TURTLE_API enum turtle_return turtle_projection_unproject_v(
+    const struct turtle_projection * projection, int n, const double * x,
+    const double * y, double * latitude, double * longitude);
+
 /**
  * Create a new map
  *
@@ -381,7 +655,10 @@ TURTLE_API void turtle_map_destroy(struct turtle_map ** map);
  * code is returned as detailed below
  *
  * Load a map from a file. The file format is guessed from the filename
- * extension.
+ * extension. Maps loaded from the TURTLE block compressed format (`.tbc`) are
+ * kept compressed in memory. Their blocks of 64x64 nodes are decompressed on
+ * access, to a small per thread cache. Thus, they are best suited for spatially
+ * coherent accesses, e.g. along particle tracks. These maps are read only.
  *
  * __Error codes__
  *
@@ -397,6 +674,45 @@ TURTLE_API void turtle_map_destroy(struct turtle_map ** map);
 TURTLE_API enum turtle_return turtle_map_load(
     struct turtle_map ** map, const char * path);
 
+/**
+ * Open a map out of core
+ *
+ * @param map     The map object
+ * @param path    The path to the map file
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * Open a map without reading its data, e.g. for maps larger than the
+ * memory. The data file is memory mapped, and its pages are read on demand
+ * by the OS, which evicts them under memory pressure. This is best suited to
+ * the TURTLE block compressed format, `.tbc`, whose blocks of 64x64 nodes are
+ * decompressed on access to a small per thread cache. Raw `.hgt` files can be
+ * opened as well. The map is then used as a loaded one, e.g. with
+ * `turtle_map_elevation` or a `turtle_stepper`. It can be converted to
+ * another `.tbc` file with `turtle_map_dump`, which proceeds by bands of
+ * blocks.
+ *
+ * **Note** that the resident memory of the map is not bounded by the
+ * library. The data are mapped privately, and their pages stay resident
+ * until the OS evicts them, e.g. under memory pressure. Modifying the map
+ * data, e.g. with `turtle_map_normalise`, copies the modified pages to
+ * memory, for good. If the library was built without memory mapping
+ * support, maps cannot be opened.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_EXTENSION    The file format is not supported
+ *
+ *    TURTLE_RETURN_BAD_FORMAT       The file cannot be memory mapped, e.g. it
+ * is compressed as `.png`, or memory mapping is not supported
+ *
+ *    TURTLE_RETURN_BAD_PATH         The file wasn't found
+ *
+ *    TURTLE_RETURN_MEMORY_ERROR     The map couldn't be allocated
+ */
+TURTLE_API enum turtle_return turtle_map_open(
+    struct turtle_map ** map, const char * path);
+
 /**
  * Dump a map to a file
  *
@@ -406,7 +722,8 @@ TURTLE_API enum turtle_return turtle_map_load(
  * code is returned as detailed below
  *
  * Dump a projection map to a file. The file format is guessed from the output
- * filename extension. Currently only a custom `.png` format is supported.
+ * filename extension. Currently a custom `.png` format and the TURTLE block
+ * compressed format, `.tbc`, are supported.
  *
  * __Error codes__
  *
@@ -423,6 +740,47 @@ TURTLE_API enum turtle_return turtle_map_load(
 TURTLE_API enum turtle_return turtle_map_dump(
     const struct turtle_map * map, const char * path);
 
+/**
+ * Write a map to a file, row by row
+ *
+ * @param path          The path for the output file
+ * @param info          The map meta data
+ * @param projection    A geographic projection, or `NULL`
+ * @param source        The provider of the map rows
+ * @param context       A user context for the source, or `NULL`
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * Write a map defined as with `turtle_map_create`, without holding its
+ * nodes in memory. The elevation values are requested from *source*, row by
+ * row, and they are compressed by bands of 64 rows. Thus, large maps can be
+ * converted from several source files, e.g. tiles, to a single one keeping
+ * its projection. Only the TURTLE block compressed format, `.tbc`, supports
+ * streaming. The written map can be opened with `turtle_map_open`. On
+ * failure, the output file is removed.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_EXTENSION     The file format is not supported
+ *
+ *    TURTLE_RETURN_BAD_FORMAT        The file format does not support
+ * streaming
+ *
+ *    TURTLE_RETURN_BAD_PATH          The file couldn't be written, or the
+ * source failed
+ *
+ *    TURTLE_RETURN_BAD_PROJECTION    An invalid projection was provided
+ *
+ *    TURTLE_RETURN_DOMAIN_ERROR      An input parameter is out of its
+ * validity range
+ *
+ *    TURTLE_RETURN_MEMORY_ERROR      Some temporary memory couldn't be
+ * allocated
+ */
+TURTLE_API enum turtle_return turtle_map_write(const char * path,
+    const struct turtle_map_info * info, const char * projection,
+    turtle_map_source_t * source, void * context);
+
 /**
  * Fill the elevation value of a map node
  *
@@ -440,6 +798,8 @@ TURTLE_API enum turtle_return turtle_map_dump(
  *
  * __Error codes__
  *
+ *    TURTLE_RETURN_BAD_FORMAT      The map data are read only, e.g. compressed
+ *
  *    TURTLE_RETURN_DOMAIN_ERROR    Some input parameter isn't valid
  */
 TURTLE_API enum turtle_return turtle_map_fill(
@@ -489,6 +849,123 @@ TURTLE_API enum turtle_return turtle_map_elevation(
     const struct turtle_map * map, double x, double y, double * elevation,
     int * inside);
 
+/**
+ * Normalise the layout of the map data
+ *
+ * @param map    The map object
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * Convert the map data, in place, to the host byte order with increasing
+ * rows, e.g. for maps loaded from hgt or png files. Elevation values are left
+ * unchanged. Normalised maps are interpolated with specialised kernels,
+ * instead of going through format specific accessors. This is a single pass
+ * over the map data. Maps having already a normalised layout, or that cannot
+ * be normalised, are left unchanged.
+ *
+ * **Note** that the tiles of a stack are managed by the stack, see
+ * `turtle_stack_normalise_set`.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_DOMAIN_ERROR    The map is managed by a stack
+ *
+ *    TURTLE_RETURN_MEMORY_ERROR    The map is not valid
+ */
+TURTLE_API enum turtle_return turtle_map_normalise(struct turtle_map * map);
+
+/**
+ * Convert the map data to a blocked layout
+ *
+ * @param map    The map object
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * Normalise the map data and store them by blocks of 8x8 nodes, such that
+ * the nodes used for interpolating the elevation, or its gradient, mostly
+ * share the same cache lines. This speeds up incoherent accesses, e.g. by
+ * scattering particles, over large maps. Elevation values are left unchanged.
+ * The data are copied to a new map object which replaces *map*. The initial
+ * map is destroyed. Maps that cannot be normalised, or that already have a
+ * blocked layout, are left unchanged.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_DOMAIN_ERROR    The map is managed by a stack
+ *
+ *    TURTLE_RETURN_MEMORY_ERROR    The blocked map couldn't be allocated
+ */
+TURTLE_API enum turtle_return turtle_map_block(struct turtle_map ** map);
+
+/**
+ * Resample a projected map over a geodetic grid
+ *
+ * @param geodetic      The resampled map
+ * @param map           The projected map
+ * @param resolution    The geodetic node spacing, in deg, or `0`
+ * @param threads       The number of resampling threads
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * Create a new map without projection, i.e. with longitude and latitude as
+ * X and Y coordinates, by interpolating the elevation of a projected map at
+ * the nodes of a regular geodetic grid. The grid covers the largest
+ * geodetic box that is inside of the projected map, such that all its nodes
+ * project inside of the map. Thus, the origin of the grid might depend on the
+ * resolution. If *resolution* is `0`, the node spacing matches the one of the
+ * projected map at its centre.
+ * Elevation values are digitised over the same range as the projected map.
+ *
+ * This is a one time cost, in exchange for which the geodetic map is
+ * accessed without any projection, e.g. when added to a stepper instead of
+ * the projected map. **Note** that the resampling smooths the elevation
+ * data, unless a finer *resolution* than the initial one is used.
+ *
+ * The rows of the geodetic grid are resampled concurrently by *threads*
+ * threads, including the calling one. A value lower than 2 results in a
+ * serial resampling, which is also the case if the library was built
+ * without threads support. Use `turtle_map_destroy` in order to recover
+ * the memory allocated for the geodetic map.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_PROJECTION    The map has no projection
+ *
+ *    TURTLE_RETURN_DOMAIN_ERROR      The geodetic grid is not valid, e.g.
+ * the resolution is too coarse
+ *
+ *    TURTLE_RETURN_MEMORY_ERROR      The geodetic map couldn't be allocated
+ */
+TURTLE_API enum turtle_return turtle_map_reproject(
+    struct turtle_map ** geodetic, const struct turtle_map * map,
+    double resolution, int threads);
+
+/**
+ * Get the map elevation over arrays of geographic coordinates
+ *
+ * @param map          The map object
+ * @param n            The number of locations
+ * @param x            The geographic X-coordinates
+ * @param y            The geographic Y-coordinates
+ * @param elevation    The elevation values
+ * @param inside       Flags for bounds check or `NULL`
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * This is a batched version of `turtle_map_elevation`, for *n* locations
+ * stored as arrays. The results are identical, but the setup is done once for
+ * all locations. The elevation is set to `0` for locations outside of the
+ * map. If *inside* is `NULL` a bound error is raised for the first location
+ * outside of the map and the remaining locations are not processed.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_DOMAIN_ERROR    The coordinates are not valid
+ */
+TURTLE_API enum turtle_return turtle_map_elevation_v(
+    const struct turtle_map * map, int n, const double * x, const double * y,
+    double * elevation, int * inside);
+
 /**
  * Get the map gradient at a geographic coordinate
  *
@@ -516,6 +993,73 @@ TURTLE_API enum turtle_return turtle_map_gradient(
     const struct turtle_map * map, double x, double y, double * gx, double * gy,
     int * inside);
 
+/**
+ * Get the map elevation and gradient at a geographic coordinate
+ *
+ * @param map          The map object
+ * @param x            The geographic X-coordinate
+ * @param y            The geographic Y-coordinate
+ * @param z            The interpolated elevation
+ * @param gx           The gradient value along X-coordinate
+ * @param gy           The gradient value along Y-coordinate
+ * @param inside       Flag for bounds check or `NULL`
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * This is equivalent to calling `turtle_map_elevation` and
+ * `turtle_map_gradient`, but the bounds check and the fetch of the
+ * interpolation nodes are done only once.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_DOMAIN_ERROR    The coordinates are not valid
+ */
+TURTLE_API enum turtle_return turtle_map_elevation_gradient(
+    const struct turtle_map * map, double x, double y, double * z, double * gx,
+    double * gy, int * inside);
+
+/**
+ * Intersect a straight ray with the map surface
+ *
+ * @param map          The map object
+ * @param position     The ray origin, as map coordinates and an elevation
+ * @param direction    The ray direction, in the same coordinates
+ * @param range        The maximum ray parameter
+ * @param n            The maximum number of crossings to get
+ * @param distance     The ray parameters of the crossings
+ * @param count        The number of crossings found
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * Get the crossings of the ray `position + t * direction`, for `t` in
+ * `[0, range]`, with the surface interpolated from the map nodes. The map
+ * cells crossed by the ray are traversed successively and the crossings are
+ * solved for analytically within each cell. Thus, the cost scales with the
+ * number of crossed cells. The parameters of the first *n* crossings are
+ * returned in increasing order. They alternate between entries into and
+ * exits from the ground, e.g. the rock thickness is the sum of the
+ * differences between consecutive entries and exits. Tangent contacts are
+ * not counted as crossings.
+ *
+ * The ray is straight in map coordinates, i.e. Earth curvature is not
+ * accounted for. The ray is clipped to the map domain. **Note** that the
+ * first crossing is an exit if the ray starts below the surface, or if it
+ * enters the map domain below it.
+ *
+ * There is no stepper counterpart. A stepper geometry stacks layers of
+ * projected and geodetic data, and it steps straight in ECEF. Such a line
+ * is curved in the coordinates of every data grid, and there is no single
+ * grid to traverse. Use `turtle_stepper_step` in this case.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_DOMAIN_ERROR    The ray is not valid
+ */
+TURTLE_API enum turtle_return turtle_map_intersect(
+    const struct turtle_map * map, const double * position,
+    const double * direction, double range, int n, double * distance,
+    int * count);
+
 /**
  * Get the map's projection
  *
@@ -571,6 +1115,43 @@ TURTLE_API void turtle_ecef_from_geodetic(
 TURTLE_API void turtle_ecef_to_geodetic(const double ecef[3], double * latitude,
     double * longitude, double * altitude);
 
+/**
+ * Transform arrays of geodetic coordinates to Cartesian ECEF ones
+ *
+ * @param n            The number of points
+ * @param latitude     The geodetic latitudes
+ * @param longitude    The geodetic longitudes
+ * @param elevation    The geodetic elevations
+ * @param ecef         The corresponding ECEF coordinates
+ *
+ * Vectorized version of `turtle_ecef_from_geodetic`. The *ecef* array must
+ * hold *3 n* values, i.e. the Cartesian coordinates of the *n* points one
+ * after the other. The results are identical to the scalar version.
+ */
+TURTLE_API void turtle_ecef_from_geodetic_v(int n, const double * latitude,
+    const double * longitude, const double * elevation, double * ecef);
+
+/**
+ * Transform an array of Cartesian ECEF coordinates to geodetic ones
+ *
+ * @param n            The number of points
+ * @param ecef         The ECEF coordinates
+ * @param latitude     The corresponding geodetic latitudes, or `NULL`
+ * @param longitude    The corresponding geodetic longitudes, or `NULL`
+ * @param altitude     The corresponding geodetic altitudes, or `NULL`
+ *
+ * Vectorized version of `turtle_ecef_to_geodetic`. The *ecef* array must
+ * hold *3 n* values, i.e. the Cartesian coordinates of the *n* points one
+ * after the other.
+ *
+ * A single step of B. R. Bowring's (1976) algorithm is used, with a branch
+ * free loop body. For altitudes between -10 km and 100 km, the position
+ * error w.r.t. `turtle_ecef_to_geodetic` is less than 0.1 mm horizontally
+ * and than 1 nm vertically. It grows up to 1 cm horizontally at 1000 km.
+ */
+TURTLE_API void turtle_ecef_to_geodetic_v(int n, const double * ecef,
+    double * latitude, double * longitude, double * altitude);
+
 /**
  * Transform horizontal angles to a Cartesian direction in ECEF
  *
@@ -601,6 +1182,40 @@ TURTLE_API void turtle_ecef_from_horizontal(double latitude, double longitude,
 TURTLE_API void turtle_ecef_to_horizontal(double latitude, double longitude,
     const double direction[3], double * azimuth, double * elevation);
 
+/**
+ * Transform arrays of horizontal angles to Cartesian directions in ECEF
+ *
+ * @param n            The number of directions
+ * @param latitude     The geodetic latitudes
+ * @param longitude    The geodetic longitudes
+ * @param azimuth      The geographic azimuth angles
+ * @param elevation    The geographic elevation angles
+ * @param direction    The corresponding directions in ECEF coordinates
+ *
+ * Vectorized version of `turtle_ecef_from_horizontal`. The *direction* array
+ * must hold *3 n* values, i.e. the *n* direction vectors one after the other.
+ */
+TURTLE_API void turtle_ecef_from_horizontal_v(int n, const double * latitude,
+    const double * longitude, const double * azimuth,
+    const double * elevation, double * direction);
+
+/**
+ * Transform an array of Cartesian directions in ECEF to horizontal angles
+ *
+ * @param n            The number of directions
+ * @param latitude     The geodetic latitudes
+ * @param longitude    The geodetic longitudes
+ * @param direction    The direction vectors in ECEF coordinates
+ * @param azimuth      The corresponding geographic azimuths, or `NULL`
+ * @param elevation    The corresponding geographic elevations, or `NULL`
+ *
+ * Vectorized version of `turtle_ecef_to_horizontal`. The *direction* array
+ * must hold *3 n* values, i.e. the *n* direction vectors one after the other.
+ */
+TURTLE_API void turtle_ecef_to_horizontal_v(int n, const double * latitude,
+    const double * longitude, const double * direction, double * azimuth,
+    double * elevation);
+
 /**
  * Create a new stack of global topography data
  *
@@ -617,12 +1232,18 @@ TURTLE_API void turtle_ecef_to_horizontal(double latitude, double longitude,
  * initialised as empty. **Note** that providing a null or negative stack *size*
  * results in all maps being kept in memory.
  *
+ * The meta-data of the tiles are read from the index file `.turtle-index` of
+ * *path*, if any and if it is up to date, see `turtle_stack_index_dump`.
+ * Otherwise, *path* is scanned for tiles, which can be slow for large data
+ * sets, e.g. world-wide.
+ *
  * __Warnings__
  *
  * For multi-threaded access to elevation data, using a `turtle_client` one must
  * provide both a `lock` and `unlock` callback, e.g. based on `sem_wait` and
  * `sem_post`. Otherwise they can be both set to `NULL`. Note that setting only
  * one to not `NULL` raises a `TURTLE_RETURN_BAD_FORMAT` error.
+ * See `turtle_stack_lock_set` for context aware and shared locks.
  *
  * __Error codes__
  *
@@ -639,21 +1260,100 @@ TURTLE_API enum turtle_return turtle_stack_create(struct turtle_stack ** stack,
     turtle_stack_locker_t * unlock);
 
 /**
- * Destroy a stack of global topography data
+ * Create a new stack of global topography data, from a remote source
  *
- * @param stack    The stack object
+ * @param stack         A handle for the stack.
+ * @param cache         The local directory where tiles are cached.
+ * @param size          The maximum number of elevation maps kept in memory.
+ * @param fetch         A callback for fetching objects of the source.
+ * @param context       A user context for the fetch callback, or `NULL`.
+ * @param lock          A callback for locking critical sections, or `NULL`.
+ * @param unlock        A callback for unlocking critical sections, or `NULL`.
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
  *
- * Fully destroy a stack and all its allocated elevation data. On return `stack`
- * is set to `NULL`.
+ * This function is similar to `turtle_stack_create` except that tiles are
+ * fetched lazily, e.g. from an object storage, using the *fetch* callback.
+ * The source must provide a tiles index, as dumped by
+ * `turtle_stack_index_dump`, which lists the tiles and the stack grid. The
+ * source is not enumerated, nor are its tiles inspected, when creating the
+ * stack. Thus, the index must be built beforehand, from a local copy of the
+ * source with the same library version, and uploaded with the tiles.
+ *
+ * Fetched objects are written to the *cache* directory, which must exist,
+ * using a temporary file which is renamed once complete. Thus, a same cache
+ * can be shared by the stacks of several processes, e.g. on a computing
+ * node. A tile is fetched from the source only if it is not already in the
+ * cache, when it is first loaded. Tiles are fetched in parallel with
+ * `turtle_stack_preload`. Cached tiles are never removed by the library.
+ * Tiles are read from their cached file, in any format supported by
+ * `turtle_map_load`. There is no in memory path, thus the cache must be
+ * large enough for all the tiles that are used.
  *
  * __Warnings__
  *
- * This method is not thread safe. All clients should have been destroyed or
- * disabled first.
- */
-TURTLE_API void turtle_stack_destroy(struct turtle_stack ** stack);
-
-/**
+ * The cached index is not checked against the source one, and the metadata
+ * of tiles stored in the index, e.g. their size and modification time, are
+ * not checked against the cached files. The cache must be cleared if the
+ * source is modified.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_ADDRESS     The fetch callback is missing, or the lock
+ * and unlock callbacks are inconsistent
+ *
+ *    TURTLE_RETURN_BAD_FORMAT      The tiles index is not valid
+ *
+ *    TURTLE_RETURN_MEMORY_ERROR    The stack couldn't be allocated
+ *
+ *    TURTLE_RETURN_PATH_ERROR      The tiles index couldn't be fetched
+ */
+TURTLE_API enum turtle_return turtle_stack_create_remote(
+    struct turtle_stack ** stack, const char * cache, int size,
+    turtle_stack_fetcher_t * fetch, void * context,
+    turtle_stack_locker_t * lock, turtle_stack_locker_t * unlock);
+
+/**
+ * Destroy a stack of global topography data
+ *
+ * @param stack    The stack object
+ *
+ * Fully destroy a stack and all its allocated elevation data. On return `stack`
+ * is set to `NULL`.
+ *
+ * __Warnings__
+ *
+ * This method is not thread safe. All clients should have been destroyed or
+ * disabled first.
+ */
+TURTLE_API void turtle_stack_destroy(struct turtle_stack ** stack);
+
+/**
+ * Dump the tiles index of a stack
+ *
+ * @param stack    The stack object
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * Write the meta-data of the stack tiles to an index file, `.turtle-index`,
+ * in the stack directory. Subsequent calls to `turtle_stack_create` read the
+ * index instead of scanning the directory, provided that the modification time
+ * of the directory has not changed since the dump. The index records the stack
+ * grid and, for each tile, its file name, size and modification time, its
+ * format and its bounds. Tiles whose size or modification time changed, e.g.
+ * replaced in place, are checked again by reading their header. If one does
+ * not match its indexed meta data any more, the directory is scanned again.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_MEMORY_ERROR    Some temporary memory couldn't be allocated
+ *
+ *    TURTLE_RETURN_PATH_ERROR      The index file couldn't be written
+ */
+TURTLE_API enum turtle_return turtle_stack_index_dump(
+    const struct turtle_stack * stack);
+
+/**
  * Clear the stack from topography data
  *
  * @param stack    The stack object
@@ -689,6 +1389,52 @@ TURTLE_API enum turtle_return turtle_stack_clear(struct turtle_stack * stack);
  */
 TURTLE_API enum turtle_return turtle_stack_load(struct turtle_stack * stack);
 
+/**
+ * Load the stack tiles of a geographic region, using several threads
+ *
+ * @param stack            The stack object
+ * @param latitude_min     The region minimum latitude, in deg
+ * @param latitude_max     The region maximum latitude, in deg
+ * @param longitude_min    The region minimum longitude, in deg
+ * @param longitude_max    The region maximum longitude, in deg
+ * @param threads          The number of decoding threads
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * Load the tiles overlapping the given region that are not yet in memory, up
+ * to the max stack size, less the tiles in use by clients. The tiles are
+ * decoded concurrently by *threads* threads, including the calling one,
+ * without holding the stack lock. Then, they are all published into the
+ * stack at once, with an exclusive access. Older tiles are evicted if needed,
+ * according to the stack policy, but a preload never evicts its own tiles. If
+ * any tile fails to load, none of the decoded tiles is published.
+ *
+ * If a memory budget is set, see `turtle_stack_budget_set`, the preloaded
+ * tiles are further limited to the part of the budget that is not yet in
+ * use. The decoding stops once it is exceeded. The number of tiles that were
+ * left out, because of tiles in use or of the budget, is added to the
+ * *truncations* counter of the stack statistics, see `turtle_stack_stats`.
+ *
+ * A value of *threads* lower than 2 results in a serial load, by the calling
+ * thread. This is also the case if the library was built without threads
+ * support.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_FORMAT      A tile has an invalid format
+ *
+ *    TURTLE_RETURN_DOMAIN_ERROR    The region is not valid
+ *
+ *    TURTLE_RETURN_LOCK_ERROR      The lock could not be acquired
+ *
+ *    TURTLE_RETURN_MEMORY_ERROR    A tile could not be allocated
+ *
+ *    TURTLE_RETURN_UNLOCK_ERROR    The lock could not be released
+ */
+TURTLE_API enum turtle_return turtle_stack_preload(
+    struct turtle_stack * stack, double latitude_min, double latitude_max,
+    double longitude_min, double longitude_max, int threads);
+
 /**
  * Get the elevation at geodetic coordinates
  *
@@ -718,6 +1464,36 @@ TURTLE_API enum turtle_return turtle_stack_elevation(
     struct turtle_stack * stack, double latitude, double longitude,
     double * elevation, int * inside);
 
+/**
+ * Get the elevation over arrays of geodetic coordinates
+ *
+ * @param stack        The stack object
+ * @param n            The number of locations
+ * @param latitude     The geodetic latitudes
+ * @param longitude    The geodetic longitudes
+ * @param elevation    The estimated elevations
+ * @param inside       Flags for bounds check or `NULL`
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * This is a batched version of `turtle_stack_elevation`, for *n* locations
+ * stored as arrays. Consecutive locations within the same tile are processed
+ * at once. Thus, spatially sorted locations perform best. If *inside* is
+ * `NULL` a bound error is raised for the first location outside of the stack
+ * tiles and the remaining locations are not processed.
+ *
+ * __Warnings__ this function is not thread safe. A `turtle_client` must be
+ * used instead for concurrent accesses to the stack data.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_PATH    The required elevation data are not in the
+ * stack path.
+ */
+TURTLE_API enum turtle_return turtle_stack_elevation_v(
+    struct turtle_stack * stack, int n, const double * latitude,
+    const double * longitude, double * elevation, int * inside);
+
 /**
  * Get the gradient at geodetic coordinates
  *
@@ -749,6 +1525,363 @@ TURTLE_API enum turtle_return turtle_stack_gradient(
     struct turtle_stack * stack, double latitude, double longitude,
     double * glat, double * glon, int * inside);
 
+/**
+ * Get the elevation and the gradient at geodetic coordinates
+ *
+ * @param stack        The stack object
+ * @param latitude     The geodetic latitude
+ * @param longitude    The geodetic longitude
+ * @param elevation    The estimated elevation
+ * @param glat         The estimated gradient along latitude
+ * @param glon         The estimated gradient along longitude
+ * @param inside       Flag for bounds check or `NULL`
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * This is equivalent to calling `turtle_stack_elevation` and
+ * `turtle_stack_gradient`, but the tile lookup and the fetch of the
+ * interpolation nodes are done only once.
+ *
+ * __Warnings__ this function is not thread safe. A `turtle_client` must be
+ * used instead for concurrent accesses to the stack data.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_PATH    The required elevation data are not in the
+ * stack path.
+ */
+TURTLE_API enum turtle_return turtle_stack_elevation_gradient(
+    struct turtle_stack * stack, double latitude, double longitude,
+    double * elevation, double * glat, double * glon, int * inside);
+
+/**
+ * Enable or disable memory mapping of the stack tiles
+ *
+ * @param stack     The stack object
+ * @param enable    Flag for enabling memory mapping
+ *
+ * When memory mapping is enabled, tiles whose raw data are stored on disk as
+ * they are in memory, e.g. SRTM hgt or tbc files, are mapped from the file
+ * instead of being read. Pages are then loaded on demand and shared with the
+ * system page cache. Other formats are read as usual. Memory mapping is
+ * disabled by default. It only applies to tiles loaded after this call.
+ */
+TURTLE_API void turtle_stack_mmap_set(struct turtle_stack * stack, int enable);
+
+/**
+ * Get the memory mapping status of the stack tiles
+ *
+ * @param stack     The stack object
+ * @return `1` if memory mapping is enabled, `0` otherwise.
+ */
+TURTLE_API int turtle_stack_mmap_get(const struct turtle_stack * stack);
+
+/**
+ * Enable or disable the normalisation of the stack tiles
+ *
+ * @param stack     The stack object
+ * @param enable    Flag for enabling the normalisation
+ *
+ * When enabled, the data of tiles are normalised when loaded, see
+ * `turtle_map_normalise`. This trades a linear pass over the data, per tile
+ * load, for faster elevation queries. **Note** that normalising memory mapped
+ * tiles results in private copies of their pages. Normalisation is disabled
+ * by default. It only applies to tiles loaded after this call.
+ */
+TURTLE_API void turtle_stack_normalise_set(
+    struct turtle_stack * stack, int enable);
+
+/**
+ * Get the normalisation status of the stack tiles
+ *
+ * @param stack     The stack object
+ * @return `1` if normalisation is enabled, `0` otherwise.
+ */
+TURTLE_API int turtle_stack_normalise_get(const struct turtle_stack * stack);
+
+/**
+ * Enable or disable the blocked layout of the stack tiles
+ *
+ * @param stack     The stack object
+ * @param enable    Flag for enabling the blocked layout
+ *
+ * When enabled, the data of tiles are converted to a blocked layout when
+ * loaded, see `turtle_map_block`. This supersedes their normalisation. The
+ * conversion requires a temporary copy of the tile data. **Note** that
+ * memory mapped tiles are then copied to memory. The blocked layout is
+ * disabled by default. It only applies to tiles loaded after this call.
+ */
+TURTLE_API void turtle_stack_block_set(struct turtle_stack * stack, int enable);
+
+/**
+ * Get the blocked layout status of the stack tiles
+ *
+ * @param stack     The stack object
+ * @return `1` if the blocked layout is enabled, `0` otherwise.
+ */
+TURTLE_API int turtle_stack_block_get(const struct turtle_stack * stack);
+
+/**
+ * Enable or disable the sharing of the stack tiles between processes
+ *
+ * @param stack     The stack object
+ * @param enable    Flag for enabling shared tiles
+ *
+ * When enabled, decoded tiles are stored in POSIX shared memory segments,
+ * e.g. `/dev/shm/turtle-*`. A tile is then decoded once per node, by the
+ * first process loading it, while the stacks of other processes map the
+ * same memory, e.g. for MPI jobs with one rank per core. Processes keep
+ * their own stack and clients, with their own capacity and eviction policy.
+ * Segments count their users over all processes. When a tile is evicted by
+ * its last user, its segment is kept for reuse. Unused segments are removed
+ * once more of them than the stack capacity, or than its memory budget, have
+ * been kept, see `turtle_stack_budget_set`, and whenever the stack is cleared
+ * or destroyed. Segments can also be removed explicitly, see
+ * `turtle_stack_shared_unlink`. Their memory is released once they are no
+ * more mapped by any process.
+ *
+ * Shared tiles are normalised, or converted to a blocked layout, see
+ * `turtle_stack_block_set`. Tiles with compressed data, e.g. tbc files,
+ * are loaded privately. Memory is shared until a tile is modified, e.g. with
+ * `turtle_map_fill`, as for memory mapped files. Sharing is disabled by
+ * default. It only applies to tiles loaded after this call.
+ *
+ * A segment left incomplete by a process that died while decoding it, or
+ * that refers to a former version of its data file, is replaced by the next
+ * process loading the tile.
+ *
+ * __Warnings__
+ *
+ * Processes that exit without destroying their stack, e.g. on a crash, leave
+ * their segments in use. These segments persist until they are removed
+ * explicitly, e.g. by a single process at the end of a job.
+ */
+TURTLE_API void turtle_stack_shared_set(
+    struct turtle_stack * stack, int enable);
+
+/**
+ * Get the sharing status of the stack tiles
+ *
+ * @param stack     The stack object
+ * @return `1` if shared tiles are enabled, `0` otherwise.
+ */
+TURTLE_API int turtle_stack_shared_get(const struct turtle_stack * stack);
+
+/**
+ * Remove the shared memory segments of the stack tiles
+ *
+ * @param stack     The stack object
+ *
+ * Remove the shared memory segments of all the tiles of the stack, if any,
+ * see `turtle_stack_shared_set`. Tiles already loaded by processes remain
+ * valid, until they are evicted. Tiles loaded afterwards are decoded again.
+ */
+TURTLE_API void turtle_stack_shared_unlink(const struct turtle_stack * stack);
+
+/**
+ * Set a memory budget for the stack tiles
+ *
+ * @param stack     The stack object
+ * @param bytes     The memory budget, in bytes, or `0` for no budget
+ *
+ * In addition to the maximum number of tiles set at creation, the memory
+ * used by the loaded tiles is limited to *bytes*. Memory mapped tiles are
+ * accounted for with the size of their mapping. When a new tile is loaded,
+ * unused tiles are evicted according to the stack policy until it fits, see
+ * `turtle_stack_policy_set`. Tiles in use by a `turtle_client` are never
+ * evicted. Thus, the budget might be exceeded temporarily. By default there
+ * is no budget.
+ */
+TURTLE_API void turtle_stack_budget_set(
+    struct turtle_stack * stack, size_t bytes);
+
+/**
+ * Get the memory budget for the stack tiles
+ *
+ * @param stack     The stack object
+ * @return The memory budget, in bytes, or `0` if there is none.
+ */
+TURTLE_API size_t turtle_stack_budget_get(const struct turtle_stack * stack);
+
+/**
+ * Set the eviction policy for the stack tiles
+ *
+ * @param stack     The stack object
+ * @param policy    The eviction policy
+ *
+ * The policy determines which unused tiles are evicted first when the stack
+ * is full. Tiles can be evicted by least recent access (LRU), by least number
+ * of accesses (LFU), or by largest distance to the location that triggered
+ * the load (DISTANCE). The default policy is LRU.
+ */
+TURTLE_API void turtle_stack_policy_set(
+    struct turtle_stack * stack, enum turtle_stack_policy policy);
+
+/**
+ * Get the eviction policy for the stack tiles
+ *
+ * @param stack     The stack object
+ * @return The eviction policy.
+ */
+TURTLE_API enum turtle_stack_policy turtle_stack_policy_get(
+    const struct turtle_stack * stack);
+
+/**
+ * Get the runtime statistics of a stack
+ *
+ * @param stack     The stack object
+ * @param stats     The statistics
+ *
+ * The statistics cover the accesses done directly with the stack, e.g. with
+ * `turtle_stack_elevation`, and all tile loads, evictions and lock
+ * acquisitions, including those triggered by clients. Per client statistics
+ * are provided by `turtle_client_stats`.
+ *
+ * __Warnings__
+ *
+ * If the stack is used concurrently, the statistics are only indicative.
+ */
+TURTLE_API void turtle_stack_stats(
+    const struct turtle_stack * stack, struct turtle_stats * stats);
+
+/**
+ * Reset the runtime statistics of a stack
+ *
+ * @param stack     The stack object
+ *
+ * __Warnings__
+ *
+ * This function is not thread safe.
+ */
+TURTLE_API void turtle_stack_stats_reset(struct turtle_stack * stack);
+
+/**
+ * Set a hook for monitoring the tiles of a stack
+ *
+ * @param stack     The stack object
+ * @param hook      The callback, or `NULL`
+ * @param context   A user supplied context for the callback
+ *
+ * The *hook* is called whenever a tile is loaded to or evicted from the
+ * stack, including when the stack is cleared or destroyed. Providing a `NULL`
+ * hook disables monitoring.
+ *
+ * __Warnings__
+ *
+ * This function is not thread safe. See also `turtle_stack_hook_t`.
+ */
+TURTLE_API void turtle_stack_hook_set(
+    struct turtle_stack * stack, turtle_stack_hook_t * hook, void * context);
+
+/**
+ * Prefetch the stack tiles that are likely to be requested next
+ *
+ * @param stack        The stack object
+ * @param position     The ECEF position hint
+ * @param direction    The ECEF direction hint, or `NULL`
+ * @param distance     The prefetch distance, in m
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * Load the tiles located along the straight line starting at *position* and
+ * going along *direction*, up to the given *distance*. The direction is
+ * typically the one provided to `turtle_stepper_step`. If *direction* is
+ * `NULL`, the tiles within the given *distance* of *position* are loaded
+ * instead. Tiles that are already loaded are left unchanged.
+ *
+ * The number of tiles loaded by a request is bounded by the stack size, such
+ * that prefetched tiles do not evict each other. If the background loader is
+ * enabled, see `turtle_stack_prefetch_async_set`, this function only queues
+ * the requested tiles and returns immediately. Otherwise the tiles are loaded
+ * synchronously, with an exclusive access to the stack.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_FORMAT      A tile has an invalid format
+ *
+ *    TURTLE_RETURN_LOCK_ERROR      The lock could not be acquired
+ *
+ *    TURTLE_RETURN_MEMORY_ERROR    A tile could not be allocated
+ *
+ *    TURTLE_RETURN_UNLOCK_ERROR    The lock could not be released
+ */
+TURTLE_API enum turtle_return turtle_stack_prefetch(
+    struct turtle_stack * stack, const double position[3],
+    const double direction[3], double distance);
+
+/**
+ * Enable or disable the background loading of prefetched tiles
+ *
+ * @param stack     The stack object
+ * @param enable    Flag for enabling the background loader
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * When enabled, a loader thread processes the requests issued with
+ * `turtle_stack_prefetch`, with an exclusive access to the stack. Thus, the
+ * stack must have a lock and its elevation data must be accessed with
+ * `turtle_client`s. Disabling the loader waits for pending requests to be
+ * processed. The loader is also stopped when the stack is destroyed.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_ADDRESS     The stack has no lock
+ *
+ *    TURTLE_RETURN_LIBRARY_ERROR   The loader thread could not be started, or
+ * the library was built without threads support
+ *
+ *    TURTLE_RETURN_MEMORY_ERROR    The loader could not be allocated
+ */
+TURTLE_API enum turtle_return turtle_stack_prefetch_async_set(
+    struct turtle_stack * stack, int enable);
+
+/**
+ * Get the status of the background loader
+ *
+ * @param stack     The stack object
+ * @return `1` if the background loader is enabled, `0` otherwise.
+ */
+TURTLE_API int turtle_stack_prefetch_async_get(
+    const struct turtle_stack * stack);
+
+/**
+ * Set the callbacks managing concurrent accesses to the stack
+ *
+ * @param stack            The stack object
+ * @param lock             A callback for exclusive locking, or `NULL`.
+ * @param unlock           A callback for exclusive unlocking, or `NULL`.
+ * @param shared_lock      A callback for shared locking, or `NULL`.
+ * @param shared_unlock    A callback for shared unlocking, or `NULL`.
+ * @param context          A user context forwarded to the callbacks.
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * This function overrides the *lock* and *unlock* callbacks provided to
+ * `turtle_stack_create`. The callbacks are called with the user supplied
+ * *context*, e.g. a `pthread_rwlock_t`. Thus, several stacks can be managed
+ * with independent locks.
+ *
+ * Providing *shared_lock* and *shared_unlock* callbacks, e.g. based on
+ * `pthread_rwlock_rdlock` and `pthread_rwlock_unlock`, enables concurrent
+ * lookups of tiles that are already loaded by `turtle_client`s. The
+ * exclusive lock is then only taken for loading or evicting tiles. Note that in
+ * this case the LRU ordering of the stack is not updated by shared lookups.
+ *
+ * __Warnings__
+ *
+ * This function is not thread safe. It must be called before any client
+ * accesses the stack.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_ADDRESS     The callbacks are inconsistent
+ */
+TURTLE_API enum turtle_return turtle_stack_lock_set(
+    struct turtle_stack * stack, turtle_stack_context_locker_t * lock,
+    turtle_stack_context_locker_t * unlock,
+    turtle_stack_context_locker_t * shared_lock,
+    turtle_stack_context_locker_t * shared_unlock, void * context);
+
 /**
  * Create a new client to a stack of global topography data
  *
@@ -811,6 +1944,67 @@ TURTLE_API enum turtle_return turtle_client_destroy(
 TURTLE_API enum turtle_return turtle_client_clear(
     struct turtle_client * client);
 
+/**
+ * Set the number of tiles pinned by a client
+ *
+ * @param client    The client object
+ * @param tiles     The number of tiles, between 1 and 16
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below.
+ *
+ * A client keeps reserved the tile it is using. In addition, it can keep
+ * pinned up to *tiles - 1* previously used tiles, e.g. 9 tiles for the
+ * current one and its 8 neighbours. These tiles are checked without locking
+ * the stack. Thus, tracks zig-zagging across tile edges do not require any
+ * lock. When the set is full, the least recently used tile is released.
+ * **Note** that pinned tiles are never evicted from the stack, which might
+ * then exceed its maximum size and its memory budget, see
+ * `turtle_stack_budget_set`. By default, only the current tile is kept. A
+ * larger default, e.g. 3x3 tiles, would let every client hold up to 9 tiles
+ * out of the reach of the stack eviction, changing the memory bounds of
+ * existing applications with many clients. Thus, it must be requested
+ * explicitly, with a stack sized accordingly.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_DOMAIN_ERROR    The number of tiles is not valid
+ *
+ *    TURTLE_RETURN_LOCK_ERROR      The lock couldn't be acquired
+ *
+ *    TURTLE_RETURN_UNLOCK_ERROR    The lock couldn't be released
+ */
+TURTLE_API enum turtle_return turtle_client_tiles_set(
+    struct turtle_client * client, int tiles);
+
+/**
+ * Get the number of tiles pinned by a client
+ *
+ * @param client    The client object
+ * @return The maximum number of pinned tiles, including the current one
+ *
+ * See `turtle_client_tiles_set`.
+ */
+TURTLE_API int turtle_client_tiles_get(const struct turtle_client * client);
+
+/**
+ * Get the runtime statistics of a client
+ *
+ * @param client    The client object
+ * @param stats     The statistics
+ *
+ * Only the accesses done with this client are accounted for, including the
+ * tiles it loaded or evicted. See also `turtle_stack_stats`.
+ */
+TURTLE_API void turtle_client_stats(
+    const struct turtle_client * client, struct turtle_stats * stats);
+
+/**
+ * Reset the runtime statistics of a client
+ *
+ * @param client    The client object
+ */
+TURTLE_API void turtle_client_stats_reset(struct turtle_client * client);
+
 /**
  * Thread safe access to the elevation data of a stack
  *
@@ -828,6 +2022,10 @@ TURTLE_API enum turtle_return turtle_client_clear(
  * provided coordinates are inside the stack tiles or not. **Note** that no
  * bound error is raised in the latter case, when *inside* is not `NULL`.
  *
+ * If the required tile is not loaded, the stack lock is released while the
+ * tile data are read. Meanwhile, other clients requesting the same tile wait
+ * for the load to complete, while the others go on.
+ *
  * __Error codes__
  *
  *    TURTLE_RETURN_BAD_PATH        The required elevation data are not in the
@@ -841,6 +2039,142 @@ TURTLE_API enum turtle_return turtle_client_elevation(
     struct turtle_client * client, double latitude, double longitude,
     double * elevation, int * inside);
 
+/**
+ * Thread safe access to the elevation data of a stack, over arrays of
+ * coordinates
+ *
+ * @param client       The client object
+ * @param n            The number of locations
+ * @param latitude     The geodetic latitudes
+ * @param longitude    The geodetic longitudes
+ * @param elevation    The estimated elevations
+ * @param inside       Flags for bounds check or `NULL`
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * This is a batched version of `turtle_client_elevation`, for *n* locations
+ * stored as arrays. Consecutive locations within the client's current tile are
+ * processed at once, without locking the stack. If *inside* is `NULL` a bound
+ * error is raised for the first location outside of the stack tiles and the
+ * remaining locations are not processed.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_PATH        The required elevation data are not in the
+ * stack path
+ *
+ *    TURTLE_RETURN_LOCK_ERROR      The lock couldn't be acquired
+ *
+ *    TURTLE_RETURN_UNLOCK_ERROR    The lock couldn't be released
+ */
+TURTLE_API enum turtle_return turtle_client_elevation_v(
+    struct turtle_client * client, int n, const double * latitude,
+    const double * longitude, double * elevation, int * inside);
+
+/**
+ * Thread safe access to the elevation data of a stack, for a large batch of
+ * unordered locations
+ *
+ * @param client       The client object
+ * @param n            The number of locations
+ * @param latitude     The geodetic latitudes
+ * @param longitude    The geodetic longitudes
+ * @param elevation    The estimated elevations
+ * @param inside       Flags for bounds check or `NULL`
+ * @param threads      The number of processing threads
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * This is equivalent to calling `turtle_client_elevation_v`, but the
+ * locations are first bucketed by stack tile, and sorted along a Morton
+ * curve within each tile. Then, all the locations of a tile are processed
+ * at once. Thus, each tile is loaded at most once per batch, even if the
+ * stack cannot hold all the tiles. The results are written back in the
+ * initial order of the locations. Sorting requires 8 bytes of temporary
+ * memory per location.
+ *
+ * The tiles are processed concurrently by *threads* threads, including the
+ * calling one. The other threads use temporary clients of the same stack,
+ * whose statistics are added to *client*. A value lower than 2 results in a
+ * serial processing, which is also the case if the library was built
+ * without threads support.
+ *
+ * If *inside* is `NULL` a bound error is raised, once all locations have
+ * been processed, if any of them is outside of the stack tiles.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_PATH        The required elevation data are not in the
+ * stack path
+ *
+ *    TURTLE_RETURN_LOCK_ERROR      The lock couldn't be acquired
+ *
+ *    TURTLE_RETURN_MEMORY_ERROR    The sorting memory couldn't be allocated
+ *
+ *    TURTLE_RETURN_UNLOCK_ERROR    The lock couldn't be released
+ */
+TURTLE_API enum turtle_return turtle_client_elevation_batch(
+    struct turtle_client * client, int n, const double * latitude,
+    const double * longitude, double * elevation, int * inside, int threads);
+
+/**
+ * Thread safe access to the gradient of the elevation data of a stack
+ *
+ * @param client       The client object
+ * @param latitude     The geodetic latitude
+ * @param longitude    The geodetic longitude
+ * @param glat         The estimated gradient along latitude
+ * @param glon         The estimated gradient along longitude
+ * @param inside       Flag for bounds check or `NULL`
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * This is the thread safe version of `turtle_stack_gradient`. The tile of
+ * the requested coordinates is managed as for `turtle_client_elevation`.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_PATH        The required elevation data are not in the
+ * stack path
+ *
+ *    TURTLE_RETURN_LOCK_ERROR      The lock couldn't be acquired
+ *
+ *    TURTLE_RETURN_UNLOCK_ERROR    The lock couldn't be released
+ */
+TURTLE_API enum turtle_return turtle_client_gradient(
+    struct turtle_client * client, double latitude, double longitude,
+    double * glat, double * glon, int * inside);
+
+/**
+ * Thread safe access to the elevation data of a stack and to their gradient
+ *
+ * @param client       The client object
+ * @param latitude     The geodetic latitude
+ * @param longitude    The geodetic longitude
+ * @param elevation    The estimated elevation
+ * @param glat         The estimated gradient along latitude
+ * @param glon         The estimated gradient along longitude
+ * @param inside       Flag for bounds check or `NULL`
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * This is equivalent to calling `turtle_client_elevation` and
+ * `turtle_client_gradient`, but the tile lookup and the fetch of the
+ * interpolation nodes are done only once.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_PATH        The required elevation data are not in the
+ * stack path
+ *
+ *    TURTLE_RETURN_LOCK_ERROR      The lock couldn't be acquired
+ *
+ *    TURTLE_RETURN_UNLOCK_ERROR    The lock couldn't be released
+ */
+TURTLE_API enum turtle_return turtle_client_elevation_gradient(
+    struct turtle_client * client, double latitude, double longitude,
+    double * elevation, double * glat, double * glon, int * inside);
+
 /**
  * Create a new ECEF stepper
  *
@@ -859,6 +2193,36 @@ TURTLE_API enum turtle_return turtle_client_elevation(
 TURTLE_API enum turtle_return turtle_stepper_create(
     struct turtle_stepper ** stepper);
 
+/**
+ * Clone an ECEF stepper
+ *
+ * @param clone     The cloned stepper object
+ * @param stepper   The stepper to clone
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * Create a new stepper sharing the configuration of *stepper*, i.e. its
+ * geometry layers and meta-data, read only. Only the stepping caches are
+ * allocated for the clone, as well as new `turtle_client` objects for the
+ * stacks having a lock. The geoid and the range, slope and resolution
+ * factors are copied. They can be modified independently for the clone.
+ *
+ * Clones are intended for multi-threaded stepping, with one clone per thread.
+ * The layers of a cloned stepper cannot be modified, nor the ones of its
+ * parent while it has living clones. The parent stepper must outlive its
+ * clones. Cloning a clone is equivalent to cloning its parent.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_LOCK_ERROR      A stack lock couldn't be acquired
+ *
+ *    TURTLE_RETURN_MEMORY_ERROR    The clone couldn't be allocated
+ *
+ *    TURTLE_RETURN_UNLOCK_ERROR    A stack lock couldn't be released
+ */
+TURTLE_API enum turtle_return turtle_stepper_clone(
+    struct turtle_stepper ** clone, struct turtle_stepper * stepper);
+
 /**
  * Properly clean an ECEf stepper
  *
@@ -868,10 +2232,13 @@ TURTLE_API enum turtle_return turtle_stepper_create(
  *
  * Attempts to destroy an ECEF stepper. **Note** that the stepper might have
  * created a `turtle_client` for thread safe access to stack data.
- * If so, the client is automatically destroyed as well.
+ * If so, the client is automatically destroyed as well. A stepper cannot
+ * be destroyed while it has living clones.
  *
  * __Error codes__
  *
+ *    TURTLE_RETURN_BAD_ADDRESS     The stepper has living clones
+ *
  *    TURTLE_RETURN_LOCK_ERROR      The client lock couldn't be acquired
  *
  *    TURTLE_RETURN_UNLOCK_ERROR    The client lock couldn't be released
@@ -890,6 +2257,10 @@ TURTLE_API enum turtle_return turtle_stepper_destroy(
  * stepping this might introduce distortions of the ground since topography data
  * are usually given w.r.t. mean sea level. Providing a geoid map allows to
  * correct for this.
+ *
+ * The stepper caches the interpolation nodes of the last geoid cell. Thus,
+ * if the geoid map is modified afterwards, e.g. with `turtle_map_fill`, it
+ * must be set again.
  */
 TURTLE_API void turtle_stepper_geoid_set(
     struct turtle_stepper * stepper, struct turtle_map * geoid);
@@ -915,6 +2286,25 @@ TURTLE_API struct turtle_map * turtle_stepper_geoid_get(
  */
 TURTLE_API void turtle_stepper_reset(struct turtle_stepper * stepper);
 
+/**
+ * Get the runtime statistics of a stepper
+ *
+ * @param stepper    The stepper object
+ * @param stats      The statistics
+ *
+ * The statistics are recorded since the stepper creation, or since the last
+ * call to `turtle_stepper_stats_reset`. Each clone has its own statistics.
+ */
+TURTLE_API void turtle_stepper_stats(const struct turtle_stepper * stepper,
+    struct turtle_stepper_stats * stats);
+
+/**
+ * Reset the runtime statistics of a stepper
+ *
+ * @param stepper    The stepper object
+ */
+TURTLE_API void turtle_stepper_stats_reset(struct turtle_stepper * stepper);
+
 /**
  * Set the validity range for local approximation to geographic transforms
  *
@@ -980,6 +2370,93 @@ TURTLE_API double turtle_stepper_resolution_get(
 TURTLE_API void turtle_stepper_resolution_set(
     struct turtle_stepper * stepper, double resolution);
 
+/**
+ * Get the precision for locating changes of medium
+ *
+ * @param stepper    The stepper object
+ * @return The precision, in m
+ */
+TURTLE_API double turtle_stepper_precision_get(
+    const struct turtle_stepper * stepper);
+
+/**
+ * Set the precision for locating changes of medium
+ *
+ * @param stepper      The stepper object
+ * @param precision    The precision, in m
+ *
+ * When a step crosses a change of medium, the step is refined until the
+ * crossing is bracketed within *precision*. The step then ends in the new
+ * medium, at most *precision* after the crossing. The default precision is
+ * 1E-08 (10 nm). A millimetre precision, e.g. 1E-03, roughly halves the
+ * number of refinement iterations with bisection.
+ */
+TURTLE_API void turtle_stepper_precision_set(
+    struct turtle_stepper * stepper, double precision);
+
+/**
+ * Get the method for locating changes of medium
+ *
+ * @param stepper    The stepper object
+ * @return The refinement method
+ */
+TURTLE_API enum turtle_stepper_refinement turtle_stepper_refinement_get(
+    const struct turtle_stepper * stepper);
+
+/**
+ * Set the method for locating changes of medium
+ *
+ * @param stepper       The stepper object
+ * @param refinement    The refinement method
+ *
+ * By default, changes of medium are located by bisection of the step. The
+ * regula falsi method interpolates the height above the crossed surface
+ * instead. It usually converges within a few iterations for smooth
+ * topographies, and it is not slower than bisection otherwise.
+ */
+TURTLE_API void turtle_stepper_refinement_set(struct turtle_stepper * stepper,
+    enum turtle_stepper_refinement refinement);
+
+/**
+ * Enable or disable the skipping of empty space using elevation bounds
+ *
+ * @param stepper    The stepper object
+ * @param enable     Flag to enable (1) or disable (0) the skipping
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * When enabled, the stepper bounds the topography elevation around the
+ * current position using a pyramid of minimum and maximum elevations over
+ * cells of map nodes. The step length is then lengthened, by doubling, as
+ * long as the step is guaranteed to stay within the current medium, e.g.
+ * far above the ground. Steps ending at a change of medium are still
+ * located by bisection, i.e. the crossings are not altered.
+ *
+ * Enabling the skipping builds the pyramids of the stepper's maps. Tiles
+ * of stacks get their pyramid when (re)loaded, including tiles of stacks
+ * added later on. Only geographic maps and stack data are bounded, as well
+ * as flat data. Pyramids are invalidated when a map is modified, e.g. with
+ * `turtle_map_fill`. They are rebuilt on the next access by a stepper with
+ * skipping enabled. The skipping is disabled by default.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_ADDRESS     The stepper is (being) cloned
+ *
+ *    TURTLE_RETURN_MEMORY_ERROR    A pyramid couldn't be allocated
+ */
+TURTLE_API enum turtle_return turtle_stepper_pyramid_set(
+    struct turtle_stepper * stepper, int enable);
+
+/**
+ * Get the status of the skipping of empty space
+ *
+ * @param stepper    The stepper object
+ * @return `1` if the skipping is enabled, `0` otherwise
+ */
+TURTLE_API int turtle_stepper_pyramid_get(
+    const struct turtle_stepper * stepper);
+
 /**
  * Add a new topography layer for the stepper
  *
@@ -1002,6 +2479,8 @@ TURTLE_API void turtle_stepper_resolution_set(
  *
  * __Error codes__
  *
+ *    TURTLE_RETURN_BAD_ADDRESS     The stepper is (being) cloned
+ *
  *    TURTLE_RETURN_MEMORY_ERROR    The layer couldn't be allocated.
  */
 TURTLE_API enum turtle_return turtle_stepper_add_layer(
@@ -1027,7 +2506,8 @@ TURTLE_API enum turtle_return turtle_stepper_add_layer(
  *
  * __Error codes__
  *
- *    TURTLE_RETURN_BAD_ADDRESS     The client could not be created.
+ *    TURTLE_RETURN_BAD_ADDRESS     The client could not be created, or the
+ * stepper is (being) cloned.
  *
  *    TURTLE_RETURN_MEMORY_ERROR    The layer couldn't be allocated.
  */
@@ -1050,8 +2530,15 @@ TURTLE_API enum turtle_return turtle_stepper_add_stack(
  * **Note** that the last registered data within the current layer is the top
  * data, i.e. it has priority over data beneath.
  *
+ * The geodetic bounding box of the map is computed when it is added. Maps not
+ * covering a location are skipped without projecting it. Layers with many
+ * data are indexed over a grid of geodetic bins. Thus, the extent of the map
+ * must not be modified afterwards.
+ *
  * __Error codes__
  *
+ *    TURTLE_RETURN_BAD_ADDRESS     The stepper is (being) cloned
+ *
  *    TURTLE_RETURN_MEMORY_ERROR    The layer couldn't be allocated
  */
 TURTLE_API enum turtle_return turtle_stepper_add_map(
@@ -1073,6 +2560,8 @@ TURTLE_API enum turtle_return turtle_stepper_add_map(
  *
  * __Error codes__
  *
+ *    TURTLE_RETURN_BAD_ADDRESS     The stepper is (being) cloned
+ *
  *    TURTLE_RETURN_MEMORY_ERROR    The layer couldn't be allocated
  */
 TURTLE_API enum turtle_return turtle_stepper_add_flat(
@@ -1128,6 +2617,126 @@ enum turtle_return turtle_stepper_step(struct turtle_stepper * stepper,
     double * longitude, double * altitude, double * elevation,
     double * step, int * index);
 
+/**
+ * Compute (or do) a step through the topography for a batch of particles
+ *
+ * @param stepper              The stepper object
+ * @param n                    The number of particles
+ * @param states               The stepping states of the particles
+ * @param position             The initial (final) ECEF positions
+ * @param direction            The initial directions in ECEF, or `NULL`
+ * @param latitude             The initial (final) geodetic latitudes
+ * @param longitude            The initial (final) geodetic longitudes
+ * @param altitude             The initial (final) geodetic altitudes
+ * @param elevation            The initial (final) topography elevations
+ * @param step_length          The step lengths
+ * @param index                The initial (final) topography and/or meta-data
+ *                               indices
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * Batch version of `turtle_stepper_step_state` for *n* independent
+ * particles. Each particle has its own stepping state, see
+ * `turtle_stepper_state_create`, which is restored before its step and saved
+ * afterwards. Thus, particles keep their own last sample and local transforms
+ * from one batch to the next, as if they were stepped alone. The *states*
+ * array must hold *n* states. The *position* and *direction* arrays must hold
+ * *3 n* values, i.e. the ECEF vectors of the particles one after the other.
+ * Likewise, *elevation* and *index* must hold *2 n* values, if non `NULL`.
+ * The other output arrays must be of size *n*, or `NULL`.
+ *
+ * The particles are processed in order, with a single error context for the
+ * whole batch. If an error occurs, the processing stops at the failing
+ * particle. The following particles are left unchanged.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_BAD_ADDRESS     The stepping states are missing
+ *
+ *    TURTLE_RETURN_DOMAIN_ERROR    A provided position is outside of all
+ * data
+ *
+ *    TURTLE_RETURN_MEMORY_ERROR    A state couldn't be resized
+ */
+TURTLE_API enum turtle_return turtle_stepper_step_n(
+    struct turtle_stepper * stepper, int n,
+    struct turtle_stepper_state ** states, double * position,
+    const double * direction, double * latitude, double * longitude,
+    double * altitude, double * elevation, double * step_length, int * index);
+
+/**
+ * Create a new stepping state
+ *
+ * @param state    The stepping state
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * Allocate a stepping state, for use with `turtle_stepper_step_state`. The
+ * state holds the stepping history of a single particle, i.e. its last
+ * sample and the local transforms used for computing its geographic
+ * coordinates. Use `turtle_stepper_state_destroy` in order to recover the
+ * allocated memory.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_MEMORY_ERROR    The state couldn't be allocated
+ */
+TURTLE_API enum turtle_return turtle_stepper_state_create(
+    struct turtle_stepper_state ** state);
+
+/**
+ * Destroy a stepping state
+ *
+ * @param state    The stepping state
+ *
+ * Recover the memory allocated by `turtle_stepper_state_create`. On return
+ * *state* is set to `NULL`.
+ */
+TURTLE_API void turtle_stepper_state_destroy(
+    struct turtle_stepper_state ** state);
+
+/**
+ * Compute (or do) a step through the topography, using a particle's own
+ * stepping history
+ *
+ * @param stepper              The stepper object
+ * @param state                The stepping state of the particle
+ * @param position             The initial (final) ECEF position
+ * @param direction            The initial direction in ECEF, or `NULL`
+ * @param latitude             The initial (final) geodetic latitude
+ * @param longitude            The initial (final) geodetic longitude
+ * @param altitude             The initial (final) geodetic altitude
+ * @param elevation            The initial (final) topography elevation(s)
+ * @param step_length          The step length
+ * @param index                The initial (final) topography and/or meta-data
+ *                               indices
+ * @return On success `TURTLE_RETURN_SUCCESS` is returned otherwise an error
+ * code is returned as detailed below
+ *
+ * This is equivalent to `turtle_stepper_step`, but the stepping history is
+ * restored from *state* before the step, and saved back to it afterwards.
+ * Thus, when interleaving the steps of several particles with a single
+ * stepper, each particle keeps its own last sample and local transforms,
+ * provided that it has its own state. The stepper's own history is
+ * overwritten.
+ *
+ * A state is bound to the stepper that last used it. It is reset if it is
+ * used with another stepper, or if the stepper history has been reset
+ * since, e.g. by changing its local range or geoid.
+ *
+ * __Error codes__
+ *
+ *    TURTLE_RETURN_DOMAIN_ERROR    The provided position is outside of all
+ * data
+ *
+ *    TURTLE_RETURN_MEMORY_ERROR    The state couldn't be resized
+ */
+TURTLE_API enum turtle_return turtle_stepper_step_state(
+    struct turtle_stepper * stepper, struct turtle_stepper_state * state,
+    double * position, const double * direction, double * latitude,
+    double * longitude, double * altitude, double * elevation,
+    double * step_length, int * index);
+
 /**
  * Convert a geograhic location to an ECEF one
  *
@@ -23,17 +23,26 @@
  * turtle_stack.
  */
 #include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "client.h"
 #include "error.h"
+#include "parallel.h"
 #include "stack.h"
 #include "turtle.h"
 
 /* Management routine(s) */
 static enum turtle_return client_release(struct turtle_client * client,
     int lock, struct turtle_error_context * error_);
+static enum turtle_return client_unpin(struct turtle_client * client,
+    struct turtle_map ** slot, int lock, struct turtle_error_context * error_);
+static enum turtle_return client_push(struct turtle_client * client,
+    struct turtle_map * map, int lock, struct turtle_error_context * error_);
+static void client_promote(struct turtle_client * client, int k);
+static int client_find(
+    const struct turtle_client * client, const struct turtle_map * map);
 
 /* Create a new stack client */
 enum turtle_return turtle_client_create(
@@ -47,7 +56,7 @@ enum turtle_return turtle_client_create(
                 return TURTLE_ERROR_MESSAGE(
                     TURTLE_RETURN_BAD_ADDRESS, "invalid null stack");
         }
-        else if (stack->lock == NULL) {
+        else if (!turtle_stack_has_lock_(stack)) {
                 return TURTLE_ERROR_MESSAGE(
                     TURTLE_RETURN_BAD_ADDRESS, "stack has no lock");
         }
@@ -57,8 +66,11 @@ enum turtle_return turtle_client_create(
         if (*client == NULL) return TURTLE_ERROR_MEMORY();
         (*client)->stack = stack;
         (*client)->map = NULL;
+        (*client)->set_n = 0;
+        (*client)->tiles = 1;
         (*client)->index_la = INT_MIN;
         (*client)->index_lo = INT_MIN;
+        memset(&(*client)->counters, 0x0, sizeof((*client)->counters));
 
         return TURTLE_RETURN_SUCCESS;
 }
@@ -95,12 +107,55 @@ enum turtle_return turtle_client_clear(struct turtle_client * client)
         return TURTLE_ERROR_RAISE();
 }
 
-/* Supervised access to the elevation data */
-enum turtle_return turtle_client_elevation(struct turtle_client * client,
-    double latitude, double longitude, double * elevation, int * inside)
+/* Set the number of tiles pinned by the client */
+enum turtle_return turtle_client_tiles_set(
+    struct turtle_client * client, int tiles)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_client_tiles_set);
+        if ((tiles < 1) || (tiles > TURTLE_CLIENT_TILES)) {
+                return TURTLE_ERROR_FORMAT(TURTLE_RETURN_DOMAIN_ERROR,
+                    "invalid number of tiles (%d)", tiles);
+        }
+
+        /* Release the least recently used maps in excess */
+        while (client->set_n > tiles - 1) {
+                struct turtle_map ** last = client->set + client->set_n - 1;
+                const enum turtle_return rc =
+                    client_unpin(client, last, 1, error_);
+                if (*last == NULL) client->set_n--;
+                if (rc != TURTLE_RETURN_SUCCESS) return TURTLE_ERROR_RAISE();
+        }
+        client->tiles = tiles;
+
+        return TURTLE_RETURN_SUCCESS;
+}
+
+int turtle_client_tiles_get(const struct turtle_client * client)
+{
+        return client->tiles;
+}
+
+/* Get the runtime statistics of the client */
+void turtle_client_stats(
+    const struct turtle_client * client, struct turtle_stats * stats)
+{
+        turtle_stack_export_(&client->counters, stats);
+}
+
+void turtle_client_stats_reset(struct turtle_client * client)
+{
+        memset(&client->counters, 0x0, sizeof(client->counters));
+}
+
+/* Supervised access to the elevation data and, if `gradient` is not `NULL`,
+ * to the gradient along latitude and longitude
+ */
+static enum turtle_return client_elevation(struct turtle_client * client,
+    double latitude, double longitude, double * elevation, double * gradient,
+    int * inside, struct turtle_error_context * error_)
 {
-        TURTLE_ERROR_INITIALISE(&turtle_client_elevation);
         if (inside != NULL) *inside = 0;
+        if (gradient != NULL) gradient[0] = gradient[1] = 0.;
 
         /* Get the proper map */
         struct turtle_map * current = client->map;
@@ -112,10 +167,31 @@ enum turtle_return turtle_client_elevation(struct turtle_client * client,
                 hy = (latitude - current->meta.y0) / current->meta.dy;
 
                 if ((hx >= 0.) && (hx < current->meta.nx - 1) && (hy >= 0.) &&
-                    (hy < current->meta.ny - 1))
+                    (hy < current->meta.ny - 1)) {
+                        client->counters.head_hits++;
+                        goto interpolate;
+                }
+        }
+
+        /* Then, let us check the other pinned maps. They are reserved by the
+         * client, thus no lock is needed
+         */
+        int k;
+        for (k = 0; k < client->set_n; k++) {
+                const struct turtle_map * map = client->set[k];
+                const double gx = (longitude - map->meta.x0) / map->meta.dx;
+                const double gy = (latitude - map->meta.y0) / map->meta.dy;
+                if ((gx >= 0.) && (gx < map->meta.nx - 1) && (gy >= 0.) &&
+                    (gy < map->meta.ny - 1)) {
+                        client->counters.set_hits++;
+                        client_promote(client, k);
                         goto interpolate;
-        } else if (((int)latitude == client->index_la) &&
+                }
+        }
+
+        if ((current == NULL) && ((int)latitude == client->index_la) &&
             ((int)longitude == client->index_lo)) {
+                client->counters.missing++;
                 if (inside != NULL) {
                         return TURTLE_RETURN_SUCCESS;
                 } else {
@@ -123,58 +199,111 @@ enum turtle_return turtle_client_elevation(struct turtle_client * client,
                 }
         }
 
-        /* Lock the stack */
+        /* Cells without any data are known from the stack creation. Thus, they
+         * can be rejected without locking the stack, unless there is a map
+         * to release. Note that in this case the stack is not modified by
+         * the load attempt
+         */
         struct turtle_stack * stack = client->stack;
-        if ((stack->lock != NULL) && (stack->lock() != 0))
+        const int index = turtle_stack_index_(stack, latitude, longitude);
+        if ((current == NULL) && turtle_stack_missing_(stack, index)) {
+                client->counters.missing++;
+                *elevation = 0.;
+                turtle_stack_load_(stack, latitude, longitude, inside, error_);
+                return TURTLE_ERROR_RAISE();
+        }
+
+        if (turtle_stack_has_shared_lock_(stack) && (index >= 0)) {
+                /* Let us first look for an already loaded map, with a shared
+                 * access to the stack
+                 */
+                if (turtle_stack_lock_shared_(stack, &client->counters) != 0)
+                        return TURTLE_ERROR_LOCK();
+                struct turtle_map * map = stack->grid[index];
+                k = -1;
+                if ((map != NULL) && (map != current)) {
+                        k = client_find(client, map);
+                        if (k < 0) TURTLE_ATOMIC_ADD(&map->clients, 1);
+                        turtle_stack_hit_(stack, map);
+                } else {
+                        map = NULL;
+                }
+                if (turtle_stack_unlock_shared_(stack) != 0) {
+                        if ((map != NULL) && (k < 0))
+                                TURTLE_ATOMIC_ADD(&map->clients, -1);
+                        return TURTLE_ERROR_UNLOCK();
+                }
+
+                if (map != NULL) {
+                        /* Pin the previous map and update the client */
+                        client->counters.grid_hits++;
+                        if (k >= 0) {
+                                client_promote(client, k);
+                        } else if (client_push(client, map, 1, error_) !=
+                            TURTLE_RETURN_SUCCESS) {
+                                TURTLE_ATOMIC_ADD(&map->clients, -1);
+                                return TURTLE_ERROR_RAISE();
+                        }
+                        goto interpolate;
+                }
+        }
+
+        /* Lock the stack */
+        if (turtle_stack_lock_(stack, &client->counters) != 0)
                 return TURTLE_ERROR_LOCK();
 
         /* The requested coordinates are not in the current map. Let's check
-         * the full stack
+         * the grid of loaded tiles
          */
-        current = stack->tiles.head;
-        while (current != NULL) {
-                if (current == client->map) {
-                        current = current->element.next;
-                        continue;
-                }
-                hx = (longitude - current->meta.x0) / current->meta.dx;
-                hy = (latitude - current->meta.y0) / current->meta.dy;
-                if ((hx >= 0.) && (hx < current->meta.nx - 1) && (hy >= 0.) &&
-                    (hy < current->meta.ny - 1)) {
+        if (index >= 0) {
+                current = stack->grid[index];
+                if ((current != NULL) && (current != client->map)) {
                         turtle_stack_touch_(stack, current);
+                        client->counters.grid_hits++;
                         if (inside != NULL) *inside = 1;
                         goto update;
                 }
-                current = current->element.next;
         }
 
-        /* No valid map was found. Let's try to load it */
-        if ((turtle_stack_load_(stack, latitude, longitude, inside, error_) !=
-                TURTLE_RETURN_SUCCESS) ||
-            ((inside != NULL) && (*inside == 0))) {
+        /* No valid map was found. Let's try to load it. The lock is released
+         * during the tile I/O, thus other threads can go on meanwhile
+         */
+        client->counters.misses++;
+        const enum turtle_return rc = turtle_stack_fetch_(stack, latitude,
+            longitude, &current, inside, &client->counters, error_);
+        if ((rc == TURTLE_RETURN_LOCK_ERROR) ||
+            (rc == TURTLE_RETURN_UNLOCK_ERROR)) {
+                *elevation = 0.;
+                return TURTLE_ERROR_RAISE();
+        } else if ((rc != TURTLE_RETURN_SUCCESS) || (current == NULL)) {
                 /* The requested map is not available. Let's record this */
-                client_release(client, 0, error_);
+                client->counters.missing++;
+                client_push(client, NULL, 0, error_);
                 client->index_la = (int)latitude;
                 client->index_lo = (int)longitude;
                 goto unlock;
+        } else if (current == client->map) {
+                /* The location is not covered by the current map */
+                goto unlock;
         }
-        current = stack->tiles.head;
         hx = (longitude - current->meta.x0) / current->meta.dx;
         hy = (latitude - current->meta.y0) / current->meta.dy;
 
-/* Update the client */
+/* Update the client, pinning the previous map */
 update:
-        if (client_release(client, 0, error_) != TURTLE_RETURN_SUCCESS)
-                goto unlock;
-        current->clients++;
-        client->map = current;
-        client->index_la = INT_MIN;
-        client->index_lo = INT_MIN;
+        k = client_find(client, current);
+        if (k >= 0) {
+                client_promote(client, k);
+        } else {
+                if (client_push(client, current, 0, error_) !=
+                    TURTLE_RETURN_SUCCESS)
+                        goto unlock;
+                TURTLE_ATOMIC_ADD(&current->clients, 1);
+        }
 
 /* Unlock the stack */
 unlock:
-        if ((stack->unlock != NULL) && (stack->unlock() != 0))
-                return TURTLE_ERROR_UNLOCK();
+        if (turtle_stack_unlock_(stack) != 0) return TURTLE_ERROR_UNLOCK();
         if ((error_->code != TURTLE_RETURN_SUCCESS) ||
             ((inside != NULL) && (*inside == 0))) {
                 *elevation = 0.;
@@ -183,41 +312,425 @@ unlock:
 
 /* Interpolate the elevation */
 interpolate:
-        return turtle_map_elevation_(
-            client->map, longitude, latitude, elevation, inside, error_);
+        if (gradient == NULL) {
+                return turtle_map_elevation_(client->map, longitude, latitude,
+                    elevation, inside, error_);
+        } else {
+                return turtle_map_elevation_gradient_(client->map, longitude,
+                    latitude, elevation, gradient + 1, gradient, inside,
+                    error_);
+        }
+}
+
+enum turtle_return turtle_client_elevation(struct turtle_client * client,
+    double latitude, double longitude, double * elevation, int * inside)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_client_elevation);
+        return client_elevation(
+            client, latitude, longitude, elevation, NULL, inside, error_);
 }
 
-/* Release any active map */
+/* Supervised access to the gradient */
+enum turtle_return turtle_client_gradient(struct turtle_client * client,
+    double latitude, double longitude, double * glat, double * glon,
+    int * inside)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_client_gradient);
+        double elevation, gradient[2];
+        const enum turtle_return rc = client_elevation(client, latitude,
+            longitude, &elevation, gradient, inside, error_);
+        *glat = gradient[0];
+        *glon = gradient[1];
+        return rc;
+}
+
+/* Supervised access to the elevation and to the gradient */
+enum turtle_return turtle_client_elevation_gradient(
+    struct turtle_client * client, double latitude, double longitude,
+    double * elevation, double * glat, double * glon, int * inside)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_client_elevation_gradient);
+        double gradient[2];
+        const enum turtle_return rc = client_elevation(client, latitude,
+            longitude, elevation, gradient, inside, error_);
+        *glat = gradient[0];
+        *glon = gradient[1];
+        return rc;
+}
+
+/* Supervised access to the elevation data over arrays of coordinates */
+enum turtle_return turtle_client_elevation_v(struct turtle_client * client,
+    int n, const double * latitude, const double * longitude,
+    double * elevation, int * inside)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_client_elevation_v);
+
+        int i = 0;
+        while (i < n) {
+                /* Locate the proper map, loading it if needed */
+                if (client_elevation(client, latitude[i], longitude[i],
+                        elevation + i, NULL,
+                        (inside != NULL) ? inside + i : NULL,
+                        error_) != TURTLE_RETURN_SUCCESS)
+                        return error_->code;
+                i++;
+                if (client->map == NULL) continue;
+
+                /* Process the following locations within the same map. The
+                 * map is reserved by the client, thus no lock is needed
+                 */
+                const int m = turtle_map_run_(
+                    client->map, n - i, longitude + i, latitude + i);
+                if (m == 0) continue;
+                turtle_map_elevation_v_(client->map, m, longitude + i,
+                    latitude + i, elevation + i,
+                    (inside != NULL) ? inside + i : NULL, error_);
+                i += m;
+        }
+
+        return TURTLE_RETURN_SUCCESS;
+}
+
+/* Release all the pinned maps */
 static enum turtle_return client_release(struct turtle_client * client,
     int lock, struct turtle_error_context * error_)
 {
-        if (client->map == NULL) return TURTLE_RETURN_SUCCESS;
+        while (client->set_n > 0) {
+                struct turtle_map ** last = client->set + client->set_n - 1;
+                const enum turtle_return rc =
+                    client_unpin(client, last, lock, error_);
+                if (*last == NULL) client->set_n--;
+                if (rc != TURTLE_RETURN_SUCCESS) return rc;
+        }
+        return client_unpin(client, &client->map, lock, error_);
+}
+
+/* Make a map the current one, keeping the previous one pinned. If the
+ * working set is full, its least recently used map is released. The map
+ * must have been reserved by the caller
+ */
+static enum turtle_return client_push(struct turtle_client * client,
+    struct turtle_map * map, int lock, struct turtle_error_context * error_)
+{
+        if (client->map != NULL) {
+                if ((client->set_n > 0) &&
+                    (client->set_n == client->tiles - 1)) {
+                        struct turtle_map ** last =
+                            client->set + client->set_n - 1;
+                        const enum turtle_return rc =
+                            client_unpin(client, last, lock, error_);
+                        if (*last == NULL) client->set_n--;
+                        if (rc != TURTLE_RETURN_SUCCESS) return rc;
+                }
+                if (client->set_n < client->tiles - 1) {
+                        memmove(client->set + 1, client->set,
+                            client->set_n * sizeof(*client->set));
+                        client->set[0] = client->map;
+                        client->set_n++;
+                } else if (client_unpin(client, &client->map, lock, error_) !=
+                    TURTLE_RETURN_SUCCESS) {
+                        return error_->code;
+                }
+        }
+        client->map = map;
+        client->index_la = INT_MIN;
+        client->index_lo = INT_MIN;
+        return TURTLE_RETURN_SUCCESS;
+}
+
+/* Make the pinned map of index *k* the current one */
+static void client_promote(struct turtle_client * client, int k)
+{
+        struct turtle_map * map = client->set[k];
+        if (client->map != NULL) {
+                memmove(client->set + 1, client->set, k * sizeof(*client->set));
+                client->set[0] = client->map;
+        } else {
+                memmove(client->set + k, client->set + k + 1,
+                    (client->set_n - k - 1) * sizeof(*client->set));
+                client->set_n--;
+        }
+        client->map = map;
+        client->index_la = INT_MIN;
+        client->index_lo = INT_MIN;
+}
+
+/* Get the index of a pinned map, or -1 if it is not pinned */
+static int client_find(
+    const struct turtle_client * client, const struct turtle_map * map)
+{
+        int k;
+        for (k = 0; k < client->set_n; k++) {
+                if (client->set[k] == map) return k;
+        }
+        return -1;
+}
+
+/* Release a pinned map, given its slot */
+static enum turtle_return client_unpin(struct turtle_client * client,
+    struct turtle_map ** slot, int lock, struct turtle_error_context * error_)
+{
+        if (*slot == NULL) return TURTLE_RETURN_SUCCESS;
 
-        /* Lock the stack */
         struct turtle_stack * stack = client->stack;
-        if (lock && (stack->lock != NULL) && (stack->lock() != 0))
+        struct turtle_map * map = *slot;
+        if (lock && turtle_stack_has_shared_lock_(stack)) {
+                /* If the stack does not overflow, the map is not removed.
+                 * Thus, a shared access is enough for updating its reference
+                 * count
+                 */
+                if (turtle_stack_lock_shared_(stack, &client->counters) != 0)
+                        return TURTLE_ERROR_REGISTER(TURTLE_RETURN_LOCK_ERROR,
+                            "could not acquire the lock");
+                const int overflow = turtle_stack_overflow_(stack);
+                if (!overflow) {
+                        *slot = NULL;
+                        if (TURTLE_ATOMIC_ADD(&map->clients, -1) < 0) {
+                                TURTLE_ATOMIC_ADD(&map->clients, 1);
+                                TURTLE_ERROR_REGISTER(
+                                    TURTLE_RETURN_LIBRARY_ERROR,
+                                    "an unexpected error occured");
+                        }
+                }
+                if (turtle_stack_unlock_shared_(stack) != 0)
+                        return TURTLE_ERROR_REGISTER(
+                            TURTLE_RETURN_UNLOCK_ERROR,
+                            "could not release the lock");
+                if (!overflow) return error_->code;
+        }
+
+        /* Lock the stack */
+        if (lock && (turtle_stack_lock_(stack, &client->counters) != 0))
                 return TURTLE_ERROR_REGISTER(
                     TURTLE_RETURN_LOCK_ERROR, "could not acquire the lock");
 
         /* Update the reference count */
-        struct turtle_map * map = client->map;
-        client->map = NULL;
-        map->clients--;
-        if (map->clients < 0) {
-                map->clients = 0;
+        *slot = NULL;
+        const int clients = TURTLE_ATOMIC_ADD(&map->clients, -1);
+        if (clients < 0) {
+                TURTLE_ATOMIC_ADD(&map->clients, 1);
                 TURTLE_ERROR_REGISTER(
                     TURTLE_RETURN_LIBRARY_ERROR, "an unexpected error occured");
                 goto unlock;
         }
 
         /* Remove the map if it is unused and if there is a stack overflow */
-        if ((map->clients == 0) && (stack->tiles.size > stack->max_size))
-                turtle_map_destroy(&map);
+        if ((clients == 0) && turtle_stack_overflow_(stack)) {
+                client->counters.evictions++;
+                turtle_stack_evict_(stack, map);
+        }
 
 /* Unlock and return */
 unlock:
-        if (lock && (stack->unlock != NULL) && (stack->unlock() != 0))
+        if (lock && (turtle_stack_unlock_(stack) != 0))
                 return TURTLE_ERROR_REGISTER(
                     TURTLE_RETURN_UNLOCK_ERROR, "could not release the lock");
         return error_->code;
 }
+
+/* A query of a batch, sorted by grid cell and by Morton code within the
+ * cell
+ */
+struct batch_query {
+        uint32_t key;
+        int index;
+};
+
+/* Shared data of a batch. Grid cells are processed concurrently, taking
+ * them in turn
+ */
+struct client_batch {
+        struct turtle_client * client;
+        const double * latitude;
+        const double * longitude;
+        double * elevation;
+        int * inside;
+        int cells;
+        int next;
+        int failed;
+        int outside;
+        int * offsets;
+        struct batch_query * queries;
+        struct turtle_stack_counters counters;
+};
+
+/* Interleave the bits of two 16 bits integers */
+static uint32_t batch_interleave(uint32_t u)
+{
+        u = (u | (u << 8)) & 0x00FF00FF;
+        u = (u | (u << 4)) & 0x0F0F0F0F;
+        u = (u | (u << 2)) & 0x33333333;
+        return (u | (u << 1)) & 0x55555555;
+}
+
+/* Get the Morton code of a location within its grid cell */
+static uint32_t batch_key(const struct turtle_stack * stack, int index,
+    double latitude, double longitude)
+{
+        if (index < 0) return 0;
+        const int ix = index % stack->longitude_n;
+        const int iy = index / stack->longitude_n;
+        double hx = (longitude - stack->longitude_0) / stack->longitude_delta -
+            ix;
+        double hy = (latitude - stack->latitude_0) / stack->latitude_delta - iy;
+        hx = (hx <= 0.) ? 0. : (hx >= 1.) ? 65535. : 65535. * hx;
+        hy = (hy <= 0.) ? 0. : (hy >= 1.) ? 65535. : 65535. * hy;
+        return batch_interleave((uint32_t)hx) |
+            (batch_interleave((uint32_t)hy) << 1);
+}
+
+static int batch_compare(const void * a, const void * b)
+{
+        const uint32_t ka = ((const struct batch_query *)a)->key;
+        const uint32_t kb = ((const struct batch_query *)b)->key;
+        return (ka > kb) - (ka < kb);
+}
+
+/* Process the cells of a batch, using the given client, until all are done
+ * or an error occurs
+ */
+static enum turtle_return batch_run(struct client_batch * batch,
+    struct turtle_client * client, struct turtle_error_context * error_)
+{
+        for (;;) {
+                if (TURTLE_ATOMIC_LOAD(&batch->failed)) break;
+                const int cell = TURTLE_ATOMIC_ADD(&batch->next, 1) - 1;
+                if (cell > batch->cells) break;
+
+                int i;
+                for (i = batch->offsets[cell]; i < batch->offsets[cell + 1];
+                     i++) {
+                        const int j = batch->queries[i].index;
+                        int inside;
+                        if (client_elevation(client, batch->latitude[j],
+                                batch->longitude[j], batch->elevation + j,
+                                NULL, &inside,
+                                error_) != TURTLE_RETURN_SUCCESS) {
+                                TURTLE_ATOMIC_STORE(
+                                    &batch->failed, error_->code);
+                                return error_->code;
+                        }
+                        if (batch->inside != NULL)
+                                batch->inside[j] = inside;
+                        else if (!inside)
+                                TURTLE_ATOMIC_STORE(&batch->outside, 1);
+                }
+        }
+        return TURTLE_RETURN_SUCCESS;
+}
+
+/* Worker thread of a batch, using a temporary client of the same stack */
+static void * batch_work(void * arg)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_client_elevation_batch);
+        struct client_batch * batch = arg;
+
+        struct turtle_client client = { .map = NULL,
+                .tiles = batch->client->tiles, .index_la = INT_MIN,
+                .index_lo = INT_MIN, .stack = batch->client->stack };
+        const enum turtle_return rc = batch_run(batch, &client, error_);
+        if ((client_release(&client, 1, error_) != TURTLE_RETURN_SUCCESS) &&
+            (rc == TURTLE_RETURN_SUCCESS)) {
+                TURTLE_ERROR_RAISE();
+                TURTLE_ATOMIC_STORE(&batch->failed, error_->code);
+        }
+
+        /* Forward the statistics to the calling client */
+        struct turtle_stack_counters * c = &batch->counters;
+        TURTLE_ATOMIC_ADD(&c->head_hits, client.counters.head_hits);
+        TURTLE_ATOMIC_ADD(&c->set_hits, client.counters.set_hits);
+        TURTLE_ATOMIC_ADD(&c->grid_hits, client.counters.grid_hits);
+        TURTLE_ATOMIC_ADD(&c->misses, client.counters.misses);
+        TURTLE_ATOMIC_ADD(&c->missing, client.counters.missing);
+        TURTLE_ATOMIC_ADD(&c->loads, client.counters.loads);
+        TURTLE_ATOMIC_ADD(&c->load_bytes, client.counters.load_bytes);
+        TURTLE_ATOMIC_ADD(&c->load_time, client.counters.load_time);
+        TURTLE_ATOMIC_ADD(&c->evictions, client.counters.evictions);
+        TURTLE_ATOMIC_ADD(&c->locks, client.counters.locks);
+        TURTLE_ATOMIC_ADD(&c->lock_time, client.counters.lock_time);
+        return NULL;
+}
+
+/* Supervised access to the elevation data for a large batch of unordered
+ * locations
+ */
+enum turtle_return turtle_client_elevation_batch(
+    struct turtle_client * client, int n, const double * latitude,
+    const double * longitude, double * elevation, int * inside, int threads)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_client_elevation_batch);
+        if (n <= 0) return TURTLE_RETURN_SUCCESS;
+
+        /* Bucket the queries by grid cell, locations outside of the grid
+         * coming last
+         */
+        struct turtle_stack * stack = client->stack;
+        const int cells = stack->latitude_n * stack->longitude_n;
+        struct client_batch batch = { .client = client, .latitude = latitude,
+                .longitude = longitude, .elevation = elevation,
+                .inside = inside, .cells = cells };
+        batch.offsets = calloc(cells + 2, sizeof(*batch.offsets));
+        batch.queries = malloc(n * sizeof(*batch.queries));
+        if ((batch.offsets == NULL) || (batch.queries == NULL)) {
+                free(batch.offsets);
+                free(batch.queries);
+                return TURTLE_ERROR_MEMORY();
+        }
+        int i;
+        for (i = 0; i < n; i++) {
+                const int index =
+                    turtle_stack_index_(stack, latitude[i], longitude[i]);
+                batch.offsets[((index < 0) ? cells : index) + 1]++;
+        }
+        for (i = 0; i <= cells; i++) batch.offsets[i + 1] += batch.offsets[i];
+        for (i = 0; i < n; i++) {
+                const int index =
+                    turtle_stack_index_(stack, latitude[i], longitude[i]);
+                const int cell = (index < 0) ? cells : index;
+                struct batch_query * query =
+                    batch.queries + batch.offsets[cell]++;
+                query->key = batch_key(stack, index, latitude[i], longitude[i]);
+                query->index = i;
+        }
+        for (i = cells; i > 0; i--) batch.offsets[i] = batch.offsets[i - 1];
+        batch.offsets[0] = 0;
+
+        /* Sort the queries of each cell along a Morton curve */
+        for (i = 0; i < cells; i++) {
+                const int m = batch.offsets[i + 1] - batch.offsets[i];
+                if (m > 1)
+                        qsort(batch.queries + batch.offsets[i], m,
+                            sizeof(*batch.queries), &batch_compare);
+        }
+
+        /* Process the cells. The calling thread takes part in the work,
+         * with its own client
+         */
+        struct turtle_parallel parallel;
+        turtle_parallel_start_(&parallel, threads, &batch_work, &batch);
+        const enum turtle_return rc = batch_run(&batch, client, error_);
+        turtle_parallel_join_(&parallel);
+        struct turtle_stack_counters * c = &client->counters;
+        c->head_hits += batch.counters.head_hits;
+        c->set_hits += batch.counters.set_hits;
+        c->grid_hits += batch.counters.grid_hits;
+        c->misses += batch.counters.misses;
+        c->missing += batch.counters.missing;
+        c->loads += batch.counters.loads;
+        c->load_bytes += batch.counters.load_bytes;
+        c->load_time += batch.counters.load_time;
+        c->evictions += batch.counters.evictions;
+        c->locks += batch.counters.locks;
+        c->lock_time += batch.counters.lock_time;
+        free(batch.offsets);
+        free(batch.queries);
+
+        /* Errors of the worker threads have already been raised */
+        if (rc != TURTLE_RETURN_SUCCESS)
+                return rc;
+        else if (batch.failed)
+                return batch.failed;
+        else if (batch.outside)
+                return TURTLE_ERROR_MISSING_DATA(stack);
+        return TURTLE_RETURN_SUCCESS;
+}
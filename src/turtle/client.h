@@ -27,17 +27,31 @@
 
 #include "turtle.h"
 #include "turtle/map.h"
+#include "turtle/stack.h"
+
+/* Maximum number of tiles pinned by a client, including the current one */
+#define TURTLE_CLIENT_TILES 16
 
 /* Container for a stack client */
 struct turtle_client {
         /* The currently used map */
         struct turtle_map * map;
 
+        /* Other pinned maps, from the most to the least recently used. They
+         * are checked before the stack, without locking it
+         */
+        struct turtle_map * set[TURTLE_CLIENT_TILES - 1];
+        int set_n;
+        int tiles; /* Capacity of the working set, including the current map */
+
         /* The last requested indices */
         int index_la, index_lo;
 
         /* The master stack */
         struct turtle_stack * stack;
+
+        /* Runtime statistics of this client */
+        struct turtle_stack_counters counters;
 };
 
 struct turtle_error_context;
@@ -129,6 +129,80 @@ void turtle_ecef_to_geodetic(const double ecef[3], double * latitude,
         if (altitude != NULL) *altitude = f + 0.5 * m * p;
 }
 
+/* Compute ECEF coordinates from arrays of geodetic ones */
+void turtle_ecef_from_geodetic_v(int n, const double * latitude,
+    const double * longitude, const double * elevation, double * ecef)
+{
+        const double a = WGS84_A, e2 = WGS84_E * WGS84_E;
+        const double deg = M_PI / 180.;
+
+        int i;
+        for (i = 0; i < n; i++) {
+                const double s = sin(latitude[i] * deg);
+                const double c = cos(latitude[i] * deg);
+                const double R = a / sqrt(1. - e2 * s * s);
+                const double h = elevation[i];
+
+                ecef[3 * i] = (R + h) * c * cos(longitude[i] * deg);
+                ecef[3 * i + 1] = (R + h) * c * sin(longitude[i] * deg);
+                ecef[3 * i + 2] = (R * (1. - e2) + h) * s;
+        }
+}
+
+/* Compute geodetic coordinates from an array of ECEF ones
+ *
+ * A single step of Bowring's algorithm is used, with all trigonometric
+ * functions of the parametric latitude expressed algebraically. The loop body
+ * has no branches, except for conditional selects, such that it vectorizes.
+ *
+ * Reference: Bowring, B. R. (1976). "Transformation from spatial to
+ * geographical coordinates," Survey Review, Vol. 23, No. 181, pp. 323-327
+ */
+void turtle_ecef_to_geodetic_v(int n, const double * ecef, double * latitude,
+    double * longitude, double * altitude)
+{
+        const double a = WGS84_A, b = WGS84_B;
+        const double e2 = WGS84_E * WGS84_E;
+        const double ep2 = e2 / (1. - e2);
+        const double rad = 180. / M_PI;
+
+        int i;
+        if (longitude != NULL) {
+                for (i = 0; i < n; i++) {
+                        const double x = ecef[3 * i], y = ecef[3 * i + 1];
+                        longitude[i] = ((x == 0.) && (y == 0.)) ?
+                            0. : atan2(y, x) * rad;
+                }
+        }
+        if ((latitude == NULL) && (altitude == NULL)) return;
+
+        for (i = 0; i < n; i++) {
+                const double x = ecef[3 * i], y = ecef[3 * i + 1];
+                const double z = ecef[3 * i + 2];
+                const double w = sqrt(x * x + y * y);
+
+                /* Parametric latitude */
+                const double t = z * a;
+                const double q = w * b;
+                const double h = sqrt(t * t + q * q);
+                const double st = (h > 0.) ? t / h : 1.;
+                const double ct = (h > 0.) ? q / h : 0.;
+
+                /* Geodetic latitude */
+                const double ny = z + ep2 * b * st * st * st;
+                const double nx = w - e2 * a * ct * ct * ct;
+                const double r = sqrt(nx * nx + ny * ny);
+                const double sp = (r > 0.) ? ny / r : 1.;
+                const double cp = (r > 0.) ? nx / r : 0.;
+
+                if (latitude != NULL) latitude[i] = atan2(ny, nx) * rad;
+                if (altitude != NULL) {
+                        altitude[i] =
+                            w * cp + z * sp - a * sqrt(1. - e2 * sp * sp);
+                }
+        }
+}
+
 /* Compute the local East, North, Up (ENU) basis vectors
  *
  * Reference: https://en.wikipedia.org/wiki/Horizontal_coordinate_system
@@ -205,3 +279,28 @@ void turtle_ecef_to_horizontal(double latitude, double longitude,
                 }
         }
 }
+
+/* Compute ECEF directions from arrays of horizontal angles */
+void turtle_ecef_from_horizontal_v(int n, const double * latitude,
+    const double * longitude, const double * azimuth,
+    const double * elevation, double * direction)
+{
+        int i;
+        for (i = 0; i < n; i++) {
+                turtle_ecef_from_horizontal(latitude[i], longitude[i],
+                    azimuth[i], elevation[i], direction + 3 * i);
+        }
+}
+
+/* Compute horizontal angles from an array of ECEF directions */
+void turtle_ecef_to_horizontal_v(int n, const double * latitude,
+    const double * longitude, const double * direction, double * azimuth,
+    double * elevation)
+{
+        int i;
+        for (i = 0; i < n; i++) {
+                turtle_ecef_to_horizontal(latitude[i], longitude[i],
+                    direction + 3 * i, (azimuth != NULL) ? azimuth + i : NULL,
+                    (elevation != NULL) ? elevation + i : NULL);
+        }
+}
@@ -23,6 +23,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef TURTLE_NO_PTHREAD
+/* POSIX threads */
+#include <pthread.h>
+#endif
 
 /* Default handler for TURTLE library errors */
 static void handle_error(
@@ -35,6 +39,56 @@ static void handle_error(
 /* The library user supplied error handler */
 static turtle_error_handler_t * _handler = &handle_error;
 
+/* Error handler of a thread, overriding the library one if active */
+struct thread_handler {
+        int active;
+        turtle_error_handler_t * handler;
+};
+
+#ifndef TURTLE_NO_PTHREAD
+/* Thread specific handlers, allocated on first use */
+static pthread_key_t thread_key;
+static pthread_once_t thread_once = PTHREAD_ONCE_INIT;
+
+static void thread_initialise(void)
+{
+        pthread_key_create(&thread_key, &free);
+}
+#endif
+
+/* Get the handler data of the current thread. If *create* is not null, the
+ * data are allocated if needed. Otherwise, `NULL` is returned if there are
+ * none, or if they could not be allocated
+ */
+static struct thread_handler * thread_get(int create)
+{
+#ifndef TURTLE_NO_PTHREAD
+        pthread_once(&thread_once, &thread_initialise);
+        struct thread_handler * thread = pthread_getspecific(thread_key);
+        if ((thread == NULL) && create) {
+                thread = calloc(1, sizeof(*thread));
+                if (thread == NULL) return NULL;
+                if (pthread_setspecific(thread_key, thread) != 0) {
+                        free(thread);
+                        return NULL;
+                }
+        }
+        return thread;
+#else
+        /* Without threads, there is a single one */
+        static struct thread_handler thread = { 0, NULL };
+        return &thread;
+#endif
+}
+
+/* Get the error handler in use by the current thread */
+static inline turtle_error_handler_t * current_handler(void)
+{
+        const struct thread_handler * thread = thread_get(0);
+        return ((thread != NULL) && thread->active) ? thread->handler :
+                                                       _handler;
+}
+
 /* Getter for the error handler */
 turtle_error_handler_t * turtle_error_handler_get(void) { return _handler; }
 
@@ -44,12 +98,37 @@ void turtle_error_handler_set(turtle_error_handler_t * handler)
         _handler = handler;
 }
 
+/* Getter for the error handler of the current thread */
+turtle_error_handler_t * turtle_error_thread_handler_get(void)
+{
+        return current_handler();
+}
+
+/* Setter for the error handler of the current thread */
+void turtle_error_thread_handler_set(turtle_error_handler_t * handler)
+{
+        struct thread_handler * thread = thread_get(1);
+        if (thread == NULL) return;
+        thread->active = 1;
+        thread->handler = handler;
+}
+
+/* Restore the library error handler for the current thread */
+void turtle_error_thread_handler_clear(void)
+{
+        struct thread_handler * thread = thread_get(0);
+        if (thread == NULL) return;
+        thread->active = 0;
+        thread->handler = NULL;
+}
+
 /* Utility function for setting a static error */
 enum turtle_return turtle_error_message_(struct turtle_error_context * error_,
     enum turtle_return rc, const char * file, int line, const char * message)
 {
         error_->code = rc;
-        if ((_handler == NULL) || (rc == TURTLE_RETURN_SUCCESS)) return rc;
+        if ((current_handler() == NULL) || (rc == TURTLE_RETURN_SUCCESS))
+                return rc;
         error_->file = file;
         error_->line = line;
         
@@ -69,7 +148,8 @@ enum turtle_return turtle_error_format_(struct turtle_error_context * error_,
     ...)
 {
         error_->code = rc;
-        if ((_handler == NULL) || (rc == TURTLE_RETURN_SUCCESS)) return rc;
+        if ((current_handler() == NULL) || (rc == TURTLE_RETURN_SUCCESS))
+                return rc;
         error_->file = file;
         error_->line = line;
 
@@ -107,8 +187,17 @@ enum turtle_return turtle_error_format_(struct turtle_error_context * error_,
 /* Utility function for handling an error */
 enum turtle_return turtle_error_raise_(struct turtle_error_context * error_)
 {
-        if ((_handler == NULL) || (error_->code == TURTLE_RETURN_SUCCESS))
+        turtle_error_handler_t * handler = current_handler();
+        if ((handler == NULL) || (error_->code == TURTLE_RETURN_SUCCESS)) {
+                /* Free any dynamic memory, e.g. if the handler was changed
+                 * since the error was registered
+                 */
+                if (error_->dynamic) {
+                        free(error_->message);
+                        error_->dynamic = 0;
+                }
                 return error_->code;
+        }
 
         /* Compute the total of the error message, in order to store it
          * back on the stack
@@ -132,11 +221,41 @@ enum turtle_return turtle_error_raise_(struct turtle_error_context * error_)
         }
 
         /* Call the library error handler */
-        _handler(error_->code, error_->function, message);
+        handler(error_->code, error_->function, message);
 
         return error_->code;
 }
 
+/* Utility function for discarding an error */
+void turtle_error_reset_(struct turtle_error_context * error_)
+{
+        if (error_->dynamic) {
+                free(error_->message);
+                error_->dynamic = 0;
+        }
+        error_->message = NULL;
+        error_->code = TURTLE_RETURN_SUCCESS;
+}
+
+/* Utility function for forwarding the first error of an array */
+void turtle_error_forward_(struct turtle_error_context * error_,
+    struct turtle_error_context * errors, int n)
+{
+        int i;
+        for (i = 0; i < n; i++) {
+                struct turtle_error_context * e = errors + i;
+                if ((e->code != TURTLE_RETURN_SUCCESS) &&
+                    (error_->code == TURTLE_RETURN_SUCCESS)) {
+                        error_->code = e->code;
+                        error_->file = e->file;
+                        error_->line = e->line;
+                        error_->message = e->message;
+                        error_->dynamic = e->dynamic;
+                } else if (e->dynamic)
+                        free(e->message);
+        }
+}
+
 /* Get a library function name as a string */
 const char * turtle_error_function(turtle_function_t * caller)
 {
@@ -147,51 +266,116 @@ const char * turtle_error_function(turtle_function_t * caller)
         TOSTRING(turtle_client_create);
         TOSTRING(turtle_client_destroy);
         TOSTRING(turtle_client_elevation);
+        TOSTRING(turtle_client_elevation_batch);
+        TOSTRING(turtle_client_elevation_gradient);
+        TOSTRING(turtle_client_elevation_v);
+        TOSTRING(turtle_client_gradient);
+        TOSTRING(turtle_client_stats);
+        TOSTRING(turtle_client_stats_reset);
+        TOSTRING(turtle_client_tiles_get);
+        TOSTRING(turtle_client_tiles_set);
 
         TOSTRING(turtle_ecef_from_geodetic);
+        TOSTRING(turtle_ecef_from_geodetic_v);
         TOSTRING(turtle_ecef_from_horizontal);
+        TOSTRING(turtle_ecef_from_horizontal_v);
         TOSTRING(turtle_ecef_to_geodetic);
+        TOSTRING(turtle_ecef_to_geodetic_v);
         TOSTRING(turtle_ecef_to_horizontal);
+        TOSTRING(turtle_ecef_to_horizontal_v);
 
         TOSTRING(turtle_error_function);
         TOSTRING(turtle_error_handler_get);
         TOSTRING(turtle_error_handler_set);
+        TOSTRING(turtle_error_thread_handler_clear);
+        TOSTRING(turtle_error_thread_handler_get);
+        TOSTRING(turtle_error_thread_handler_set);
 
+        TOSTRING(turtle_map_block);
         TOSTRING(turtle_map_create);
         TOSTRING(turtle_map_destroy);
         TOSTRING(turtle_map_dump);
         TOSTRING(turtle_map_elevation);
+        TOSTRING(turtle_map_elevation_gradient);
+        TOSTRING(turtle_map_elevation_v);
         TOSTRING(turtle_map_fill);
+        TOSTRING(turtle_map_gradient);
+        TOSTRING(turtle_map_intersect);
         TOSTRING(turtle_map_load);
         TOSTRING(turtle_map_meta);
         TOSTRING(turtle_map_node);
+        TOSTRING(turtle_map_normalise);
+        TOSTRING(turtle_map_open);
         TOSTRING(turtle_map_projection);
+        TOSTRING(turtle_map_reproject);
+        TOSTRING(turtle_map_write);
 
         TOSTRING(turtle_projection_configure);
         TOSTRING(turtle_projection_create);
         TOSTRING(turtle_projection_destroy);
         TOSTRING(turtle_projection_name);
         TOSTRING(turtle_projection_project);
+        TOSTRING(turtle_projection_project_v);
         TOSTRING(turtle_projection_unproject);
+        TOSTRING(turtle_projection_unproject_v);
 
+        TOSTRING(turtle_stack_block_get);
+        TOSTRING(turtle_stack_block_set);
+        TOSTRING(turtle_stack_budget_get);
+        TOSTRING(turtle_stack_budget_set);
         TOSTRING(turtle_stack_clear);
         TOSTRING(turtle_stack_create);
+        TOSTRING(turtle_stack_create_remote);
         TOSTRING(turtle_stack_destroy);
         TOSTRING(turtle_stack_elevation);
+        TOSTRING(turtle_stack_elevation_gradient);
+        TOSTRING(turtle_stack_elevation_v);
+        TOSTRING(turtle_stack_gradient);
+        TOSTRING(turtle_stack_hook_set);
+        TOSTRING(turtle_stack_index_dump);
         TOSTRING(turtle_stack_load);
+        TOSTRING(turtle_stack_lock_set);
+        TOSTRING(turtle_stack_mmap_get);
+        TOSTRING(turtle_stack_mmap_set);
+        TOSTRING(turtle_stack_normalise_get);
+        TOSTRING(turtle_stack_normalise_set);
+        TOSTRING(turtle_stack_policy_get);
+        TOSTRING(turtle_stack_policy_set);
+        TOSTRING(turtle_stack_prefetch);
+        TOSTRING(turtle_stack_prefetch_async_get);
+        TOSTRING(turtle_stack_prefetch_async_set);
+        TOSTRING(turtle_stack_preload);
+        TOSTRING(turtle_stack_shared_get);
+        TOSTRING(turtle_stack_shared_set);
+        TOSTRING(turtle_stack_shared_unlink);
+        TOSTRING(turtle_stack_stats);
+        TOSTRING(turtle_stack_stats_reset);
 
         TOSTRING(turtle_stepper_add_flat);
         TOSTRING(turtle_stepper_add_layer);
         TOSTRING(turtle_stepper_add_map);
         TOSTRING(turtle_stepper_add_stack);
+        TOSTRING(turtle_stepper_clone);
         TOSTRING(turtle_stepper_create);
         TOSTRING(turtle_stepper_destroy);
         TOSTRING(turtle_stepper_geoid_get);
         TOSTRING(turtle_stepper_geoid_set);
+        TOSTRING(turtle_stepper_pyramid_get);
+        TOSTRING(turtle_stepper_pyramid_set);
         TOSTRING(turtle_stepper_range_get);
         TOSTRING(turtle_stepper_range_set);
+        TOSTRING(turtle_stepper_refinement_get);
+        TOSTRING(turtle_stepper_refinement_set);
         TOSTRING(turtle_stepper_position);
+        TOSTRING(turtle_stepper_precision_get);
+        TOSTRING(turtle_stepper_precision_set);
+        TOSTRING(turtle_stepper_state_create);
+        TOSTRING(turtle_stepper_state_destroy);
         TOSTRING(turtle_stepper_step);
+        TOSTRING(turtle_stepper_step_n);
+        TOSTRING(turtle_stepper_step_state);
+        TOSTRING(turtle_stepper_stats);
+        TOSTRING(turtle_stepper_stats_reset);
 
         return NULL;
 #undef TOSTRING
@@ -118,4 +118,13 @@ enum turtle_return turtle_error_format_(struct turtle_error_context * error_,
 /* Generic function for handling an error */
 enum turtle_return turtle_error_raise_(struct turtle_error_context * error_);
 
+/* Discard any registered error, e.g. an expected one, without raising it */
+void turtle_error_reset_(struct turtle_error_context * error_);
+
+/* Forward the first error of an array, e.g. of worker threads, unless an
+ * error is already registered. Other errors are discarded
+ */
+void turtle_error_forward_(struct turtle_error_context * error_,
+    struct turtle_error_context * errors, int n);
+
 #endif
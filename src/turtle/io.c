@@ -23,6 +23,10 @@
 /* C89 standard library */
 #include <stdlib.h>
 #include <string.h>
+#ifndef TURTLE_NO_PTHREAD
+/* POSIX threads */
+#include <pthread.h>
+#endif
 /* TURTLE library */
 #include "turtle/io.h"
 
@@ -56,6 +60,10 @@ extern enum turtle_return turtle_io_png16_create_(
 extern enum turtle_return turtle_io_asc_create_(
     struct turtle_io ** io, struct turtle_error_context * error_);
 #endif
+#ifndef TURTLE_NO_TBC
+extern enum turtle_return turtle_io_tbc_create_(
+    struct turtle_io ** io, struct turtle_error_context * error_);
+#endif
 
 static struct io_info info[] = {
 #ifndef TURTLE_NO_TIFF
@@ -73,8 +81,19 @@ static struct io_info info[] = {
 #ifndef TURTLE_NO_ASC
         { "asc", &turtle_io_asc_create_ },
 #endif
+#ifndef TURTLE_NO_TBC
+        { "tbc", &turtle_io_tbc_create_ },
+#endif
 };
 
+#ifndef TURTLE_NO_PTHREAD
+/* Readers lazily bind their backend library on first use. Their creation is
+ * serialised, since tiles might be decoded concurrently, e.g. by
+ * `turtle_stack_preload`
+ */
+static pthread_mutex_t create_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 /* Generic io allocator, given a file name */
 enum turtle_return turtle_io_create_(struct turtle_io ** io, const char * path,
     struct turtle_error_context * error_)
@@ -92,7 +111,13 @@ enum turtle_return turtle_io_create_(struct turtle_io ** io, const char * path,
         int i;
         for (i = 0; i < n; i++) {
                 if (strcmp(info[i].extension, extension) == 0) {
+#ifndef TURTLE_NO_PTHREAD
+                        pthread_mutex_lock(&create_mutex);
+#endif
                         enum turtle_return rc = info[i].create(io, error_);
+#ifndef TURTLE_NO_PTHREAD
+                        pthread_mutex_unlock(&create_mutex);
+#endif
                         if (rc == TURTLE_RETURN_SUCCESS)
                                 strcpy((*io)->meta.encoding, extension);
                         return rc;
@@ -35,20 +35,63 @@ typedef enum turtle_return turtle_io_reader_t(struct turtle_io * io,
     struct turtle_map * map, struct turtle_error_context * error_);
 typedef enum turtle_return turtle_io_writer_t(struct turtle_io * io,
     const struct turtle_map * map, struct turtle_error_context * error_);
+typedef enum turtle_return turtle_io_streamer_t(struct turtle_io * io,
+    const struct turtle_map_meta * meta, turtle_map_source_t * source,
+    void * context, struct turtle_error_context * error_);
 
 struct turtle_io {
         /* Meta data for the map */
         struct turtle_map_meta meta;
 
+        /* Offset of the elevation data in the file, if they are stored
+         * exactly as expected in memory, i.e. such that the file can be
+         * mapped directly. A negative value indicates that the data must be
+         * read explicitly.
+         */
+        long data_offset;
+
+        /* Size of the elevation data in memory, in bytes, if they are
+         * stored in a compressed form. A null value indicates nx * ny raw
+         * 16b values.
+         */
+        size_t data_size;
+
         /* Generic io methods */
         turtle_io_opener_t * open;
         turtle_io_closer_t * close;
         turtle_io_reader_t * read;
         turtle_io_writer_t * write;
+
+        /* Writer from the rows of a user source, given the meta data of the
+         * map, or `NULL` if the format does not support streaming
+         */
+        turtle_io_streamer_t * stream;
 };
 
 /* Generic io allocator, given a file name */
 enum turtle_return turtle_io_create_(struct turtle_io ** io, const char * path,
     struct turtle_error_context * error_);
 
+/* Bulk parser for the numeric data of text grids, e.g. ASC or GRD files. The
+ * data are split in chunks which are processed concurrently, for large files
+ */
+struct turtle_io_text;
+
+/* Map the numeric data of a text file, starting at *offset*, and get the min
+ * and max of its first *n* values. If *nodata* is not `NULL`, matching values
+ * are excluded from the min and max
+ */
+enum turtle_return turtle_io_text_open_(struct turtle_io_text ** text,
+    const char * path, long offset, long n, const double * nodata,
+    double * zmin, double * zmax, struct turtle_error_context * error_);
+
+/* Convert the text values to map data, in row major order. If *flip* is not
+ * null, rows are stored from top to bottom
+ */
+void turtle_io_text_read_(
+    struct turtle_io_text * text, struct turtle_map * map, int flip);
+
+/* Release the text data */
+void turtle_io_text_close_(struct turtle_io_text ** text);
+
 #endif
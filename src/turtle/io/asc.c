@@ -23,7 +23,6 @@
  */
 
 /* C89 standard library */
-#include <float.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -39,6 +38,7 @@ struct asc_io {
         /* Internal data for the io */
         FILE * fid;
         const char * path;
+        struct turtle_io_text * text;
 };
 
 static enum turtle_return asc_open(struct turtle_io * io, const char * path,
@@ -84,29 +84,14 @@ static enum turtle_return asc_open(struct turtle_io * io, const char * path,
         io->meta.x0 += 0.5 * io->meta.dx;
         io->meta.y0 += 0.5 * io->meta.dy;
 
-        /* Check the min and max z values */
-        const long offset = ftell(asc->fid);
-        int i;
-        double zmin = DBL_MAX, zmax = -DBL_MIN;
-        for (i = 0; i < io->meta.ny; i++) {
-                int j;
-                for (j = 0; j < io->meta.nx; j++) {
-                        double d;
-                        if (fscanf(asc->fid, "%lf", &d) != 1) {
-                                io->close(io);
-                                return TURTLE_ERROR_VREGISTER(
-                                    TURTLE_RETURN_BAD_FORMAT,
-                                    "inconsistent data in file `%s'", path);
-                        }
-                        if (d == nodata)
-                                continue;
-                        else if (d < zmin)
-                                zmin = d;
-                        else if (d > zmax)
-                                zmax = d;
-                }
+        /* Parse the data and check the min and max z values */
+        double zmin, zmax;
+        if (turtle_io_text_open_(&asc->text, path, ftell(asc->fid),
+                (long)io->meta.nx * io->meta.ny, &nodata, &zmin, &zmax,
+                error_) != TURTLE_RETURN_SUCCESS) {
+                io->close(io);
+                return error_->code;
         }
-        fseek(asc->fid, offset, SEEK_SET);
         io->meta.z0 = zmin;
         io->meta.dz = (zmax - zmin) / 65535;
 
@@ -121,6 +106,7 @@ static void asc_close(struct turtle_io * io)
                 asc->fid = NULL;
                 asc->path = NULL;
         }
+        turtle_io_text_close_(&asc->text);
 }
 
 static double get_z(const struct turtle_map * map, int ix, int iy)
@@ -139,13 +125,7 @@ static enum turtle_return asc_read(struct turtle_io * io,
     struct turtle_map * map, struct turtle_error_context * error_)
 {
         struct asc_io * asc = (struct asc_io *)io;
-        int ix, iy;
-        for (iy = io->meta.ny - 1; iy >= 0; iy--) /* data in reading order */
-            for (ix = 0; ix < io->meta.nx; ix++) {
-                double d;
-                if (fscanf(asc->fid, "%lf", &d) != 1) d = 0.;
-                set_z(map, ix, iy, d);
-        }
+        turtle_io_text_read_(asc->text, map, 1); /* Rows from top to bottom */
 
         return TURTLE_RETURN_SUCCESS;
 }
@@ -165,15 +145,20 @@ enum turtle_return turtle_io_asc_create_(
         memset(asc, 0x0, sizeof(*asc));
         asc->fid = NULL;
         asc->path = NULL;
+        asc->text = NULL;
         asc->base.meta.projection.type = PROJECTION_NONE;
+        asc->base.data_offset = -1;
 
         asc->base.open = &asc_open;
         asc->base.close = &asc_close;
         asc->base.read = &asc_read;
         asc->base.write = NULL;
+        asc->base.stream = NULL;
 
         asc->base.meta.get_z = &get_z;
         asc->base.meta.set_z = &set_z;
+        asc->base.meta.layout = TURTLE_MAP_LAYOUT_LINEAR;
+        asc->base.meta.normal = TURTLE_MAP_LAYOUT_LINEAR;
 
         return TURTLE_RETURN_SUCCESS;
 }
@@ -345,14 +345,18 @@ enum turtle_return turtle_io_geotiff16_create_(
         geotiff16->tiff = NULL;
         geotiff16->path = NULL;
         geotiff16->base.meta.projection.type = PROJECTION_NONE;
+        geotiff16->base.data_offset = -1;
 
         geotiff16->base.open = &geotiff16_open;
         geotiff16->base.close = &geotiff16_close;
         geotiff16->base.read = &geotiff16_read;
         geotiff16->base.write = &geotiff16_write;
+        geotiff16->base.stream = NULL;
 
         geotiff16->base.meta.get_z = &get_z;
         geotiff16->base.meta.set_z = &set_z;
+        geotiff16->base.meta.layout = TURTLE_MAP_LAYOUT_INT16;
+        geotiff16->base.meta.normal = TURTLE_MAP_LAYOUT_INT16;
 
         return TURTLE_RETURN_SUCCESS;
 }
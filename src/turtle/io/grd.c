@@ -23,7 +23,6 @@
  */
 
 /* C89 standard library */
-#include <float.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,6 +40,7 @@ struct grd_io {
         /* Internal data for the io */
         FILE * fid;
         const char * path;
+        struct turtle_io_text * text;
 };
 
 static enum turtle_return grd_open(struct turtle_io * io, const char * path,
@@ -85,27 +85,14 @@ static enum turtle_return grd_open(struct turtle_io * io, const char * path,
         io->meta.nx = (int)round((h[3] - h[2]) / h[5]) + 1;
         io->meta.ny = (int)round((h[1] - h[0]) / h[4]) + 1;
 
-        /* Check the min and max z values */
-        const long offset = ftell(grd->fid);
-        int i;
-        double zmin = DBL_MAX, zmax = -DBL_MIN;
-        for (i = 0; i < io->meta.ny; i++) {
-                int j;
-                for (j = 0; j < io->meta.nx; j++) {
-                        double d;
-                        if (fscanf(grd->fid, "%lf", &d) != 1) {
-                                io->close(io);
-                                return TURTLE_ERROR_VREGISTER(
-                                    TURTLE_RETURN_BAD_FORMAT,
-                                    "inconsistent data in file `%s'", path);
-                        }
-                        if (d < zmin)
-                                zmin = d;
-                        else if (d > zmax)
-                                zmax = d;
-                }
+        /* Parse the data and check the min and max z values */
+        double zmin, zmax;
+        if (turtle_io_text_open_(&grd->text, path, ftell(grd->fid),
+                (long)io->meta.nx * io->meta.ny, NULL, &zmin, &zmax,
+                error_) != TURTLE_RETURN_SUCCESS) {
+                io->close(io);
+                return error_->code;
         }
-        fseek(grd->fid, offset, SEEK_SET);
         io->meta.z0 = zmin;
         io->meta.dz = (zmax - zmin) / 65535;
 
@@ -120,6 +107,7 @@ static void grd_close(struct turtle_io * io)
                 grd->fid = NULL;
                 grd->path = NULL;
         }
+        turtle_io_text_close_(&grd->text);
 }
 
 static double get_z(const struct turtle_map * map, int ix, int iy)
@@ -138,20 +126,7 @@ static enum turtle_return grd_read(struct turtle_io * io,
     struct turtle_map * map, struct turtle_error_context * error_)
 {
         struct grd_io * grd = (struct grd_io *)io;
-
-        int i = 0;
-        char buffer[128];
-        while (fgets(buffer, sizeof(buffer), grd->fid) != NULL) {
-                char *start = buffer, *end;
-                for (;; i++) {
-                        const double d = strtod(start, &end);
-                        if (start == end) break;
-                        start = end;
-                        int ix = i % io->meta.nx;
-                        int iy = i / io->meta.nx;
-                        set_z(map, ix, iy, d);
-                }
-        }
+        turtle_io_text_read_(grd->text, map, 0);
 
         return TURTLE_RETURN_SUCCESS;
 }
@@ -171,15 +146,20 @@ enum turtle_return turtle_io_grd_create_(
         memset(grd, 0x0, sizeof(*grd));
         grd->fid = NULL;
         grd->path = NULL;
+        grd->text = NULL;
         grd->base.meta.projection.type = PROJECTION_NONE;
+        grd->base.data_offset = -1;
 
         grd->base.open = &grd_open;
         grd->base.close = &grd_close;
         grd->base.read = &grd_read;
         grd->base.write = NULL;
+        grd->base.stream = NULL;
 
         grd->base.meta.get_z = &get_z;
         grd->base.meta.set_z = &set_z;
+        grd->base.meta.layout = TURTLE_MAP_LAYOUT_LINEAR;
+        grd->base.meta.normal = TURTLE_MAP_LAYOUT_LINEAR;
 
         return TURTLE_RETURN_SUCCESS;
 }
@@ -166,14 +166,20 @@ enum turtle_return turtle_io_hgt_create_(
         hgt->fid = NULL;
         hgt->path = NULL;
         hgt->base.meta.projection.type = PROJECTION_NONE;
+        /* The raw big endian data are used as is in memory. Therefore, hgt
+         * files can be memory mapped */
+        hgt->base.data_offset = 0;
 
         hgt->base.open = &hgt_open;
         hgt->base.close = &hgt_close;
         hgt->base.read = &hgt_read;
         hgt->base.write = NULL;
+        hgt->base.stream = NULL;
 
         hgt->base.meta.get_z = &get_z;
         hgt->base.meta.set_z = &set_z;
+        hgt->base.meta.layout = TURTLE_MAP_LAYOUT_RAW;
+        hgt->base.meta.normal = TURTLE_MAP_LAYOUT_INT16;
 
         return TURTLE_RETURN_SUCCESS;
 }
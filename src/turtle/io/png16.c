@@ -566,14 +566,18 @@ enum turtle_return turtle_io_png16_create_(
         png16->png_ptr = NULL;
         png16->info_ptr = NULL;
         png16->base.meta.projection.type = PROJECTION_NONE;
+        png16->base.data_offset = -1;
 
         png16->base.open = &png16_open;
         png16->base.close = &png16_close;
         png16->base.read = &png16_read;
         png16->base.write = &png16_write;
+        png16->base.stream = NULL;
 
         png16->base.meta.get_z = &get_z;
         png16->base.meta.set_z = &set_z;
+        png16->base.meta.layout = TURTLE_MAP_LAYOUT_RAW;
+        png16->base.meta.normal = TURTLE_MAP_LAYOUT_LINEAR;
 
         return TURTLE_RETURN_SUCCESS;
 }
@@ -0,0 +1,818 @@
+/*
+ * Copyright (C) 2017 Université Clermont Auvergne, CNRS/IN2P3, LPC
+ * Author: Valentin NIESS (niess@in2p3.fr)
+ *
+ * Topographic Utilities for tRansporting parTicules over Long rangEs (TURTLE)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/*
+ * I/O's for the TURTLE block compressed format (tbc), providing a read/write
+ * for 16b data
+ *
+ * The elevation data are split in blocks of TBC_BLOCK x TBC_BLOCK nodes,
+ * which are compressed independently. Nodes are predicted from their left,
+ * lower and lower left neighbours, and the residuals are Rice coded with a
+ * parameter adapted to each row. The predictor is selected per block, among
+ * the MED one, which preserves edges, and the planar one, a + b - c, which
+ * is better suited to smooth relief. All integers are stored in little
+ * endian. The file layout is:
+ *
+ *   magic "TBC", version (8b), block size (16b), projection length (16b),
+ *   nx, ny (32b), x0, y0, z0, dx, dy, dz (64b floats), payload size (32b),
+ *   projection name, padding to 8 bytes, payload.
+ *
+ * The payload starts with the offsets of the blocks streams, w.r.t. the
+ * payload start, followed by the streams. It is kept as is in memory, and
+ * blocks are decompressed on access to a per thread cache.
+ *
+ * Offsets and the payload size are stored over 32b (version 1), or over 64b
+ * (version 2) for maps whose payload might exceed 4 GB. Files are written by
+ * bands of blocks, such that the full grid is never held in memory.
+ */
+
+/* C89 standard library */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef TURTLE_NO_PTHREAD
+/* POSIX threads */
+#include <pthread.h>
+#endif
+/* TURTLE library */
+#include "turtle/io.h"
+
+/* Geometry of compressed blocks */
+#define TBC_BLOCK 64
+#define TBC_HEADER_SIZE 72
+#define TBC_VERSION 1
+#define TBC_VERSION_WIDE 2
+
+/* Upper bound on the size of a compressed block, in bytes */
+#define TBC_BLOCK_BOUND                                                        \
+        ((TBC_PBITS +                                                          \
+             TBC_BLOCK * (TBC_KBITS + (TBC_ESCAPE + 16) * TBC_BLOCK) + 7) / 8)
+
+/* Number of decompressed blocks cached per thread, i.e. 2 x 4 blocks for two
+ * maps, such that neighbouring blocks never collide
+ */
+#define TBC_CACHE_SIZE 16
+
+/* Maximum quotient before escaping a Rice code, and number of bits for the
+ * row parameter
+ */
+#define TBC_ESCAPE 16
+#define TBC_KBITS 4
+
+/* Block predictors, and number of bits for their index */
+#define TBC_PREDICTOR_MED 0
+#define TBC_PREDICTOR_PLANAR 1
+#define TBC_PREDICTORS 2
+#define TBC_PBITS 1
+
+/* Data for accessing a tbc file */
+struct tbc_io {
+        /* Base io object */
+        struct turtle_io base;
+
+        /* Internal data for the io */
+        FILE * fid;
+        const char * path;
+};
+
+/* Cache of decompressed blocks */
+struct tbc_cache {
+        struct {
+                unsigned long serial;
+                int block;
+                uint16_t data[TBC_BLOCK * TBC_BLOCK];
+        } entry[TBC_CACHE_SIZE];
+};
+
+/* Little endian serialisation */
+static void put_uint(unsigned char * p, uint64_t value, int n)
+{
+        int i;
+        for (i = 0; i < n; i++, value >>= 8) p[i] = value & 0xFF;
+}
+
+static uint64_t get_uint(const unsigned char * p, int n)
+{
+        uint64_t value = 0;
+        int i;
+        for (i = n - 1; i >= 0; i--) value = (value << 8) | p[i];
+        return value;
+}
+
+static void put_double(unsigned char * p, double value)
+{
+        uint64_t u;
+        memcpy(&u, &value, sizeof(u));
+        put_uint(p, u, 8);
+}
+
+static double get_double(const unsigned char * p)
+{
+        const uint64_t u = get_uint(p, 8);
+        double value;
+        memcpy(&value, &u, sizeof(value));
+        return value;
+}
+
+/* Predict a node, given its left (a), lower (b) and lower left (c)
+ * neighbours
+ */
+static inline int tbc_predict(int predictor, int a, int b, int c)
+{
+        if (predictor == TBC_PREDICTOR_PLANAR) return a + b - c;
+
+        const int lo = (a < b) ? a : b;
+        const int hi = (a < b) ? b : a;
+        if (c >= hi)
+                return lo;
+        else if (c <= lo)
+                return hi;
+        else
+                return a + b - c;
+}
+
+/* Count the low order null bits of a non null word */
+static inline int tbc_ctz(uint64_t word)
+{
+#ifdef __GNUC__
+        return __builtin_ctzll(word);
+#else
+        int n = 0;
+        for (; !(word & 1); word >>= 1) n++;
+        return n;
+#endif
+}
+
+/* Decompress a block. The stream is bounded by *end*, beyond which null bits
+ * are read, such that corrupted data cannot overflow
+ */
+static void tbc_decode(const unsigned char * p, const unsigned char * end,
+    int width, int height, uint16_t * data)
+{
+        uint64_t acc = 0;
+        int bits = 0;
+#define REFILL                                                                 \
+        while (bits <= 56) {                                                   \
+                if (p < end) acc |= (uint64_t)(*p++) << bits;                  \
+                bits += 8;                                                     \
+        }
+
+        REFILL
+        const int predictor = acc & ((1 << TBC_PBITS) - 1);
+        acc >>= TBC_PBITS;
+        bits -= TBC_PBITS;
+
+        int iy;
+        for (iy = 0; iy < height; iy++) {
+                REFILL
+                const int k = acc & ((1 << TBC_KBITS) - 1);
+                acc >>= TBC_KBITS;
+                bits -= TBC_KBITS;
+
+                uint16_t * row = data + iy * TBC_BLOCK;
+                const uint16_t * below = row - TBC_BLOCK;
+                int ix;
+                for (ix = 0; ix < width; ix++) {
+                        REFILL
+                        unsigned int u;
+                        const int q = (acc == 0) ? TBC_ESCAPE :
+                                                   tbc_ctz(acc);
+                        if (q >= TBC_ESCAPE) {
+                                acc >>= TBC_ESCAPE;
+                                u = acc & 0xFFFF;
+                                acc >>= 16;
+                                bits -= TBC_ESCAPE + 16;
+                        } else {
+                                acc >>= q + 1;
+                                u = (q << k) | (acc & ((1U << k) - 1));
+                                acc >>= k;
+                                bits -= q + 1 + k;
+                        }
+
+                        int predicted;
+                        if (iy == 0)
+                                predicted = (ix == 0) ? 0 : row[ix - 1];
+                        else if (ix == 0)
+                                predicted = below[0];
+                        else
+                                predicted = tbc_predict(predictor,
+                                    row[ix - 1], below[ix], below[ix - 1]);
+                        const int d = (int)(u >> 1) ^ -(int)(u & 1);
+                        row[ix] = (uint16_t)(predicted + d);
+                }
+        }
+#undef REFILL
+}
+
+/* Decompress the block of index *block* of a map, given the size of its
+ * offsets
+ */
+static void tbc_block(
+    const struct turtle_map * map, int block, int bytes, uint16_t * data)
+{
+        const int nbx = (map->meta.nx + TBC_BLOCK - 1) / TBC_BLOCK;
+        const int nby = (map->meta.ny + TBC_BLOCK - 1) / TBC_BLOCK;
+        const int bx = block % nbx, by = block / nbx;
+        int width = map->meta.nx - bx * TBC_BLOCK;
+        if (width > TBC_BLOCK) width = TBC_BLOCK;
+        int height = map->meta.ny - by * TBC_BLOCK;
+        if (height > TBC_BLOCK) height = TBC_BLOCK;
+
+        /* Locate the stream, using the payload size as bound */
+        const unsigned char * payload = (const unsigned char *)map->data;
+        const uint64_t size = map->data_size;
+        const uint64_t table = bytes * ((uint64_t)nbx * nby + 1);
+        uint64_t start = get_uint(payload + (size_t)bytes * block, bytes);
+        uint64_t stop =
+            get_uint(payload + (size_t)bytes * (block + 1), bytes);
+        if (stop > size) stop = size;
+        if ((start < table) || (start > stop)) start = stop;
+        tbc_decode(payload + start, payload + stop, width, height, data);
+}
+
+#ifndef TURTLE_NO_PTHREAD
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+static void cache_initialise(void)
+{
+        pthread_key_create(&cache_key, &free);
+}
+#endif
+
+/* Get the block cache of the calling thread, or `NULL` if out of memory */
+static struct tbc_cache * cache_get(void)
+{
+#ifndef TURTLE_NO_PTHREAD
+        pthread_once(&cache_once, &cache_initialise);
+        struct tbc_cache * cache = pthread_getspecific(cache_key);
+        if (cache == NULL) {
+                cache = calloc(1, sizeof(*cache));
+                if (cache == NULL) return NULL;
+                if (pthread_setspecific(cache_key, cache) != 0) {
+                        free(cache);
+                        return NULL;
+                }
+        }
+        return cache;
+#else
+        static struct tbc_cache cache;
+        return &cache;
+#endif
+}
+
+static inline double tbc_get_z(
+    const struct turtle_map * map, int ix, int iy, int bytes)
+{
+        const int bx = ix / TBC_BLOCK, by = iy / TBC_BLOCK;
+        const int nbx = (map->meta.nx + TBC_BLOCK - 1) / TBC_BLOCK;
+        const int block = by * nbx + bx;
+        const int offset = (iy % TBC_BLOCK) * TBC_BLOCK + ix % TBC_BLOCK;
+
+        struct tbc_cache * cache = cache_get();
+        if (cache == NULL) {
+                /* Decompress without caching */
+                uint16_t data[TBC_BLOCK * TBC_BLOCK];
+                tbc_block(map, block, bytes, data);
+                return map->meta.z0 + data[offset] * map->meta.dz;
+        }
+
+        const int slot = (bx & 3) | ((by & 1) << 2) | ((map->serial & 1) << 3);
+        if ((cache->entry[slot].serial != map->serial) ||
+            (cache->entry[slot].block != block)) {
+                tbc_block(map, block, bytes, cache->entry[slot].data);
+                cache->entry[slot].serial = map->serial;
+                cache->entry[slot].block = block;
+        }
+        return map->meta.z0 + cache->entry[slot].data[offset] * map->meta.dz;
+}
+
+/* Data getters for 32b and 64b offsets */
+static double get_z(const struct turtle_map * map, int ix, int iy)
+{
+        return tbc_get_z(map, ix, iy, 4);
+}
+
+static double get_z_wide(const struct turtle_map * map, int ix, int iy)
+{
+        return tbc_get_z(map, ix, iy, 8);
+}
+
+static enum turtle_return tbc_open(struct turtle_io * io, const char * path,
+    const char * mode, struct turtle_error_context * error_)
+{
+        struct tbc_io * tbc = (struct tbc_io *)io;
+        if (tbc->fid != NULL) io->close(io);
+
+        /* Open the file */
+        tbc->fid = fopen(path, mode);
+        if (tbc->fid == NULL) {
+                return TURTLE_ERROR_VREGISTER(
+                    TURTLE_RETURN_PATH_ERROR, "could not open file `%s'", path);
+        }
+        tbc->path = path;
+        if (mode[0] != 'r') return TURTLE_RETURN_SUCCESS;
+
+        /* Initialise the meta data */
+        io->meta.nx = io->meta.ny = 0;
+        io->meta.x0 = io->meta.y0 = io->meta.z0 = 0.;
+        io->meta.dx = io->meta.dy = io->meta.dz = 0.;
+        io->meta.projection.type = PROJECTION_NONE;
+
+        /* Parse the header */
+        unsigned char header[TBC_HEADER_SIZE];
+        if ((fread(header, 1, TBC_HEADER_SIZE, tbc->fid) != TBC_HEADER_SIZE) ||
+            (strncmp((const char *)header, "TBC", 3) != 0) ||
+            (header[3] < TBC_VERSION) || (header[3] > TBC_VERSION_WIDE) ||
+            (get_uint(header + 4, 2) != TBC_BLOCK)) {
+                TURTLE_ERROR_VREGISTER(TURTLE_RETURN_BAD_FORMAT,
+                    "invalid header for tbc file `%s'", path);
+                goto error;
+        }
+        const int length = get_uint(header + 6, 2);
+        io->meta.nx = get_uint(header + 8, 4);
+        io->meta.ny = get_uint(header + 12, 4);
+        io->meta.x0 = get_double(header + 16);
+        io->meta.y0 = get_double(header + 24);
+        io->meta.z0 = get_double(header + 32);
+        io->meta.dx = get_double(header + 40);
+        io->meta.dy = get_double(header + 48);
+        io->meta.dz = get_double(header + 56);
+        const int version = header[3];
+        const int bytes = (version == TBC_VERSION) ? 4 : 8;
+        io->data_size = get_uint(header + 64, bytes);
+        io->meta.get_z = (bytes == 4) ? &get_z : &get_z_wide;
+
+        const uint64_t n_blocks =
+            (uint64_t)((io->meta.nx + TBC_BLOCK - 1) / TBC_BLOCK) *
+            ((io->meta.ny + TBC_BLOCK - 1) / TBC_BLOCK);
+        if ((io->meta.nx <= 0) || (io->meta.ny <= 0) ||
+            (io->data_size < bytes * (n_blocks + 1))) {
+                TURTLE_ERROR_VREGISTER(TURTLE_RETURN_BAD_FORMAT,
+                    "invalid header for tbc file `%s'", path);
+                goto error;
+        }
+
+        /* Parse the projection */
+        if (length > 0) {
+                char * name = malloc(length + 1);
+                if (name == NULL) {
+                        TURTLE_ERROR_REGISTER(TURTLE_RETURN_MEMORY_ERROR,
+                            "could not allocate memory for tbc projection");
+                        goto error;
+                }
+                if (fread(name, 1, length, tbc->fid) != length) {
+                        free(name);
+                        TURTLE_ERROR_VREGISTER(TURTLE_RETURN_BAD_FORMAT,
+                            "invalid projection for tbc file `%s'", path);
+                        goto error;
+                }
+                name[length] = '\0';
+                turtle_projection_configure_(
+                    &io->meta.projection, name, error_);
+                free(name);
+                if (error_->code != TURTLE_RETURN_SUCCESS) goto error;
+        }
+
+        /* Locate the payload, which is aligned on 8 bytes */
+        io->data_offset = (TBC_HEADER_SIZE + length + 7) & ~7L;
+        if (fseek(tbc->fid, io->data_offset, SEEK_SET) != 0) {
+                TURTLE_ERROR_VREGISTER(TURTLE_RETURN_BAD_FORMAT,
+                    "missing data in tbc file `%s'", path);
+                goto error;
+        }
+
+        return TURTLE_RETURN_SUCCESS;
+error:
+        /* Close and return if an error occurred */
+        io->close(io);
+        return error_->code;
+}
+
+static void tbc_close(struct turtle_io * io)
+{
+        struct tbc_io * tbc = (struct tbc_io *)io;
+        if (tbc->fid != NULL) {
+                fclose(tbc->fid);
+                tbc->fid = NULL;
+                tbc->path = NULL;
+        }
+}
+
+static enum turtle_return tbc_read(struct turtle_io * io,
+    struct turtle_map * map, struct turtle_error_context * error_)
+{
+        struct tbc_io * tbc = (struct tbc_io *)io;
+
+        /* Load the compressed payload as is */
+        if (fread(map->data, 1, io->data_size, tbc->fid) != io->data_size) {
+                return TURTLE_ERROR_VREGISTER(TURTLE_RETURN_BAD_FORMAT,
+                    "missing data when reading file `%s'", tbc->path);
+        }
+        return TURTLE_RETURN_SUCCESS;
+}
+
+/* Buffer for writing bit streams */
+struct tbc_stream {
+        unsigned char * data;
+        size_t size;
+        size_t capacity;
+        uint64_t acc;
+        int bits;
+};
+
+static int stream_put(struct tbc_stream * stream, uint64_t value, int n)
+{
+        stream->acc |= value << stream->bits;
+        stream->bits += n;
+        while (stream->bits >= 8) {
+                if (stream->size == stream->capacity) {
+                        const size_t capacity = (stream->capacity == 0) ?
+                            65536 : 2 * stream->capacity;
+                        unsigned char * tmp = realloc(stream->data, capacity);
+                        if (tmp == NULL) return EXIT_FAILURE;
+                        stream->data = tmp;
+                        stream->capacity = capacity;
+                }
+                stream->data[stream->size++] = stream->acc & 0xFF;
+                stream->acc >>= 8;
+                stream->bits -= 8;
+        }
+        return EXIT_SUCCESS;
+}
+
+static int stream_flush(struct tbc_stream * stream)
+{
+        return (stream->bits > 0) ? stream_put(stream, 0, 8 - stream->bits) :
+                                    EXIT_SUCCESS;
+}
+
+/* Compute the residuals of a block row, mapped to unsigned integers */
+static void tbc_residuals(int predictor, int width, int iy,
+    const uint16_t * data, uint16_t * u)
+{
+        const uint16_t * row = data + iy * TBC_BLOCK;
+        const uint16_t * below = row - TBC_BLOCK;
+        int ix;
+        for (ix = 0; ix < width; ix++) {
+                int predicted;
+                if (iy == 0)
+                        predicted = (ix == 0) ? 0 : row[ix - 1];
+                else if (ix == 0)
+                        predicted = below[0];
+                else
+                        predicted = tbc_predict(predictor, row[ix - 1],
+                            below[ix], below[ix - 1]);
+                const uint16_t d = row[ix] - predicted;
+                u[ix] = (uint16_t)(d << 1) ^ ((d & 0x8000) ? 0xFFFF : 0x0);
+        }
+}
+
+/* Select the Rice parameter with the least cost for a row of residuals */
+static int tbc_parameter(int width, const uint16_t * u, long * cost_min)
+{
+        int k, best = 0;
+        *cost_min = -1;
+        for (k = 0; k < (1 << TBC_KBITS); k++) {
+                long cost = TBC_KBITS;
+                int ix;
+                for (ix = 0; ix < width; ix++) {
+                        const int q = u[ix] >> k;
+                        cost += (q < TBC_ESCAPE) ? q + 1 + k : TBC_ESCAPE + 16;
+                }
+                if ((*cost_min < 0) || (cost < *cost_min)) {
+                        *cost_min = cost;
+                        best = k;
+                }
+        }
+        return best;
+}
+
+/* Compress a block, given its data with a row stride of TBC_BLOCK */
+static int tbc_encode(struct tbc_stream * stream, int width, int height,
+    const uint16_t * data)
+{
+        /* Select the predictor with the least cost. Rows are short, thus
+         * this is cheap compared to the encoding
+         */
+        int predictor, selected = TBC_PREDICTOR_MED;
+        long cost_min = -1;
+        for (predictor = 0; predictor < TBC_PREDICTORS; predictor++) {
+                long cost = 0;
+                int iy;
+                for (iy = 0; iy < height; iy++) {
+                        uint16_t u[TBC_BLOCK];
+                        long row_cost;
+                        tbc_residuals(predictor, width, iy, data, u);
+                        tbc_parameter(width, u, &row_cost);
+                        cost += row_cost;
+                }
+                if ((cost_min < 0) || (cost < cost_min)) {
+                        cost_min = cost;
+                        selected = predictor;
+                }
+        }
+        if (stream_put(stream, selected, TBC_PBITS) != EXIT_SUCCESS)
+                return EXIT_FAILURE;
+
+        int iy;
+        for (iy = 0; iy < height; iy++) {
+                uint16_t u[TBC_BLOCK];
+                long cost;
+                tbc_residuals(selected, width, iy, data, u);
+                const int best = tbc_parameter(width, u, &cost);
+
+                /* Encode the row */
+                if (stream_put(stream, best, TBC_KBITS) != EXIT_SUCCESS)
+                        return EXIT_FAILURE;
+                int ix;
+                for (ix = 0; ix < width; ix++) {
+                        const int q = u[ix] >> best;
+                        int rc;
+                        if (q < TBC_ESCAPE) {
+                                rc = stream_put(stream,
+                                    (1ULL << q) |
+                                        ((uint64_t)(u[ix] & ((1U << best) - 1))
+                                            << (q + 1)),
+                                    q + 1 + best);
+                        } else {
+                                rc = stream_put(stream,
+                                    (uint64_t)u[ix] << TBC_ESCAPE,
+                                    TBC_ESCAPE + 16);
+                        }
+                        if (rc != EXIT_SUCCESS) return EXIT_FAILURE;
+                }
+        }
+        return stream_flush(stream);
+}
+
+/* Quantise an elevation value over 16b */
+static uint16_t tbc_quantise(const struct turtle_map_meta * meta, double z)
+{
+        if (meta->dz <= 0.) return 0;
+        const double d = round((z - meta->z0) / meta->dz);
+        if (!(d > 0.))
+                return 0; /* Including NaN */
+        else if (d > 65535.)
+                return 65535;
+        else
+                return (uint16_t)d;
+}
+
+/* Provider of the quantised nodes of a band of *height* rows, starting at
+ * row *iy*. The band has a row stride of nx
+ */
+typedef int tbc_band_t(void * context, const struct turtle_map_meta * meta,
+    int iy, int height, uint16_t * band);
+
+/* Write the header, the projection and the payload of a tbc file, by bands
+ * of blocks. The offsets table is filled in once all blocks are written
+ */
+static enum turtle_return tbc_stream_write(struct tbc_io * tbc,
+    const struct turtle_map_meta * meta, tbc_band_t * get_band,
+    void * context, struct turtle_error_context * error_)
+{
+        const int nx = meta->nx, ny = meta->ny;
+        const int nbx = (nx + TBC_BLOCK - 1) / TBC_BLOCK;
+        const int nby = (ny + TBC_BLOCK - 1) / TBC_BLOCK;
+        const int n_blocks = nbx * nby;
+
+        /* Offsets are stored over 64b if the payload might exceed 4 GB */
+        const uint64_t bound = 4 * ((uint64_t)n_blocks + 1) +
+            (uint64_t)n_blocks * TBC_BLOCK_BOUND;
+        const int version =
+            (bound > UINT32_MAX) ? TBC_VERSION_WIDE : TBC_VERSION;
+        const int bytes = (version == TBC_VERSION) ? 4 : 8;
+
+        struct tbc_stream stream = { NULL, 0, 0, 0, 0 };
+        uint64_t * offsets = malloc((n_blocks + 1) * sizeof(*offsets));
+        uint16_t * band =
+            malloc((size_t)TBC_BLOCK * nx * sizeof(*band));
+        if ((offsets == NULL) || (band == NULL)) {
+                TURTLE_ERROR_REGISTER(TURTLE_RETURN_MEMORY_ERROR,
+                    "could not allocate memory for tbc data");
+                goto exit;
+        }
+
+        /* Write the header, with a null payload size for now */
+        const char * projection = turtle_projection_name(&meta->projection);
+        const int length = (projection == NULL) ? 0 : strlen(projection);
+        unsigned char header[TBC_HEADER_SIZE + 8];
+        memset(header, 0x0, sizeof(header));
+        memcpy(header, "TBC", 3);
+        header[3] = version;
+        put_uint(header + 4, TBC_BLOCK, 2);
+        put_uint(header + 6, length, 2);
+        put_uint(header + 8, nx, 4);
+        put_uint(header + 12, ny, 4);
+        put_double(header + 16, meta->x0);
+        put_double(header + 24, meta->y0);
+        put_double(header + 32, meta->z0);
+        put_double(header + 40, meta->dx);
+        put_double(header + 48, meta->dy);
+        put_double(header + 56, meta->dz);
+
+        const long start = (TBC_HEADER_SIZE + length + 7) & ~7L;
+        const int padding = start - TBC_HEADER_SIZE - length;
+        if ((fwrite(header, 1, TBC_HEADER_SIZE, tbc->fid) !=
+                TBC_HEADER_SIZE) ||
+            ((length > 0) &&
+                (fwrite(projection, 1, length, tbc->fid) != length)) ||
+            (fwrite(header + TBC_HEADER_SIZE, 1, padding, tbc->fid) !=
+                padding))
+                goto write_error;
+
+        /* Reserve the offsets table at the payload start */
+        const uint64_t table = bytes * ((uint64_t)n_blocks + 1);
+        if (fseek(tbc->fid, start + table, SEEK_SET) != 0) goto write_error;
+
+        /* Compress the blocks, by bands */
+        uint64_t size = table;
+        int by;
+        for (by = 0; by < nby; by++) {
+                int height = ny - by * TBC_BLOCK;
+                if (height > TBC_BLOCK) height = TBC_BLOCK;
+                if (get_band(context, meta, by * TBC_BLOCK, height, band) !=
+                    EXIT_SUCCESS) {
+                        TURTLE_ERROR_VREGISTER(TURTLE_RETURN_PATH_ERROR,
+                            "could not get the elevation data for file `%s'",
+                            tbc->path);
+                        goto exit;
+                }
+
+                int bx;
+                for (bx = 0; bx < nbx; bx++) {
+                        int width = nx - bx * TBC_BLOCK;
+                        if (width > TBC_BLOCK) width = TBC_BLOCK;
+
+                        uint16_t data[TBC_BLOCK * TBC_BLOCK];
+                        int iy;
+                        for (iy = 0; iy < height; iy++) {
+                                memcpy(data + iy * TBC_BLOCK,
+                                    band + (size_t)iy * nx + bx * TBC_BLOCK,
+                                    width * sizeof(*data));
+                        }
+
+                        stream.size = 0;
+                        if (tbc_encode(&stream, width, height, data) !=
+                            EXIT_SUCCESS) {
+                                TURTLE_ERROR_REGISTER(
+                                    TURTLE_RETURN_MEMORY_ERROR,
+                                    "could not allocate memory for tbc data");
+                                goto exit;
+                        }
+                        if (fwrite(stream.data, 1, stream.size, tbc->fid) !=
+                            stream.size)
+                                goto write_error;
+                        offsets[by * nbx + bx] = size;
+                        size += stream.size;
+                }
+        }
+        offsets[n_blocks] = size;
+
+        /* Fill in the offsets table and the payload size */
+        if (fseek(tbc->fid, start, SEEK_SET) != 0) goto write_error;
+        int block;
+        for (block = 0; block <= n_blocks; block++) {
+                unsigned char buffer[8];
+                put_uint(buffer, offsets[block], bytes);
+                if (fwrite(buffer, 1, bytes, tbc->fid) != bytes)
+                        goto write_error;
+        }
+        put_uint(header + 64, size, bytes);
+        if ((fseek(tbc->fid, 64, SEEK_SET) != 0) ||
+            (fwrite(header + 64, 1, bytes, tbc->fid) != bytes))
+                goto write_error;
+
+exit:
+        free(offsets);
+        free(band);
+        free(stream.data);
+        return error_->code;
+
+write_error:
+        TURTLE_ERROR_VREGISTER(TURTLE_RETURN_PATH_ERROR,
+            "could not write to file `%s'", tbc->path);
+        goto exit;
+}
+
+/* Band provider for dumping a map */
+static int map_band(void * context, const struct turtle_map_meta * meta,
+    int iy, int height, uint16_t * band)
+{
+        const struct turtle_map * map = context;
+        int i;
+        for (i = 0; i < height; i++) {
+                int ix;
+                for (ix = 0; ix < meta->nx; ix++) {
+                        const double z = meta->get_z(map, ix, iy + i);
+                        band[(size_t)i * meta->nx + ix] =
+                            tbc_quantise(meta, z);
+                }
+        }
+        return EXIT_SUCCESS;
+}
+
+/* Dump a map in tbc format */
+static enum turtle_return tbc_write(struct turtle_io * io,
+    const struct turtle_map * map, struct turtle_error_context * error_)
+{
+        return tbc_stream_write((struct tbc_io *)io, &map->meta, &map_band,
+            (void *)map, error_);
+}
+
+/* Band provider for streaming the rows of a user source */
+struct source_context {
+        turtle_map_source_t * source;
+        void * context;
+        double * row;
+};
+
+static int source_band(void * context, const struct turtle_map_meta * meta,
+    int iy, int height, uint16_t * band)
+{
+        struct source_context * source = context;
+        int i;
+        for (i = 0; i < height; i++) {
+                if (source->source(source->context, iy + i, source->row) != 0)
+                        return EXIT_FAILURE;
+                int ix;
+                for (ix = 0; ix < meta->nx; ix++) {
+                        band[(size_t)i * meta->nx + ix] =
+                            tbc_quantise(meta, source->row[ix]);
+                }
+        }
+        return EXIT_SUCCESS;
+}
+
+/* Write a map in tbc format, from the rows of a user source */
+static enum turtle_return tbc_stream(struct turtle_io * io,
+    const struct turtle_map_meta * meta, turtle_map_source_t * source,
+    void * context, struct turtle_error_context * error_)
+{
+        struct source_context band = { source, context, NULL };
+        band.row = malloc(meta->nx * sizeof(*band.row));
+        if (band.row == NULL) {
+                return TURTLE_ERROR_REGISTER(TURTLE_RETURN_MEMORY_ERROR,
+                    "could not allocate memory for tbc data");
+        }
+        tbc_stream_write(
+            (struct tbc_io *)io, meta, &source_band, &band, error_);
+        free(band.row);
+        return error_->code;
+}
+
+enum turtle_return turtle_io_tbc_create_(
+    struct turtle_io ** io_p, struct turtle_error_context * error_)
+{
+        /* Allocate the tbc io manager */
+        struct tbc_io * tbc = malloc(sizeof(*tbc));
+        if (tbc == NULL) {
+                return TURTLE_ERROR_REGISTER(TURTLE_RETURN_MEMORY_ERROR,
+                    "could not allocate memory for tbc format");
+        }
+        *io_p = &tbc->base;
+
+        /* Initialise the io object */
+        memset(tbc, 0x0, sizeof(*tbc));
+        tbc->fid = NULL;
+        tbc->path = NULL;
+        tbc->base.meta.projection.type = PROJECTION_NONE;
+        /* The compressed payload is used as is in memory. Therefore, tbc
+         * files can be memory mapped. The offset is set when opening */
+        tbc->base.data_offset = 0;
+
+        tbc->base.open = &tbc_open;
+        tbc->base.close = &tbc_close;
+        tbc->base.read = &tbc_read;
+        tbc->base.write = &tbc_write;
+        tbc->base.stream = &tbc_stream;
+
+        /* The data remain compressed. Thus, they are read only and cannot be
+         * normalised */
+        tbc->base.meta.get_z = &get_z;
+        tbc->base.meta.set_z = NULL;
+        tbc->base.meta.layout = TURTLE_MAP_LAYOUT_RAW;
+        tbc->base.meta.normal = TURTLE_MAP_LAYOUT_RAW;
+
+        return TURTLE_RETURN_SUCCESS;
+}
@@ -0,0 +1,450 @@
+/*
+ * Copyright (C) 2017 Université Clermont Auvergne, CNRS/IN2P3, LPC
+ * Author: Valentin NIESS (niess@in2p3.fr)
+ *
+ * Topographic Utilities for tRansporting parTicules over Long rangEs (TURTLE)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/*
+ * Bulk parser for the numeric data of text grids, e.g. ASC or GRD files
+ */
+
+/* C89 standard library */
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef TURTLE_NO_MMAP
+/* Memory mapping */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifndef TURTLE_NO_PTHREAD
+/* Number of processors, for sizing the threads pool */
+#include <unistd.h>
+#endif
+/* TURTLE library */
+#include "turtle/io.h"
+#include "turtle/parallel.h"
+
+/* Minimum amount of data, in bytes, for parsing a chunk in its own thread */
+#define TEXT_CHUNK_SIZE (1 << 22)
+
+/* Maximum number of parsing threads */
+#define TEXT_THREADS_MAX 64
+
+/* A chunk of text data, starting and ending on a tokens boundary */
+struct text_chunk {
+        const char * start;
+        const char * end;
+
+        /* Index of the first value and count of values */
+        long offset;
+        long count;
+        int error;
+
+        /* Statistics of the chunk values, see `text_scan` */
+        double min;
+        double max;
+        double first;
+        int has_first;
+};
+
+struct turtle_io_text {
+        /* The text data, either memory mapped or read to a buffer */
+        const char * data;
+        size_t size;
+        void * mapping;
+        size_t mapping_size;
+        char * buffer;
+
+        /* Number of expected values and value for missing data, if any */
+        long n;
+        int has_nodata;
+        double nodata;
+
+        /* Work partition */
+        int n_chunks;
+        struct text_chunk chunks[];
+};
+
+/* Work item for a parsing thread */
+struct text_task {
+        const struct turtle_io_text * text;
+        struct text_chunk * chunk;
+        long limit;
+        struct turtle_map * map;
+        int flip;
+};
+
+static int is_space(char c)
+{
+        return (c == ' ') || (c == '\n') || (c == '\r') || (c == '\t') ||
+            (c == '\v') || (c == '\f');
+}
+
+static int is_digit(char c) { return (unsigned)(c - '0') < 10; }
+
+/* Powers of ten which are exactly represented as doubles */
+static const double pow10_exact[] = { 1E+00, 1E+01, 1E+02, 1E+03, 1E+04,
+        1E+05, 1E+06, 1E+07, 1E+08, 1E+09, 1E+10, 1E+11, 1E+12, 1E+13, 1E+14,
+        1E+15, 1E+16, 1E+17, 1E+18, 1E+19, 1E+20, 1E+21, 1E+22 };
+
+/* Convert a number token. Decimal numbers with an exact mantissa and a small
+ * exponent are converted with a single, correctly rounded, floating point
+ * operation (Clinger's fast path). Other tokens are converted with `strtod`.
+ * Thus, the result is the same as for `strtod` or `fscanf`. Returns `0` on
+ * success
+ */
+static int text_convert(const char * start, const char * end, double * value)
+{
+        const char * p = start;
+        int negative = 0;
+        if ((p < end) && ((*p == '-') || (*p == '+'))) {
+                negative = (*p == '-');
+                p++;
+        }
+
+        uint64_t mantissa = 0;
+        int digits = 0, exponent = 0;
+        for (; (p < end) && is_digit(*p); p++, digits++)
+                mantissa = 10 * mantissa + (*p - '0');
+        if ((p < end) && (*p == '.')) {
+                for (p++; (p < end) && is_digit(*p); p++, digits++) {
+                        mantissa = 10 * mantissa + (*p - '0');
+                        exponent--;
+                }
+        }
+        if (digits == 0) goto fallback;
+        if ((p < end) && ((*p == 'e') || (*p == 'E'))) {
+                p++;
+                int eneg = 0;
+                if ((p < end) && ((*p == '-') || (*p == '+'))) {
+                        eneg = (*p == '-');
+                        p++;
+                }
+                if ((p == end) || !is_digit(*p)) goto fallback;
+                int e = 0;
+                for (; (p < end) && is_digit(*p); p++)
+                        if (e < 10000) e = 10 * e + (*p - '0');
+                exponent += eneg ? -e : e;
+        }
+        if ((p != end) || (digits > 19) || (mantissa > (1ULL << 53)) ||
+            (exponent < -22) || (exponent > 22))
+                goto fallback;
+
+        double d = (double)mantissa;
+        d = (exponent < 0) ? d / pow10_exact[-exponent] :
+                             d * pow10_exact[exponent];
+        *value = negative ? -d : d;
+        return 0;
+
+fallback:;
+        char tmp[64];
+        const int n = end - start;
+        if (n >= (int)sizeof(tmp)) return -1;
+        memcpy(tmp, start, n);
+        tmp[n] = 0x0;
+        char * tail;
+        *value = strtod(tmp, &tail);
+        return (tail == tmp + n) ? 0 : -1;
+}
+
+/* Convert the values of a chunk and compute their statistics.
+ *
+ * The statistics reproduce the sequential scan used by the readers, i.e.
+ * `if (d < zmin) zmin = d; else if (d > zmax) zmax = d;`. The max is taken
+ * over values that are not a running min. The latter are decreasing. Thus,
+ * for a chunk, only its first running min can turn out not to be a global
+ * one, when merging the chunks statistics
+ */
+static void * text_scan(void * arg)
+{
+        struct text_task * task = arg;
+        const struct turtle_io_text * text = task->text;
+        struct text_chunk * chunk = task->chunk;
+
+        const char * p = chunk->start;
+        const char * end = chunk->end;
+        long count = 0;
+        double min = DBL_MAX, max = -DBL_MIN, first = 0.;
+        int has_first = 0, error = 0;
+        for (;;) {
+                while ((p < end) && is_space(*p)) p++;
+                if ((p == end) || (count == task->limit)) break;
+                const char * token = p;
+                while ((p < end) && !is_space(*p)) p++;
+
+                double d;
+                if (text_convert(token, p, &d) != 0) {
+                        error = 1;
+                        break;
+                }
+                count++;
+                if (text->has_nodata && (d == text->nodata)) {
+                        continue;
+                } else if (d < min) {
+                        if (!has_first) {
+                                first = d;
+                                has_first = 1;
+                        }
+                        min = d;
+                } else if (d > max)
+                        max = d;
+        }
+
+        chunk->count = count;
+        chunk->error = error;
+        chunk->min = min;
+        chunk->max = max;
+        chunk->first = first;
+        chunk->has_first = has_first;
+
+        return NULL;
+}
+
+/* Convert the values of a chunk to map data */
+static void * text_fill(void * arg)
+{
+        struct text_task * task = arg;
+        const struct text_chunk * chunk = task->chunk;
+        struct turtle_map * map = task->map;
+
+        const int nx = map->meta.nx, ny = map->meta.ny;
+        const double z0 = map->meta.z0, dz = map->meta.dz;
+        long index = chunk->offset;
+        int ix = index % nx;
+        int iy = index / nx;
+        uint16_t * row = map->data + (task->flip ? ny - 1 - iy : iy) * nx;
+
+        const char * p = chunk->start;
+        const char * end = chunk->end;
+        long i;
+        for (i = 0; i < chunk->count; i++) {
+                while ((p < end) && is_space(*p)) p++;
+                const char * token = p;
+                while ((p < end) && !is_space(*p)) p++;
+
+                /* Values have already been checked by the scan */
+                double z;
+                text_convert(token, p, &z);
+                const double d = round((z - z0) / dz);
+                row[ix] = (uint16_t)d;
+
+                if ((++ix == nx) && (++iy < ny)) {
+                        ix = 0;
+                        row = map->data + (task->flip ? ny - 1 - iy : iy) * nx;
+                }
+        }
+
+        return NULL;
+}
+
+/* Tasks over all chunks, taken in turn by the parsing threads */
+struct text_pool {
+        struct text_task * tasks;
+        int size;
+        int next;
+        void * (*run)(void *);
+};
+
+/* Run the tasks of a pool until all are done */
+static void * text_work(void * arg)
+{
+        struct text_pool * pool = arg;
+        for (;;) {
+                const int i = TURTLE_ATOMIC_ADD(&pool->next, 1) - 1;
+                if (i >= pool->size) break;
+                pool->run(pool->tasks + i);
+        }
+        return NULL;
+}
+
+/* Run a task over all chunks, with one thread per chunk */
+static void text_run(struct turtle_io_text * text, void * (*run)(void *),
+    struct turtle_map * map, int flip)
+{
+        struct text_task tasks[TEXT_THREADS_MAX];
+        int i;
+        for (i = 0; i < text->n_chunks; i++) {
+                tasks[i].text = text;
+                tasks[i].chunk = text->chunks + i;
+                tasks[i].limit = -1;
+                tasks[i].map = map;
+                tasks[i].flip = flip;
+        }
+
+        struct text_pool pool = { tasks, text->n_chunks, 0, run };
+        turtle_parallel_run_(text->n_chunks, &text_work, &pool);
+}
+
+/* Get the number of parsing threads for a given amount of data */
+static int text_threads(size_t size)
+{
+        long n = 1;
+#if !defined(TURTLE_NO_PTHREAD) && defined(_SC_NPROCESSORS_ONLN)
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        const long m = (long)(size / TEXT_CHUNK_SIZE);
+        if (n > m) n = m;
+        if (n > TEXT_THREADS_MAX) n = TEXT_THREADS_MAX;
+        return (n < 1) ? 1 : (int)n;
+}
+
+/* Get the text data, by mapping the file to memory or by reading it */
+static int text_load(struct turtle_io_text * text, const char * path,
+    long offset)
+{
+#ifndef TURTLE_NO_MMAP
+        const int fd = open(path, O_RDONLY);
+        if (fd >= 0) {
+                struct stat st;
+                if ((fstat(fd, &st) == 0) && (st.st_size > offset)) {
+                        void * mapping = mmap(NULL, st.st_size, PROT_READ,
+                            MAP_PRIVATE, fd, 0);
+                        if (mapping != MAP_FAILED) {
+                                close(fd);
+                                text->mapping = mapping;
+                                text->mapping_size = st.st_size;
+                                text->data = (char *)mapping + offset;
+                                text->size = st.st_size - offset;
+                                return EXIT_SUCCESS;
+                        }
+                }
+                close(fd);
+        }
+#endif
+        FILE * stream = fopen(path, "rb");
+        if (stream == NULL) return EXIT_FAILURE;
+        int rc = EXIT_FAILURE;
+        if (fseek(stream, 0, SEEK_END) != 0) goto exit;
+        const long size = ftell(stream) - offset;
+        if ((size < 0) || (fseek(stream, offset, SEEK_SET) != 0)) goto exit;
+        text->buffer = malloc((size > 0) ? size : 1);
+        if (text->buffer == NULL) goto exit;
+        if (fread(text->buffer, 1, size, stream) != (size_t)size) goto exit;
+        text->data = text->buffer;
+        text->size = size;
+        rc = EXIT_SUCCESS;
+exit:
+        fclose(stream);
+        return rc;
+}
+
+/* Map the numeric data of a text file and get the statistics of its values */
+enum turtle_return turtle_io_text_open_(struct turtle_io_text ** text_p,
+    const char * path, long offset, long n, const double * nodata,
+    double * zmin, double * zmax, struct turtle_error_context * error_)
+{
+        struct turtle_io_text * text = malloc(
+            sizeof(*text) + TEXT_THREADS_MAX * sizeof(*text->chunks));
+        if (text == NULL) {
+                return TURTLE_ERROR_VREGISTER(TURTLE_RETURN_MEMORY_ERROR,
+                    "could not allocate memory for file `%s'", path);
+        }
+        text->mapping = NULL;
+        text->mapping_size = 0;
+        text->buffer = NULL;
+        text->n = n;
+        text->has_nodata = (nodata != NULL);
+        text->nodata = (nodata != NULL) ? *nodata : 0.;
+        *text_p = text;
+
+        if (text_load(text, path, offset) != EXIT_SUCCESS) {
+                turtle_io_text_close_(text_p);
+                return TURTLE_ERROR_VREGISTER(
+                    TURTLE_RETURN_PATH_ERROR, "could not read file `%s'", path);
+        }
+
+        /* Split the data in chunks, on tokens boundaries */
+        const char * end = text->data + text->size;
+        text->n_chunks = text_threads(text->size);
+        const char * start = text->data;
+        int i;
+        for (i = 0; i < text->n_chunks; i++) {
+                const char * stop = (i == text->n_chunks - 1) ?
+                    end :
+                    text->data + (i + 1) * (text->size / text->n_chunks);
+                if (stop < start) stop = start;
+                while ((stop < end) && !is_space(*stop)) stop++;
+                text->chunks[i].start = start;
+                text->chunks[i].end = stop;
+                start = stop;
+        }
+
+        /* Scan all the chunks concurrently. Then, merge the statistics of the
+         * first *n* values, in reading order
+         */
+        text_run(text, &text_scan, NULL, 0);
+        double min = DBL_MAX, max = -DBL_MIN;
+        long count = 0;
+        for (i = 0; i < text->n_chunks; i++) {
+                struct text_chunk * chunk = text->chunks + i;
+                if ((count + chunk->count >= n) &&
+                    ((count + chunk->count > n) || chunk->error)) {
+                        /* Rescan the last chunk, up to the last value */
+                        struct text_task task = { text, chunk, n - count,
+                                NULL, 0 };
+                        text_scan(&task);
+                }
+                if (chunk->error) break;
+
+                chunk->offset = count;
+                if (chunk->max > max) max = chunk->max;
+                if (chunk->has_first && !(chunk->first < min) &&
+                    (chunk->first > max))
+                        max = chunk->first;
+                if (chunk->min < min) min = chunk->min;
+                count += chunk->count;
+                if (count == n) {
+                        text->n_chunks = i + 1;
+                        break;
+                }
+        }
+        if (count < n) {
+                turtle_io_text_close_(text_p);
+                return TURTLE_ERROR_VREGISTER(TURTLE_RETURN_BAD_FORMAT,
+                    "inconsistent data in file `%s'", path);
+        }
+        *zmin = min;
+        *zmax = max;
+
+        return TURTLE_RETURN_SUCCESS;
+}
+
+/* Convert the text values to map data */
+void turtle_io_text_read_(struct turtle_io_text * text,
+    struct turtle_map * map, int flip)
+{
+        text_run(text, &text_fill, map, flip);
+}
+
+/* Release the text data */
+void turtle_io_text_close_(struct turtle_io_text ** text)
+{
+        if ((text == NULL) || (*text == NULL)) return;
+#ifndef TURTLE_NO_MMAP
+        if ((*text)->mapping != NULL)
+                munmap((*text)->mapping, (*text)->mapping_size);
+#endif
+        free((*text)->buffer);
+        free(*text);
+        *text = NULL;
+}
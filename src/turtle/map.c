@@ -22,32 +22,617 @@
  * Turtle projection map handle for managing local maps.
  */
 
+/* POSIX shared memory, signals and sleep, for shared tiles */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 /* C89 standard library */
 #include <float.h>
+#include <limits.h>
 #include <math.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef TURTLE_NO_MMAP
+/* Memory mapping */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
 /* TURTLE library */
 #include "turtle.h"
 #include "turtle/error.h"
 #include "turtle/io.h"
 #include "turtle/list.h"
 #include "turtle/map.h"
+#include "turtle/parallel.h"
 #include "turtle/projection.h"
 #include "turtle/stack.h"
 
 /* Default data getter */
 static double get_default_z(const struct turtle_map * map, int ix, int iy)
 {
-        return map->meta.z0 + map->data[iy * map->meta.nx + ix] * map->meta.dz;
+        return map->meta.z0 +
+            map->data[(size_t)iy * map->meta.nx + ix] * map->meta.dz;
 }
 
 /* Default data setter */
 static void set_default_z(struct turtle_map * map, int ix, int iy, double z)
 {
         const double d = round((z - map->meta.z0) / map->meta.dz);
-        map->data[iy * map->meta.nx + ix] = (uint16_t)d;
+        map->data[(size_t)iy * map->meta.nx + ix] = (uint16_t)d;
+}
+
+/* Data getter for signed data */
+static double get_int16_z(const struct turtle_map * map, int ix, int iy)
+{
+        return (int16_t)map->data[(size_t)iy * map->meta.nx + ix];
+}
+
+/* Data setter for signed data */
+static void set_int16_z(struct turtle_map * map, int ix, int iy, double z)
+{
+        map->data[(size_t)iy * map->meta.nx + ix] = (int16_t)z;
+}
+
+/* Index of a node in a blocked layout. Indices are non negative, thus
+ * unsigned arithmetic is used, which reduces to shifts and masks
+ */
+static inline size_t map_block_index(
+    const struct turtle_map * map, int ix, int iy)
+{
+        const unsigned int b = TURTLE_MAP_BLOCK;
+        const unsigned int nbx = ((unsigned int)map->meta.nx + b - 1) / b;
+        const unsigned int jx = ix, jy = iy;
+        const size_t block = (size_t)(jy / b) * nbx + jx / b;
+        return block * b * b + (jy % b) * b + jx % b;
+}
+
+/* Data getter for blocked unsigned data */
+static double get_blocked_z(const struct turtle_map * map, int ix, int iy)
+{
+        return map->meta.z0 +
+            map->data[map_block_index(map, ix, iy)] * map->meta.dz;
+}
+
+/* Data setter for blocked unsigned data */
+static void set_blocked_z(struct turtle_map * map, int ix, int iy, double z)
+{
+        const double d = round((z - map->meta.z0) / map->meta.dz);
+        map->data[map_block_index(map, ix, iy)] = (uint16_t)d;
+}
+
+/* Data getter for blocked signed data */
+static double get_int16_blocked_z(
+    const struct turtle_map * map, int ix, int iy)
+{
+        return (int16_t)map->data[map_block_index(map, ix, iy)];
+}
+
+/* Data setter for blocked signed data */
+static void set_int16_blocked_z(
+    struct turtle_map * map, int ix, int iy, double z)
+{
+        map->data[map_block_index(map, ix, iy)] = (int16_t)z;
+}
+
+/* Conversion to a blocked layout, done after loading on request */
+static int map_block(struct turtle_map ** map);
+
+/* Counter of map serials. A new serial is drawn whenever the map data
+ * change, thus invalidating any cached data
+ */
+static unsigned long map_serial = 0;
+
+/* Allocate a new map handle, with in place storage for n data */
+static struct turtle_map * map_allocate(size_t n)
+{
+        struct turtle_map * map =
+            malloc(sizeof(*map) + n * sizeof(*map->storage));
+        if (map == NULL) return NULL;
+
+        map->stack = NULL;
+        memset(&map->element, 0x0, sizeof(map->element));
+        map->clients = 0;
+        map->index = -1;
+        map->stamp = 0;
+        map->hits = 0;
+        map->serial = TURTLE_ATOMIC_ADD(&map_serial, 1);
+        map->mapping = NULL;
+        map->mapping_size = 0;
+        map->data = map->storage;
+        map->data_size = n * sizeof(*map->storage);
+        map->pyramid = NULL;
+        map->segment = NULL;
+
+        return map;
+}
+
+#ifndef TURTLE_NO_MMAP
+/* Map the elevation data of a file to memory
+ *
+ * The mapping is private. Thus, it is shared with the page cache until a
+ * node is modified, e.g. with `turtle_map_fill`.
+ */
+static int map_mmap(struct turtle_map * map, const char * path, long offset,
+    size_t data_size)
+{
+        const int fd = open(path, O_RDONLY);
+        if (fd < 0) return EXIT_FAILURE;
+
+        const size_t size = offset + data_size;
+        struct stat st;
+        if ((fstat(fd, &st) != 0) || (st.st_size < (off_t)size)) {
+                close(fd);
+                return EXIT_FAILURE;
+        }
+
+        void * mapping =
+            mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) return EXIT_FAILURE;
+
+        map->mapping = mapping;
+        map->mapping_size = size;
+        map->data = (uint16_t *)((char *)mapping + offset);
+        map->data_size = data_size;
+
+        return EXIT_SUCCESS;
+}
+
+/* Maximum number of 1 ms waits for a segment being published by another
+ * process
+ */
+#define MAP_SEGMENT_WAIT 10000
+
+/* Age, in s, beyond which a segment without header is considered as left
+ * over by a publisher that crashed
+ */
+#define MAP_SEGMENT_AGE 2
+
+/* Load options selecting the segment of a data file, i.e. its data layout */
+#define MAP_SEGMENT_OPTIONS TURTLE_MAP_LOAD_BLOCK
+
+/* Offset of the elevation data, aligned on a cache line */
+#define MAP_SEGMENT_OFFSET                                                     \
+        ((sizeof(struct turtle_map_segment) + 63) / 64 * 64)
+
+/* Status of a shared memory segment */
+enum map_segment_status {
+        MAP_SEGMENT_PRIVATE = -1,
+        MAP_SEGMENT_PENDING,
+        MAP_SEGMENT_READY
+};
+
+/* Get the name of the shared memory segment of a data file, and the file
+ * status
+ *
+ * The name identifies the file, by its device and inode, and the data layout.
+ * The file size and modification time are stored in the segment header.
+ * Thus, the segment of a modified file is found and replaced, instead of
+ * being left over.
+ */
+static int map_segment_name(
+    const char * path, int options, char * name, struct stat * st)
+{
+        if (stat(path, st) != 0) return EXIT_FAILURE;
+        const unsigned long long values[] = { st->st_dev, st->st_ino,
+                options & MAP_SEGMENT_OPTIONS };
+
+        /* 64 bits FNV-1a hash */
+        unsigned long long hash = 14695981039346656037ULL;
+        int i;
+        for (i = 0; i < sizeof(values) / sizeof(*values); i++) {
+                int j;
+                for (j = 0; j < 8; j++) {
+                        hash ^= (values[i] >> (8 * j)) & 0xFF;
+                        hash *= 1099511628211ULL;
+                }
+        }
+        sprintf(name, "/turtle-%016llx", hash);
+        return EXIT_SUCCESS;
+}
+
+/* Set the data accessors of a normalised layout. Function pointers are not
+ * shared, since they differ between processes
+ */
+static void map_layout_accessors(struct turtle_map_meta * meta)
+{
+        if (meta->layout == TURTLE_MAP_LAYOUT_LINEAR) {
+                meta->get_z = &get_default_z;
+                meta->set_z = &set_default_z;
+        } else if (meta->layout == TURTLE_MAP_LAYOUT_INT16) {
+                meta->get_z = &get_int16_z;
+                meta->set_z = &set_int16_z;
+        } else if (meta->layout == TURTLE_MAP_LAYOUT_LINEAR_BLOCKED) {
+                meta->get_z = &get_blocked_z;
+                meta->set_z = &set_blocked_z;
+        } else {
+                meta->get_z = &get_int16_blocked_z;
+                meta->set_z = &set_int16_blocked_z;
+        }
+}
+
+/* Check if the publisher of a segment is still running. Processes that
+ * cannot be signaled, e.g. of other users, are assumed to be running
+ */
+static int map_segment_alive(long pid)
+{
+        return (kill((pid_t)pid, 0) == 0) || (errno != ESRCH);
+}
+
+/* Attach a shared memory segment to a new map. Returns `1` on success, `0`
+ * if the segment is pending, `-1` if it cannot be used or `-2` if it is
+ * stale and must be replaced
+ *
+ * A segment is stale if its publisher died before completing it, if it
+ * refers to another version of the data file, or if its data could not be
+ * shared. As for files, the data mapping is private. Thus, it is shared with
+ * other processes until a node is modified. The header mapping is shared,
+ * for counting the users of the segment.
+ */
+static int map_segment_attach(
+    struct turtle_map ** map, int fd, const struct stat * file)
+{
+        struct stat st;
+        if (fstat(fd, &st) != 0) return -1;
+        if (st.st_size < (off_t)MAP_SEGMENT_OFFSET) {
+                /* The header is not written yet */
+                return (time(NULL) - st.st_mtime > MAP_SEGMENT_AGE) ? -2 : 0;
+        }
+        struct turtle_map_segment * segment = mmap(NULL, MAP_SEGMENT_OFFSET,
+            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (segment == MAP_FAILED) return -1;
+
+        int rc = 1;
+        const int status = TURTLE_ATOMIC_LOAD(&segment->status);
+        if ((strcmp(segment->tag, TURTLE_MAP_SEGMENT_TAG) != 0) ||
+            (segment->size != file->st_size) ||
+            (segment->mtime != file->st_mtime) ||
+            (status == MAP_SEGMENT_PRIVATE))
+                rc = -2;
+        else if (status == MAP_SEGMENT_PENDING)
+                rc = map_segment_alive(segment->owner) ? 0 : -2;
+        else if (MAP_SEGMENT_OFFSET + segment->data_size > (size_t)st.st_size)
+                rc = -2;
+        if (rc != 1) {
+                munmap(segment, MAP_SEGMENT_OFFSET);
+                return rc;
+        }
+
+        const size_t size = st.st_size;
+        void * mapping =
+            mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+                munmap(segment, MAP_SEGMENT_OFFSET);
+                return -1;
+        }
+        *map = map_allocate(0);
+        if (*map == NULL) {
+                munmap(mapping, size);
+                munmap(segment, MAP_SEGMENT_OFFSET);
+                return -1;
+        }
+        TURTLE_ATOMIC_ADD(&segment->users, 1);
+        memcpy(&(*map)->meta, &segment->meta, sizeof((*map)->meta));
+        map_layout_accessors(&(*map)->meta);
+        (*map)->mapping = mapping;
+        (*map)->mapping_size = size;
+        (*map)->data = (uint16_t *)((char *)mapping + MAP_SEGMENT_OFFSET);
+        (*map)->data_size = segment->data_size;
+        (*map)->segment = segment;
+        return 1;
+}
+
+/* Remove a segment, unless it was replaced meanwhile. If *unused* is not
+ * zero, the segment is removed only if it has no users
+ */
+static void map_segment_remove(const char * name, long long inode, int unused)
+{
+        const int fd = shm_open(name, O_RDONLY, 0);
+        if (fd < 0) return;
+        struct stat st;
+        if ((fstat(fd, &st) != 0) || (st.st_ino != inode)) {
+                close(fd);
+                return;
+        }
+        if (!unused) {
+                shm_unlink(name);
+        } else if (st.st_size >= (off_t)MAP_SEGMENT_OFFSET) {
+                struct turtle_map_segment * segment = mmap(NULL,
+                    MAP_SEGMENT_OFFSET, PROT_READ, MAP_SHARED, fd, 0);
+                if (segment != MAP_FAILED) {
+                        if (TURTLE_ATOMIC_LOAD(&segment->users) <= 0)
+                                shm_unlink(name);
+                        munmap(segment, MAP_SEGMENT_OFFSET);
+                }
+        }
+        close(fd);
+}
+
+/* Remove the segment opened as *fd*, unless it was replaced meanwhile */
+static void map_segment_discard(int fd, const char * name)
+{
+        struct stat st;
+        if (fstat(fd, &st) == 0) map_segment_remove(name, st.st_ino, 0);
+}
+
+/* Forget the former release of a segment by a stack, if any */
+static void map_segment_forget(struct turtle_stack * stack, const char * name)
+{
+        struct turtle_stack_segment ** link = &stack->released.head;
+        struct turtle_stack_segment * last = NULL;
+        while (*link != NULL) {
+                struct turtle_stack_segment * released = *link;
+                if (strcmp(released->name, name) == 0) {
+                        *link = released->next;
+                        stack->released.size--;
+                        stack->released.bytes -= released->size;
+                        free(released);
+                } else {
+                        last = released;
+                        link = &released->next;
+                }
+        }
+        stack->released.tail = last;
+}
+
+/* Keep an unused segment for reuse by the stack. The least recently released
+ * segments are removed if the stack capacity or its memory budget is exceeded
+ */
+static int map_segment_release(struct turtle_stack * stack,
+    const struct turtle_map_segment * segment, size_t size)
+{
+        map_segment_forget(stack, segment->name);
+        struct turtle_stack_segment * released = malloc(sizeof(*released));
+        if (released == NULL) return EXIT_FAILURE;
+        released->next = NULL;
+        strcpy(released->name, segment->name);
+        released->inode = segment->inode;
+        released->size = size;
+        if (stack->released.tail != NULL)
+                stack->released.tail->next = released;
+        else
+                stack->released.head = released;
+        stack->released.tail = released;
+        stack->released.size++;
+        stack->released.bytes += size;
+
+        while ((stack->released.size > stack->max_size) ||
+            ((stack->max_bytes > 0) &&
+                (stack->released.bytes > stack->max_bytes))) {
+                released = stack->released.head;
+                stack->released.head = released->next;
+                if (stack->released.head == NULL) stack->released.tail = NULL;
+                stack->released.size--;
+                stack->released.bytes -= released->size;
+                map_segment_remove(released->name, released->inode, 1);
+                free(released);
+        }
+        return EXIT_SUCCESS;
+}
+
+/* Detach a map from its segment. The last user, over all processes, releases
+ * the segment to the stack of the map, or removes it
+ */
+static void map_segment_detach(
+    struct turtle_map * map, struct turtle_stack * stack)
+{
+        struct turtle_map_segment * segment = map->segment;
+        if ((TURTLE_ATOMIC_ADD(&segment->users, -1) <= 0) &&
+            ((stack == NULL) ||
+                (map_segment_release(stack, segment, map->mapping_size) !=
+                    EXIT_SUCCESS)))
+                map_segment_remove(segment->name, segment->inode, 1);
+        munmap(segment, MAP_SEGMENT_OFFSET);
+}
+
+/* Write the header of a newly created segment, as pending. The header is
+ * written at once, such that other processes never see a partial one
+ */
+static int map_segment_create(int fd, const char * name,
+    const struct stat * file)
+{
+        struct stat st;
+        if (fstat(fd, &st) != 0) return EXIT_FAILURE;
+
+        union {
+                struct turtle_map_segment segment;
+                char bytes[MAP_SEGMENT_OFFSET];
+        } header;
+        memset(&header, 0x0, sizeof(header));
+        strcpy(header.segment.tag, TURTLE_MAP_SEGMENT_TAG);
+        strcpy(header.segment.name, name);
+        header.segment.status = MAP_SEGMENT_PENDING;
+        header.segment.owner = getpid();
+        header.segment.inode = st.st_ino;
+        header.segment.size = file->st_size;
+        header.segment.mtime = file->st_mtime;
+        return (write(fd, header.bytes, MAP_SEGMENT_OFFSET) ==
+                   (ssize_t)MAP_SEGMENT_OFFSET) ?
+            EXIT_SUCCESS :
+            EXIT_FAILURE;
+}
+
+/* Publish decoded elevation data to a pending segment. Returns `1` on
+ * success, `0` if the data layout cannot be shared or `-1` on failure
+ */
+static int map_segment_publish(const struct turtle_map * map, int fd)
+{
+        const int shareable = (map->meta.layout != TURTLE_MAP_LAYOUT_RAW);
+        const size_t data_size = shareable ? map->data_size : 0;
+        const size_t size = MAP_SEGMENT_OFFSET + data_size;
+        if (ftruncate(fd, size) != 0) return -1;
+        void * mapping =
+            mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) return -1;
+
+        struct turtle_map_segment * segment = mapping;
+        memcpy(&segment->meta, &map->meta, sizeof(segment->meta));
+        segment->data_size = data_size;
+        memcpy((char *)mapping + MAP_SEGMENT_OFFSET, map->data, data_size);
+        TURTLE_ATOMIC_STORE(&segment->status,
+            shareable ? MAP_SEGMENT_READY : MAP_SEGMENT_PRIVATE);
+        munmap(mapping, size);
+        return shareable;
+}
+
+static enum turtle_return map_load(struct turtle_map ** map,
+    const char * path, int options, struct turtle_error_context * error_);
+
+/* Load a map from a shared memory segment, decoding the data file and
+ * publishing the segment if it does not exist yet
+ *
+ * Processes race for creating the segment. The winner decodes the file, while
+ * the others wait for the segment to be ready. Stale segments are removed and
+ * replaced, e.g. if their publisher died. Segments are removed by inode, such
+ * that a fresh segment published meanwhile by another process is left
+ * untouched. On any other failure, the map is loaded privately.
+ */
+static enum turtle_return map_load_shared(struct turtle_map ** map,
+    const char * path, int options, struct turtle_error_context * error_)
+{
+        /* Shared data must have a normalised layout. The pyramid is built
+         * by each process
+         */
+        const int pyramid = options & TURTLE_MAP_LOAD_PYRAMID;
+        options &= ~(TURTLE_MAP_LOAD_SHARED | TURTLE_MAP_LOAD_PYRAMID);
+        if (!(options & TURTLE_MAP_LOAD_BLOCK))
+                options |= TURTLE_MAP_LOAD_NORMALISE;
+
+        *map = NULL;
+        char name[32];
+        struct stat file;
+        int wait = 0;
+        while ((wait < MAP_SEGMENT_WAIT) &&
+            (map_segment_name(path, options, name, &file) == EXIT_SUCCESS)) {
+                int fd = shm_open(name, O_RDWR, 0);
+                if (fd >= 0) {
+                        const int rc = map_segment_attach(map, fd, &file);
+                        if (rc == -2) map_segment_discard(fd, name);
+                        close(fd);
+                        if (rc == -2) {
+                                wait++;
+                                continue;
+                        } else if (rc != 0) {
+                                break;
+                        }
+                        const struct timespec ms = { 0, 1000000 };
+                        nanosleep(&ms, NULL);
+                        wait++;
+                        continue;
+                } else if (errno != ENOENT) {
+                        break;
+                }
+
+                fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+                if (fd < 0) {
+                        if (errno != EEXIST) break;
+                        wait++;
+                        continue;
+                }
+                if (map_segment_create(fd, name, &file) != EXIT_SUCCESS) {
+                        map_segment_discard(fd, name);
+                        close(fd);
+                        break;
+                }
+                struct turtle_map * decoded;
+                if (map_load(&decoded, path, options, error_) !=
+                    TURTLE_RETURN_SUCCESS) {
+                        map_segment_discard(fd, name);
+                        close(fd);
+                        return error_->code;
+                }
+                const int rc = map_segment_publish(decoded, fd);
+                if (rc <= 0) map_segment_discard(fd, name);
+                if ((rc > 0) && (map_segment_attach(map, fd, &file) > 0))
+                        turtle_map_destroy(&decoded);
+                else
+                        *map = decoded;
+                close(fd);
+                break;
+        }
+
+        if ((*map == NULL) &&
+            (map_load(map, path, options, error_) != TURTLE_RETURN_SUCCESS))
+                return error_->code;
+        if (pyramid) turtle_map_pyramid_build_(*map);
+        return TURTLE_RETURN_SUCCESS;
+}
+#endif
+
+/* Get the name of the shared memory segment of a data file */
+int turtle_map_segment_name_(const char * path, int options, char * name)
+{
+#ifndef TURTLE_NO_MMAP
+        struct stat st;
+        return map_segment_name(path, options, name, &st);
+#else
+        return EXIT_FAILURE;
+#endif
+}
+
+/* Withdraw the segment of a map inserted in a stack from its released ones */
+void turtle_map_segment_claim_(
+    struct turtle_stack * stack, const struct turtle_map * map)
+{
+#ifndef TURTLE_NO_MMAP
+        if ((map->segment != NULL) && (stack->released.head != NULL))
+                map_segment_forget(stack, map->segment->name);
+#endif
+}
+
+/* Remove the unused shared memory segments released by a stack */
+void turtle_map_segment_flush_(struct turtle_stack * stack)
+{
+        while (stack->released.head != NULL) {
+                struct turtle_stack_segment * released = stack->released.head;
+                stack->released.head = released->next;
+#ifndef TURTLE_NO_MMAP
+                map_segment_remove(released->name, released->inode, 1);
+#endif
+                free(released);
+        }
+        memset(&stack->released, 0x0, sizeof(stack->released));
+}
+
+/* Remove the shared memory segments of a data file, if any */
+void turtle_map_segment_unlink_(const char * path)
+{
+#ifndef TURTLE_NO_MMAP
+        /* Loop over all the subsets of the options that select a segment */
+        int options = 0;
+        do {
+                char name[32];
+                struct stat st;
+                if (map_segment_name(path, options, name, &st) ==
+                    EXIT_SUCCESS)
+                        shm_unlink(name);
+                options = (options - MAP_SEGMENT_OPTIONS) & MAP_SEGMENT_OPTIONS;
+        } while (options != 0);
+#endif
+}
+
+/* Initialise the grid of a map from its info */
+static void map_meta_initialise(
+    struct turtle_map_meta * meta, const struct turtle_map_info * info)
+{
+        meta->nx = info->nx;
+        meta->ny = info->ny;
+        meta->x0 = info->x[0];
+        meta->y0 = info->y[0];
+        meta->z0 = info->z[0];
+        meta->dx =
+            (info->nx > 1) ? (info->x[1] - info->x[0]) / (info->nx - 1) : 0.;
+        meta->dy =
+            (info->ny > 1) ? (info->y[1] - info->y[0]) / (info->ny - 1) : 0.;
+        meta->dz = (info->z[1] - info->z[0]) / 65535;
 }
 
 /* Create a handle to a new empty map */
@@ -68,33 +653,21 @@ enum turtle_return turtle_map_create(struct turtle_map ** map,
                 return TURTLE_ERROR_RAISE();
 
         /* Allocate the map memory */
-        *map =
-            malloc(sizeof(**map) + info->nx * info->ny * sizeof(*(*map)->data));
+        const size_t n = (size_t)info->nx * info->ny;
+        *map = map_allocate(n);
         if (*map == NULL) return TURTLE_ERROR_MEMORY();
 
         /* Fill the identifiers */
-        (*map)->meta.nx = info->nx;
-        (*map)->meta.ny = info->ny;
-        (*map)->meta.x0 = info->x[0];
-        (*map)->meta.y0 = info->y[0];
-        (*map)->meta.z0 = info->z[0];
-        (*map)->meta.dx =
-            (info->nx > 1) ? (info->x[1] - info->x[0]) / (info->nx - 1) : 0.;
-        (*map)->meta.dy =
-            (info->ny > 1) ? (info->y[1] - info->y[0]) / (info->ny - 1) : 0.;
-        (*map)->meta.dz = (info->z[1] - info->z[0]) / 65535;
+        map_meta_initialise(&(*map)->meta, info);
         memcpy(
             &(*map)->meta.projection, &proj, sizeof((*map)->meta.projection));
-        memset((*map)->data, 0x0, sizeof(*(*map)->data) * info->nx * info->ny);
+        memset((*map)->data, 0x0, sizeof(*(*map)->data) * n);
 
         (*map)->meta.get_z = &get_default_z;
         (*map)->meta.set_z = &set_default_z;
+        (*map)->meta.layout = (*map)->meta.normal = TURTLE_MAP_LAYOUT_LINEAR;
         strcpy((*map)->meta.encoding, "none");
 
-        (*map)->stack = NULL;
-        memset(&(*map)->element, 0x0, sizeof((*map)->element));
-        (*map)->clients = 0;
-
         return TURTLE_RETURN_SUCCESS;
 }
 
@@ -103,18 +676,262 @@ void turtle_map_destroy(struct turtle_map ** map)
 {
         if ((map == NULL) || (*map == NULL)) return;
 
-        if ((*map)->stack != NULL) {
+        struct turtle_stack * stack = (*map)->stack;
+        if (stack != NULL) {
                 /* Update the stack */
-                turtle_list_remove_(&(*map)->stack->tiles, *map);
+                turtle_list_remove_(&stack->tiles, *map);
+                stack->bytes -= turtle_map_bytes_(*map);
+                const int index = (*map)->index;
+                if ((index >= 0) && (stack->grid[index] == *map))
+                        stack->grid[index] = NULL;
         }
 
+#ifndef TURTLE_NO_MMAP
+        if ((*map)->segment != NULL) map_segment_detach(*map, stack);
+        if ((*map)->mapping != NULL)
+                munmap((*map)->mapping, (*map)->mapping_size);
+#endif
+
+        free((*map)->pyramid);
         free(*map);
         *map = NULL;
 }
 
-/* Load a map from a data file */
-enum turtle_return turtle_map_load_(struct turtle_map ** map, const char * path,
-    struct turtle_error_context * error_)
+/* Get the memory footprint of a map, in bytes */
+size_t turtle_map_bytes_(const struct turtle_map * map)
+{
+        const size_t pyramid =
+            (map->pyramid != NULL) ? map->pyramid->size : 0;
+        if (map->mapping != NULL)
+                return sizeof(*map) + map->mapping_size + pyramid;
+        else
+                return sizeof(*map) + map->data_size + pyramid;
+}
+
+/* Round a double to a lower or upper float */
+static float float_lower(double z)
+{
+        float f = (float)z;
+        if (f > z) f = nextafterf(f, -FLT_MAX);
+        return f;
+}
+
+static float float_upper(double z)
+{
+        float f = (float)z;
+        if (f < z) f = nextafterf(f, FLT_MAX);
+        return f;
+}
+
+/* Build the pyramid of elevation bounds
+ *
+ * Level 0 cells are filled by scanning their nodes, which preserves the data
+ * locality for blocked or compressed layouts. Upper levels merge groups of
+ * 2 x 2 cells. The bounds of a cell hold for the bilinear interpolation over
+ * the cell, since it is a convex combination of nodes.
+ */
+static void pyramid_compute(
+    const struct turtle_map * map, struct turtle_map_pyramid * pyramid);
+
+int turtle_map_pyramid_build_(struct turtle_map * map)
+{
+        if (map->pyramid != NULL) {
+                turtle_map_pyramid_refresh_(map);
+                return EXIT_SUCCESS;
+        }
+
+        /* Compute the pyramid geometry */
+        const int nx = map->meta.nx, ny = map->meta.ny;
+        int levels = 0, cx = nx, cy = ny;
+        size_t n = 0;
+        do {
+                cx = (levels == 0) ? (cx + TURTLE_MAP_CELL - 1) /
+                        TURTLE_MAP_CELL : (cx + 1) / 2;
+                cy = (levels == 0) ? (cy + TURTLE_MAP_CELL - 1) /
+                        TURTLE_MAP_CELL : (cy + 1) / 2;
+                n += (size_t)cx * cy;
+                levels++;
+        } while (((cx > 1) || (cy > 1)) && (levels < TURTLE_MAP_LEVELS));
+
+        const size_t size =
+            sizeof(struct turtle_map_pyramid) + 2 * n * sizeof(float);
+        struct turtle_map_pyramid * pyramid = malloc(size);
+        if (pyramid == NULL) return EXIT_FAILURE;
+        pyramid->valid = TURTLE_MAP_PYRAMID_VALID;
+        pyramid->levels = levels;
+        pyramid->size = size;
+
+        float * data = pyramid->data;
+        int level;
+        cx = nx;
+        cy = ny;
+        for (level = 0; level < levels; level++) {
+                cx = (level == 0) ? (cx + TURTLE_MAP_CELL - 1) /
+                        TURTLE_MAP_CELL : (cx + 1) / 2;
+                cy = (level == 0) ? (cy + TURTLE_MAP_CELL - 1) /
+                        TURTLE_MAP_CELL : (cy + 1) / 2;
+                pyramid->level[level].nx = cx;
+                pyramid->level[level].ny = cy;
+                pyramid->level[level].zmin = data;
+                data += (size_t)cx * cy;
+                pyramid->level[level].zmax = data;
+                data += (size_t)cx * cy;
+        }
+        pyramid_compute(map, pyramid);
+
+        map->pyramid = pyramid;
+        return EXIT_SUCCESS;
+}
+
+void turtle_map_pyramid_refresh_(struct turtle_map * map)
+{
+        /* The state is checked first, in order to not contend over the
+         * cache line of valid pyramids
+         */
+        struct turtle_map_pyramid * pyramid = map->pyramid;
+        int state = TURTLE_MAP_PYRAMID_STALE;
+        if ((pyramid == NULL) ||
+            (TURTLE_ATOMIC_LOAD(&pyramid->valid) != state) ||
+            !TURTLE_ATOMIC_CAS(
+                &pyramid->valid, &state, TURTLE_MAP_PYRAMID_BUILDING))
+                return;
+        pyramid_compute(map, pyramid);
+        TURTLE_ATOMIC_STORE(&pyramid->valid, TURTLE_MAP_PYRAMID_VALID);
+}
+
+/* Compute the bounds of all pyramid levels, given their geometry */
+static void pyramid_compute(
+    const struct turtle_map * map, struct turtle_map_pyramid * pyramid)
+{
+        /* Scan the map nodes */
+        const int nx = map->meta.nx, ny = map->meta.ny;
+        const int levels = pyramid->levels;
+        turtle_map_getter_t * get_z = map->meta.get_z;
+        float * zmin = pyramid->level[0].zmin;
+        float * zmax = pyramid->level[0].zmax;
+        int i, j, level;
+        for (j = 0; j < pyramid->level[0].ny; j++) {
+                for (i = 0; i < pyramid->level[0].nx; i++) {
+                        double lo = DBL_MAX, hi = -DBL_MAX;
+                        const int ix0 = i * TURTLE_MAP_CELL;
+                        const int iy0 = j * TURTLE_MAP_CELL;
+                        int ix1 = ix0 + TURTLE_MAP_CELL;
+                        if (ix1 > nx) ix1 = nx;
+                        int iy1 = iy0 + TURTLE_MAP_CELL;
+                        if (iy1 > ny) iy1 = ny;
+                        int ix, iy;
+                        for (iy = iy0; iy < iy1; iy++) {
+                                for (ix = ix0; ix < ix1; ix++) {
+                                        const double z = get_z(map, ix, iy);
+                                        if (z < lo) lo = z;
+                                        if (z > hi) hi = z;
+                                }
+                        }
+                        const size_t k = (size_t)j * pyramid->level[0].nx + i;
+                        zmin[k] = float_lower(lo);
+                        zmax[k] = float_upper(hi);
+                }
+        }
+
+        /* Merge the cells of lower levels */
+        for (level = 1; level < levels; level++) {
+                const int nx0 = pyramid->level[level - 1].nx;
+                const int ny0 = pyramid->level[level - 1].ny;
+                const float * zmin0 = pyramid->level[level - 1].zmin;
+                const float * zmax0 = pyramid->level[level - 1].zmax;
+                zmin = pyramid->level[level].zmin;
+                zmax = pyramid->level[level].zmax;
+                for (j = 0; j < pyramid->level[level].ny; j++) {
+                        for (i = 0; i < pyramid->level[level].nx; i++) {
+                                float lo = FLT_MAX, hi = -FLT_MAX;
+                                int di, dj;
+                                for (dj = 0; dj < 2; dj++) {
+                                        const int j0 = 2 * j + dj;
+                                        if (j0 >= ny0) break;
+                                        for (di = 0; di < 2; di++) {
+                                                const int i0 = 2 * i + di;
+                                                if (i0 >= nx0) break;
+                                                const size_t k =
+                                                    (size_t)j0 * nx0 + i0;
+                                                if (zmin0[k] < lo)
+                                                        lo = zmin0[k];
+                                                if (zmax0[k] > hi)
+                                                        hi = zmax0[k];
+                                        }
+                                }
+                                const size_t k =
+                                    (size_t)j * pyramid->level[level].nx + i;
+                                zmin[k] = lo;
+                                zmax[k] = hi;
+                        }
+                }
+        }
+}
+
+/* Get elevation bounds over a rectangle, using the coarsest pyramid level
+ * where it spans at most 2 x 2 cells
+ */
+int turtle_map_bounds_(const struct turtle_map * map, double x0, double x1,
+    double y0, double y1, double * zmin, double * zmax)
+{
+        const struct turtle_map_pyramid * pyramid = map->pyramid;
+        if ((pyramid == NULL) || (TURTLE_ATOMIC_LOAD(&pyramid->valid) !=
+                                     TURTLE_MAP_PYRAMID_VALID))
+                return 0;
+
+        double hx0 = (x0 - map->meta.x0) / map->meta.dx;
+        double hx1 = (x1 - map->meta.x0) / map->meta.dx;
+        if (hx0 > hx1) {
+                const double tmp = hx0;
+                hx0 = hx1;
+                hx1 = tmp;
+        }
+        double hy0 = (y0 - map->meta.y0) / map->meta.dy;
+        double hy1 = (y1 - map->meta.y0) / map->meta.dy;
+        if (hy0 > hy1) {
+                const double tmp = hy0;
+                hy0 = hy1;
+                hy1 = tmp;
+        }
+        if (!((hx0 >= 0.) && (hx1 <= map->meta.nx - 1) && (hy0 >= 0.) &&
+                (hy1 <= map->meta.ny - 1)))
+                return 0;
+
+        /* Get the cells containing the interpolation nodes */
+        int i0 = (int)hx0 / TURTLE_MAP_CELL;
+        int i1 = (int)ceil(hx1) / TURTLE_MAP_CELL;
+        int j0 = (int)hy0 / TURTLE_MAP_CELL;
+        int j1 = (int)ceil(hy1) / TURTLE_MAP_CELL;
+        int level = 0;
+        while (((i1 - i0 > 1) || (j1 - j0 > 1)) &&
+            (level < pyramid->levels - 1)) {
+                i0 /= 2;
+                i1 /= 2;
+                j0 /= 2;
+                j1 /= 2;
+                level++;
+        }
+
+        float lo = FLT_MAX, hi = -FLT_MAX;
+        const int nx = pyramid->level[level].nx;
+        int i, j;
+        for (j = j0; j <= j1; j++) {
+                for (i = i0; i <= i1; i++) {
+                        const size_t k = (size_t)j * nx + i;
+                        if (pyramid->level[level].zmin[k] < lo)
+                                lo = pyramid->level[level].zmin[k];
+                        if (pyramid->level[level].zmax[k] > hi)
+                                hi = pyramid->level[level].zmax[k];
+                }
+        }
+        *zmin = lo;
+        *zmax = hi;
+        return 1;
+}
+
+/* Load a map from a data file, privately */
+static enum turtle_return map_load(struct turtle_map ** map,
+    const char * path, int options, struct turtle_error_context * error_)
 {
         /* Get an io manager for the file */
         struct turtle_io * io;
@@ -124,21 +941,44 @@ enum turtle_return turtle_map_load_(struct turtle_map ** map, const char * path,
         /* Load the meta data */
         if (io->open(io, path, "rb", error_) != TURTLE_RETURN_SUCCESS)
                 goto exit;
+        const size_t data_size = (io->data_size > 0) ? io->data_size :
+            (size_t)io->meta.nx * io->meta.ny * sizeof(*(*map)->data);
 
-        /* Allocate the map */
-        *map = malloc(
-            sizeof(**map) + io->meta.nx * io->meta.ny * sizeof(*(*map)->data));
-        if (*map == NULL) {
-                TURTLE_ERROR_VREGISTER(TURTLE_RETURN_MEMORY_ERROR,
-                    "could not allocate memory for map `%s'", path);
+#ifndef TURTLE_NO_MMAP
+        if ((options & TURTLE_MAP_LOAD_MMAP) && (io->data_offset >= 0)) {
+                /* Try to map the data file directly to memory. On failure,
+                 * let us fall back to an explicit read.
+                 */
+                *map = map_allocate(0);
+                if (*map == NULL) goto memory_error;
+                memcpy(&(*map)->meta, &io->meta, sizeof((*map)->meta));
+                if (map_mmap(*map, path, io->data_offset, data_size) ==
+                    EXIT_SUCCESS) {
+                        if (options & TURTLE_MAP_LOAD_BLOCK)
+                                map_block(map);
+                        else if (options & TURTLE_MAP_LOAD_NORMALISE)
+                                turtle_map_normalise_(*map);
+                        if (options & TURTLE_MAP_LOAD_PYRAMID)
+                                turtle_map_pyramid_build_(*map);
+                        goto close;
+                }
+                free(*map);
+                *map = NULL;
+        }
+#endif
+        if (options & TURTLE_MAP_LOAD_PAGED) {
+                TURTLE_ERROR_VREGISTER(TURTLE_RETURN_BAD_FORMAT,
+                    "map `%s' cannot be paged", path);
+                io->close(io);
                 goto exit;
         }
 
+        /* Allocate the map */
+        *map = map_allocate((data_size + 1) / sizeof(*(*map)->storage));
+        if (*map == NULL) goto memory_error;
+
         /* Initialise the map data */
         memcpy(&(*map)->meta, &io->meta, sizeof((*map)->meta));
-        (*map)->stack = NULL;
-        memset(&(*map)->element, 0x0, sizeof((*map)->element));
-        (*map)->clients = 0;
 
         /* Load the topography data */
         if (io->read(io, *map, error_) != TURTLE_RETURN_SUCCESS) {
@@ -146,18 +986,54 @@ enum turtle_return turtle_map_load_(struct turtle_map ** map, const char * path,
                 *map = NULL;
                 goto exit;
         }
+        if (options & TURTLE_MAP_LOAD_BLOCK)
+                map_block(map);
+        else if (options & TURTLE_MAP_LOAD_NORMALISE)
+                turtle_map_normalise_(*map);
+        if (options & TURTLE_MAP_LOAD_PYRAMID)
+                turtle_map_pyramid_build_(*map);
 
         /* Finalise the io manager */
+#ifndef TURTLE_NO_MMAP
+close:
+#endif
         io->close(io);
 exit:
         free(io);
         return error_->code;
+
+memory_error:
+        TURTLE_ERROR_VREGISTER(TURTLE_RETURN_MEMORY_ERROR,
+            "could not allocate memory for map `%s'", path);
+        io->close(io);
+        goto exit;
+}
+
+/* Load a map from a data file, shared between processes on request */
+enum turtle_return turtle_map_load_(struct turtle_map ** map, const char * path,
+    int options, struct turtle_error_context * error_)
+{
+#ifndef TURTLE_NO_MMAP
+        if (options & TURTLE_MAP_LOAD_SHARED)
+                return map_load_shared(map, path, options, error_);
+#endif
+        return map_load(map, path, options, error_);
 }
 
 enum turtle_return turtle_map_load(struct turtle_map ** map, const char * path)
 {
         TURTLE_ERROR_INITIALISE(&turtle_map_load);
-        turtle_map_load_(map, path, error_);
+        turtle_map_load_(map, path, TURTLE_MAP_LOAD_DEFAULT, error_);
+        return TURTLE_ERROR_RAISE();
+}
+
+/* Open a map, paging its data in on demand */
+enum turtle_return turtle_map_open(struct turtle_map ** map, const char * path)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_map_open);
+        *map = NULL;
+        turtle_map_load_(map, path,
+            TURTLE_MAP_LOAD_MMAP | TURTLE_MAP_LOAD_PAGED, error_);
         return TURTLE_ERROR_RAISE();
 }
 
@@ -179,6 +1055,45 @@ enum turtle_return turtle_map_dump(
         return TURTLE_ERROR_RAISE();
 }
 
+/* Write a map to disk, from the rows of a user source */
+enum turtle_return turtle_map_write(const char * path,
+    const struct turtle_map_info * info, const char * projection,
+    turtle_map_source_t * source, void * context)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_map_write);
+
+        /* Check the input arguments */
+        if ((info->nx <= 0) || (info->ny <= 0) || (info->z[0] == info->z[1]))
+                return TURTLE_ERROR_MESSAGE(
+                    TURTLE_RETURN_DOMAIN_ERROR, "invalid input parameter(s)");
+
+        struct turtle_map_meta meta;
+        memset(&meta, 0x0, sizeof(meta));
+        if (turtle_projection_configure_(
+                &meta.projection, projection, error_) != TURTLE_RETURN_SUCCESS)
+                return TURTLE_ERROR_RAISE();
+        map_meta_initialise(&meta, info);
+
+        /* Stream the rows to the output file */
+        struct turtle_io * io;
+        if (turtle_io_create_(&io, path, error_) != TURTLE_RETURN_SUCCESS)
+                return TURTLE_ERROR_RAISE();
+        if (io->stream == NULL) {
+                free(io);
+                return TURTLE_ERROR_FORMAT(TURTLE_RETURN_BAD_FORMAT,
+                    "cannot stream to file `%s'", path);
+        }
+        if (io->open(io, path, "wb+", error_) != TURTLE_RETURN_SUCCESS) {
+                free(io);
+                return TURTLE_ERROR_RAISE();
+        }
+        io->stream(io, &meta, source, context, error_);
+        io->close(io);
+        free(io);
+        if (error_->code != TURTLE_RETURN_SUCCESS) remove(path);
+        return TURTLE_ERROR_RAISE();
+}
+
 /* Fill in a map node with an elevation value */
 enum turtle_return turtle_map_fill(
     struct turtle_map * map, int ix, int iy, double elevation)
@@ -190,6 +1105,9 @@ enum turtle_return turtle_map_fill(
         } else if ((ix < 0) || (ix >= map->meta.nx) || (iy < 0) ||
             (iy >= map->meta.ny)) {
                 return TURTLE_ERROR_OUTSIDE_MAP();
+        } else if (map->meta.set_z == NULL) {
+                return TURTLE_ERROR_MESSAGE(
+                    TURTLE_RETURN_BAD_FORMAT, "map data are read only");
         }
 
         if ((map->meta.dz <= 0.) && (elevation != map->meta.z0))
@@ -200,6 +1118,11 @@ enum turtle_return turtle_map_fill(
                 return TURTLE_ERROR_MESSAGE(TURTLE_RETURN_DOMAIN_ERROR,
                     "elevation is outside of map span");
         map->meta.set_z(map, ix, iy, elevation);
+        map->serial = TURTLE_ATOMIC_ADD(&map_serial, 1);
+        if (map->pyramid != NULL) {
+                TURTLE_ATOMIC_STORE(
+                    &map->pyramid->valid, TURTLE_MAP_PYRAMID_STALE);
+        }
 
         return TURTLE_RETURN_SUCCESS;
 }
@@ -225,34 +1148,429 @@ enum turtle_return turtle_map_node(const struct turtle_map * map, int ix,
         return TURTLE_RETURN_SUCCESS;
 }
 
-/* Interpolate the elevation at a given location */
-enum turtle_return turtle_map_elevation_(const struct turtle_map * map,
-    double x, double y, double * z, int * inside,
-    struct turtle_error_context * error_)
+/* Normalise the layout of the map data
+ *
+ * The data are converted to the host byte order with increasing rows. Format
+ * specific getters either flip rows or not. Thus, the logical rows iy and
+ * ny - 1 - iy are always stored in the same pair of physical rows, which are
+ * converted together using a temporary buffer.
+ */
+void turtle_map_normalise_(struct turtle_map * map)
 {
-        if (isnan(x) || isnan(y)) {
-                if (inside != NULL) {
-                        *inside = 0;
-                        return TURTLE_RETURN_SUCCESS;
-                } else {
-                        return TURTLE_ERROR_OUTSIDE_MAP();
+        if ((map->meta.layout != TURTLE_MAP_LAYOUT_RAW) ||
+            (map->meta.normal == TURTLE_MAP_LAYOUT_RAW))
+                return;
+
+        const int nx = map->meta.nx, ny = map->meta.ny;
+        uint16_t * buffer = malloc(2 * nx * sizeof(*buffer));
+        if (buffer == NULL) return; /* The raw layout remains valid */
+
+        const int linear = (map->meta.normal == TURTLE_MAP_LAYOUT_LINEAR);
+        turtle_map_getter_t * get_z = map->meta.get_z;
+        int iy;
+        for (iy = 0; iy < (ny + 1) / 2; iy++) {
+                const int jy = ny - 1 - iy;
+                int ix;
+                for (ix = 0; ix < nx; ix++) {
+                        const double z0 = get_z(map, ix, iy);
+                        const double z1 = get_z(map, ix, jy);
+                        if (linear) {
+                                buffer[ix] = (uint16_t)round(
+                                    (z0 - map->meta.z0) / map->meta.dz);
+                                buffer[nx + ix] = (uint16_t)round(
+                                    (z1 - map->meta.z0) / map->meta.dz);
+                        } else {
+                                buffer[ix] = (uint16_t)(int16_t)z0;
+                                buffer[nx + ix] = (uint16_t)(int16_t)z1;
+                        }
+                }
+                memcpy(map->data + (size_t)iy * nx, buffer,
+                    nx * sizeof(*buffer));
+                memcpy(map->data + (size_t)jy * nx, buffer + nx,
+                    nx * sizeof(*buffer));
+        }
+        free(buffer);
+
+        if (linear) {
+                map->meta.get_z = &get_default_z;
+                map->meta.set_z = &set_default_z;
+        } else {
+                map->meta.get_z = &get_int16_z;
+                map->meta.set_z = &set_int16_z;
+        }
+        map->meta.layout = map->meta.normal;
+}
+
+enum turtle_return turtle_map_normalise(struct turtle_map * map)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_map_normalise);
+        if (map == NULL) {
+                return TURTLE_ERROR_MESSAGE(
+                    TURTLE_RETURN_MEMORY_ERROR, "invalid map");
+        } else if (map->stack != NULL) {
+                return TURTLE_ERROR_MESSAGE(TURTLE_RETURN_DOMAIN_ERROR,
+                    "map is managed by a stack");
+        }
+        turtle_map_normalise_(map);
+        return TURTLE_RETURN_SUCCESS;
+}
+
+/* Convert the map data to a blocked layout
+ *
+ * The blocked data are copied to a new map, padded to full blocks, which
+ * replaces the initial one. On failure, the initial map is left unchanged.
+ */
+static int map_block(struct turtle_map ** map)
+{
+        struct turtle_map * initial = *map;
+        enum turtle_map_layout layout;
+        if (initial->meta.normal == TURTLE_MAP_LAYOUT_LINEAR)
+                layout = TURTLE_MAP_LAYOUT_LINEAR_BLOCKED;
+        else if (initial->meta.normal == TURTLE_MAP_LAYOUT_INT16)
+                layout = TURTLE_MAP_LAYOUT_INT16_BLOCKED;
+        else
+                return EXIT_SUCCESS; /* e.g. compressed data */
+        if (initial->meta.layout >= TURTLE_MAP_LAYOUT_LINEAR_BLOCKED)
+                return EXIT_SUCCESS;
+
+        const int nx = initial->meta.nx, ny = initial->meta.ny;
+        const int nbx = (nx + TURTLE_MAP_BLOCK - 1) / TURTLE_MAP_BLOCK;
+        const int nby = (ny + TURTLE_MAP_BLOCK - 1) / TURTLE_MAP_BLOCK;
+        const size_t n =
+            (size_t)nbx * nby * TURTLE_MAP_BLOCK * TURTLE_MAP_BLOCK;
+        struct turtle_map * blocked = map_allocate(n);
+        if (blocked == NULL) return EXIT_FAILURE;
+        memcpy(&blocked->meta, &initial->meta, sizeof(blocked->meta));
+        memset(blocked->data, 0x0, n * sizeof(*blocked->data));
+
+        /* Copy the data, converting raw ones if needed */
+        const int linear = (layout == TURTLE_MAP_LAYOUT_LINEAR_BLOCKED);
+        turtle_map_getter_t * get_z = initial->meta.get_z;
+        int iy;
+        for (iy = 0; iy < ny; iy++) {
+                int ix;
+                for (ix = 0; ix < nx; ix++) {
+                        uint16_t d;
+                        if (initial->meta.layout == initial->meta.normal) {
+                                d = initial->data[(size_t)iy * nx + ix];
+                        } else if (linear) {
+                                d = (initial->meta.dz > 0.) ?
+                                    (uint16_t)round((get_z(initial, ix, iy) -
+                                                        initial->meta.z0) /
+                                        initial->meta.dz) :
+                                    0;
+                        } else {
+                                d = (uint16_t)(int16_t)get_z(initial, ix, iy);
+                        }
+                        blocked->data[map_block_index(blocked, ix, iy)] = d;
+                }
+        }
+
+        if (linear) {
+                blocked->meta.get_z = &get_blocked_z;
+                blocked->meta.set_z = &set_blocked_z;
+        } else {
+                blocked->meta.get_z = &get_int16_blocked_z;
+                blocked->meta.set_z = &set_int16_blocked_z;
+        }
+        blocked->meta.layout = layout;
+
+        turtle_map_destroy(map);
+        *map = blocked;
+        return EXIT_SUCCESS;
+}
+
+enum turtle_return turtle_map_block(struct turtle_map ** map)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_map_block);
+        if ((map == NULL) || (*map == NULL)) {
+                return TURTLE_ERROR_MESSAGE(
+                    TURTLE_RETURN_MEMORY_ERROR, "invalid map");
+        } else if ((*map)->stack != NULL) {
+                return TURTLE_ERROR_MESSAGE(TURTLE_RETURN_DOMAIN_ERROR,
+                    "map is managed by a stack");
+        }
+        if (map_block(map) != EXIT_SUCCESS) return TURTLE_ERROR_MEMORY();
+        return TURTLE_RETURN_SUCCESS;
+}
+
+/* Number of samples per side of a map, when bounding it in geodetic
+ * coordinates
+ */
+#define REPROJECT_SAMPLES 32
+
+/* Shared data of a reprojection. Rows are resampled concurrently, taking
+ * them in turn
+ */
+struct map_reproject {
+        const struct turtle_map * map;
+        struct turtle_map * geodetic;
+        int next;
+        int workers;
+        double * buffers;
+        int * inside;
+        struct turtle_error_context * errors;
+};
+
+/* Resample the rows of the geodetic map until all are done */
+static void * reproject_run(void * arg)
+{
+        struct map_reproject * reproject = arg;
+        const struct turtle_map * map = reproject->map;
+        struct turtle_map * geodetic = reproject->geodetic;
+        const int nx = geodetic->meta.nx;
+        const int worker = TURTLE_ATOMIC_ADD(&reproject->workers, 1) - 1;
+        double * latitude = reproject->buffers + 5 * worker * (size_t)nx;
+        double * longitude = latitude + nx;
+        double * x = longitude + nx;
+        double * y = x + nx;
+        double * z = y + nx;
+        int * inside = reproject->inside + worker * (size_t)nx;
+        struct turtle_error_context * error_ = reproject->errors + worker;
+        const double x1 = map->meta.x0 + (map->meta.nx - 1) * map->meta.dx;
+        const double y1 = map->meta.y0 + (map->meta.ny - 1) * map->meta.dy;
+
+        int ix;
+        for (ix = 0; ix < nx; ix++) {
+                longitude[ix] = geodetic->meta.x0 + ix * geodetic->meta.dx;
+        }
+        for (;;) {
+                const int iy = TURTLE_ATOMIC_ADD(&reproject->next, 1) - 1;
+                if (iy >= geodetic->meta.ny) break;
+
+                const double lat = geodetic->meta.y0 + iy * geodetic->meta.dy;
+                for (ix = 0; ix < nx; ix++) latitude[ix] = lat;
+                turtle_projection_project_v(
+                    &map->meta.projection, nx, latitude, longitude, x, y);
+
+                /* Nodes are inside of the projected map, see
+                 * `reproject_shrink`, up to rounding errors. Thus, they are
+                 * clamped to it
+                 */
+                for (ix = 0; ix < nx; ix++) {
+                        if (x[ix] < map->meta.x0) x[ix] = map->meta.x0;
+                        else if (x[ix] > x1) x[ix] = x1;
+                        if (y[ix] < map->meta.y0) y[ix] = map->meta.y0;
+                        else if (y[ix] > y1) y[ix] = y1;
+                }
+                if (turtle_map_elevation_v_(map, nx, x, y, z, inside,
+                        error_) != TURTLE_RETURN_SUCCESS)
+                        break;
+
+                uint16_t * data = geodetic->data + (size_t)iy * nx;
+                for (ix = 0; ix < nx; ix++) {
+                        const double d = round(
+                            (z[ix] - geodetic->meta.z0) / geodetic->meta.dz);
+                        data[ix] = (d <= 0.) ? 0 :
+                            (d >= 65535.) ? 65535 : (uint16_t)d;
                 }
         }
+        return NULL;
+}
+
+/* Get the largest geodetic box inside of a projected map, and the node
+ * spacing matching its centre
+ */
+static void reproject_box(const struct turtle_map * map, double * box,
+    double * latitude_delta, double * longitude_delta)
+{
+        const struct turtle_projection * projection = &map->meta.projection;
+        const double x0 = map->meta.x0, y0 = map->meta.y0;
+        const double lx = (map->meta.nx - 1) * map->meta.dx;
+        const double ly = (map->meta.ny - 1) * map->meta.dy;
+
+        /* The box is bounded by the inner extrema of the map sides */
+        box[0] = box[2] = -DBL_MAX;
+        box[1] = box[3] = DBL_MAX;
+        int i;
+        for (i = 0; i <= REPROJECT_SAMPLES; i++) {
+                const double u = i / (double)REPROJECT_SAMPLES;
+                double latitude, longitude;
+                turtle_projection_unproject(
+                    projection, x0 + u * lx, y0, &latitude, &longitude);
+                if (latitude > box[0]) box[0] = latitude;
+                turtle_projection_unproject(
+                    projection, x0 + u * lx, y0 + ly, &latitude, &longitude);
+                if (latitude < box[1]) box[1] = latitude;
+                turtle_projection_unproject(
+                    projection, x0, y0 + u * ly, &latitude, &longitude);
+                if (longitude > box[2]) box[2] = longitude;
+                turtle_projection_unproject(
+                    projection, x0 + lx, y0 + u * ly, &latitude, &longitude);
+                if (longitude < box[3]) box[3] = longitude;
+        }
+
+        /* Geodetic steps of the central nodes */
+        const double xc = x0 + 0.5 * lx, yc = y0 + 0.5 * ly;
+        double latitude, longitude, latitude_x, longitude_x, latitude_y,
+            longitude_y;
+        turtle_projection_unproject(projection, xc, yc, &latitude, &longitude);
+        turtle_projection_unproject(
+            projection, xc + map->meta.dx, yc, &latitude_x, &longitude_x);
+        turtle_projection_unproject(
+            projection, xc, yc + map->meta.dy, &latitude_y, &longitude_y);
+        *latitude_delta = fabs(latitude_y - latitude);
+        *longitude_delta = fabs(longitude_x - longitude);
+}
+
+/* Check if a geodetic node projects inside of a map */
+static int reproject_inside(
+    const struct turtle_map * map, double latitude, double longitude)
+{
+        double x, y;
+        turtle_projection_project(
+            &map->meta.projection, latitude, longitude, &x, &y);
+        const double x1 = map->meta.x0 + (map->meta.nx - 1) * map->meta.dx;
+        const double y1 = map->meta.y0 + (map->meta.ny - 1) * map->meta.dy;
+        return (x >= map->meta.x0) && (x <= x1) && (y >= map->meta.y0) &&
+            (y <= y1);
+}
+
+/* Shrink a geodetic grid until all its boundary nodes project inside of the
+ * map. Since the box is bounded from a sampling of the map sides, nodes in
+ * between samples might lie slightly outside. Returns `EXIT_FAILURE` if the
+ * grid gets empty
+ */
+static int reproject_shrink(const struct turtle_map * map, double * box,
+    double latitude_delta, double longitude_delta, int * nx, int * ny)
+{
+        for (;;) {
+                if ((*nx < 2) || (*ny < 2)) return EXIT_FAILURE;
+                const double latitude_1 = box[0] + (*ny - 1) * latitude_delta;
+                const double longitude_1 =
+                    box[2] + (*nx - 1) * longitude_delta;
+                int south = 0, north = 0, west = 0, east = 0;
+                int i;
+                for (i = 0; i < *nx; i++) {
+                        const double longitude = box[2] + i * longitude_delta;
+                        if (!reproject_inside(map, box[0], longitude))
+                                south = 1;
+                        if (!reproject_inside(map, latitude_1, longitude))
+                                north = 1;
+                }
+                for (i = 0; i < *ny; i++) {
+                        const double latitude = box[0] + i * latitude_delta;
+                        if (!reproject_inside(map, latitude, box[2]))
+                                west = 1;
+                        if (!reproject_inside(map, latitude, longitude_1))
+                                east = 1;
+                }
+                if (!(south || north || west || east)) return EXIT_SUCCESS;
+
+                if (south) box[0] += latitude_delta;
+                if (west) box[2] += longitude_delta;
+                *ny -= south + north;
+                *nx -= west + east;
+        }
+}
+
+/* Resample a projected map over a geodetic grid */
+enum turtle_return turtle_map_reproject(struct turtle_map ** geodetic,
+    const struct turtle_map * map, double resolution, int threads)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_map_reproject);
+        *geodetic = NULL;
+
+        if (map->meta.projection.type == PROJECTION_NONE)
+                return TURTLE_ERROR_MESSAGE(
+                    TURTLE_RETURN_BAD_PROJECTION, "map is not projected");
+        else if ((map->meta.nx < 2) || (map->meta.ny < 2) ||
+            !(resolution == resolution))
+                return TURTLE_ERROR_MESSAGE(
+                    TURTLE_RETURN_DOMAIN_ERROR, "invalid input parameter(s)");
+
+        /* Get the geodetic grid */
+        double box[4], latitude_delta, longitude_delta;
+        reproject_box(map, box, &latitude_delta, &longitude_delta);
+        if (resolution > 0.) latitude_delta = longitude_delta = resolution;
+        const double fy = (box[1] - box[0]) / latitude_delta;
+        const double fx = (box[3] - box[2]) / longitude_delta;
+        if (!(fx >= 1.) || !(fy >= 1.) || ((fx + 1.) * (fy + 1.) > INT_MAX))
+                return TURTLE_ERROR_MESSAGE(TURTLE_RETURN_DOMAIN_ERROR,
+                    "invalid geodetic grid");
+        int nx = (int)fx + 1;
+        int ny = (int)fy + 1;
+        if (reproject_shrink(map, box, latitude_delta, longitude_delta, &nx,
+                &ny) != EXIT_SUCCESS)
+                return TURTLE_ERROR_MESSAGE(TURTLE_RETURN_DOMAIN_ERROR,
+                    "invalid geodetic grid");
+
+        /* Allocate the geodetic map. The elevation values are digitised as
+         * for the initial map
+         */
+        struct map_reproject reproject = { .map = map };
+        if (threads < 1) threads = 1;
+        else if (threads > ny) threads = ny;
+        reproject.errors = calloc(threads, sizeof(*reproject.errors));
+        reproject.buffers = malloc((size_t)threads * nx *
+            (5 * sizeof(*reproject.buffers) + sizeof(*reproject.inside)));
+        struct turtle_map * g = map_allocate((size_t)nx * ny);
+        if ((reproject.errors == NULL) || (reproject.buffers == NULL) ||
+            (g == NULL)) {
+                free(reproject.errors);
+                free(reproject.buffers);
+                free(g);
+                return TURTLE_ERROR_MEMORY();
+        }
+        reproject.inside =
+            (int *)(reproject.buffers + 5 * (size_t)threads * nx);
+        g->meta.nx = nx;
+        g->meta.ny = ny;
+        g->meta.x0 = box[2];
+        g->meta.y0 = box[0];
+        g->meta.dx = longitude_delta;
+        g->meta.dy = latitude_delta;
+        if (map->meta.dz > 0.) {
+                g->meta.z0 = map->meta.z0;
+                g->meta.dz = map->meta.dz;
+        } else {
+                g->meta.z0 = -32767.;
+                g->meta.dz = 1.;
+        }
+        g->meta.get_z = &get_default_z;
+        g->meta.set_z = &set_default_z;
+        g->meta.layout = g->meta.normal = TURTLE_MAP_LAYOUT_LINEAR;
+        strcpy(g->meta.encoding, "none");
+        turtle_projection_configure_(&g->meta.projection, NULL, error_);
+        reproject.geodetic = g;
 
+        /* Resample the rows. The calling thread takes part in the work.
+         * Each worker has its own error context
+         */
+        int i;
+        for (i = 0; i < threads; i++) {
+                reproject.errors[i].function =
+                    (turtle_function_t *)&turtle_map_reproject;
+        }
+        turtle_parallel_run_(threads, &reproject_run, &reproject);
+        free(reproject.buffers);
+
+        /* Forward the first error, if any */
+        turtle_error_forward_(error_, reproject.errors, threads);
+        free(reproject.errors);
+        if (error_->code != TURTLE_RETURN_SUCCESS) {
+                turtle_map_destroy(&g);
+                return TURTLE_ERROR_RAISE();
+        }
+
+        *geodetic = g;
+        return TURTLE_RETURN_SUCCESS;
+}
+
+/* Bilinear interpolation kernel. Returns `0` if the location is outside of
+ * the map, including NaN coordinates
+ */
+static inline int map_interpolate(const struct turtle_map * map,
+    turtle_map_getter_t * get_z, double x, double y, double * z)
+{
         double hx = (x - map->meta.x0) / map->meta.dx;
         double hy = (y - map->meta.y0) / map->meta.dy;
+        if (!((hx >= 0.) && (hx <= map->meta.nx - 1) && (hy >= 0.) &&
+                (hy <= map->meta.ny - 1)))
+                return 0;
+
         int ix = (int)hx;
         int iy = (int)hy;
-
-        if ((hx > map->meta.nx - 1) || (hx < 0) ||
-            (hy > map->meta.ny - 1) || (hy < 0)) {
-                if (inside != NULL) {
-                        *inside = 0;
-                        return TURTLE_RETURN_SUCCESS;
-                } else {
-                        return TURTLE_ERROR_OUTSIDE_MAP();
-                }
-        }
         if (ix == map->meta.nx - 1) {
                 ix--;
                 hx = 1.;
@@ -264,7 +1582,6 @@ enum turtle_return turtle_map_elevation_(const struct turtle_map * map,
         } else
                 hy -= iy;
 
-        turtle_map_getter_t * get_z = map->meta.get_z;
         const double z00 = get_z(map, ix, iy);
         const double z10 = get_z(map, ix + 1, iy);
         const double z01 = get_z(map, ix, iy + 1);
@@ -272,38 +1589,116 @@ enum turtle_return turtle_map_elevation_(const struct turtle_map * map,
         *z = z00 * (1. - hx) * (1. - hy) + z01 * (1. - hx) * hy +
             z10 * hx * (1. - hy) + z11 * hx * hy;
 
-        if (inside != NULL) *inside = 1;
-        return TURTLE_RETURN_SUCCESS;
+        return 1;
 }
 
-/* Compute the gradient at a given location */
-enum turtle_return turtle_map_gradient_(const struct turtle_map * map,
-    double x, double y, double * gx, double * gy, int * inside,
+/* Interpolate the elevation at a given location */
+enum turtle_return turtle_map_elevation_(const struct turtle_map * map,
+    double x, double y, double * z, int * inside,
     struct turtle_error_context * error_)
 {
-        if (isnan(x) || isnan(y)) {
-                if (inside != NULL) {
-                        *inside = 0;
-                        return TURTLE_RETURN_SUCCESS;
-                } else {
-                        return TURTLE_ERROR_OUTSIDE_MAP();
+        int valid;
+        if (map->meta.layout == TURTLE_MAP_LAYOUT_LINEAR)
+                valid = map_interpolate(map, &get_default_z, x, y, z);
+        else if (map->meta.layout == TURTLE_MAP_LAYOUT_INT16)
+                valid = map_interpolate(map, &get_int16_z, x, y, z);
+        else if (map->meta.layout == TURTLE_MAP_LAYOUT_LINEAR_BLOCKED)
+                valid = map_interpolate(map, &get_blocked_z, x, y, z);
+        else if (map->meta.layout == TURTLE_MAP_LAYOUT_INT16_BLOCKED)
+                valid = map_interpolate(map, &get_int16_blocked_z, x, y, z);
+        else
+                valid = map_interpolate(map, map->meta.get_z, x, y, z);
+        if (inside != NULL) {
+                *inside = valid;
+                return TURTLE_RETURN_SUCCESS;
+        } else if (!valid) {
+                return TURTLE_ERROR_OUTSIDE_MAP();
+        }
+        return TURTLE_RETURN_SUCCESS;
+}
+
+/* Interpolation loop over arrays of locations. The getter is provided as an
+ * argument in order to let the compiler inline known ones. Returns the index
+ * of the first location outside of the map, when not checking the bounds, or
+ * `n` otherwise
+ */
+static inline int map_elevation_loop(const struct turtle_map * map,
+    turtle_map_getter_t * get_z, int n, const double * x, const double * y,
+    double * z, int * inside)
+{
+        int i;
+        for (i = 0; i < n; i++) {
+                const int valid =
+                    map_interpolate(map, get_z, x[i], y[i], z + i);
+                if (!valid) {
+                        z[i] = 0.;
+                        if (inside == NULL) return i;
                 }
+                if (inside != NULL) inside[i] = valid;
         }
+        return n;
+}
 
+/* Interpolate the elevation over arrays of locations */
+enum turtle_return turtle_map_elevation_v_(const struct turtle_map * map,
+    int n, const double * x, const double * y, double * z, int * inside,
+    struct turtle_error_context * error_)
+{
+        int m;
+        if (map->meta.layout == TURTLE_MAP_LAYOUT_LINEAR)
+                m = map_elevation_loop(
+                    map, &get_default_z, n, x, y, z, inside);
+        else if (map->meta.layout == TURTLE_MAP_LAYOUT_INT16)
+                m = map_elevation_loop(map, &get_int16_z, n, x, y, z, inside);
+        else if (map->meta.layout == TURTLE_MAP_LAYOUT_LINEAR_BLOCKED)
+                m = map_elevation_loop(
+                    map, &get_blocked_z, n, x, y, z, inside);
+        else if (map->meta.layout == TURTLE_MAP_LAYOUT_INT16_BLOCKED)
+                m = map_elevation_loop(
+                    map, &get_int16_blocked_z, n, x, y, z, inside);
+        else
+                m = map_elevation_loop(
+                    map, map->meta.get_z, n, x, y, z, inside);
+
+        if (m < n) return TURTLE_ERROR_OUTSIDE_MAP();
+        return TURTLE_RETURN_SUCCESS;
+}
+
+/* Count the leading locations that are strictly inside of the map, i.e.
+ * excluding its upper bounds
+ */
+int turtle_map_run_(
+    const struct turtle_map * map, int n, const double * x, const double * y)
+{
+        const double x0 = map->meta.x0, dx = map->meta.dx;
+        const double y0 = map->meta.y0, dy = map->meta.dy;
+        const int nx = map->meta.nx - 1, ny = map->meta.ny - 1;
+        int i;
+        for (i = 0; i < n; i++) {
+                const double hx = (x[i] - x0) / dx;
+                const double hy = (y[i] - y0) / dy;
+                if (!((hx >= 0.) && (hx < nx) && (hy >= 0.) && (hy < ny)))
+                        break;
+        }
+        return i;
+}
+
+/* Gradient kernel, fused with the bilinear interpolation of the elevation
+ * if `z` is not `NULL`. Returns `0` if the location is outside of the map,
+ * including NaN coordinates
+ */
+static inline int map_gradient(const struct turtle_map * map,
+    turtle_map_getter_t * get_z, double x, double y, double * z, double * gx,
+    double * gy)
+{
         double hx = (x - map->meta.x0) / map->meta.dx;
         double hy = (y - map->meta.y0) / map->meta.dy;
+        if (!((hx >= 0.) && (hx <= map->meta.nx - 1) && (hy >= 0.) &&
+                (hy <= map->meta.ny - 1)))
+                return 0;
+
         int ix = (int)hx;
         int iy = (int)hy;
-
-        if ((hx > map->meta.nx - 1) || (hx < 0) ||
-            (hy > map->meta.ny - 1) || (hy < 0)) {
-                if (inside != NULL) {
-                        *inside = 0;
-                        return TURTLE_RETURN_SUCCESS;
-                } else {
-                        return TURTLE_ERROR_OUTSIDE_MAP();
-                }
-        }
         if (ix == map->meta.nx - 1) {
                 ix--;
                 hx = 1.;
@@ -315,11 +1710,14 @@ enum turtle_return turtle_map_gradient_(const struct turtle_map * map,
         } else
                 hy -= iy;
 
-        turtle_map_getter_t * get_z = map->meta.get_z;
         const double z00 = get_z(map, ix, iy);
         const double z10 = get_z(map, ix + 1, iy);
         const double z01 = get_z(map, ix, iy + 1);
         const double z11 = get_z(map, ix + 1, iy + 1);
+        if (z != NULL) {
+                *z = z00 * (1. - hx) * (1. - hy) + z01 * (1. - hx) * hy +
+                    z10 * hx * (1. - hy) + z11 * hx * hy;
+        }
 
         if (hx <= 0.5) {
                 const double gx1 = (z10 - z00) * (1. - hy) + (z11 - z01) * hy;
@@ -350,7 +1748,7 @@ enum turtle_return turtle_map_gradient_(const struct turtle_map * map,
         if (hy <= 0.5) {
                 const double gy1 = (z01 - z00) * (1. - hx) + (z11 - z10) * hx;
                 if (iy == 0) {
-                        *gx = gy1 / map->meta.dy;
+                        *gy = gy1 / map->meta.dy;
                 } else {
                         const double z0_1 = get_z(map, ix, iy - 1);
                         const double z1_1 = get_z(map, ix + 1, iy - 1);
@@ -373,10 +1771,47 @@ enum turtle_return turtle_map_gradient_(const struct turtle_map * map,
                 }
         }
 
-        if (inside != NULL) *inside = 1;
+        return 1;
+}
+
+/* Compute the elevation, if `z` is not `NULL`, and the gradient at a given
+ * location, from a single fetch of the interpolation nodes
+ */
+enum turtle_return turtle_map_elevation_gradient_(
+    const struct turtle_map * map, double x, double y, double * z,
+    double * gx, double * gy, int * inside,
+    struct turtle_error_context * error_)
+{
+        int valid;
+        if (map->meta.layout == TURTLE_MAP_LAYOUT_LINEAR)
+                valid = map_gradient(map, &get_default_z, x, y, z, gx, gy);
+        else if (map->meta.layout == TURTLE_MAP_LAYOUT_INT16)
+                valid = map_gradient(map, &get_int16_z, x, y, z, gx, gy);
+        else if (map->meta.layout == TURTLE_MAP_LAYOUT_LINEAR_BLOCKED)
+                valid = map_gradient(map, &get_blocked_z, x, y, z, gx, gy);
+        else if (map->meta.layout == TURTLE_MAP_LAYOUT_INT16_BLOCKED)
+                valid = map_gradient(
+                    map, &get_int16_blocked_z, x, y, z, gx, gy);
+        else
+                valid = map_gradient(map, map->meta.get_z, x, y, z, gx, gy);
+        if (inside != NULL) {
+                *inside = valid;
+                return TURTLE_RETURN_SUCCESS;
+        } else if (!valid) {
+                return TURTLE_ERROR_OUTSIDE_MAP();
+        }
         return TURTLE_RETURN_SUCCESS;
 }
 
+/* Compute the gradient at a given location */
+enum turtle_return turtle_map_gradient_(const struct turtle_map * map,
+    double x, double y, double * gx, double * gy, int * inside,
+    struct turtle_error_context * error_)
+{
+        return turtle_map_elevation_gradient_(
+            map, x, y, NULL, gx, gy, inside, error_);
+}
+
 enum turtle_return turtle_map_elevation(
     const struct turtle_map * map, double x, double y, double * z, int * inside)
 {
@@ -384,13 +1819,187 @@ enum turtle_return turtle_map_elevation(
         return turtle_map_elevation_(map, x, y, z, inside, error_);
 }
 
+enum turtle_return turtle_map_elevation_v(const struct turtle_map * map,
+    int n, const double * x, const double * y, double * elevation,
+    int * inside)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_map_elevation_v);
+        return turtle_map_elevation_v_(map, n, x, y, elevation, inside, error_);
+}
+
 enum turtle_return turtle_map_gradient(const struct turtle_map * map,
     double x, double y, double * gx, double * gy, int * inside)
 {
-        TURTLE_ERROR_INITIALISE(&turtle_map_elevation);
+        TURTLE_ERROR_INITIALISE(&turtle_map_gradient);
         return turtle_map_gradient_(map, x, y, gx, gy, inside, error_);
 }
 
+enum turtle_return turtle_map_elevation_gradient(
+    const struct turtle_map * map, double x, double y, double * z,
+    double * gx, double * gy, int * inside)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_map_elevation_gradient);
+        return turtle_map_elevation_gradient_(
+            map, x, y, z, gx, gy, inside, error_);
+}
+
+/* Sign of the height of the ray above the bilinear patch of a cell */
+static inline int patch_sign(double a, double b, double c, double u)
+{
+        const double f = a + u * (b + u * c);
+        return (f > 0.) ? 1 : ((f < 0.) ? -1 : 0);
+}
+
+/* Intersect a straight ray with the map. Cells are traversed with a DDA and
+ * the crossings with the bilinear patch of each cell are solved for
+ * analytically, as roots of a quadratic polynomial. A crossing is recorded
+ * when the sign of the ray height w.r.t. the surface changes, thus grazing
+ * rays are not counted
+ */
+enum turtle_return turtle_map_intersect(const struct turtle_map * map,
+    const double * position, const double * direction, double range, int n,
+    double * distance, int * count)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_map_intersect);
+        *count = 0;
+
+        int i;
+        for (i = 0; i < 3; i++) {
+                if (!isfinite(position[i]) || !isfinite(direction[i])) {
+                        return TURTLE_ERROR_MESSAGE(
+                            TURTLE_RETURN_DOMAIN_ERROR, "invalid ray");
+                }
+        }
+        if ((n <= 0) || (map->meta.nx < 2) || (map->meta.ny < 2))
+                return TURTLE_RETURN_SUCCESS;
+
+        /* Clip the ray to the map domain, in units of node indices */
+        const int nx = map->meta.nx, ny = map->meta.ny;
+        const double hx0 = (position[0] - map->meta.x0) / map->meta.dx;
+        const double hy0 = (position[1] - map->meta.y0) / map->meta.dy;
+        const double px = direction[0] / map->meta.dx;
+        const double py = direction[1] / map->meta.dy;
+        double t0 = 0., t1 = range;
+        const double h0[2] = { hx0, hy0 }, p[2] = { px, py };
+        const int hmax[2] = { nx - 1, ny - 1 };
+        for (i = 0; i < 2; i++) {
+                if (p[i] == 0.) {
+                        if ((h0[i] < 0.) || (h0[i] > hmax[i]))
+                                return TURTLE_RETURN_SUCCESS;
+                } else {
+                        double ta = -h0[i] / p[i];
+                        double tb = (hmax[i] - h0[i]) / p[i];
+                        if (ta > tb) {
+                                const double tmp = ta;
+                                ta = tb;
+                                tb = tmp;
+                        }
+                        if (ta > t0) t0 = ta;
+                        if (tb < t1) t1 = tb;
+                }
+        }
+        if (!(t0 <= t1)) return TURTLE_RETURN_SUCCESS;
+
+        /* Locate the entry cell */
+        int ix = (int)floor(hx0 + px * t0);
+        if (ix < 0) ix = 0;
+        else if (ix > nx - 2) ix = nx - 2;
+        int iy = (int)floor(hy0 + py * t0);
+        if (iy < 0) iy = 0;
+        else if (iy > ny - 2) iy = ny - 2;
+        const int sx = (px > 0.) ? 1 : -1;
+        const int sy = (py > 0.) ? 1 : -1;
+
+        /* Traverse the cells */
+        turtle_map_getter_t * get_z = map->meta.get_z;
+        int state = 0;
+        double t = t0;
+        for (;;) {
+                /* Get the ray parameter at the cell exit */
+                double tx = DBL_MAX, ty = DBL_MAX;
+                if (px != 0.) tx = (ix + (sx > 0) - hx0) / px;
+                if (py != 0.) ty = (iy + (sy > 0) - hy0) / py;
+                double tc = (tx < ty) ? tx : ty;
+                if (tc > t1) tc = t1;
+                const double length = (tc > t) ? tc - t : 0.;
+
+                /* Height of the ray above the bilinear patch, as a quadratic
+                 * polynomial of the distance u to the cell entry
+                 */
+                const double z00 = get_z(map, ix, iy);
+                const double z10 = get_z(map, ix + 1, iy);
+                const double z01 = get_z(map, ix, iy + 1);
+                const double z11 = get_z(map, ix + 1, iy + 1);
+                const double b = z10 - z00, c = z01 - z00;
+                const double d = z00 - z10 - z01 + z11;
+                const double x0 = hx0 + px * t - ix;
+                const double y0 = hy0 + py * t - iy;
+                const double fc = position[2] + direction[2] * t -
+                    (z00 + b * x0 + c * y0 + d * x0 * y0);
+                const double fb = direction[2] -
+                    (b * px + c * py + d * (x0 * py + y0 * px));
+                const double fa = -d * px * py;
+
+                /* Get the roots within the cell, sorted */
+                double u[4];
+                int m = 0;
+                u[m++] = 0.;
+                if (fa != 0.) {
+                        const double delta = fb * fb - 4. * fa * fc;
+                        if (delta > 0.) {
+                                const double sq = sqrt(delta);
+                                const double q = (fb >= 0.) ?
+                                    -0.5 * (fb + sq) : -0.5 * (fb - sq);
+                                double r1 = q / fa;
+                                double r2 = (q != 0.) ? fc / q : r1;
+                                if (r1 > r2) {
+                                        const double tmp = r1;
+                                        r1 = r2;
+                                        r2 = tmp;
+                                }
+                                if ((r1 > 0.) && (r1 < length)) u[m++] = r1;
+                                if ((r2 > 0.) && (r2 < length) &&
+                                    (r2 > u[m - 1]))
+                                        u[m++] = r2;
+                        }
+                } else if (fb != 0.) {
+                        const double r = -fc / fb;
+                        if ((r > 0.) && (r < length)) u[m++] = r;
+                }
+                u[m++] = length;
+
+                /* Record the sign changes between the intervals */
+                int k;
+                for (k = 0; k < m - 1; k++) {
+                        const double mid = 0.5 * (u[k] + u[k + 1]);
+                        const int s = (length > 0.) ?
+                            patch_sign(fc, fb, fa, mid) :
+                            patch_sign(fc, fb, fa, 0.);
+                        if (s == 0) continue;
+                        if ((state != 0) && (s != state)) {
+                                distance[(*count)++] = t + u[k];
+                                if (*count == n)
+                                        return TURTLE_RETURN_SUCCESS;
+                        }
+                        state = s;
+                }
+
+                /* Move to the next cell */
+                if (tc >= t1) break;
+                t = tc;
+                if (tx <= ty) {
+                        ix += sx;
+                        if ((ix < 0) || (ix > nx - 2)) break;
+                }
+                if (ty <= tx) {
+                        iy += sy;
+                        if ((iy < 0) || (iy > ny - 2)) break;
+                }
+        }
+
+        return TURTLE_RETURN_SUCCESS;
+}
+
 const struct turtle_projection * turtle_map_projection(
     const struct turtle_map * map)
 {
@@ -25,6 +25,7 @@
 #define TURTLE_MAP_H
 
 /* C89 standard library */
+#include <stddef.h>
 #include <stdint.h>
 /* Turtle library */
 #include "turtle/list.h"
@@ -37,6 +38,56 @@ typedef double turtle_map_getter_t(
 typedef void turtle_map_setter_t(
     struct turtle_map * map, int ix, int iy, double z);
 
+/* Layouts of the elevation data in memory. Normalised layouts use the host
+ * byte order and increasing rows, such that they can be interpolated with
+ * specialised kernels
+ */
+enum turtle_map_layout {
+        /* Format specific layout, accessed through the getter only */
+        TURTLE_MAP_LAYOUT_RAW = 0,
+        /* Unsigned data, linearly mapped to elevation values */
+        TURTLE_MAP_LAYOUT_LINEAR,
+        /* Signed data, directly giving elevation values */
+        TURTLE_MAP_LAYOUT_INT16,
+        /* Blocked counterparts of the previous layouts. The data are stored
+         * by blocks of TURTLE_MAP_BLOCK x TURTLE_MAP_BLOCK nodes, in row major
+         * order, such that neighbouring nodes share cache lines
+         */
+        TURTLE_MAP_LAYOUT_LINEAR_BLOCKED,
+        TURTLE_MAP_LAYOUT_INT16_BLOCKED
+};
+
+/* Size of data blocks, i.e. 8 x 8 nodes spanning two cache lines */
+#define TURTLE_MAP_BLOCK 8
+
+/* Pyramid of elevation bounds over cells of nodes. At level 0, cells are
+ * made of TURTLE_MAP_CELL x TURTLE_MAP_CELL nodes. Their size doubles at
+ * each level, up to a single cell covering the whole map. Bounds are stored
+ * as floats, rounded outwards
+ */
+#define TURTLE_MAP_CELL 16
+#define TURTLE_MAP_LEVELS 32
+
+enum turtle_map_pyramid_state {
+        /* The map data were modified since the pyramid was built */
+        TURTLE_MAP_PYRAMID_STALE = 0,
+        TURTLE_MAP_PYRAMID_VALID,
+        /* The pyramid is being rebuilt, by another thread */
+        TURTLE_MAP_PYRAMID_BUILDING
+};
+
+struct turtle_map_pyramid {
+        int valid; /* See `turtle_map_pyramid_state` */
+        int levels;
+        struct {
+                int nx, ny;
+                float * zmin;
+                float * zmax;
+        } level[TURTLE_MAP_LEVELS];
+        size_t size; /* In bytes */
+        float data[];
+};
+
 /* Header container for map meta data */
 struct turtle_map_meta {
         /* Map meta data */
@@ -48,6 +99,10 @@ struct turtle_map_meta {
         turtle_map_getter_t * get_z;
         turtle_map_setter_t * set_z;
 
+        /* Current data layout and its normalised counterpart */
+        enum turtle_map_layout layout;
+        enum turtle_map_layout normal;
+
         /* Data encoding format */
         char encoding[8];
 
@@ -65,20 +120,128 @@ struct turtle_map {
         /* Stack data */
         struct turtle_stack * stack;
         int clients;
+        int index; /* Grid cell index in the stack, or -1 */
+        unsigned long stamp; /* Last access time, in stack clock units */
+        unsigned long hits;  /* Number of accesses through the stack */
 
-        /* Placeholder for raw elevation data */
-        uint16_t data[];
+        /* Unique identifier of the map, e.g. for caching decoded data */
+        unsigned long serial;
+
+        /* Memory mapping of the data file, if any */
+        void * mapping;
+        size_t mapping_size;
+
+        /* Raw elevation data, either stored in place or memory mapped */
+        uint16_t * data;
+        size_t data_size; /* In bytes */
+
+        /* Elevation bounds, if built */
+        struct turtle_map_pyramid * pyramid;
+
+        /* Header of the shared memory segment holding the data, if any */
+        struct turtle_map_segment * segment;
+
+        /* Placeholder for in place elevation data */
+        uint16_t storage[];
+};
+
+/* Options for loading maps */
+enum turtle_map_load_option {
+        TURTLE_MAP_LOAD_DEFAULT = 0,
+        /* Memory map the data file instead of reading it, when possible */
+        TURTLE_MAP_LOAD_MMAP = 1 << 0,
+        /* Normalise the data layout after loading */
+        TURTLE_MAP_LOAD_NORMALISE = 1 << 1,
+        /* Convert the data to a blocked layout after loading */
+        TURTLE_MAP_LOAD_BLOCK = 1 << 2,
+        /* Build the pyramid of elevation bounds after loading */
+        TURTLE_MAP_LOAD_PYRAMID = 1 << 3,
+        /* Share the decoded data between processes, using POSIX shared
+         * memory
+         */
+        TURTLE_MAP_LOAD_SHARED = 1 << 4,
+        /* Require the data to be memory mapped, i.e. paged in on demand,
+         * without falling back to an explicit read
+         */
+        TURTLE_MAP_LOAD_PAGED = 1 << 5
 };
 
 enum turtle_return turtle_map_elevation_(const struct turtle_map * map,
     double x, double y, double * z, int * inside,
     struct turtle_error_context * error_);
 
+enum turtle_return turtle_map_elevation_v_(const struct turtle_map * map,
+    int n, const double * x, const double * y, double * z, int * inside,
+    struct turtle_error_context * error_);
+
+int turtle_map_run_(
+    const struct turtle_map * map, int n, const double * x, const double * y);
+
 enum turtle_return turtle_map_gradient_(const struct turtle_map * map,
     double x, double y, double * gx, double * gy, int * inside,
     struct turtle_error_context * error_);
 
-enum turtle_return turtle_map_load_(struct turtle_map ** map, const char * path,
+enum turtle_return turtle_map_elevation_gradient_(
+    const struct turtle_map * map, double x, double y, double * z,
+    double * gx, double * gy, int * inside,
     struct turtle_error_context * error_);
 
+void turtle_map_normalise_(struct turtle_map * map);
+
+/* Tag of the shared memory segments of decoded tiles */
+#define TURTLE_MAP_SEGMENT_TAG "TURTLE-SEGMENT 2"
+
+/* Header of a shared memory segment of decoded tile data. It is shared by
+ * all processes mapping the segment, while the data that follow are mapped
+ * privately
+ */
+struct turtle_map_segment {
+        char tag[sizeof(TURTLE_MAP_SEGMENT_TAG)];
+        char name[32]; /* The segment name, for removing it */
+        int status; /* 0 if pending, 1 if ready, -1 if not shareable */
+        int users; /* Number of attached maps, over all processes */
+        long owner; /* Process id of the publisher */
+        long long inode; /* Of the segment, for checking its name */
+        long long size, mtime; /* Of the data file, for detecting changes */
+        struct turtle_map_meta meta;
+        size_t data_size;
+};
+
+/* Get the name of the shared memory segment of a data file, for the given
+ * load options. Returns `EXIT_FAILURE` if the file cannot be stat'ed
+ */
+int turtle_map_segment_name_(const char * path, int options, char * name);
+
+/* Withdraw the segment of a map inserted in a stack from its released ones */
+void turtle_map_segment_claim_(
+    struct turtle_stack * stack, const struct turtle_map * map);
+
+/* Remove the unused shared memory segments released by a stack */
+void turtle_map_segment_flush_(struct turtle_stack * stack);
+
+/* Remove the shared memory segments of a data file, if any */
+void turtle_map_segment_unlink_(const char * path);
+
+size_t turtle_map_bytes_(const struct turtle_map * map);
+
+/* Build the pyramid of elevation bounds of a map, returning `EXIT_SUCCESS`
+ * or `EXIT_FAILURE` if it couldn't be allocated
+ */
+int turtle_map_pyramid_build_(struct turtle_map * map);
+
+/* Rebuild in place a stale pyramid, e.g. after a `turtle_map_fill`. Only one
+ * thread rebuilds the pyramid, others see it as not valid meanwhile
+ */
+void turtle_map_pyramid_refresh_(struct turtle_map * map);
+
+/* Get conservative bounds for the elevation over a rectangle of map
+ * coordinates. Returns `0` if the rectangle is not fully inside the map, or
+ * if the map has no valid pyramid
+ */
+int turtle_map_bounds_(const struct turtle_map * map, double x0, double x1,
+    double y0, double y1, double * zmin, double * zmax);
+
+enum turtle_return turtle_map_load_(struct turtle_map ** map, const char * path,
+    int options, struct turtle_error_context * error_);
+
 #endif
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2017 Université Clermont Auvergne, CNRS/IN2P3, LPC
+ * Author: Valentin NIESS (niess@in2p3.fr)
+ *
+ * Topographic Utilities for tRansporting parTicules over Long rangEs (TURTLE)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Internal helpers for sharing work between threads */
+
+/* C89 standard library */
+#include <stdlib.h>
+#ifndef TURTLE_NO_PTHREAD
+/* POSIX threads */
+#include <pthread.h>
+#endif
+/* TURTLE library */
+#include "turtle/parallel.h"
+
+#ifndef TURTLE_NO_PTHREAD
+/* Entry point of the workers */
+static void * parallel_work(void * arg)
+{
+        struct turtle_parallel * parallel = arg;
+        turtle_error_thread_handler_set(parallel->handler);
+        return parallel->run(parallel->arg);
+}
+#endif
+
+/* Start the workers of a task */
+int turtle_parallel_start_(struct turtle_parallel * parallel, int threads,
+    void * (*run)(void *), void * arg)
+{
+        parallel->run = run;
+        parallel->arg = arg;
+        parallel->handler = turtle_error_thread_handler_get();
+        parallel->n_workers = 0;
+        parallel->workers = NULL;
+#ifndef TURTLE_NO_PTHREAD
+        if (threads < 2) return 0;
+        pthread_t * workers = malloc((threads - 1) * sizeof(*workers));
+        if (workers == NULL) return 0;
+        parallel->workers = workers;
+
+        /* On failure, let us go on with less threads */
+        for (; parallel->n_workers < threads - 1; parallel->n_workers++) {
+                if (pthread_create(workers + parallel->n_workers, NULL,
+                        &parallel_work, parallel) != 0)
+                        break;
+        }
+#endif
+        return parallel->n_workers;
+}
+
+/* Wait for the workers of a task */
+void turtle_parallel_join_(struct turtle_parallel * parallel)
+{
+#ifndef TURTLE_NO_PTHREAD
+        pthread_t * workers = parallel->workers;
+        int i;
+        for (i = 0; i < parallel->n_workers; i++)
+                pthread_join(workers[i], NULL);
+#endif
+        free(parallel->workers);
+        parallel->workers = NULL;
+        parallel->n_workers = 0;
+}
+
+/* Run a task over several threads */
+void turtle_parallel_run_(int threads, void * (*run)(void *), void * arg)
+{
+        struct turtle_parallel parallel;
+        turtle_parallel_start_(&parallel, threads, run, arg);
+        run(arg);
+        turtle_parallel_join_(&parallel);
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2017 Université Clermont Auvergne, CNRS/IN2P3, LPC
+ * Author: Valentin NIESS (niess@in2p3.fr)
+ *
+ * Topographic Utilities for tRansporting parTicules over Long rangEs (TURTLE)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/* Internal helpers for sharing work between threads */
+#ifndef TURTLE_PARALLEL_H
+#define TURTLE_PARALLEL_H
+
+#include "turtle.h"
+
+/* Atomic operations, e.g. on maps reference counts or on work counters */
+#define TURTLE_ATOMIC_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define TURTLE_ATOMIC_ADD(ptr, value)                                          \
+        __atomic_add_fetch(ptr, value, __ATOMIC_ACQ_REL)
+#define TURTLE_ATOMIC_STORE(ptr, value)                                        \
+        __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#define TURTLE_ATOMIC_CAS(ptr, expected, value)                                \
+        __atomic_compare_exchange_n(                                           \
+            ptr, expected, value, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+/* Worker threads running a task along with the calling thread. Workers
+ * handle errors as the calling thread
+ */
+struct turtle_parallel {
+        void * (*run)(void *);
+        void * arg;
+        turtle_error_handler_t * handler;
+        int n_workers;
+        void * workers;
+};
+
+/* Start up-to `threads - 1` workers running `run(arg)`. On failure, the task
+ * goes on with less threads. Returns the number of started workers
+ */
+int turtle_parallel_start_(struct turtle_parallel * parallel, int threads,
+    void * (*run)(void *), void * arg);
+
+/* Wait for the workers to complete and release them */
+void turtle_parallel_join_(struct turtle_parallel * parallel);
+
+/* Run a task with *threads* threads, including the calling one */
+void turtle_parallel_run_(int threads, void * (*run)(void *), void * arg);
+
+#endif
@@ -37,18 +37,19 @@
 #endif
 
 /* Routines for map projections */
-static enum turtle_return project_lambert(
-    const struct turtle_projection * projection, double latitude,
-    double longitude, double * x, double * y);
-static enum turtle_return unproject_lambert(
-    const struct turtle_projection * projection, double x, double y,
-    double * latitude, double * longitude);
-static enum turtle_return project_utm(
-    const struct turtle_projection * projection, double latitude,
-    double longitude, double * x, double * y);
-static enum turtle_return unproject_utm(
-    const struct turtle_projection * projection, double x, double y,
-    double * latitude, double * longitude);
+static void lambert_initialise(struct turtle_projection * projection);
+static inline void lambert_ll_to_xy(double latitude, double longitude,
+    const struct turtle_projection_lambert * parameters, double * x,
+    double * y);
+static inline void lambert_xy_to_ll(double x, double y,
+    const struct turtle_projection_lambert * parameters, double * latitude,
+    double * longitude);
+static void utm_initialise(struct turtle_projection * projection);
+static inline void utm_ll_to_xy(double latitude, double longitude,
+    const struct turtle_projection_utm * constants, double * x, double * y);
+static inline void utm_xy_to_ll(double x, double y,
+    const struct turtle_projection_utm * constants, double * latitude,
+    double * longitude);
 
 /* Allocate a new projection handle */
 enum turtle_return turtle_projection_create(
@@ -166,6 +167,12 @@ enum turtle_return turtle_projection_configure_(
         return TURTLE_ERROR_VREGISTER(
             TURTLE_RETURN_BAD_PROJECTION, "invalid projection `%s'", p);
 exit:
+        /* Precompute the projection constants */
+        if (projection->type == PROJECTION_LAMBERT)
+                lambert_initialise(projection);
+        else
+                utm_initialise(projection);
+
         /* Copy the tag and return */
         strcpy(projection->tag, name);
         return TURTLE_RETURN_SUCCESS;
@@ -204,9 +211,12 @@ enum turtle_return turtle_projection_project(
                 return TURTLE_ERROR_MESSAGE(
                     TURTLE_RETURN_BAD_PROJECTION, "invalid projection");
         else if (projection->type == PROJECTION_LAMBERT)
-                return project_lambert(projection, latitude, longitude, x, y);
+                lambert_ll_to_xy(latitude, longitude,
+                    &projection->constants.lambert, x, y);
         else
-                return project_utm(projection, latitude, longitude, x, y);
+                utm_ll_to_xy(
+                    latitude, longitude, &projection->constants.utm, x, y);
+        return TURTLE_RETURN_SUCCESS;
 }
 
 /* Unproject flat coordinates to geodetic ones. */
@@ -225,9 +235,91 @@ enum turtle_return turtle_projection_unproject(
                 return TURTLE_ERROR_MESSAGE(
                     TURTLE_RETURN_BAD_PROJECTION, "invalid projection");
         else if (projection->type == PROJECTION_LAMBERT)
-                return unproject_lambert(projection, x, y, latitude, longitude);
+                lambert_xy_to_ll(x, y, &projection->constants.lambert,
+                    latitude, longitude);
         else
-                return unproject_utm(projection, x, y, latitude, longitude);
+                utm_xy_to_ll(
+                    x, y, &projection->constants.utm, latitude, longitude);
+        return TURTLE_RETURN_SUCCESS;
+}
+
+/* Project arrays of geodetic coordinates to flat ones. */
+enum turtle_return turtle_projection_project_v(
+    const struct turtle_projection * projection, int n,
+    const double * latitude, const double * longitude, double * x,
+    double * y)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_projection_project_v);
+
+        if ((projection == NULL) || (projection->type == PROJECTION_NONE)) {
+                memset(x, 0x0, n * sizeof(*x));
+                memset(y, 0x0, n * sizeof(*y));
+                if (projection == NULL)
+                        return TURTLE_ERROR_MESSAGE(
+                            TURTLE_RETURN_BAD_ADDRESS, "missing projection");
+                else
+                        return TURTLE_ERROR_MESSAGE(
+                            TURTLE_RETURN_BAD_PROJECTION,
+                            "invalid projection");
+        }
+
+        /* Dispatch once and loop over points */
+        int i;
+        if (projection->type == PROJECTION_LAMBERT) {
+                const struct turtle_projection_lambert * parameters =
+                    &projection->constants.lambert;
+                for (i = 0; i < n; i++) {
+                        lambert_ll_to_xy(latitude[i], longitude[i],
+                            parameters, x + i, y + i);
+                }
+        } else {
+                const struct turtle_projection_utm * constants =
+                    &projection->constants.utm;
+                for (i = 0; i < n; i++) {
+                        utm_ll_to_xy(latitude[i], longitude[i], constants,
+                            x + i, y + i);
+                }
+        }
+        return TURTLE_RETURN_SUCCESS;
+}
+
+/* Unproject arrays of flat coordinates to geodetic ones. */
+enum turtle_return turtle_projection_unproject_v(
+    const struct turtle_projection * projection, int n, const double * x,
+    const double * y, double * latitude, double * longitude)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_projection_unproject_v);
+
+        if ((projection == NULL) || (projection->type == PROJECTION_NONE)) {
+                memset(latitude, 0x0, n * sizeof(*latitude));
+                memset(longitude, 0x0, n * sizeof(*longitude));
+                if (projection == NULL)
+                        return TURTLE_ERROR_MESSAGE(
+                            TURTLE_RETURN_BAD_ADDRESS, "missing projection");
+                else
+                        return TURTLE_ERROR_MESSAGE(
+                            TURTLE_RETURN_BAD_PROJECTION,
+                            "invalid projection");
+        }
+
+        /* Dispatch once and loop over points */
+        int i;
+        if (projection->type == PROJECTION_LAMBERT) {
+                const struct turtle_projection_lambert * parameters =
+                    &projection->constants.lambert;
+                for (i = 0; i < n; i++) {
+                        lambert_xy_to_ll(x[i], y[i], parameters,
+                            latitude + i, longitude + i);
+                }
+        } else {
+                const struct turtle_projection_utm * constants =
+                    &projection->constants.utm;
+                for (i = 0; i < n; i++) {
+                        utm_xy_to_ll(x[i], y[i], constants, latitude + i,
+                            longitude + i);
+                }
+        }
+        return TURTLE_RETURN_SUCCESS;
 }
 
 /* Compute the isometric latitude for Lambert projections.
@@ -267,24 +359,15 @@ static double lambert_iso_to_latitude(double L, double e)
         }
 }
 
-/* Parameters for a Lambert projection. */
-struct lambert_parameters {
-        double e;
-        double n;
-        double c;
-        double lambda_c;
-        double xs;
-        double ys;
-};
-
 /* Compute the projected coordinates for Lambert projections.
  *
  * Source:
  * 	ALG0003 from http://geodesie.ign.fr/contenu/fichiers/documentation/
  * 	algorithmes/notice/NTG_71.pdf.
  */
-static void lambert_ll_to_xy(double latitude, double longitude,
-    struct lambert_parameters * parameters, double * x, double * y)
+static inline void lambert_ll_to_xy(double latitude, double longitude,
+    const struct turtle_projection_lambert * parameters, double * x,
+    double * y)
 {
         const double L = lambert_latitude_to_iso(latitude, parameters->e);
         const double cenL = parameters->c * exp(-parameters->n * L);
@@ -301,8 +384,8 @@ static void lambert_ll_to_xy(double latitude, double longitude,
  * 	ALG0004 from http://geodesie.ign.fr/contenu/fichiers/documentation/
  * 	algorithmes/notice/NTG_71.pdf.
  */
-static void lambert_xy_to_ll(double x, double y,
-    struct lambert_parameters * parameters, double * latitude,
+static inline void lambert_xy_to_ll(double x, double y,
+    const struct turtle_projection_lambert * parameters, double * latitude,
     double * longitude)
 {
         const double dx = x - parameters->xs;
@@ -315,7 +398,8 @@ static void lambert_xy_to_ll(double x, double y,
         *latitude = lambert_iso_to_latitude(L, parameters->e);
 }
 
-/* Get the parameters for a specific Lambert projection.
+
+/* Set the parameters for a specific Lambert projection.
  * Beware: there is no bound check.
  *
  * Source:
@@ -324,9 +408,9 @@ static void lambert_xy_to_ll(double x, double y,
  * 	http://geodesie.ign.fr/contenu/fichiers/documentation/
  * 	rgf93/Lambert-93.pdf (for Lambert 93/RGF93).
  */
-static struct lambert_parameters * lambert_get_parameters(int tag)
+static void lambert_initialise(struct turtle_projection * projection)
 {
-        static struct lambert_parameters parameters[6] = {
+        static const struct turtle_projection_lambert parameters[6] = {
                 { 0.08248325676, 0.7604059656, 11603796.98, 0.04079234433,
                     600000.0, 5657616.674 },
                 { 0.08248325676, 0.7289686274, 11745793.39, 0.04079234433,
@@ -343,68 +427,95 @@ static struct lambert_parameters * lambert_get_parameters(int tag)
                     700000.0, 12657560.145 }
         };
 
-        return parameters + tag;
-}
-
-/* Encapsulation of Lambert projections. */
-static enum turtle_return project_lambert(
-    const struct turtle_projection * projection, double latitude,
-    double longitude, double * x, double * y)
-{
-        struct lambert_parameters * parameters =
-            lambert_get_parameters(projection->settings.lambert_tag);
-        lambert_ll_to_xy(latitude, longitude, parameters, x, y);
-        return TURTLE_RETURN_SUCCESS;
+        projection->constants.lambert =
+            parameters[projection->settings.lambert_tag];
 }
 
-/* Encapsulation of inverse Lambert projections.  */
-static enum turtle_return unproject_lambert(
-    const struct turtle_projection * projection, double x, double y,
-    double * latitude, double * longitude)
-{
-        struct lambert_parameters * parameters =
-            lambert_get_parameters(projection->settings.lambert_tag);
-        lambert_xy_to_ll(x, y, parameters, latitude, longitude);
-        return TURTLE_RETURN_SUCCESS;
-}
-
-/* Compute the projected coordinates for UTM projections.
+/* Precompute the series coefficients of a UTM projection.
  *
  * Source:
  * 	Wikipedia https://en.wikipedia.org/wiki/
  * 	Universal_Transverse_Mercator_coordinate_system.
  */
-static void utm_ll_to_xy(double latitude, double longitude, double longitude_0,
-    int hemisphere, double * x, double * y)
+static void utm_initialise(struct turtle_projection * projection)
 {
         const double a = 6378.137E+03;
         const double f = 1. / 298.257223563;
-        const double E0 = 5E+05;
-        const double N0 = (hemisphere > 0) ? 0. : 1E+07;
         const double k0 = 0.9996;
 
+        struct turtle_projection_utm * constants = &projection->constants.utm;
+        constants->longitude_0 = projection->settings.utm.longitude_0;
+        constants->E0 = 5E+05;
+        constants->N0 = (projection->settings.utm.hemisphere > 0) ? 0. : 1E+07;
+
         const double n = f / (2. - f);
         const double A = a / (1. + n) * (1. + n * n * (0.25 + 0.0625 * n * n));
-        const double alpha[3] = { n * (0.5 + n * (-2. / 3. + 5. / 16. * n)),
-                n * n * (13. / 48. - 3. / 5. * n), 61. / 240. * n * n * n };
+        constants->kA = k0 * A;
+        constants->c = 2. * sqrt(n) / (1. + n);
+
+        constants->alpha[0] = n * (0.5 + n * (-2. / 3. + 5. / 16. * n));
+        constants->alpha[1] = n * n * (13. / 48. - 3. / 5. * n);
+        constants->alpha[2] = 61. / 240. * n * n * n;
+
+        constants->beta[0] = n * (0.5 + n * (-2. / 3. + 37. / 96. * n));
+        constants->beta[1] = n * n * (1. / 48. + 1. / 15. * n);
+        constants->beta[2] = 17. / 480. * n * n * n;
+
+        constants->delta[0] = n * (2. + n * (-2. / 3. - 2. * n));
+        constants->delta[1] = n * n * (7. / 3. - 8. / 5. * n);
+        constants->delta[2] = 56. / 15. * n * n * n;
+}
+
+/* Compute the harmonics sin(2 k zeta), cos(2 k zeta), sinh(2 k eta) and
+ * cosh(2 k eta) for k = 1, 2, 3, using addition formulae.
+ */
+static inline void utm_harmonics(double zeta, double eta, double * sz,
+    double * cz, double * sh, double * ch)
+{
+        sz[0] = sin(2. * zeta);
+        cz[0] = cos(2. * zeta);
+        const double ep = exp(2. * eta);
+        const double em = 1. / ep;
+        sh[0] = 0.5 * (ep - em);
+        ch[0] = 0.5 * (ep + em);
+
+        int i;
+        for (i = 1; i < 3; i++) {
+                sz[i] = sz[i - 1] * cz[0] + cz[i - 1] * sz[0];
+                cz[i] = cz[i - 1] * cz[0] - sz[i - 1] * sz[0];
+                sh[i] = sh[i - 1] * ch[0] + ch[i - 1] * sh[0];
+                ch[i] = ch[i - 1] * ch[0] + sh[i - 1] * sh[0];
+        }
+}
 
-        const double c = 2. * sqrt(n) / (1. + n);
+/* Compute the projected coordinates for UTM projections.
+ *
+ * Source:
+ * 	Wikipedia https://en.wikipedia.org/wiki/
+ * 	Universal_Transverse_Mercator_coordinate_system.
+ */
+static inline void utm_ll_to_xy(double latitude, double longitude,
+    const struct turtle_projection_utm * constants, double * x, double * y)
+{
+        const double c = constants->c;
         const double s = sin(latitude * M_PI / 180.);
         const double t = sinh(atanh(s) - c * atanh(c * s));
-        const double dl = (longitude - longitude_0) * M_PI / 180.;
+        const double dl = (longitude - constants->longitude_0) * M_PI / 180.;
         const double zeta = atan2(t, cos(dl));
         const double eta = atanh(sin(dl) / sqrt(1. + t * t));
 
-        double xs = 0., ys = 0.;
-        int i;
-        for (i = 0; i < 3; i++) {
-                xs += alpha[i] * cos(2. * (i + 1) * zeta) *
-                    sinh(2. * (i + 1) * eta);
-                ys += alpha[i] * sin(2. * (i + 1) * zeta) *
-                    cosh(2. * (i + 1) * eta);
-        }
-        *x = E0 + k0 * A * (eta + xs);
-        *y = N0 + k0 * A * (zeta + ys);
+        double sz[3], cz[3], sh[3], ch[3];
+        utm_harmonics(zeta, eta, sz, cz, sh, ch);
+
+        const double * const alpha = constants->alpha;
+        const double xs =
+            alpha[0] * cz[0] * sh[0] + alpha[1] * cz[1] * sh[1] +
+            alpha[2] * cz[2] * sh[2];
+        const double ys =
+            alpha[0] * sz[0] * ch[0] + alpha[1] * sz[1] * ch[1] +
+            alpha[2] * sz[2] * ch[2];
+        *x = constants->E0 + constants->kA * (eta + xs);
+        *y = constants->N0 + constants->kA * (zeta + ys);
 }
 
 /* Compute the geodetic coordinates from the projected ones for a UTM
@@ -414,55 +525,30 @@ static void utm_ll_to_xy(double latitude, double longitude, double longitude_0,
  * 	Wikipedia https://en.wikipedia.org/wiki/
  * 	Universal_Transverse_Mercator_coordinate_system.
  */
-static void utm_xy_to_ll(double x, double y, double longitude_0, int hemisphere,
-    double * latitude, double * longitude)
+static inline void utm_xy_to_ll(double x, double y,
+    const struct turtle_projection_utm * constants, double * latitude,
+    double * longitude)
 {
-        const double a = 6378.137E+03;
-        const double f = 1. / 298.257223563;
-        const double E0 = 5E+05;
-        const double N0 = (hemisphere > 0) ? 0. : 1E+07;
-        const double k0 = 0.9996;
+        const double zeta0 = (y - constants->N0) / constants->kA;
+        const double eta0 = (x - constants->E0) / constants->kA;
 
-        const double n = f / (2. - f);
-        const double A = a / (1. + n) * (1. + n * n * (0.25 + 0.0625 * n * n));
-        const double beta[3] = { n * (0.5 + n * (-2. / 3. + 37. / 96. * n)),
-                n * n * (1. / 48. + 1. / 15. * n), 17. / 480. * n * n * n };
-        const double delta[3] = { n * (2. + n * (-2. / 3. - 2. * n)),
-                n * n * (7. / 3. - 8. / 5. * n), 56. / 15. * n * n * n };
-
-        const double zeta0 = (y - N0) / (k0 * A);
-        const double eta0 = (x - E0) / (k0 * A);
-        double zeta = zeta0, eta = eta0;
-        int i;
-        for (i = 0; i < 3; i++) {
-                zeta -= beta[i] * sin(2. * (i + 1) * zeta0) *
-                    cosh(2. * (i + 1) * eta0);
-                eta -= beta[i] * cos(2. * (i + 1) * zeta0) *
-                    sinh(2. * (i + 1) * eta0);
-        }
-        const double chi = asin(sin(zeta) / cosh(eta));
-        double s = 0.;
-        for (i = 0; i < 3; i++) s += delta[i] * sin(2. * (i + 1) * chi);
-        *latitude = (chi + s) * 180. / M_PI;
-        *longitude = longitude_0 + atan2(sinh(eta), cos(zeta)) * 180. / M_PI;
-}
+        double sz[3], cz[3], sh[3], ch[3];
+        utm_harmonics(zeta0, eta0, sz, cz, sh, ch);
 
-/* Encapsulation of UTM projections. */
-static enum turtle_return project_utm(
-    const struct turtle_projection * projection, double latitude,
-    double longitude, double * x, double * y)
-{
-        utm_ll_to_xy(latitude, longitude, projection->settings.utm.longitude_0,
-            projection->settings.utm.hemisphere, x, y);
-        return TURTLE_RETURN_SUCCESS;
-}
+        const double * const beta = constants->beta;
+        const double zeta = zeta0 - beta[0] * sz[0] * ch[0] -
+            beta[1] * sz[1] * ch[1] - beta[2] * sz[2] * ch[2];
+        const double eta = eta0 - beta[0] * cz[0] * sh[0] -
+            beta[1] * cz[1] * sh[1] - beta[2] * cz[2] * sh[2];
 
-/* Encapsulation of inverse UTM projections.  */
-static enum turtle_return unproject_utm(
-    const struct turtle_projection * projection, double x, double y,
-    double * latitude, double * longitude)
-{
-        utm_xy_to_ll(x, y, projection->settings.utm.longitude_0,
-            projection->settings.utm.hemisphere, latitude, longitude);
-        return TURTLE_RETURN_SUCCESS;
+        const double chi = asin(sin(zeta) / cosh(eta));
+        const double s1 = sin(2. * chi);
+        const double c1 = cos(2. * chi);
+        const double s2 = 2. * s1 * c1;
+        const double s3 = s1 * (3. - 4. * s1 * s1);
+        const double * const delta = constants->delta;
+        const double s = delta[0] * s1 + delta[1] * s2 + delta[2] * s3;
+        *latitude = (chi + s) * 180. / M_PI;
+        *longitude = constants->longitude_0 +
+            atan2(sinh(eta), cos(zeta)) * 180. / M_PI;
 }
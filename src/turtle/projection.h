@@ -33,6 +33,28 @@ enum projection_type {
         N_PROJECTIONS
 };
 
+/* Parameters for a Lambert projection. */
+struct turtle_projection_lambert {
+        double e;
+        double n;
+        double c;
+        double lambda_c;
+        double xs;
+        double ys;
+};
+
+/* Precomputed constants for a UTM projection. */
+struct turtle_projection_utm {
+        double longitude_0;
+        double E0;
+        double N0;
+        double kA;
+        double c;
+        double alpha[3];
+        double beta[3];
+        double delta[3];
+};
+
 /* Container for a geographic projection. */
 struct turtle_projection {
         enum projection_type type;
@@ -43,6 +65,10 @@ struct turtle_projection {
                 } utm;
                 int lambert_tag;
         } settings;
+        union {
+                struct turtle_projection_lambert lambert;
+                struct turtle_projection_utm utm;
+        } constants;
         char tag[64];
 };
 
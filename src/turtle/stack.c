@@ -22,12 +22,28 @@
  * Turtle handle for accessing world-wide elevation data.
  */
 
+/* POSIX monotonic clock and file times, for runtime statistics and for the
+ * tiles index
+ */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 /* C89 standard library */
 #include <float.h>
 #include <limits.h>
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+/* POSIX file status and process identifier */
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef TURTLE_NO_PTHREAD
+/* POSIX threads */
+#include <pthread.h>
+#endif
 /* TinyDir library */
 #include "deps/tinydir.h"
 /* TURTLE library */
@@ -42,43 +58,260 @@
 #define M_PI 3.14159265358979323846
 #endif
 
-/* Create a new stack of maps */
-enum turtle_return turtle_stack_create(struct turtle_stack ** stack,
-    const char * path, int size, turtle_stack_locker_t * lock,
-    turtle_stack_locker_t * unlock)
+/* Mean Earth radius, used for converting prefetch distances */
+#define EARTH_RADIUS 6371E+03
+
+#ifndef TURTLE_NO_PTHREAD
+/* Background loader for prefetched tiles */
+struct turtle_stack_prefetcher {
+        pthread_t thread;
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        int stop;
+
+        /* Queue of grid cells to load, and flags for pending cells */
+        int head, size;
+        unsigned char * pending;
+        int queue[];
+};
+
+static void prefetcher_stop(struct turtle_stack * stack, int drain);
+
+/* Synchronisation of the loads done outside of the stack lock. Waiters are
+ * woken up whenever a load completes, and check their own cell
+ */
+static pthread_mutex_t loading_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t loading_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
+static void stack_insert(struct turtle_stack * stack, struct turtle_map * map,
+    int index, double latitude, double longitude);
+
+/* Name of the tiles index file, in the stack directory */
+#define STACK_INDEX ".turtle-index"
+
+/* Version tag of the tiles index format. Version 2 records the meta data of
+ * each tile, i.e. its file size and modification time, its format and its
+ * bounds
+ */
+#define STACK_INDEX_TAG "TURTLE-INDEX 2"
+
+/* Meta data of a tile, found when scanning the stack directory */
+struct stack_tile {
+        double x0, y0;
+        int index;
+        char * path;
+};
+
+/* Geometry of the stack grid */
+struct stack_grid {
+        double latitude_0, latitude_delta;
+        double longitude_0, longitude_delta;
+        int latitude_n, longitude_n;
+};
+
+static void tiles_clear(struct stack_tile * tiles, int n)
 {
-        TURTLE_ERROR_INITIALISE(&turtle_stack_create);
-        *stack = NULL;
+        int i;
+        for (i = 0; i < n; i++) free(tiles[i].path);
+        free(tiles);
+}
 
-        /* Check the lock and unlock consistency. */
-        if (((lock == NULL) && (unlock != NULL)) ||
-            ((unlock == NULL) && (lock != NULL)))
-                return TURTLE_ERROR_MESSAGE(
-                    TURTLE_RETURN_BAD_ADDRESS, "inconsistent lock & unlock");
+/* Append a tile to a growing array */
+static int tiles_append(struct stack_tile ** tiles, int * n, int * capacity,
+    double x0, double y0, int index, const char * path, int path_size)
+{
+        if (*n == *capacity) {
+                const int m = (*capacity > 0) ? 2 * *capacity : 64;
+                void * tmp = realloc(*tiles, m * sizeof(**tiles));
+                if (tmp == NULL) return EXIT_FAILURE;
+                *tiles = tmp;
+                *capacity = m;
+        }
+        struct stack_tile * tile = *tiles + *n;
+        tile->path = malloc(path_size + 1);
+        if (tile->path == NULL) return EXIT_FAILURE;
+        memcpy(tile->path, path, path_size);
+        tile->path[path_size] = 0x0;
+        tile->x0 = x0;
+        tile->y0 = y0;
+        tile->index = index;
+        (*n)++;
+        return EXIT_SUCCESS;
+}
+
+/* Get the modification time of a file or of a directory, in ns if available */
+static long long stack_mtime(const char * path)
+{
+        struct stat st;
+        if (stat(path, &st) != 0) return -1;
+#if defined(__linux__) && (_POSIX_C_SOURCE >= 200809L)
+        return st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+        return (long long)st.st_mtime;
+#endif
+}
+
+/* Get the size and the modification time of a file */
+static int stack_stat(const char * path, long long * size, long long * mtime)
+{
+        struct stat st;
+        if (stat(path, &st) != 0) return EXIT_FAILURE;
+        *size = (long long)st.st_size;
+        *mtime = stack_mtime(path);
+        return EXIT_SUCCESS;
+}
+
+/* Check an index entry against its tile file. If the file was modified
+ * since the index dump, its meta data are read again and compared to the
+ * indexed ones
+ */
+static int stack_tile_check(const char * path, long long size,
+    long long mtime, const char * encoding, const double * bounds)
+{
+        long long file_size, file_mtime;
+        if (stack_stat(path, &file_size, &file_mtime) != EXIT_SUCCESS)
+                return EXIT_FAILURE;
+        if ((file_size == size) && (file_mtime == mtime))
+                return EXIT_SUCCESS;
+
+        struct turtle_error_context error_data = {
+                .code = TURTLE_RETURN_SUCCESS, .function = NULL,
+                .message = NULL, .dynamic = 0 };
+        struct turtle_error_context * error_ = &error_data;
+        struct turtle_io * io;
+        int rc = EXIT_FAILURE;
+        if (turtle_io_create_(&io, path, error_) != TURTLE_RETURN_SUCCESS)
+                goto exit;
+        if (io->open(io, path, "rb", error_) == TURTLE_RETURN_SUCCESS) {
+                const struct turtle_map_meta * meta = &io->meta;
+                const double tx = FLT_EPSILON * (bounds[1] - bounds[0]);
+                const double ty = FLT_EPSILON * (bounds[3] - bounds[2]);
+                const double x1 = meta->x0 + meta->dx * (meta->nx - 1);
+                const double y1 = meta->y0 + meta->dy * (meta->ny - 1);
+                if ((strcmp(meta->encoding, encoding) == 0) &&
+                    (fabs(meta->x0 - bounds[0]) <= tx) &&
+                    (fabs(x1 - bounds[1]) <= tx) &&
+                    (fabs(meta->y0 - bounds[2]) <= ty) &&
+                    (fabs(y1 - bounds[3]) <= ty))
+                        rc = EXIT_SUCCESS;
+                io->close(io);
+        }
+        free(io);
+exit:
+        turtle_error_reset_(error_);
+        return rc;
+}
+
+/* Read the tiles index of a stack directory, if any and if up to date.
+ * The modification times are not checked if *check* is `0`. Otherwise, each
+ * tile is checked against its indexed meta data
+ */
+static int stack_index_read(const char * path, int check,
+    struct stack_grid * grid, struct stack_tile ** tiles, int * n_tiles)
+{
+        *tiles = NULL;
+        *n_tiles = 0;
+        const int root_size = strlen(path);
+        char * filename = malloc(root_size + sizeof(STACK_INDEX) + 1);
+        if (filename == NULL) return EXIT_FAILURE;
+        sprintf(filename, "%s/%s", path, STACK_INDEX);
+        FILE * stream = fopen(filename, "r");
+        free(filename);
+        if (stream == NULL) return EXIT_FAILURE;
+
+        /* Check the header and the directory modification time */
+        char line[4096];
+        long long mtime;
+        int n;
+        if ((fgets(line, sizeof(line), stream) == NULL) ||
+            (strncmp(line, STACK_INDEX_TAG, sizeof(STACK_INDEX_TAG) - 1) !=
+                0) ||
+            (fscanf(stream, "%lld", &mtime) != 1) ||
+            (check && (mtime != stack_mtime(path))) ||
+            (fscanf(stream, "%lf %lf %lf %lf %d %d %d", &grid->latitude_0,
+                 &grid->latitude_delta, &grid->longitude_0,
+                 &grid->longitude_delta, &grid->latitude_n,
+                 &grid->longitude_n, &n) != 7) ||
+            (fgets(line, sizeof(line), stream) == NULL))
+                goto error;
+
+        /* Parse the tiles, given as cell index, file size and modification
+         * time, format, bounds and file name
+         */
+        const int n_cells = grid->latitude_n * grid->longitude_n;
+        int i, capacity = 0;
+        for (i = 0; i < n; i++) {
+                int index, offset;
+                long long size, tile_mtime;
+                char encoding[8];
+                double bounds[4];
+                if ((fgets(line, sizeof(line), stream) == NULL) ||
+                    (sscanf(line, "%d %lld %lld %7s %lf %lf %lf %lf %n",
+                         &index, &size, &tile_mtime, encoding, bounds,
+                         bounds + 1, bounds + 2, bounds + 3, &offset) != 8) ||
+                    (index < 0) || (index >= n_cells))
+                        goto error;
+                const char * name = line + offset;
+                int name_size = strlen(name);
+                if ((name_size > 0) && (name[name_size - 1] == '\n'))
+                        name_size--;
+                if (name_size == 0) goto error;
+                char * tile_path = malloc(root_size + name_size + 2);
+                if (tile_path == NULL) goto error;
+                sprintf(tile_path, "%s/%.*s", path, name_size, name);
+                if (check && (stack_tile_check(tile_path, size, tile_mtime,
+                                  encoding, bounds) != EXIT_SUCCESS)) {
+                        free(tile_path);
+                        goto error;
+                }
+                const int rc = tiles_append(tiles, n_tiles, &capacity,
+                    bounds[0], bounds[2], index, tile_path,
+                    root_size + name_size + 1);
+                free(tile_path);
+                if (rc != EXIT_SUCCESS) goto error;
+        }
+        fclose(stream);
+        return EXIT_SUCCESS;
 
-        /* Scan the provided path for the map data */
+error:
+        fclose(stream);
+        tiles_clear(*tiles, *n_tiles);
+        *tiles = NULL;
+        *n_tiles = 0;
+        return EXIT_FAILURE;
+}
+
+/* Scan a stack directory for tiles, in a single pass */
+static enum turtle_return stack_scan(const char * path,
+    struct stack_grid * grid, struct stack_tile ** tiles, int * n_tiles,
+    struct turtle_error_context * error_)
+{
         double lat_min = DBL_MAX, long_min = DBL_MAX;
         double lat_max = -DBL_MAX, long_max = -DBL_MAX;
         double lat_delta = 0., long_delta = 0.;
-        int data_size = strlen(path) + 1;
+        int capacity = 0;
+        *tiles = NULL;
+        *n_tiles = 0;
 
         tinydir_dir dir;
         int rc = tinydir_open(&dir, path);
         if (rc != 0) {
-                return TURTLE_ERROR_FORMAT(
+                return TURTLE_ERROR_VREGISTER(
                     TURTLE_RETURN_PATH_ERROR, "could not access %s", path);
         }
         for (; dir.has_next; tinydir_next(&dir)) {
                 tinydir_file file;
                 tinydir_readfile(&dir, &file);
-                if (file.is_dir) continue;
+                if (file.is_dir || (strcmp(file.name, STACK_INDEX) == 0))
+                        continue;
 
                 /* Get the map meta-data */
                 enum turtle_return trc;
                 struct turtle_io * io;
                 if ((trc = turtle_io_create_(&io, file.path, error_)) ==
                     TURTLE_RETURN_BAD_EXTENSION) {
-                        error_->code = TURTLE_RETURN_SUCCESS;
+                        turtle_error_reset_(error_);
                         continue;
                 } else if (trc != TURTLE_RETURN_SUCCESS)
                         goto error;
@@ -109,7 +342,12 @@ enum turtle_return turtle_stack_create(struct turtle_stack ** stack,
                 if (x1 > long_max) long_max = x1;
                 const double y1 = io->meta.y0 + dy;
                 if (y1 > lat_max) lat_max = y1;
-                data_size += strlen(file.path) + 1;
+                if (tiles_append(tiles, n_tiles, &capacity, io->meta.x0,
+                        io->meta.y0, 0, file.path, strlen(file.path)) !=
+                    EXIT_SUCCESS) {
+                        TURTLE_ERROR_MEMORY();
+                        goto error;
+                }
 
                 io->close(io);
                 free(io);
@@ -120,94 +358,348 @@ enum turtle_return turtle_stack_create(struct turtle_stack ** stack,
                         free(io);
                 }
                 tinydir_close(&dir);
-                return TURTLE_ERROR_RAISE();
+                tiles_clear(*tiles, *n_tiles);
+                *tiles = NULL;
+                *n_tiles = 0;
+                return error_->code;
         }
         tinydir_close(&dir);
 
         /* Check the grid size */
-        int lat_n = 0, long_n = 0;
+        memset(grid, 0x0, sizeof(*grid));
         if ((lat_delta > 0.) && (long_delta > 0.)) {
                 const double dx = (long_max - long_min) / long_delta;
-                long_n = (int)(dx + FLT_EPSILON);
-                if (fabs(long_n - dx) > FLT_EPSILON)
-                        return TURTLE_ERROR_MESSAGE(
-                            TURTLE_RETURN_BAD_FORMAT, "invalid longitude grid");
+                grid->longitude_n = (int)(dx + FLT_EPSILON);
                 const double dy = (lat_max - lat_min) / lat_delta;
-                lat_n = (int)(dy + FLT_EPSILON);
-                if (fabs(lat_n - dy) > FLT_EPSILON)
-                        return TURTLE_ERROR_MESSAGE(
-                            TURTLE_RETURN_BAD_FORMAT, "invalid latitude grid");
+                grid->latitude_n = (int)(dy + FLT_EPSILON);
+                const char * msg = NULL;
+                if (fabs(grid->longitude_n - dx) > FLT_EPSILON)
+                        msg = "invalid longitude grid";
+                else if (fabs(grid->latitude_n - dy) > FLT_EPSILON)
+                        msg = "invalid latitude grid";
+                if (msg != NULL) {
+                        tiles_clear(*tiles, *n_tiles);
+                        *tiles = NULL;
+                        *n_tiles = 0;
+                        return TURTLE_ERROR_REGISTER(
+                            TURTLE_RETURN_BAD_FORMAT, msg);
+                }
+                grid->latitude_0 = lat_min;
+                grid->latitude_delta = lat_delta;
+                grid->longitude_0 = long_min;
+                grid->longitude_delta = long_delta;
+        }
+
+        /* Compute the lookup indices */
+        int i;
+        for (i = 0; i < *n_tiles; i++) {
+                struct stack_tile * tile = *tiles + i;
+                const int ix = (int)((tile->x0 - long_min) / long_delta);
+                const int iy = (int)((tile->y0 - lat_min) / lat_delta);
+                tile->index = iy * grid->longitude_n + ix;
+        }
+
+        return TURTLE_RETURN_SUCCESS;
+}
+
+/* Get a local copy of an object of the stack source, unless it is already
+ * cached. The object is fetched to a temporary file which is then renamed, in
+ * order not to expose partial data to other threads or processes
+ */
+static enum turtle_return stack_cache(turtle_stack_fetcher_t * fetch,
+    void * context, const char * name, const char * path,
+    struct turtle_error_context * error_)
+{
+        struct stat st;
+        if (stat(path, &st) == 0) return TURTLE_RETURN_SUCCESS;
+
+        static unsigned long counter = 0;
+        const unsigned long n = TURTLE_ATOMIC_ADD(&counter, 1);
+        const int size = strlen(path) + 48;
+        char * tmp = malloc(size);
+        if (tmp == NULL) {
+                return TURTLE_ERROR_REGISTER(
+                    TURTLE_RETURN_MEMORY_ERROR, "could not allocate memory");
+        }
+        snprintf(tmp, size, "%s.part-%ld-%lu", path, (long)getpid(), n);
+        if (fetch(context, name, tmp) != 0) {
+                remove(tmp);
+                free(tmp);
+                return TURTLE_ERROR_VREGISTER(
+                    TURTLE_RETURN_PATH_ERROR, "could not fetch `%s'", name);
         }
+        if ((rename(tmp, path) != 0) && (stat(path, &st) != 0)) {
+                remove(tmp);
+                TURTLE_ERROR_VREGISTER(TURTLE_RETURN_PATH_ERROR,
+                    "could not write file `%s'", path);
+        }
+        free(tmp);
+        return error_->code;
+}
 
+/* Allocate and initialise a stack from the meta-data of its tiles. The tiles
+ * array is released
+ */
+static enum turtle_return stack_build(struct turtle_stack ** stack,
+    const char * path, int size, turtle_stack_locker_t * lock,
+    turtle_stack_locker_t * unlock, const struct stack_grid * grid,
+    struct stack_tile * tiles, int n_tiles,
+    struct turtle_error_context * error_)
+{
         /* Allocate the new stack handle */
-        const int path_size = lat_n * long_n * sizeof(char *);
-        data_size += path_size;
+        const int lat_n = grid->latitude_n, long_n = grid->longitude_n;
+        const int n_cells = lat_n * long_n;
+        const int path_size = n_cells * sizeof(char *);
+        const int grid_size = n_cells * sizeof(struct turtle_map *);
+        const int missing_size = (n_cells + 7) / 8;
+        int data_size = strlen(path) + 1;
+        int i;
+        for (i = 0; i < n_tiles; i++) data_size += strlen(tiles[i].path) + 1;
+        data_size += path_size + grid_size + 2 * missing_size;
         *stack = malloc(sizeof(**stack) + data_size);
-        if (*stack == NULL) return TURTLE_ERROR_MEMORY();
+        if (*stack == NULL) {
+                tiles_clear(tiles, n_tiles);
+                return TURTLE_ERROR_REGISTER(
+                    TURTLE_RETURN_MEMORY_ERROR, "could not allocate memory");
+        }
 
         /* Initialise the handle */
         memset(&(*stack)->tiles, 0x0, sizeof((*stack)->tiles));
         (*stack)->max_size = (size > 0) ? size : INT_MAX;
+        (*stack)->max_bytes = 0;
+        (*stack)->bytes = 0;
+        (*stack)->policy = TURTLE_STACK_POLICY_LRU;
+        (*stack)->clock = 0;
+        (*stack)->map_options = TURTLE_MAP_LOAD_DEFAULT;
         (*stack)->lock = lock;
         (*stack)->unlock = unlock;
-        (*stack)->latitude_0 = lat_min;
-        (*stack)->longitude_0 = long_min;
-        (*stack)->latitude_delta = lat_delta;
-        (*stack)->longitude_delta = long_delta;
+        (*stack)->prefetcher = NULL;
+        memset(&(*stack)->released, 0x0, sizeof((*stack)->released));
+        memset(&(*stack)->counters, 0x0, sizeof((*stack)->counters));
+        (*stack)->hook = NULL;
+        (*stack)->hook_context = NULL;
+        memset(&(*stack)->locker, 0x0, sizeof((*stack)->locker));
+        memset(&(*stack)->source, 0x0, sizeof((*stack)->source));
+        (*stack)->latitude_0 = grid->latitude_0;
+        (*stack)->longitude_0 = grid->longitude_0;
+        (*stack)->latitude_delta = grid->latitude_delta;
+        (*stack)->longitude_delta = grid->longitude_delta;
         (*stack)->latitude_n = lat_n;
         (*stack)->longitude_n = long_n;
+        (*stack)->path = (char **)((*stack)->data);
+        (*stack)->grid =
+            (struct turtle_map **)((*stack)->data + path_size);
         const int root_size = strlen(path) + 1;
-        (*stack)->root = (char *)((*stack)->data);
+        (*stack)->root = (*stack)->data + path_size + grid_size;
         memcpy((*stack)->root, path, root_size);
-        (*stack)->path = (char **)((*stack)->data + root_size);
+        (*stack)->missing = (unsigned char *)((*stack)->root + root_size);
+        (*stack)->loading = (*stack)->missing + missing_size;
+        memset((*stack)->loading, 0x0, missing_size);
 
-        if ((lat_n == 0) || (long_n == 0)) return TURTLE_RETURN_SUCCESS;
+        if ((lat_n == 0) || (long_n == 0)) {
+                tiles_clear(tiles, n_tiles);
+                return TURTLE_RETURN_SUCCESS;
+        }
 
         /* Build the lookup data */
-        int i;
-        for (i = 0; i < lat_n * long_n; i++) (*stack)->path[i] = NULL;
+        for (i = 0; i < n_cells; i++) {
+                (*stack)->path[i] = NULL;
+                (*stack)->grid[i] = NULL;
+        }
 
-        char * cursor = (char *)((*stack)->path) + path_size;
-        for (tinydir_open(&dir, path); dir.has_next; tinydir_next(&dir)) {
-                tinydir_file file;
-                tinydir_readfile(&dir, &file);
-                if (file.is_dir) continue;
+        char * cursor = (char *)((*stack)->loading) + missing_size;
+        for (i = 0; i < n_tiles; i++) {
+                /* Copy the path name */
+                const int n = strlen(tiles[i].path) + 1;
+                memcpy(cursor, tiles[i].path, n);
+                (*stack)->path[tiles[i].index] = cursor;
+                cursor += n;
+        }
+        tiles_clear(tiles, n_tiles);
 
-                /* Check the format. */
-                struct turtle_io * io;
-                if (turtle_io_create_(&io, file.path, error_) !=
-                    TURTLE_RETURN_SUCCESS) {
-                        error_->code = TURTLE_RETURN_SUCCESS;
-                        continue;
-                }
-                io->open(io, file.path, "rb", error_);
+        /* Flag the cells without any data */
+        memset((*stack)->missing, 0x0, missing_size);
+        for (i = 0; i < n_cells; i++) {
+                if ((*stack)->path[i] == NULL)
+                        (*stack)->missing[i / 8] |= 1 << (i % 8);
+        }
 
-                /* Compute the lookup index */
-                const int ix = (int)((io->meta.x0 - long_min) / long_delta);
-                const int iy = (int)((io->meta.y0 - lat_min) / lat_delta);
-                i = iy * long_n + ix;
-                io->close(io);
-                free(io);
+        return TURTLE_RETURN_SUCCESS;
+}
 
-                /* Copy the path name */
-                const int n = strlen(file.path) + 1;
-                memcpy(cursor, file.path, n);
-                (*stack)->path[i] = cursor;
-                cursor += n;
+/* Create a new stack of maps */
+enum turtle_return turtle_stack_create(struct turtle_stack ** stack,
+    const char * path, int size, turtle_stack_locker_t * lock,
+    turtle_stack_locker_t * unlock)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_stack_create);
+        *stack = NULL;
+
+        /* Check the lock and unlock consistency. */
+        if (((lock == NULL) && (unlock != NULL)) ||
+            ((unlock == NULL) && (lock != NULL)))
+                return TURTLE_ERROR_MESSAGE(
+                    TURTLE_RETURN_BAD_ADDRESS, "inconsistent lock & unlock");
+
+        /* Get the tiles meta data, from an up to date index if any, or by
+         * scanning the provided path
+         */
+        struct stack_grid grid;
+        struct stack_tile * tiles;
+        int n_tiles;
+        if (((stack_index_read(path, 1, &grid, &tiles, &n_tiles) !=
+                 EXIT_SUCCESS) &&
+                (stack_scan(path, &grid, &tiles, &n_tiles, error_) !=
+                    TURTLE_RETURN_SUCCESS)) ||
+            (stack_build(stack, path, size, lock, unlock, &grid, tiles,
+                 n_tiles, error_) != TURTLE_RETURN_SUCCESS))
+                return TURTLE_ERROR_RAISE();
+
+        turtle_error_reset_(error_);
+        return TURTLE_RETURN_SUCCESS;
+}
+
+/* Create a new stack of maps, fetched from a tiles source */
+enum turtle_return turtle_stack_create_remote(struct turtle_stack ** stack,
+    const char * cache, int size, turtle_stack_fetcher_t * fetch,
+    void * context, turtle_stack_locker_t * lock,
+    turtle_stack_locker_t * unlock)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_stack_create_remote);
+        *stack = NULL;
+
+        if (fetch == NULL) {
+                return TURTLE_ERROR_MESSAGE(
+                    TURTLE_RETURN_BAD_ADDRESS, "missing fetch callback");
         }
-        tinydir_close(&dir);
+        if (((lock == NULL) && (unlock != NULL)) ||
+            ((unlock == NULL) && (lock != NULL)))
+                return TURTLE_ERROR_MESSAGE(
+                    TURTLE_RETURN_BAD_ADDRESS, "inconsistent lock & unlock");
+
+        /* Get the tiles index from the cache, fetching it first if needed.
+         * Its modification time refers to the source, not to the cache
+         */
+        char * filename = malloc(strlen(cache) + sizeof(STACK_INDEX) + 1);
+        if (filename == NULL) return TURTLE_ERROR_MEMORY();
+        sprintf(filename, "%s/%s", cache, STACK_INDEX);
+        const enum turtle_return rc =
+            stack_cache(fetch, context, STACK_INDEX, filename, error_);
+        free(filename);
+        if (rc != TURTLE_RETURN_SUCCESS) return TURTLE_ERROR_RAISE();
+
+        struct stack_grid grid;
+        struct stack_tile * tiles;
+        int n_tiles;
+        if (stack_index_read(cache, 0, &grid, &tiles, &n_tiles) !=
+            EXIT_SUCCESS) {
+                return TURTLE_ERROR_FORMAT(TURTLE_RETURN_BAD_FORMAT,
+                    "invalid tiles index in `%s'", cache);
+        }
+        if (stack_build(stack, cache, size, lock, unlock, &grid, tiles,
+                n_tiles, error_) != TURTLE_RETURN_SUCCESS)
+                return TURTLE_ERROR_RAISE();
+        (*stack)->source.fetch = fetch;
+        (*stack)->source.context = context;
 
         return TURTLE_RETURN_SUCCESS;
 }
 
+/* Load the tile of a grid cell, fetching it first from the stack source if
+ * it is not in the local cache
+ */
+static enum turtle_return stack_map_load(struct turtle_stack * stack,
+    int index, int options, struct turtle_map ** map,
+    struct turtle_error_context * error_)
+{
+        *map = NULL;
+        const char * path = stack->path[index];
+        if (stack->source.fetch != NULL) {
+                const char * name = path + strlen(stack->root) + 1;
+                if (stack_cache(stack->source.fetch, stack->source.context,
+                        name, path, error_) != TURTLE_RETURN_SUCCESS)
+                        return error_->code;
+        }
+        return turtle_map_load_(map, path, options, error_);
+}
+
+/* Dump the tiles index of a stack, for fast creations of the stack */
+enum turtle_return turtle_stack_index_dump(const struct turtle_stack * stack)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_stack_index_dump);
+
+        const int root_size = strlen(stack->root);
+        char * filename = malloc(root_size + sizeof(STACK_INDEX) + 1);
+        if (filename == NULL) return TURTLE_ERROR_MEMORY();
+        sprintf(filename, "%s/%s", stack->root, STACK_INDEX);
+        FILE * stream = fopen(filename, "w");
+        if (stream == NULL) {
+                TURTLE_ERROR_VREGISTER(TURTLE_RETURN_PATH_ERROR,
+                    "could not open file `%s'", filename);
+                free(filename);
+                return TURTLE_ERROR_RAISE();
+        }
+
+        /* The directory modification time is set once the index file has
+         * been created, since this modifies the directory
+         */
+        const int n_cells = stack->latitude_n * stack->longitude_n;
+        int i, n = 0;
+        for (i = 0; i < n_cells; i++) {
+                if (stack->path[i] != NULL) n++;
+        }
+        fprintf(stream, "%s\n%20lld\n%.17g %.17g %.17g %.17g %d %d %d\n",
+            STACK_INDEX_TAG, -1LL, stack->latitude_0, stack->latitude_delta,
+            stack->longitude_0, stack->longitude_delta, stack->latitude_n,
+            stack->longitude_n, n);
+        for (i = 0; i < n_cells; i++) {
+                const char * path = stack->path[i];
+                if (path == NULL) continue;
+                long long size, mtime;
+                if (stack_stat(path, &size, &mtime) != EXIT_SUCCESS)
+                        size = mtime = -1;
+                const char * encoding = strrchr(path, '.');
+                encoding = (encoding == NULL) ? "none" : encoding + 1;
+                const int ix = i % stack->longitude_n;
+                const int iy = i / stack->longitude_n;
+                const double x0 =
+                    stack->longitude_0 + ix * stack->longitude_delta;
+                const double y0 =
+                    stack->latitude_0 + iy * stack->latitude_delta;
+                const char * name = path + root_size;
+                while ((*name == '/') || (*name == '\\')) name++;
+                fprintf(stream,
+                    "%d %lld %lld %.7s %.17g %.17g %.17g %.17g %s\n", i, size,
+                    mtime, encoding, x0, x0 + stack->longitude_delta, y0,
+                    y0 + stack->latitude_delta, name);
+        }
+        int rc = (ferror(stream) != 0);
+        rc |= (fclose(stream) != 0);
+
+        if (!rc && ((stream = fopen(filename, "r+")) != NULL)) {
+                fseek(stream, sizeof(STACK_INDEX_TAG), SEEK_SET);
+                fprintf(stream, "%20lld", stack_mtime(stack->root));
+                rc |= (fclose(stream) != 0);
+        } else {
+                rc = 1;
+        }
+        if (rc) {
+                TURTLE_ERROR_VREGISTER(TURTLE_RETURN_PATH_ERROR,
+                    "could not write file `%s'", filename);
+        }
+        free(filename);
+
+        return TURTLE_ERROR_RAISE();
+}
+
 /* Low level routine for cleaning the stack */
 static void stack_clear(struct turtle_stack * stack, int force)
 {
         struct turtle_map * map = stack->tiles.head;
         while (map != NULL) {
                 struct turtle_map * next = map->element.next;
-                if ((force != 0) || (map->clients == 0))
-                        turtle_map_destroy(&map);
+                if ((force != 0) || (TURTLE_ATOMIC_LOAD(&map->clients) == 0))
+                        turtle_stack_evict_(stack, map);
                 map = next;
         }
 }
@@ -217,8 +709,14 @@ void turtle_stack_destroy(struct turtle_stack ** stack)
 {
         if ((stack == NULL) || (*stack == NULL)) return;
 
+#ifndef TURTLE_NO_PTHREAD
+        /* Stop any background loader, discarding pending requests */
+        prefetcher_stop(*stack, 0);
+#endif
+
         /* Force the stack cleaning */
         stack_clear(*stack, 1);
+        turtle_map_segment_flush_(*stack);
 
         /* Delete the stack and return */
         free(*stack);
@@ -229,18 +727,25 @@ void turtle_stack_destroy(struct turtle_stack ** stack)
 enum turtle_return turtle_stack_clear(struct turtle_stack * stack)
 {
         TURTLE_ERROR_INITIALISE(&turtle_stack_clear);
-        if ((stack->lock != NULL) && (stack->lock() != 0))
-                return TURTLE_ERROR_LOCK();
+        if (turtle_stack_lock_(stack, NULL) != 0) return TURTLE_ERROR_LOCK();
 
         /* Soft clean of the stack */
         stack_clear(stack, 0);
+        turtle_map_segment_flush_(stack);
 
-        if ((stack->unlock != NULL) && (stack->unlock() != 0))
+        if (turtle_stack_unlock_(stack) != 0)
                 return TURTLE_ERROR_UNLOCK();
         else
                 return TURTLE_RETURN_SUCCESS;
 }
 
+/* Check if the stack lock is still held after a failed fetch */
+static int stack_locked(const struct turtle_error_context * error_)
+{
+        return (error_->code != TURTLE_RETURN_LOCK_ERROR) &&
+            (error_->code != TURTLE_RETURN_UNLOCK_ERROR);
+}
+
 /* Load the stack elevation data into memory */
 enum turtle_return turtle_stack_load(struct turtle_stack * stack)
 {
@@ -248,97 +753,302 @@ enum turtle_return turtle_stack_load(struct turtle_stack * stack)
         if ((stack->latitude_n == 0) || (stack->longitude_n == 0))
                 return TURTLE_RETURN_SUCCESS;
 
-        if ((stack->lock != NULL) && (stack->lock() != 0))
-                return TURTLE_ERROR_LOCK();
+        if (turtle_stack_lock_(stack, NULL) != 0) return TURTLE_ERROR_LOCK();
 
-        double x = stack->longitude_0 + 0.5 * stack->longitude_delta;
-        double y = stack->latitude_0 + 0.5 * stack->latitude_delta;
-        struct turtle_map * head = stack->tiles.head;
-
-        while (stack->tiles.size < stack->max_size) {
-                /* First, let us check the initial stack */
-                int load = 1;
-                struct turtle_map * map = head;
-                while (map != NULL) {
-                        const double hx = (x - map->meta.x0) / map->meta.dx;
-                        const double hy = (y - map->meta.y0) / map->meta.dy;
-
-                        if ((hx >= 0.) && (hx <= map->meta.nx) && (hy >= 0.) &&
-                            (hy <= map->meta.ny)) {
-                                load = 0;
-                                break;
-                        }
-                        map = map->element.next;
+        const int n_cells = stack->latitude_n * stack->longitude_n;
+        int i;
+        for (i = 0; (i < n_cells) && !turtle_stack_full_(stack); i++) {
+                /* Skip cells that are already loaded or without data */
+                if ((stack->grid[i] != NULL) || turtle_stack_missing_(stack, i))
+                        continue;
+
+                /* Load the tile using its centre coordinates */
+                const int ix = i % stack->longitude_n;
+                const int iy = i / stack->longitude_n;
+                const double x = stack->longitude_0 +
+                    (ix + 0.5) * stack->longitude_delta;
+                const double y =
+                    stack->latitude_0 + (iy + 0.5) * stack->latitude_delta;
+                struct turtle_map * map;
+                if (turtle_stack_fetch_(stack, y, x, &map, NULL, NULL,
+                        error_) != TURTLE_RETURN_SUCCESS)
+                        break;
+        }
+
+        if (stack_locked(error_) && (turtle_stack_unlock_(stack) != 0))
+                return TURTLE_ERROR_UNLOCK();
+        else
+                return TURTLE_ERROR_RAISE();
+}
+
+/* Shared data of a bulk preload. Tiles are decoded concurrently without
+ * holding the stack lock, then published at once
+ */
+struct stack_preload {
+        struct turtle_stack * stack;
+        int map_options;
+        int size;
+        int next;
+        int failed;
+        int full;
+        int truncations;
+        size_t room;
+        size_t bytes;
+        unsigned long long load_time;
+        int * cells;
+        struct turtle_map ** maps;
+        struct turtle_error_context * errors;
+};
+
+/* Decode the preloaded tiles until all cells are done or an error occurs.
+ * If the stack has a memory budget, the decoding stops once the room left is
+ * exceeded
+ */
+static void * preload_run(void * arg)
+{
+        struct stack_preload * preload = arg;
+        for (;;) {
+                if (TURTLE_ATOMIC_LOAD(&preload->failed)) break;
+                const int i = TURTLE_ATOMIC_ADD(&preload->next, 1) - 1;
+                if (i >= preload->size) break;
+                if (TURTLE_ATOMIC_LOAD(&preload->full)) {
+                        TURTLE_ATOMIC_ADD(&preload->truncations, 1);
+                        continue;
                 }
 
-                if (load) {
-                        int inside;
-                        if (turtle_stack_load_(stack, y, x, &inside, error_) !=
-                            TURTLE_RETURN_SUCCESS)
-                                break;
+                struct turtle_error_context * error_ = preload->errors + i;
+                const unsigned long long t0 = turtle_stack_clock_();
+                if (stack_map_load(preload->stack, preload->cells[i],
+                        preload->map_options, preload->maps + i,
+                        error_) != TURTLE_RETURN_SUCCESS) {
+                        TURTLE_ATOMIC_STORE(&preload->failed, 1);
+                        break;
                 }
+                TURTLE_ATOMIC_ADD(
+                    &preload->load_time, turtle_stack_clock_() - t0);
 
-                /* Update the coordinates and check for termination */
-                x += stack->longitude_delta;
-                if (x > stack->longitude_0 +
-                        stack->longitude_n * stack->longitude_delta) {
-                        y += stack->latitude_delta;
-                        if (y > stack->latitude_0 +
-                                stack->latitude_n * stack->latitude_delta)
-                                break;
-                        x = stack->longitude_0 + 0.5 * stack->longitude_delta;
+                if (preload->stack->max_bytes > 0) {
+                        const size_t bytes =
+                            turtle_map_bytes_(preload->maps[i]);
+                        if (TURTLE_ATOMIC_ADD(&preload->bytes, bytes) >
+                            preload->room) {
+                                turtle_map_destroy(preload->maps + i);
+                                TURTLE_ATOMIC_STORE(&preload->full, 1);
+                                TURTLE_ATOMIC_ADD(&preload->truncations, 1);
+                        }
                 }
         }
+        return NULL;
+}
+
+/* Get the range of grid cells overlapping an interval. Returns `0` if there
+ * is none
+ */
+static int preload_range(double min, double max, double origin, double delta,
+    int n, int * i0, int * i1)
+{
+        const double u0 = (min - origin) / delta;
+        const double u1 = (max - origin) / delta;
+        if ((u1 < 0.) || (u0 >= n)) return 0;
+        *i0 = (u0 <= 0.) ? 0 : (int)u0;
+        *i1 = (u1 >= n) ? n - 1 : (int)u1;
+        return 1;
+}
+
+/* Load the tiles of a geographic region, using several threads */
+enum turtle_return turtle_stack_preload(struct turtle_stack * stack,
+    double latitude_min, double latitude_max, double longitude_min,
+    double longitude_max, int threads)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_stack_preload);
+        if (!(latitude_min <= latitude_max) ||
+            !(longitude_min <= longitude_max))
+                return TURTLE_ERROR_BOX();
+
+        int ix0, ix1, iy0, iy1;
+        if (!preload_range(latitude_min, latitude_max, stack->latitude_0,
+                stack->latitude_delta, stack->latitude_n, &iy0, &iy1) ||
+            !preload_range(longitude_min, longitude_max, stack->longitude_0,
+                stack->longitude_delta, stack->longitude_n, &ix0, &ix1))
+                return TURTLE_RETURN_SUCCESS;
+
+        /* Allocate the work data */
+        const int n = (iy1 - iy0 + 1) * (ix1 - ix0 + 1);
+        struct stack_preload preload = { .stack = stack };
+        preload.errors = calloc(n, sizeof(*preload.errors) +
+                sizeof(*preload.maps) + sizeof(*preload.cells));
+        if (preload.errors == NULL) return TURTLE_ERROR_MEMORY();
+        preload.maps = (struct turtle_map **)(preload.errors + n);
+        preload.cells = (int *)(preload.maps + n);
 
-        if ((stack->unlock != NULL) && (stack->unlock() != 0))
+        /* Select the cells to load, within the stack capacity */
+        if (turtle_stack_lock_(stack, NULL) != 0) {
+                free(preload.errors);
+                return TURTLE_ERROR_LOCK();
+        }
+        /* The tiles are bounded by the stack capacity, less the tiles in use
+         * that cannot be evicted. The memory budget left, if any, bounds them
+         * as well. Their size is estimated from the tiles already loaded, or
+         * checked while decoding
+         */
+        size_t room = 0;
+        int max_size = stack->max_size;
+        const struct turtle_map * map;
+        for (map = stack->tiles.head; map != NULL; map = map->element.next) {
+                if (TURTLE_ATOMIC_LOAD(&map->clients) != 0) max_size--;
+        }
+        if (max_size < 0) max_size = 0;
+        if (stack->max_bytes > 0) {
+                room = (stack->bytes < stack->max_bytes) ?
+                    stack->max_bytes - stack->bytes : 0;
+                if (stack->tiles.size > 0) {
+                        const size_t bytes = stack->bytes / stack->tiles.size;
+                        if ((bytes > 0) && (room / bytes < (size_t)max_size))
+                                max_size = room / bytes;
+                }
+        }
+        int ix, iy, truncations = 0;
+        for (iy = iy0; iy <= iy1; iy++) {
+                for (ix = ix0; ix <= ix1; ix++) {
+                        const int index = iy * stack->longitude_n + ix;
+                        if ((stack->grid[index] != NULL) ||
+                            turtle_stack_missing_(stack, index))
+                                continue;
+                        if (preload.size >= max_size) {
+                                if (max_size < stack->max_size) truncations++;
+                                continue;
+                        }
+                        preload.cells[preload.size++] = index;
+                }
+        }
+        stack->counters.truncations += truncations;
+        preload.map_options = stack->map_options;
+        preload.room = room;
+        if (turtle_stack_unlock_(stack) != 0) {
+                free(preload.errors);
                 return TURTLE_ERROR_UNLOCK();
-        else
-                return TURTLE_ERROR_RAISE();
+        }
+
+        /* Decode the tiles without holding the lock. The calling thread
+         * takes part in the work
+         */
+        int i;
+        for (i = 0; i < preload.size; i++) {
+                preload.errors[i].function =
+                    (turtle_function_t *)&turtle_stack_preload;
+        }
+        if (threads > preload.size) threads = preload.size;
+        turtle_parallel_run_(threads, &preload_run, &preload);
+
+        /* Publish all the decoded tiles at once, or none of them on
+         * failure
+         */
+        if (!preload.failed) {
+                if (turtle_stack_lock_(stack, NULL) != 0) {
+                        TURTLE_ERROR_REGISTER(TURTLE_RETURN_LOCK_ERROR,
+                            "could not acquire the lock");
+                        goto exit;
+                }
+                stack->counters.load_time += preload.load_time;
+                stack->counters.truncations += preload.truncations;
+                if (stack->max_bytes > 0) {
+                        room = (stack->bytes < stack->max_bytes) ?
+                            stack->max_bytes - stack->bytes : 0;
+                }
+                for (i = 0; i < preload.size; i++) {
+                        /* Skip tiles that were loaded meanwhile, or left
+                         * out by the budget
+                         */
+                        const int index = preload.cells[i];
+                        if ((preload.maps[i] == NULL) ||
+                            (stack->grid[index] != NULL))
+                                continue;
+
+                        /* Drop the tiles exceeding the memory budget */
+                        if (stack->max_bytes > 0) {
+                                const size_t bytes =
+                                    turtle_map_bytes_(preload.maps[i]);
+                                if (bytes > room) {
+                                        stack->counters.truncations++;
+                                        continue;
+                                }
+                                room -= bytes;
+                        }
+
+                        ix = index % stack->longitude_n;
+                        iy = index / stack->longitude_n;
+                        const double longitude = stack->longitude_0 +
+                            (ix + 0.5) * stack->longitude_delta;
+                        const double latitude = stack->latitude_0 +
+                            (iy + 0.5) * stack->latitude_delta;
+                        /* The published tiles are pinned, such that they
+                         * are not evicted by the following ones
+                         */
+                        stack_insert(stack, preload.maps[i], index, latitude,
+                            longitude);
+                        TURTLE_ATOMIC_ADD(&preload.maps[i]->clients, 1);
+                }
+                for (i = 0; i < preload.size; i++) {
+                        struct turtle_map * m = preload.maps[i];
+                        if ((m == NULL) || (m->stack != stack)) continue;
+                        TURTLE_ATOMIC_ADD(&m->clients, -1);
+                        preload.maps[i] = NULL;
+                }
+                if (turtle_stack_unlock_(stack) != 0) {
+                        TURTLE_ERROR_REGISTER(TURTLE_RETURN_UNLOCK_ERROR,
+                            "could not release the lock");
+                }
+        }
+
+exit:
+        /* Release any unpublished tile and forward the first error */
+        for (i = 0; i < preload.size; i++)
+                turtle_map_destroy(preload.maps + i);
+        turtle_error_forward_(error_, preload.errors, preload.size);
+        free(preload.errors);
+
+        return TURTLE_ERROR_RAISE();
 }
 
 /* Get the proper map for given coordinates */
 static int stack_get_map(
     struct turtle_stack * stack, double latitude, double longitude)
 {
-        int load = 1;
         if (stack->tiles.head != NULL) {
                 /* First let's check the top of the stack */
                 struct turtle_map * head = stack->tiles.head;
-                double hx = (longitude - head->meta.x0) / head->meta.dx;
-                double hy = (latitude - head->meta.y0) / head->meta.dy;
-
-                if ((hx < 0.) || (hx >= head->meta.nx - 1) || (hy < 0.) ||
-                    (hy >= head->meta.ny - 1)) {
-                        /* The requested coordinates are not in the top
-                         * maps. Let's check the full stack */
-                        struct turtle_map * map = head->element.next;
-                        while (map != NULL) {
-                                hx = (longitude - map->meta.x0) / map->meta.dx;
-                                hy = (latitude - map->meta.y0) / map->meta.dy;
-
-                                if ((hx >= 0.) && (hx < map->meta.nx - 1) &&
-                                    (hy >= 0.) && (hy < map->meta.ny - 1)) {
-                                        /*
-                                         * Move the valid map to the top
-                                         * of the stack
-                                         */
-                                        turtle_stack_touch_(stack, map);
-                                        load = 0;
-                                        break;
-                                }
-                                map = map->element.next;
-                        }
-                } else
-                        load = 0;
+                const double hx = (longitude - head->meta.x0) / head->meta.dx;
+                const double hy = (latitude - head->meta.y0) / head->meta.dy;
+
+                if ((hx >= 0.) && (hx < head->meta.nx - 1) && (hy >= 0.) &&
+                    (hy < head->meta.ny - 1)) {
+                        stack->counters.head_hits++;
+                        return 0;
+                }
+
+                /* The requested coordinates are not in the top map. Let's
+                 * lookup the grid of loaded tiles
+                 */
+                const int index =
+                    turtle_stack_index_(stack, latitude, longitude);
+                if ((index >= 0) && (stack->grid[index] != NULL)) {
+                        /* Move the valid map to the top of the stack */
+                        turtle_stack_touch_(stack, stack->grid[index]);
+                        stack->counters.grid_hits++;
+                        return 0;
+                }
         }
-        return load;
+        stack->counters.misses++;
+        return 1;
 }
 
-/* Get the elevation at the given geodetic coordinates */
-enum turtle_return turtle_stack_elevation(struct turtle_stack * stack,
-    double latitude, double longitude, double * elevation, int * inside)
+/* Get the elevation at the given geodetic coordinates and, if `gradient` is
+ * not `NULL`, the gradient along latitude and longitude
+ */
+static enum turtle_return stack_elevation(struct turtle_stack * stack,
+    double latitude, double longitude, double * elevation, double * gradient,
+    int * inside, struct turtle_error_context * error_)
 {
-        TURTLE_ERROR_INITIALISE(&turtle_stack_elevation);
         if (inside != NULL) *inside = 0;
 
         /* Get the proper map */
@@ -351,50 +1061,755 @@ enum turtle_return turtle_stack_elevation(struct turtle_stack * stack,
                 if ((rc != TURTLE_RETURN_SUCCESS) ||
                     ((inside != NULL) && (*inside == 0))) {
                         *elevation = 0.;
+                        if (gradient != NULL) gradient[0] = gradient[1] = 0.;
                         return TURTLE_ERROR_RAISE();
                 }
         }
 
         /* Interpolate the elevation */
-        return turtle_map_elevation_(
-            stack->tiles.head, longitude, latitude, elevation, inside, error_);
+        if (gradient == NULL) {
+                return turtle_map_elevation_(stack->tiles.head, longitude,
+                    latitude, elevation, inside, error_);
+        } else {
+                return turtle_map_elevation_gradient_(stack->tiles.head,
+                    longitude, latitude, elevation, gradient + 1, gradient,
+                    inside, error_);
+        }
 }
 
-/* Get the gradient at the given geodetic coordinates */
-enum turtle_return turtle_stack_gradient(struct turtle_stack * stack,
-    double latitude, double longitude, double * glat, double * glon,
-    int * inside)
+enum turtle_return turtle_stack_elevation(struct turtle_stack * stack,
+    double latitude, double longitude, double * elevation, int * inside)
 {
         TURTLE_ERROR_INITIALISE(&turtle_stack_elevation);
-        if (inside != NULL) *inside = 0;
+        return stack_elevation(
+            stack, latitude, longitude, elevation, NULL, inside, error_);
+}
 
-        /* Get the proper map */
-        const int load = stack_get_map(stack, latitude, longitude);
+/* Get the elevation over arrays of geodetic coordinates */
+enum turtle_return turtle_stack_elevation_v(struct turtle_stack * stack, int n,
+    const double * latitude, const double * longitude, double * elevation,
+    int * inside)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_stack_elevation_v);
 
-        if (load) {
-                /* No valid map was found. Let's try to load it */
-                enum turtle_return rc = turtle_stack_load_(
-                    stack, latitude, longitude, inside, error_);
-                if ((rc != TURTLE_RETURN_SUCCESS) ||
-                    ((inside != NULL) && (*inside == 0))) {
-                        *glat = *glon = 0.;
-                        return TURTLE_ERROR_RAISE();
-                }
+        int i = 0;
+        while (i < n) {
+                /* Locate the proper map, loading it if needed */
+                if (stack_elevation(stack, latitude[i], longitude[i],
+                        elevation + i, NULL,
+                        (inside != NULL) ? inside + i : NULL,
+                        error_) != TURTLE_RETURN_SUCCESS)
+                        return error_->code;
+                i++;
+                if (stack->tiles.head == NULL) continue;
+
+                /* Process the following locations within the same map */
+                const int m = turtle_map_run_(
+                    stack->tiles.head, n - i, longitude + i, latitude + i);
+                if (m == 0) continue;
+                turtle_map_elevation_v_(stack->tiles.head, m, longitude + i,
+                    latitude + i, elevation + i,
+                    (inside != NULL) ? inside + i : NULL, error_);
+                i += m;
         }
 
-        /* Interpolate the elevation */
-        return turtle_map_gradient_(
-            stack->tiles.head, longitude, latitude, glon, glat, inside, error_);
+        return TURTLE_RETURN_SUCCESS;
 }
 
-/* Move a map to the top of the stack */
+/* Get the gradient at the given geodetic coordinates */
+enum turtle_return turtle_stack_gradient(struct turtle_stack * stack,
+    double latitude, double longitude, double * glat, double * glon,
+    int * inside)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_stack_gradient);
+        double elevation, gradient[2] = { 0., 0. };
+        const enum turtle_return rc = stack_elevation(stack, latitude,
+            longitude, &elevation, gradient, inside, error_);
+        *glat = gradient[0];
+        *glon = gradient[1];
+        return rc;
+}
+
+/* Get the elevation and the gradient at the given geodetic coordinates */
+enum turtle_return turtle_stack_elevation_gradient(struct turtle_stack * stack,
+    double latitude, double longitude, double * elevation, double * glat,
+    double * glon, int * inside)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_stack_elevation_gradient);
+        double gradient[2] = { 0., 0. };
+        const enum turtle_return rc = stack_elevation(stack, latitude,
+            longitude, elevation, gradient, inside, error_);
+        *glat = gradient[0];
+        *glon = gradient[1];
+        return rc;
+}
+
+/* Load the tile of a given grid cell, if not already loaded */
+static enum turtle_return stack_load_cell(struct turtle_stack * stack,
+    int index, int * loaded, struct turtle_error_context * error_)
+{
+        *loaded = 0;
+        if ((stack->grid[index] != NULL) || turtle_stack_missing_(stack, index))
+                return TURTLE_RETURN_SUCCESS;
+
+        /* Load the tile using its centre coordinates */
+        const int ix = index % stack->longitude_n;
+        const int iy = index / stack->longitude_n;
+        const double longitude =
+            stack->longitude_0 + (ix + 0.5) * stack->longitude_delta;
+        const double latitude =
+            stack->latitude_0 + (iy + 0.5) * stack->latitude_delta;
+        struct turtle_map * map;
+        turtle_stack_fetch_(
+            stack, latitude, longitude, &map, NULL, NULL, error_);
+        *loaded = (map != NULL);
+        return error_->code;
+}
+
+#ifndef TURTLE_NO_PTHREAD
+/* Main loop of the background loader */
+static void * prefetcher_run(void * arg)
+{
+        struct turtle_stack * stack = arg;
+        struct turtle_stack_prefetcher * prefetcher = stack->prefetcher;
+        const int n_cells = stack->latitude_n * stack->longitude_n;
+
+        pthread_mutex_lock(&prefetcher->mutex);
+        for (;;) {
+                while ((prefetcher->size == 0) && !prefetcher->stop)
+                        pthread_cond_wait(
+                            &prefetcher->cond, &prefetcher->mutex);
+                if (prefetcher->size == 0) break;
+
+                /* Pop the next request */
+                const int index = prefetcher->queue[prefetcher->head];
+                prefetcher->head = (prefetcher->head + 1) % n_cells;
+                prefetcher->size--;
+                pthread_mutex_unlock(&prefetcher->mutex);
+
+                /* Load the tile. Errors are not reported, since the tile
+                 * is loaded again on demand, if needed
+                 */
+                TURTLE_ERROR_INITIALISE(&turtle_stack_prefetch);
+                if (turtle_stack_lock_(stack, NULL) == 0) {
+                        int loaded;
+                        stack_load_cell(stack, index, &loaded, error_);
+                        if (stack_locked(error_)) turtle_stack_unlock_(stack);
+                }
+                if (error_->dynamic) free(error_->message);
+
+                pthread_mutex_lock(&prefetcher->mutex);
+                prefetcher->pending[index] = 0;
+        }
+        pthread_mutex_unlock(&prefetcher->mutex);
+
+        return NULL;
+}
+
+/* Stop the background loader, if any */
+static void prefetcher_stop(struct turtle_stack * stack, int drain)
+{
+        struct turtle_stack_prefetcher * prefetcher = stack->prefetcher;
+        if (prefetcher == NULL) return;
+
+        pthread_mutex_lock(&prefetcher->mutex);
+        prefetcher->stop = 1;
+        if (!drain) prefetcher->size = 0;
+        pthread_cond_signal(&prefetcher->cond);
+        pthread_mutex_unlock(&prefetcher->mutex);
+        pthread_join(prefetcher->thread, NULL);
+
+        pthread_cond_destroy(&prefetcher->cond);
+        pthread_mutex_destroy(&prefetcher->mutex);
+        free(prefetcher);
+        stack->prefetcher = NULL;
+}
+
+/* Queue a grid cell for a background load */
+static int prefetcher_push(struct turtle_stack * stack, int index)
+{
+        struct turtle_stack_prefetcher * prefetcher = stack->prefetcher;
+        if (turtle_stack_missing_(stack, index)) return 0;
+
+        pthread_mutex_lock(&prefetcher->mutex);
+        int queued = 0;
+        if (!prefetcher->pending[index]) {
+                const int n_cells = stack->latitude_n * stack->longitude_n;
+                const int tail =
+                    (prefetcher->head + prefetcher->size) % n_cells;
+                prefetcher->queue[tail] = index;
+                prefetcher->size++;
+                prefetcher->pending[index] = 1;
+                pthread_cond_signal(&prefetcher->cond);
+                queued = 1;
+        }
+        pthread_mutex_unlock(&prefetcher->mutex);
+
+        return queued;
+}
+#endif
+
+/* Enable or disable the background loading of prefetched tiles */
+enum turtle_return turtle_stack_prefetch_async_set(
+    struct turtle_stack * stack, int enable)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_stack_prefetch_async_set);
+
+#ifdef TURTLE_NO_PTHREAD
+        if (!enable) return TURTLE_RETURN_SUCCESS;
+        return TURTLE_ERROR_MESSAGE(TURTLE_RETURN_LIBRARY_ERROR,
+            "asynchronous prefetching is not available");
+#else
+        if (!enable) {
+                /* Process any pending request and stop the loader */
+                prefetcher_stop(stack, 1);
+                return TURTLE_RETURN_SUCCESS;
+        } else if (stack->prefetcher != NULL)
+                return TURTLE_RETURN_SUCCESS;
+
+        if (!turtle_stack_has_lock_(stack))
+                return TURTLE_ERROR_MESSAGE(
+                    TURTLE_RETURN_BAD_ADDRESS, "stack has no lock");
+        const int n_cells = stack->latitude_n * stack->longitude_n;
+        if (n_cells == 0) return TURTLE_RETURN_SUCCESS;
+
+        /* Allocate and initialise the loader */
+        struct turtle_stack_prefetcher * prefetcher = malloc(
+            sizeof(*prefetcher) + n_cells * (sizeof(int) + 1));
+        if (prefetcher == NULL) return TURTLE_ERROR_MEMORY();
+        prefetcher->stop = 0;
+        prefetcher->head = prefetcher->size = 0;
+        prefetcher->pending = (unsigned char *)(prefetcher->queue + n_cells);
+        memset(prefetcher->pending, 0x0, n_cells);
+        pthread_mutex_init(&prefetcher->mutex, NULL);
+        pthread_cond_init(&prefetcher->cond, NULL);
+
+        /* Start the loader thread */
+        stack->prefetcher = prefetcher;
+        if (pthread_create(&prefetcher->thread, NULL, &prefetcher_run,
+                stack) != 0) {
+                pthread_cond_destroy(&prefetcher->cond);
+                pthread_mutex_destroy(&prefetcher->mutex);
+                free(prefetcher);
+                stack->prefetcher = NULL;
+                return TURTLE_ERROR_MESSAGE(TURTLE_RETURN_LIBRARY_ERROR,
+                    "could not start the loader thread");
+        }
+
+        return TURTLE_RETURN_SUCCESS;
+#endif
+}
+
+int turtle_stack_prefetch_async_get(const struct turtle_stack * stack)
+{
+        return (stack->prefetcher != NULL) ? 1 : 0;
+}
+
+/* Request the loading of a grid cell, either directly or in the background */
+static enum turtle_return stack_prefetch_cell(struct turtle_stack * stack,
+    int index, int * count, struct turtle_error_context * error_)
+{
+        if (index < 0) return TURTLE_RETURN_SUCCESS;
+#ifndef TURTLE_NO_PTHREAD
+        if (stack->prefetcher != NULL) {
+                *count += prefetcher_push(stack, index);
+                return TURTLE_RETURN_SUCCESS;
+        }
+#endif
+        int loaded;
+        if (stack_load_cell(stack, index, &loaded, error_) !=
+            TURTLE_RETURN_SUCCESS)
+                return error_->code;
+        *count += loaded;
+        return TURTLE_RETURN_SUCCESS;
+}
+
+/* Load the tiles that are likely to be requested next */
+enum turtle_return turtle_stack_prefetch(struct turtle_stack * stack,
+    const double position[3], const double direction[3], double distance)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_stack_prefetch);
+        if ((stack->latitude_n == 0) || (stack->longitude_n == 0))
+                return TURTLE_RETURN_SUCCESS;
+
+        /* Synchronous loads are done with an exclusive access to the stack */
+        const int async = (stack->prefetcher != NULL);
+        if (!async && (turtle_stack_lock_(stack, NULL) != 0))
+                return TURTLE_ERROR_LOCK();
+
+        /* The number of requested tiles is bounded by the stack size, in
+         * order to not evict prefetched tiles
+         */
+        int count = 0;
+        double latitude, longitude, altitude;
+        turtle_ecef_to_geodetic(position, &latitude, &longitude, &altitude);
+        if (stack_prefetch_cell(stack,
+                turtle_stack_index_(stack, latitude, longitude), &count,
+                error_) != TURTLE_RETURN_SUCCESS)
+                goto exit;
+
+        if (direction != NULL) {
+                /* Scan the tiles along the given direction, with a step
+                 * smaller than the tiles size. The scan is bounded by the
+                 * extent of the stack grid, i.e. by a few steps per grid
+                 * cell
+                 */
+                const double norm = sqrt(direction[0] * direction[0] +
+                    direction[1] * direction[1] + direction[2] * direction[2]);
+                if ((norm <= 0.) || !(distance > 0.)) goto exit;
+                const double delta =
+                    (stack->latitude_delta < stack->longitude_delta) ?
+                    stack->latitude_delta :
+                    stack->longitude_delta;
+                const double step = 0.5 * delta * M_PI / 180. * EARTH_RADIUS;
+                const int n_max =
+                    4 * (stack->latitude_n + stack->longitude_n);
+                const double ns = ceil(distance / step);
+                const int n = (ns < n_max) ? (int)ns : n_max;
+                const double length = (ns < n_max) ? distance : n * step;
+                int i, previous = -1;
+                for (i = 1; (i <= n) && (count < stack->max_size); i++) {
+                        const double s = (i < n) ? i * step / norm :
+                                                   length / norm;
+                        const double r[3] = { position[0] + s * direction[0],
+                                position[1] + s * direction[1],
+                                position[2] + s * direction[2] };
+                        turtle_ecef_to_geodetic(
+                            r, &latitude, &longitude, &altitude);
+                        const int index =
+                            turtle_stack_index_(stack, latitude, longitude);
+                        if (index == previous) continue;
+                        previous = index;
+                        if (stack_prefetch_cell(stack, index, &count,
+                                error_) != TURTLE_RETURN_SUCCESS)
+                                goto exit;
+                }
+        } else {
+                /* Scan the tiles within the given distance */
+                const double dlat = distance / EARTH_RADIUS * 180. / M_PI;
+                const double c = cos(latitude * M_PI / 180.);
+                const double dlon = (c > dlat * M_PI / 180.) ? dlat / c : 180.;
+                double lat0 = latitude - dlat, lon0 = longitude - dlon;
+                if (lat0 < stack->latitude_0) lat0 = stack->latitude_0;
+                if (lon0 < stack->longitude_0) lon0 = stack->longitude_0;
+                const int ix0 = (int)((lon0 - stack->longitude_0) /
+                    stack->longitude_delta);
+                const int iy0 = (int)((lat0 - stack->latitude_0) /
+                    stack->latitude_delta);
+                int ix1 = (int)((longitude + dlon - stack->longitude_0) /
+                    stack->longitude_delta);
+                int iy1 = (int)((latitude + dlat - stack->latitude_0) /
+                    stack->latitude_delta);
+                if (ix1 >= stack->longitude_n) ix1 = stack->longitude_n - 1;
+                if (iy1 >= stack->latitude_n) iy1 = stack->latitude_n - 1;
+                int ix, iy;
+                for (iy = iy0; iy <= iy1; iy++) {
+                        for (ix = ix0; (ix <= ix1) &&
+                             (count < stack->max_size);
+                             ix++) {
+                                if (stack_prefetch_cell(stack,
+                                        iy * stack->longitude_n + ix, &count,
+                                        error_) != TURTLE_RETURN_SUCCESS)
+                                        goto exit;
+                        }
+                }
+        }
+
+exit:
+        if (!async && stack_locked(error_) &&
+            (turtle_stack_unlock_(stack) != 0))
+                return TURTLE_ERROR_UNLOCK();
+        return TURTLE_ERROR_RAISE();
+}
+
+/* Enable or disable the memory mapping of tiles */
+void turtle_stack_mmap_set(struct turtle_stack * stack, int enable)
+{
+        if (enable)
+                stack->map_options |= TURTLE_MAP_LOAD_MMAP;
+        else
+                stack->map_options &= ~TURTLE_MAP_LOAD_MMAP;
+}
+
+int turtle_stack_mmap_get(const struct turtle_stack * stack)
+{
+        return (stack->map_options & TURTLE_MAP_LOAD_MMAP) ? 1 : 0;
+}
+
+/* Enable or disable the normalisation of tiles */
+void turtle_stack_normalise_set(struct turtle_stack * stack, int enable)
+{
+        if (enable)
+                stack->map_options |= TURTLE_MAP_LOAD_NORMALISE;
+        else
+                stack->map_options &= ~TURTLE_MAP_LOAD_NORMALISE;
+}
+
+int turtle_stack_normalise_get(const struct turtle_stack * stack)
+{
+        return (stack->map_options & TURTLE_MAP_LOAD_NORMALISE) ? 1 : 0;
+}
+
+/* Enable or disable the blocked layout of tiles */
+void turtle_stack_block_set(struct turtle_stack * stack, int enable)
+{
+        if (enable)
+                stack->map_options |= TURTLE_MAP_LOAD_BLOCK;
+        else
+                stack->map_options &= ~TURTLE_MAP_LOAD_BLOCK;
+}
+
+int turtle_stack_block_get(const struct turtle_stack * stack)
+{
+        return (stack->map_options & TURTLE_MAP_LOAD_BLOCK) ? 1 : 0;
+}
+
+/* Enable or disable the sharing of tiles between processes */
+void turtle_stack_shared_set(struct turtle_stack * stack, int enable)
+{
+        if (enable)
+                stack->map_options |= TURTLE_MAP_LOAD_SHARED;
+        else
+                stack->map_options &= ~TURTLE_MAP_LOAD_SHARED;
+}
+
+int turtle_stack_shared_get(const struct turtle_stack * stack)
+{
+        return (stack->map_options & TURTLE_MAP_LOAD_SHARED) ? 1 : 0;
+}
+
+/* Remove the shared memory segments of the stack tiles */
+void turtle_stack_shared_unlink(const struct turtle_stack * stack)
+{
+        const int n_cells = stack->latitude_n * stack->longitude_n;
+        int i;
+        for (i = 0; i < n_cells; i++) {
+                if (stack->path[i] != NULL)
+                        turtle_map_segment_unlink_(stack->path[i]);
+        }
+}
+
+/* Set the memory budget for loaded tiles */
+void turtle_stack_budget_set(struct turtle_stack * stack, size_t bytes)
+{
+        stack->max_bytes = bytes;
+}
+
+size_t turtle_stack_budget_get(const struct turtle_stack * stack)
+{
+        return stack->max_bytes;
+}
+
+/* Get the runtime statistics of the stack */
+void turtle_stack_stats(
+    const struct turtle_stack * stack, struct turtle_stats * stats)
+{
+        struct turtle_stack_counters counters = stack->counters;
+        counters.missing = TURTLE_ATOMIC_LOAD(&stack->counters.missing);
+        counters.locks = TURTLE_ATOMIC_LOAD(&stack->counters.locks);
+        counters.lock_time = TURTLE_ATOMIC_LOAD(&stack->counters.lock_time);
+        turtle_stack_export_(&counters, stats);
+}
+
+void turtle_stack_stats_reset(struct turtle_stack * stack)
+{
+        memset(&stack->counters, 0x0, sizeof(stack->counters));
+}
+
+/* Set a hook for load and evict events */
+void turtle_stack_hook_set(
+    struct turtle_stack * stack, turtle_stack_hook_t * hook, void * context)
+{
+        stack->hook = hook;
+        stack->hook_context = context;
+}
+
+/* Get a monotonic time stamp, in ns */
+unsigned long long turtle_stack_clock_(void)
+{
+#ifdef CLOCK_MONOTONIC
+        struct timespec ts;
+        if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+                return (unsigned long long)ts.tv_sec * 1000000000ULL +
+                    ts.tv_nsec;
+        }
+#endif
+        return (unsigned long long)(clock() * (1E+09 / CLOCKS_PER_SEC));
+}
+
+/* Export runtime counters to the public statistics structure */
+void turtle_stack_export_(
+    const struct turtle_stack_counters * counters, struct turtle_stats * stats)
+{
+        stats->head_hits = counters->head_hits;
+        stats->set_hits = counters->set_hits;
+        stats->grid_hits = counters->grid_hits;
+        stats->misses = counters->misses;
+        stats->missing = counters->missing;
+        stats->loads = counters->loads;
+        stats->load_bytes = counters->load_bytes;
+        stats->load_time = counters->load_time * 1E-09;
+        stats->evictions = counters->evictions;
+        stats->truncations = counters->truncations;
+        stats->locks = counters->locks;
+        stats->lock_time = counters->lock_time * 1E-09;
+}
+
+/* Set the eviction policy for loaded tiles */
+void turtle_stack_policy_set(
+    struct turtle_stack * stack, enum turtle_stack_policy policy)
+{
+        stack->policy = policy;
+}
+
+enum turtle_stack_policy turtle_stack_policy_get(
+    const struct turtle_stack * stack)
+{
+        return stack->policy;
+}
+
+/* Set the context aware lock callbacks */
+enum turtle_return turtle_stack_lock_set(struct turtle_stack * stack,
+    turtle_stack_context_locker_t * lock,
+    turtle_stack_context_locker_t * unlock,
+    turtle_stack_context_locker_t * shared_lock,
+    turtle_stack_context_locker_t * shared_unlock, void * context)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_stack_lock_set);
+
+        /* Check the callbacks consistency */
+        if (((lock == NULL) != (unlock == NULL)) ||
+            ((shared_lock == NULL) != (shared_unlock == NULL)))
+                return TURTLE_ERROR_MESSAGE(
+                    TURTLE_RETURN_BAD_ADDRESS, "inconsistent lock & unlock");
+        if ((lock == NULL) && (shared_lock != NULL))
+                return TURTLE_ERROR_MESSAGE(TURTLE_RETURN_BAD_ADDRESS,
+                    "shared lock without exclusive lock");
+
+        stack->locker.lock = lock;
+        stack->locker.unlock = unlock;
+        stack->locker.shared_lock = shared_lock;
+        stack->locker.shared_unlock = shared_unlock;
+        stack->locker.context = context;
+
+        return TURTLE_RETURN_SUCCESS;
+}
+
+/* Check if the stack is protected by a lock */
+int turtle_stack_has_lock_(const struct turtle_stack * stack)
+{
+        return (stack->locker.lock != NULL) || (stack->lock != NULL);
+}
+
+/* Check if the stack allows for shared accesses */
+int turtle_stack_has_shared_lock_(const struct turtle_stack * stack)
+{
+        return stack->locker.shared_lock != NULL;
+}
+
+/* Record a lock acquisition started at t0 */
+static void stack_count_lock(struct turtle_stack * stack,
+    struct turtle_stack_counters * counters, unsigned long long t0)
+{
+        const unsigned long long dt = turtle_stack_clock_() - t0;
+        TURTLE_ATOMIC_ADD(&stack->counters.locks, 1);
+        TURTLE_ATOMIC_ADD(&stack->counters.lock_time, dt);
+        if (counters != NULL) {
+                counters->locks++;
+                counters->lock_time += dt;
+        }
+}
+
+/* Acquire an exclusive access to the stack. If non NULL, the acquisition is
+ * also recorded to the given counters
+ */
+int turtle_stack_lock_(
+    struct turtle_stack * stack, struct turtle_stack_counters * counters)
+{
+        if (!turtle_stack_has_lock_(stack)) return 0;
+
+        const unsigned long long t0 = turtle_stack_clock_();
+        const int rc = (stack->locker.lock != NULL) ?
+            stack->locker.lock(stack->locker.context) :
+            stack->lock();
+        stack_count_lock(stack, counters, t0);
+        return rc;
+}
+
+/* Release an exclusive access to the stack */
+int turtle_stack_unlock_(struct turtle_stack * stack)
+{
+        if (stack->locker.unlock != NULL)
+                return stack->locker.unlock(stack->locker.context);
+        else if (stack->unlock != NULL)
+                return stack->unlock();
+        else
+                return 0;
+}
+
+/* Acquire a shared access to the stack, or an exclusive one if not
+ * available
+ */
+int turtle_stack_lock_shared_(
+    struct turtle_stack * stack, struct turtle_stack_counters * counters)
+{
+        if (stack->locker.shared_lock == NULL)
+                return turtle_stack_lock_(stack, counters);
+
+        const unsigned long long t0 = turtle_stack_clock_();
+        const int rc = stack->locker.shared_lock(stack->locker.context);
+        stack_count_lock(stack, counters, t0);
+        return rc;
+}
+
+/* Release a shared access to the stack */
+int turtle_stack_unlock_shared_(struct turtle_stack * stack)
+{
+        if (stack->locker.shared_unlock != NULL)
+                return stack->locker.shared_unlock(stack->locker.context);
+        else
+                return turtle_stack_unlock_(stack);
+}
+
+/* Get the grid cell index for the given coordinates, or -1 if outside */
+int turtle_stack_index_(
+    const struct turtle_stack * stack, double latitude, double longitude)
+{
+        if ((longitude < stack->longitude_0) || (latitude < stack->latitude_0))
+                return -1;
+        const int ix =
+            (int)((longitude - stack->longitude_0) / stack->longitude_delta);
+        if (ix >= stack->longitude_n) return -1;
+        const int iy =
+            (int)((latitude - stack->latitude_0) / stack->latitude_delta);
+        if (iy >= stack->latitude_n) return -1;
+        return iy * stack->longitude_n + ix;
+}
+
+/* Check if a grid cell has no elevation data */
+int turtle_stack_missing_(const struct turtle_stack * stack, int index)
+{
+        return (index < 0) || (stack->missing[index / 8] & (1 << (index % 8)));
+}
+
+/* Move a map to the top of the stack */
 void turtle_stack_touch_(struct turtle_stack * stack, struct turtle_map * map)
 {
+        turtle_stack_hit_(stack, map);
         if (map->element.previous == NULL) return; /* Already on top */
         turtle_list_remove_(&stack->tiles, map);
         turtle_list_insert_(&stack->tiles, map, 0);
 }
 
+/* Record an access to a map, for the eviction policy. This is safe under a
+ * shared lock
+ */
+void turtle_stack_hit_(struct turtle_stack * stack, struct turtle_map * map)
+{
+        TURTLE_ATOMIC_STORE(&map->stamp, TURTLE_ATOMIC_ADD(&stack->clock, 1));
+        TURTLE_ATOMIC_ADD(&map->hits, 1);
+}
+
+/* Check if no more tiles can be loaded without evicting another one */
+int turtle_stack_full_(const struct turtle_stack * stack)
+{
+        return (stack->tiles.size >= stack->max_size) ||
+            ((stack->max_bytes > 0) && (stack->bytes >= stack->max_bytes));
+}
+
+/* Check if the loaded tiles exceed the stack capacity */
+int turtle_stack_overflow_(const struct turtle_stack * stack)
+{
+        return (stack->tiles.size > stack->max_size) ||
+            ((stack->max_bytes > 0) && (stack->bytes > stack->max_bytes));
+}
+
+/* Evict a map from the stack */
+void turtle_stack_evict_(struct turtle_stack * stack, struct turtle_map * map)
+{
+        stack->counters.evictions++;
+        if (stack->hook != NULL) {
+                const char * path =
+                    (map->index >= 0) ? stack->path[map->index] : NULL;
+                stack->hook(
+                    stack->hook_context, TURTLE_STACK_EVENT_EVICT, map, path);
+        }
+        turtle_map_destroy(&map);
+}
+
+/* Score a map for eviction. Maps with the lowest score are evicted first */
+static double stack_score(const struct turtle_stack * stack,
+    const struct turtle_map * map, double latitude, double longitude)
+{
+        if (stack->policy == TURTLE_STACK_POLICY_LFU) {
+                return (double)TURTLE_ATOMIC_LOAD(&map->hits);
+        } else if (stack->policy == TURTLE_STACK_POLICY_DISTANCE) {
+                /* Angular distance of the tile centre to the requested
+                 * location
+                 */
+                const double x =
+                    map->meta.x0 + 0.5 * (map->meta.nx - 1) * map->meta.dx;
+                const double y =
+                    map->meta.y0 + 0.5 * (map->meta.ny - 1) * map->meta.dy;
+                const double dx =
+                    (x - longitude) * cos(latitude * M_PI / 180.);
+                const double dy = y - latitude;
+                return -(dx * dx + dy * dy);
+        } else {
+                return (double)TURTLE_ATOMIC_LOAD(&map->stamp);
+        }
+}
+
+/* Evict unused maps according to the stack policy, until there is room for
+ * a new map of the given size
+ */
+static void stack_evict(struct turtle_stack * stack, size_t bytes,
+    double latitude, double longitude)
+{
+        while ((stack->tiles.size >= stack->max_size) ||
+            ((stack->max_bytes > 0) &&
+                (stack->bytes + bytes > stack->max_bytes))) {
+                struct turtle_map * victim = NULL;
+                double worst = 0.;
+                struct turtle_map * m;
+                for (m = stack->tiles.tail; m != NULL;
+                     m = m->element.previous) {
+                        if (TURTLE_ATOMIC_LOAD(&m->clients) != 0) continue;
+                        const double score =
+                            stack_score(stack, m, latitude, longitude);
+                        if ((victim == NULL) || (score < worst)) {
+                                victim = m;
+                                worst = score;
+                        }
+                }
+                if (victim == NULL) break; /* All maps are in use */
+                turtle_stack_evict_(stack, victim);
+        }
+}
+
+/* Append a newly loaded map at the head of the stack */
+static void stack_insert(struct turtle_stack * stack, struct turtle_map * map,
+    int index, double latitude, double longitude)
+{
+        /* Make room for the new map, if needed */
+        const size_t bytes = turtle_map_bytes_(map);
+        turtle_map_segment_claim_(stack, map);
+        stack_evict(stack, bytes, latitude, longitude);
+
+        map->stack = stack;
+        map->index = index;
+        stack->grid[index] = map;
+        stack->bytes += bytes;
+        turtle_list_insert_(&stack->tiles, map, 0);
+        turtle_stack_hit_(stack, map);
+        stack->counters.loads++;
+        stack->counters.load_bytes += bytes;
+        if (stack->hook != NULL) {
+                stack->hook(stack->hook_context, TURTLE_STACK_EVENT_LOAD, map,
+                    stack->path[index]);
+        }
+}
+
 /* Load a new map and manage the stack */
 enum turtle_return turtle_stack_load_(struct turtle_stack * stack,
     double latitude, double longitude, int * inside,
@@ -412,39 +1827,179 @@ enum turtle_return turtle_stack_load_(struct turtle_stack * stack,
 
         /* Lookup the requested file */
         if (inside != NULL) *inside = 0;
-        if ((longitude < stack->longitude_0) || (latitude < stack->latitude_0))
+        const int index = turtle_stack_index_(stack, latitude, longitude);
+        if (turtle_stack_missing_(stack, index)) {
+                /* This might be called without any lock, e.g. by clients */
+                TURTLE_ATOMIC_ADD(&stack->counters.missing, 1);
                 RETURN_OR_RAISE()
-        const int ix =
-            (int)((longitude - stack->longitude_0) / stack->longitude_delta);
-        if (ix >= stack->longitude_n) RETURN_OR_RAISE()
-        const int iy =
-            (int)((latitude - stack->latitude_0) / stack->latitude_delta);
-        if (iy >= stack->latitude_n) RETURN_OR_RAISE()
-        const int index = iy * stack->longitude_n + ix;
-        if (stack->path[index] == NULL) RETURN_OR_RAISE()
+        }
 #undef RETURN_OR_RAISE
 
         /* Load the map data according to the format */
         struct turtle_map * map;
-        if (turtle_map_load_(&map, stack->path[index], error_) !=
+        const unsigned long long t0 = turtle_stack_clock_();
+        if (stack_map_load(stack, index, stack->map_options, &map, error_) !=
             TURTLE_RETURN_SUCCESS)
                 return error_->code;
+        stack->counters.load_time += turtle_stack_clock_() - t0;
+        stack_insert(stack, map, index, latitude, longitude);
 
-        /* Make room for the new map, if needed */
-        if (stack->tiles.size >= stack->max_size) {
-                struct turtle_map * m = stack->tiles.tail;
-                while ((m != NULL) && (stack->tiles.size >= stack->max_size)) {
-                        struct turtle_map * previous = m->element.previous;
-                        if (m->clients == 0)
-                                turtle_map_destroy(&m);
-                        m = previous;
+        if (inside != NULL) *inside = 1;
+        return TURTLE_RETURN_SUCCESS;
+}
+
+#ifndef TURTLE_NO_PTHREAD
+/* Claim a grid cell for loading. Returns `0` if the cell is already being
+ * loaded by another thread
+ */
+static int stack_loading_claim(struct turtle_stack * stack, int index)
+{
+        const unsigned char bit = 1 << (index % 8);
+        pthread_mutex_lock(&loading_mutex);
+        const int claimed = !(stack->loading[index / 8] & bit);
+        if (claimed) stack->loading[index / 8] |= bit;
+        pthread_mutex_unlock(&loading_mutex);
+        return claimed;
+}
+
+/* Release a claimed grid cell and wake up any waiter */
+static void stack_loading_release(struct turtle_stack * stack, int index)
+{
+        pthread_mutex_lock(&loading_mutex);
+        stack->loading[index / 8] &= ~(1 << (index % 8));
+        pthread_cond_broadcast(&loading_cond);
+        pthread_mutex_unlock(&loading_mutex);
+}
+
+/* Wait until the pending load of a grid cell completes */
+static void stack_loading_wait(struct turtle_stack * stack, int index)
+{
+        const unsigned char bit = 1 << (index % 8);
+        pthread_mutex_lock(&loading_mutex);
+        while (stack->loading[index / 8] & bit)
+                pthread_cond_wait(&loading_cond, &loading_mutex);
+        pthread_mutex_unlock(&loading_mutex);
+}
+#endif
+
+/* Get the map of a grid cell, loading it if needed, with the stack lock held */
+enum turtle_return turtle_stack_fetch_(struct turtle_stack * stack,
+    double latitude, double longitude, struct turtle_map ** map, int * inside,
+    struct turtle_stack_counters * counters,
+    struct turtle_error_context * error_)
+{
+        *map = NULL;
+        if (inside != NULL) *inside = 0;
+        const int index = turtle_stack_index_(stack, latitude, longitude);
+
+#ifndef TURTLE_NO_PTHREAD
+        if (turtle_stack_has_lock_(stack) &&
+            !turtle_stack_missing_(stack, index)) {
+                for (;;) {
+                        /* Check for an already loaded tile */
+                        if (stack->grid[index] != NULL) {
+                                *map = stack->grid[index];
+                                turtle_stack_touch_(stack, *map);
+                                if (inside != NULL) *inside = 1;
+                                return TURTLE_RETURN_SUCCESS;
+                        }
+
+                        if (!stack_loading_claim(stack, index)) {
+                                /* The tile is being loaded by another
+                                 * thread. Let us wait for it and check again
+                                 */
+                                if (turtle_stack_unlock_(stack) != 0)
+                                        goto unlock_error;
+                                stack_loading_wait(stack, index);
+                                if (turtle_stack_lock_(stack, counters) != 0)
+                                        goto lock_error;
+                                continue;
+                        }
+
+                        /* Read the tile data without holding the lock */
+                        const int options = stack->map_options;
+                        if (turtle_stack_unlock_(stack) != 0) {
+                                stack_loading_release(stack, index);
+                                goto unlock_error;
+                        }
+                        struct turtle_map * loaded = NULL;
+                        const unsigned long long t0 = turtle_stack_clock_();
+                        stack_map_load(
+                            stack, index, options, &loaded, error_);
+                        const unsigned long long dt =
+                            turtle_stack_clock_() - t0;
+                        const int rc = turtle_stack_lock_(stack, counters);
+                        stack_loading_release(stack, index);
+                        if (rc != 0) {
+                                turtle_map_destroy(&loaded);
+                                goto lock_error;
+                        }
+                        if (loaded == NULL) return error_->code;
+
+                        /* Publish the tile, unless it was loaded meanwhile,
+                         * e.g. by `turtle_stack_preload`
+                         */
+                        stack->counters.load_time += dt;
+                        if (stack->grid[index] != NULL) {
+                                turtle_map_destroy(&loaded);
+                                continue;
+                        }
+                        const struct turtle_stack_counters before =
+                            stack->counters;
+                        stack_insert(stack, loaded, index, latitude,
+                            longitude);
+                        if (counters != NULL) {
+                                counters->loads++;
+                                counters->load_bytes +=
+                                    stack->counters.load_bytes -
+                                    before.load_bytes;
+                                counters->load_time += dt;
+                                counters->evictions +=
+                                    stack->counters.evictions -
+                                    before.evictions;
+                        }
+                        *map = loaded;
+                        if (inside != NULL) *inside = 1;
+                        return TURTLE_RETURN_SUCCESS;
                 }
         }
+#endif
 
-        /* Append the new map at the head of the stack */
-        map->stack = stack;
-        turtle_list_insert_(&stack->tiles, map, 0);
-
+        /* Without concurrent accesses, the tile is loaded directly */
+        if ((index >= 0) && (stack->grid[index] != NULL)) {
+                *map = stack->grid[index];
+                turtle_stack_touch_(stack, *map);
+                if (inside != NULL) *inside = 1;
+                return TURTLE_RETURN_SUCCESS;
+        }
+        const struct turtle_stack_counters before = stack->counters;
+        int loaded;
+        if (turtle_stack_load_(stack, latitude, longitude, &loaded, error_) !=
+            TURTLE_RETURN_SUCCESS)
+                return error_->code;
+        if (!loaded) {
+                if (inside == NULL) TURTLE_ERROR_REGISTER_MISSING_DATA(stack);
+                return error_->code;
+        }
+        if (counters != NULL) {
+                counters->loads += stack->counters.loads - before.loads;
+                counters->load_bytes +=
+                    stack->counters.load_bytes - before.load_bytes;
+                counters->load_time +=
+                    stack->counters.load_time - before.load_time;
+                counters->evictions +=
+                    stack->counters.evictions - before.evictions;
+        }
+        *map = stack->grid[index];
         if (inside != NULL) *inside = 1;
         return TURTLE_RETURN_SUCCESS;
+
+#ifndef TURTLE_NO_PTHREAD
+lock_error:
+        return TURTLE_ERROR_REGISTER(
+            TURTLE_RETURN_LOCK_ERROR, "could not acquire the lock");
+unlock_error:
+        return TURTLE_ERROR_REGISTER(
+            TURTLE_RETURN_UNLOCK_ERROR, "could not release the lock");
+#endif
 }
@@ -27,17 +27,62 @@
 #include "turtle.h"
 #include "turtle/list.h"
 #include "turtle/map.h"
+#include "turtle/parallel.h"
+
+/* Runtime counters of a stack or of a client, see `turtle_stats`. Times
+ * are in ns
+ */
+struct turtle_stack_counters {
+        unsigned long head_hits;
+        unsigned long set_hits;
+        unsigned long grid_hits;
+        unsigned long misses;
+        unsigned long missing;
+        unsigned long loads;
+        unsigned long long load_bytes;
+        unsigned long long load_time;
+        unsigned long evictions;
+        unsigned long truncations;
+        unsigned long locks;
+        unsigned long long lock_time;
+};
 
 /* Container for a stack of global topography data */
+/* Reference to an unused shared memory segment, released by a stack */
+struct turtle_stack_segment {
+        struct turtle_stack_segment * next;
+        char name[32];
+        long long inode;
+        size_t size;
+};
+
 struct turtle_stack {
         /* The stack of loaded tiles */
         struct turtle_list tiles;
         int max_size;
 
+        /* Memory budget, in bytes, and eviction policy for loaded tiles */
+        size_t max_bytes;
+        size_t bytes;
+        enum turtle_stack_policy policy;
+        unsigned long clock;
+
+        /* Options for loading tiles, e.g. memory mapping */
+        int map_options;
+
         /* Callbacks for managing concurent accesses to the stack */
         turtle_stack_locker_t * lock;
         turtle_stack_locker_t * unlock;
 
+        /* Context aware callbacks, overriding the previous ones if set */
+        struct {
+                turtle_stack_context_locker_t * lock;
+                turtle_stack_context_locker_t * unlock;
+                turtle_stack_context_locker_t * shared_lock;
+                turtle_stack_context_locker_t * shared_unlock;
+                void * context;
+        } locker;
+
         /* Lookup data for tile's file names */
         double latitude_0, latitude_delta;
         double longitude_0, longitude_delta;
@@ -45,14 +90,77 @@ struct turtle_stack {
         char * root;
         char ** path;
 
+        /* Source of the tiles, if the stack root is a local cache */
+        struct {
+                turtle_stack_fetcher_t * fetch;
+                void * context;
+        } source;
+
+        /* Background loader for prefetched tiles, if any */
+        struct turtle_stack_prefetcher * prefetcher;
+
+        /* Grid of loaded tiles and bitmap of cells without any data */
+        struct turtle_map ** grid;
+        unsigned char * missing;
+
+        /* Bitmap of cells whose tile is being loaded outside of the lock */
+        unsigned char * loading;
+
+        /* Unused shared memory segments of evicted tiles, oldest first.
+         * They are kept for reuse within the stack capacity and budget
+         */
+        struct {
+                struct turtle_stack_segment * head;
+                struct turtle_stack_segment * tail;
+                int size;
+                size_t bytes;
+        } released;
+
+        /* Runtime statistics and user hook for load and evict events */
+        struct turtle_stack_counters counters;
+        turtle_stack_hook_t * hook;
+        void * hook_context;
+
         char data[]; /* Placeholder for data */
 };
 
+/* Lock management routines, returning `0` on success */
+int turtle_stack_has_lock_(const struct turtle_stack * stack);
+int turtle_stack_has_shared_lock_(const struct turtle_stack * stack);
+int turtle_stack_lock_(
+    struct turtle_stack * stack, struct turtle_stack_counters * counters);
+int turtle_stack_unlock_(struct turtle_stack * stack);
+int turtle_stack_lock_shared_(
+    struct turtle_stack * stack, struct turtle_stack_counters * counters);
+int turtle_stack_unlock_shared_(struct turtle_stack * stack);
+
+/* Statistics routines */
+unsigned long long turtle_stack_clock_(void);
+void turtle_stack_export_(
+    const struct turtle_stack_counters * counters, struct turtle_stats * stats);
+
 /* Map management routines */
+int turtle_stack_index_(
+    const struct turtle_stack * stack, double latitude, double longitude);
+int turtle_stack_missing_(const struct turtle_stack * stack, int index);
 void turtle_stack_touch_(struct turtle_stack * stack, struct turtle_map * map);
+void turtle_stack_hit_(struct turtle_stack * stack, struct turtle_map * map);
+int turtle_stack_full_(const struct turtle_stack * stack);
+int turtle_stack_overflow_(const struct turtle_stack * stack);
+void turtle_stack_evict_(struct turtle_stack * stack, struct turtle_map * map);
 struct turtle_error_context;
 enum turtle_return turtle_stack_load_(struct turtle_stack * stack,
     double latitude, double longitude, int * inside,
     struct turtle_error_context * error_);
 
+/* Get the map of a grid cell, loading it if needed, with the stack lock held.
+ * The lock is released during the tile I/O, while other requests for the
+ * same cell wait for the load to complete. On return, the lock is held again
+ * unless a lock or unlock error is returned
+ */
+enum turtle_return turtle_stack_fetch_(struct turtle_stack * stack,
+    double latitude, double longitude, struct turtle_map ** map, int * inside,
+    struct turtle_stack_counters * counters,
+    struct turtle_error_context * error_);
+
 #endif
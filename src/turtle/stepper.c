@@ -34,19 +34,78 @@
 #include "stdlib.h"
 #include "string.h"
 
+#ifndef M_PI
+/* Define pi, if unknown */
+#define M_PI 3.14159265358979323846
+#endif
+
+/* Get a new identifier for a stepping history, unique over all steppers */
+static unsigned long new_generation(void)
+{
+        static unsigned long generation = 0;
+        return TURTLE_ATOMIC_ADD(&generation, 1);
+}
+
+/* Get the geoid undulation, returning `0` if outside of the geoid map. The
+ * interpolation nodes of the last cell are cached, since the undulation
+ * varies slowly. The result is the same as `turtle_map_elevation`
+ */
+static int geoid_undulation(struct turtle_stepper * stepper, double latitude,
+    double longitude, double * undulation)
+{
+        const struct turtle_map * geoid = stepper->geoid;
+        const double x = (longitude >= 0) ? longitude : longitude + 360.;
+        double hx = (x - geoid->meta.x0) / geoid->meta.dx;
+        double hy = (latitude - geoid->meta.y0) / geoid->meta.dy;
+
+        if ((stepper->geoid_cell.map != geoid) ||
+            (stepper->geoid_cell.serial != geoid->serial) ||
+            !((hx >= stepper->geoid_cell.ix) &&
+                (hx < stepper->geoid_cell.ix + 1) &&
+                (hy >= stepper->geoid_cell.iy) &&
+                (hy < stepper->geoid_cell.iy + 1))) {
+                if (!((hx >= 0.) && (hx < geoid->meta.nx - 1) &&
+                        (hy >= 0.) && (hy < geoid->meta.ny - 1))) {
+                        /* Upper edges or outside of the map */
+                        int inside;
+                        turtle_map_elevation(
+                            geoid, x, latitude, undulation, &inside);
+                        return inside;
+                }
+
+                /* Fetch the nodes of the new cell */
+                const int ix = (int)hx;
+                const int iy = (int)hy;
+                turtle_map_getter_t * get_z = geoid->meta.get_z;
+                stepper->geoid_cell.map = geoid;
+                stepper->geoid_cell.serial = geoid->serial;
+                stepper->geoid_cell.ix = ix;
+                stepper->geoid_cell.iy = iy;
+                stepper->geoid_cell.z00 = get_z(geoid, ix, iy);
+                stepper->geoid_cell.z10 = get_z(geoid, ix + 1, iy);
+                stepper->geoid_cell.z01 = get_z(geoid, ix, iy + 1);
+                stepper->geoid_cell.z11 = get_z(geoid, ix + 1, iy + 1);
+        }
+
+        hx -= stepper->geoid_cell.ix;
+        hy -= stepper->geoid_cell.iy;
+        *undulation = stepper->geoid_cell.z00 * (1. - hx) * (1. - hy) +
+            stepper->geoid_cell.z01 * (1. - hx) * hy +
+            stepper->geoid_cell.z10 * hx * (1. - hy) +
+            stepper->geoid_cell.z11 * hx * hy;
+        return 1;
+}
+
 static void ecef_to_geodetic(struct turtle_stepper * stepper,
     const double * position, double * geographic)
 {
         turtle_ecef_to_geodetic(
             position, geographic, geographic + 1, geographic + 2);
         if (stepper->geoid != NULL) {
-                int inside;
                 double undulation;
-                const double lo = (geographic[1] >= 0) ? geographic[1]:
-                    geographic[1] + 360.;
-                turtle_map_elevation(stepper->geoid, lo, geographic[0],
-                    &undulation, &inside);
-                if (inside) geographic[2] -= undulation;
+                if (geoid_undulation(stepper, geographic[0], geographic[1],
+                    &undulation))
+                        geographic[2] -= undulation;
         }
 }
 
@@ -58,6 +117,7 @@ static enum turtle_return compute_geodetic(struct turtle_stepper * stepper,
     struct turtle_stepper_data * data, const double * position, int n0,
     double * geographic)
 {
+        stepper->stats.computations++;
         ecef_to_geodetic(stepper, position, geographic);
         return TURTLE_RETURN_SUCCESS;
 }
@@ -66,6 +126,7 @@ static enum turtle_return compute_geomap(struct turtle_stepper * stepper,
     struct turtle_stepper_data * data, const double * position, int n0,
     double * geographic)
 {
+        stepper->stats.computations++;
         if (n0 == 0) {
                 ecef_to_geodetic(stepper, position, geographic);
         }
@@ -82,12 +143,13 @@ static enum turtle_return compute_geomap(struct turtle_stepper * stepper,
         }
 }
 
-static enum turtle_return get_geographic(struct turtle_stepper * stepper,
+static enum turtle_return transform_geographic(
+    struct turtle_stepper * stepper,
+    struct turtle_stepper_transform * transform,
     struct turtle_stepper_data * data, const double * position, int n0,
     int n1, geographic_computer_t * compute_geographic, double * geographic)
 {
         /* Let us check if this transform has already been processed */
-        struct turtle_stepper_transform * transform = data->transform;
         if (transform->history.updated) {
                 memcpy(geographic + n0, transform->history.geographic + n0,
                     (n1 - n0) * sizeof(double));
@@ -117,6 +179,7 @@ static enum turtle_return get_geographic(struct turtle_stepper * stepper,
 
         if (range < stepper->local_range) {
                 /* Apply the local transform */
+                stepper->stats.transform_hits++;
                 for (i = n0; i < n1; i++) {
                         geographic[i] = transform->reference_geographic[i];
                         int j;
@@ -143,6 +206,7 @@ static enum turtle_return get_geographic(struct turtle_stepper * stepper,
 
         if (step < 0.33 * stepper->local_range) {
                 /* Update the local transform */
+                stepper->stats.transform_rebuilds++;
                 memcpy(transform->reference_ecef, position,
                     sizeof(transform->reference_ecef));
                 memcpy(transform->reference_geographic + n0, geographic + n0,
@@ -170,6 +234,14 @@ backup_and_exit:
         return TURTLE_RETURN_SUCCESS;
 }
 
+static enum turtle_return get_geographic(struct turtle_stepper * stepper,
+    struct turtle_stepper_data * data, const double * position, int n0,
+    int n1, geographic_computer_t * compute_geographic, double * geographic)
+{
+        return transform_geographic(stepper, data->transform, data, position,
+            n0, n1, compute_geographic, geographic);
+}
+
 static enum turtle_return stepper_step(struct turtle_stepper * stepper,
     struct turtle_stepper_data * data, const double * position,
     int has_geodetic, double * geographic, double * elevation, int * inside)
@@ -181,6 +253,7 @@ static enum turtle_return stepper_step(struct turtle_stepper * stepper,
                 *inside = data->history.inside;
         } else {
                 enum turtle_return rc;
+                stepper->stats.evaluations++;
                 rc = data->step(stepper, data, position, has_geodetic,
                     geographic, elevation, inside);
                 if (rc != TURTLE_RETURN_SUCCESS)
@@ -329,38 +402,170 @@ static enum turtle_return stepper_clean_client(
         return turtle_client_destroy_(&data->a.client, error_);
 }
 
-static enum turtle_return add_data(struct turtle_stepper * stepper,
-    struct turtle_stepper_data * data, const char * name)
+/* Get the transform of a coordinates system, creating it if needed */
+static struct turtle_stepper_transform * get_transform(
+    struct turtle_stepper * stepper, const char * name)
 {
         /* Look for an existing transform */
         struct turtle_stepper_transform * transform;
         for (transform = stepper->transforms.head; transform != NULL;
             transform = transform->element.next) {
-                if (strcmp(transform->name, name) == 0) break;
+                if (strcmp(transform->name, name) == 0) return transform;
         }
 
-        if (transform == NULL) {
-                /* Create the new transform */
-                const int n = strlen(name) + 1;
-                transform = malloc(sizeof(*data->transform) + n);
-                if (transform == NULL)
-                        return TURTLE_RETURN_MEMORY_ERROR;
+        /* Create the new transform */
+        const int n = strlen(name) + 1;
+        transform = malloc(sizeof(*transform) + n);
+        if (transform == NULL) return NULL;
 
-                transform->reference_ecef[0] = DBL_MAX;
-                transform->reference_ecef[1] = DBL_MAX;
-                transform->reference_ecef[2] = DBL_MAX;
-                memcpy(transform->name, name, n);
+        transform->reference_ecef[0] = DBL_MAX;
+        transform->reference_ecef[1] = DBL_MAX;
+        transform->reference_ecef[2] = DBL_MAX;
+        memcpy(transform->name, name, n);
+
+        turtle_list_append_(&stepper->transforms, transform);
+        stepper->generation = new_generation();
+        return transform;
+}
+
+/* Number of samples per side when bounding the domain of a projected map */
+#define BOX_SAMPLES 32
+
+/* Set the geodetic bounding box of a data set, slightly enlarged for
+ * rounding errors. Projected maps are bounded by sampling the boundary of
+ * their domain, which contains the extrema of the geodetic coordinates. The
+ * largest sampling step is added as a margin
+ */
+static void data_box(struct turtle_stepper_data * data)
+{
+        double * const box = data->box;
+        box[0] = -DBL_MAX;
+        box[1] = DBL_MAX;
+        box[2] = -DBL_MAX;
+        box[3] = DBL_MAX;
+
+        double margin[2] = { 0., 0. };
+        if (data->step == &stepper_step_flat) {
+                return;
+        } else if ((data->step == &stepper_step_stack) ||
+            (data->step == &stepper_step_client)) {
+                const struct turtle_stack * stack =
+                    (data->step == &stepper_step_client) ?
+                    data->a.client->stack : data->a.stack;
+                box[0] = stack->latitude_0;
+                box[1] = stack->latitude_0 +
+                    stack->latitude_n * stack->latitude_delta;
+                box[2] = stack->longitude_0;
+                box[3] = stack->longitude_0 +
+                    stack->longitude_n * stack->longitude_delta;
+        } else {
+                const struct turtle_map * map = data->a.map;
+                const double x0 = map->meta.x0;
+                const double x1 = x0 + (map->meta.nx - 1) * map->meta.dx;
+                const double y0 = map->meta.y0;
+                const double y1 = y0 + (map->meta.ny - 1) * map->meta.dy;
+                const struct turtle_projection * projection =
+                    turtle_map_projection(map);
+                if (projection == NULL) {
+                        box[0] = (y0 < y1) ? y0 : y1;
+                        box[1] = (y0 < y1) ? y1 : y0;
+                        box[2] = (x0 < x1) ? x0 : x1;
+                        box[3] = (x0 < x1) ? x1 : x0;
+                } else {
+                        double b[4] = { DBL_MAX, -DBL_MAX, DBL_MAX,
+                                -DBL_MAX };
+                        double previous[2] = { 0., 0. };
+                        int i;
+                        for (i = 0; i <= 4 * BOX_SAMPLES; i++) {
+                                /* Walk along the boundary, counterclockwise
+                                 */
+                                const int side = (i / BOX_SAMPLES) % 4;
+                                const double t =
+                                    (i % BOX_SAMPLES) / (double)BOX_SAMPLES;
+                                double x, y;
+                                if (side == 0) {
+                                        x = x0 + t * (x1 - x0);
+                                        y = y0;
+                                } else if (side == 1) {
+                                        x = x1;
+                                        y = y0 + t * (y1 - y0);
+                                } else if (side == 2) {
+                                        x = x1 - t * (x1 - x0);
+                                        y = y1;
+                                } else {
+                                        x = x0;
+                                        y = y1 - t * (y1 - y0);
+                                }
+                                double g[2];
+                                turtle_projection_unproject(
+                                    projection, x, y, g, g + 1);
+                                if (!isfinite(g[0]) || !isfinite(g[1]))
+                                        return;
+                                int j;
+                                for (j = 0; j < 2; j++) {
+                                        if (g[j] < b[2 * j]) b[2 * j] = g[j];
+                                        if (g[j] > b[2 * j + 1])
+                                                b[2 * j + 1] = g[j];
+                                        const double d =
+                                            fabs(g[j] - previous[j]);
+                                        if ((i > 0) && (d > margin[j]))
+                                                margin[j] = d;
+                                        previous[j] = g[j];
+                                }
+                        }
+                        memcpy(box, b, sizeof(b));
+                }
+        }
+
+        int j;
+        for (j = 0; j < 2; j++) {
+                const double m = margin[j] +
+                    FLT_EPSILON * (1. + fabs(box[2 * j]) +
+                        fabs(box[2 * j + 1]));
+                box[2 * j] -= m;
+                box[2 * j + 1] += m;
+        }
+}
+
+static enum turtle_return add_data(struct turtle_stepper * stepper,
+    struct turtle_stepper_data * data, const char * name)
+{
+        struct turtle_stepper_transform * transform =
+            get_transform(stepper, name);
+        if (transform == NULL) return TURTLE_RETURN_MEMORY_ERROR;
 
-                turtle_list_append_(&stepper->transforms, transform);
+        /* The geodetic transform is always available, for culling data by
+         * their bounding box
+         */
+        if (stepper->geodetic == NULL) {
+                stepper->geodetic = get_transform(stepper, "geodetic");
+                if (stepper->geodetic == NULL)
+                        return TURTLE_RETURN_MEMORY_ERROR;
         }
 
         /* Append the data to the stack */
         data->transform = transform;
+        data->index = stepper->data.size;
+        data_box(data);
         turtle_list_append_(&stepper->data, data);
 
         return TURTLE_RETURN_SUCCESS;
 }
 
+/* Check that the configuration of a stepper can be modified */
+static enum turtle_return check_configurable(struct turtle_stepper * stepper,
+    struct turtle_error_context * error_)
+{
+        if (stepper->parent != NULL) {
+                return TURTLE_ERROR_REGISTER(TURTLE_RETURN_BAD_ADDRESS,
+                    "cannot modify a cloned stepper");
+        } else if (TURTLE_ATOMIC_LOAD(&stepper->clones) > 0) {
+                return TURTLE_ERROR_REGISTER(TURTLE_RETURN_BAD_ADDRESS,
+                    "cannot modify a cloned stepper");
+        }
+        return TURTLE_RETURN_SUCCESS;
+}
+
 static enum turtle_return stepper_add_layer(struct turtle_stepper * stepper)
 {
         struct turtle_stepper_layer * layer = stepper->layers.tail;
@@ -371,6 +576,8 @@ static enum turtle_return stepper_add_layer(struct turtle_stepper * stepper)
         if (layer == NULL)
                 return TURTLE_RETURN_MEMORY_ERROR;
         memset(&layer->meta, 0x0, sizeof(layer->meta));
+        layer->indexed = 0;
+        layer->index = NULL;
         turtle_list_append_(&stepper->layers, layer);
 
         return TURTLE_RETURN_SUCCESS;
@@ -380,6 +587,8 @@ enum turtle_return turtle_stepper_add_layer(struct turtle_stepper * stepper)
 {
         TURTLE_ERROR_INITIALISE(&turtle_stepper_add_layer);
 
+        if (check_configurable(stepper, error_) != TURTLE_RETURN_SUCCESS)
+                return TURTLE_ERROR_RAISE();
         if (stepper_add_layer(stepper) != TURTLE_RETURN_SUCCESS) {
                 return TURTLE_ERROR_MEMORY();
         } else {
@@ -404,6 +613,9 @@ static enum turtle_return add_meta(struct turtle_stepper * stepper,
 
         struct turtle_stepper_layer * layer = stepper->layers.tail;
         turtle_list_append_(&layer->meta, meta);
+        free(layer->index);
+        layer->index = NULL;
+        layer->indexed = 0;
 
         return TURTLE_RETURN_SUCCESS;
 }
@@ -413,11 +625,14 @@ enum turtle_return turtle_stepper_add_stack(
 {
         TURTLE_ERROR_INITIALISE(&turtle_stepper_add_stack);
 
+        if (check_configurable(stepper, error_) != TURTLE_RETURN_SUCCESS)
+                return TURTLE_ERROR_RAISE();
+
         /* Look if the data already exist */
         struct turtle_stepper_data * data;
         for (data = stepper->data.head; data != NULL;
             data = data->element.next) {
-                if ((stack->lock != NULL) &&
+                if (turtle_stack_has_lock_(stack) &&
                     (data->clean == &stepper_clean_client) &&
                     (data->a.client->stack == stack))
                         break;
@@ -429,7 +644,7 @@ enum turtle_return turtle_stepper_add_stack(
         if (data == NULL) {
                 /* Allocate an encapsulation of the new data */
                 enum turtle_return rc;
-                if (stack->lock != NULL) {
+                if (turtle_stack_has_lock_(stack)) {
                         /* Get a new client for the stack */
                         rc = turtle_client_create(&client, stack);
                         if (rc != TURTLE_RETURN_SUCCESS) return rc;
@@ -455,6 +670,8 @@ enum turtle_return turtle_stepper_add_stack(
                 if (add_data(stepper, data, "geodetic") !=
                     TURTLE_RETURN_SUCCESS)
                         goto memory_error;
+                if (stepper->pyramid)
+                        stack->map_options |= TURTLE_MAP_LOAD_PYRAMID;
         }
 
         /* Add the meta data to the current layer */
@@ -474,6 +691,9 @@ enum turtle_return turtle_stepper_add_map(struct turtle_stepper * stepper,
 {
         TURTLE_ERROR_INITIALISE(&turtle_stepper_add_map);
 
+        if (check_configurable(stepper, error_) != TURTLE_RETURN_SUCCESS)
+                return TURTLE_ERROR_RAISE();
+
         /* Look if the data already exist */
         struct turtle_stepper_data * data;
         for (data = stepper->data.head; data != NULL;
@@ -499,6 +719,9 @@ enum turtle_return turtle_stepper_add_map(struct turtle_stepper * stepper,
                         return TURTLE_ERROR_MEMORY();
                 }
         }
+        if (stepper->pyramid &&
+            (turtle_map_pyramid_build_(map) != EXIT_SUCCESS))
+                return TURTLE_ERROR_MEMORY();
 
         /* Add the meta data to the current layer */
         if (add_meta(stepper, data, offset) != TURTLE_RETURN_SUCCESS) {
@@ -513,6 +736,9 @@ enum turtle_return turtle_stepper_add_flat(
 {
         TURTLE_ERROR_INITIALISE(&turtle_stepper_add_flat);
 
+        if (check_configurable(stepper, error_) != TURTLE_RETURN_SUCCESS)
+                return TURTLE_ERROR_RAISE();
+
         /* Look if the data already exist */
         struct turtle_stepper_data * data;
         for (data = stepper->data.head; data != NULL;
@@ -544,20 +770,20 @@ enum turtle_return turtle_stepper_add_flat(
         }
 }
 
-enum turtle_return turtle_stepper_create(struct turtle_stepper ** stepper_)
+static void stepper_initialise(struct turtle_stepper * stepper)
 {
-        TURTLE_ERROR_INITIALISE(&turtle_stepper_create);
-
-        struct turtle_stepper * stepper = malloc(sizeof(*stepper));
-        if (stepper == NULL) return TURTLE_ERROR_MEMORY();
-        *stepper_ = stepper;
         memset(&stepper->data, 0x0, sizeof(stepper->data));
         memset(&stepper->transforms, 0x0, sizeof(stepper->transforms));
         memset(&stepper->layers, 0x0, sizeof(stepper->layers));
+        stepper->geodetic = NULL;
         stepper->geoid = NULL;
         stepper->local_range = 1.;
         stepper->slope_factor = 0.4;
         stepper->resolution_factor = 1E-02;
+        stepper->precision = 1E-08;
+        stepper->refinement = TURTLE_STEPPER_REFINEMENT_BISECTION;
+        stepper->pyramid = 0;
+        stepper->geoid_cell.map = NULL;
         stepper->last.index[0] = -1;
         stepper->last.index[1] = -1;
         stepper->last.elevation[0] = 0;
@@ -565,8 +791,91 @@ enum turtle_return turtle_stepper_create(struct turtle_stepper ** stepper_)
         stepper->last.position[0] = DBL_MAX;
         stepper->last.position[1] = DBL_MAX;
         stepper->last.position[2] = DBL_MAX;
+        stepper->generation = new_generation();
+        stepper->parent = NULL;
+        stepper->table = NULL;
+        stepper->clones = 0;
+        memset(&stepper->stats, 0x0, sizeof(stepper->stats));
+}
+
+enum turtle_return turtle_stepper_create(struct turtle_stepper ** stepper_)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_stepper_create);
+
+        struct turtle_stepper * stepper = malloc(sizeof(*stepper));
+        if (stepper == NULL) return TURTLE_ERROR_MEMORY();
+        *stepper_ = stepper;
+        stepper_initialise(stepper);
+
+        return TURTLE_RETURN_SUCCESS;
+}
+
+static void stepper_index(struct turtle_stepper * stepper);
+
+enum turtle_return turtle_stepper_clone(
+    struct turtle_stepper ** clone_, struct turtle_stepper * stepper)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_stepper_clone);
+        *clone_ = NULL;
+
+        /* Clones always refer to the original configuration */
+        struct turtle_stepper * parent =
+            (stepper->parent != NULL) ? stepper->parent : stepper;
+
+        struct turtle_stepper * clone = malloc(sizeof(*clone));
+        if (clone == NULL) return TURTLE_ERROR_MEMORY();
+        stepper_initialise(clone);
+        clone->geoid = stepper->geoid;
+        clone->local_range = stepper->local_range;
+        clone->slope_factor = stepper->slope_factor;
+        clone->resolution_factor = stepper->resolution_factor;
+        clone->precision = stepper->precision;
+        clone->refinement = stepper->refinement;
+        clone->pyramid = stepper->pyramid;
+        clone->parent = parent;
+        stepper_index(parent);
+        TURTLE_ATOMIC_ADD(&parent->clones, 1);
+
+        if (parent->data.size > 0) {
+                clone->table =
+                    malloc(parent->data.size * sizeof(*clone->table));
+                if (clone->table == NULL) goto memory_error;
+        }
+
+        /* Copy the data, with their own cache and transform. Stack clients
+         * are renewed
+         */
+        struct turtle_stepper_data * data;
+        for (data = parent->data.head; data != NULL;
+            data = data->element.next) {
+                struct turtle_stepper_data * copy = malloc(sizeof(*copy));
+                if (copy == NULL) goto memory_error;
+                memcpy(copy, data, sizeof(*copy));
+                copy->history.updated = 0;
+                if (data->clean == &stepper_clean_client) {
+                        enum turtle_return rc = turtle_client_create(
+                            &copy->a.client, data->a.client->stack);
+                        if (rc != TURTLE_RETURN_SUCCESS) {
+                                free(copy);
+                                turtle_stepper_destroy(&clone);
+                                return rc;
+                        }
+                }
+                if (add_data(clone, copy, data->transform->name) !=
+                    TURTLE_RETURN_SUCCESS) {
+                        if (copy->clean != NULL) copy->clean(copy, error_);
+                        free(copy);
+                        goto memory_error;
+                }
+                clone->table[data->index] = copy;
+        }
 
+        *clone_ = clone;
         return TURTLE_RETURN_SUCCESS;
+
+memory_error:
+        turtle_stepper_destroy(&clone);
+        return TURTLE_ERROR_MEMORY();
 }
 
 enum turtle_return turtle_stepper_destroy(struct turtle_stepper ** stepper)
@@ -575,6 +884,11 @@ enum turtle_return turtle_stepper_destroy(struct turtle_stepper ** stepper)
         if ((stepper == NULL) || (*stepper == NULL))
                 return TURTLE_RETURN_SUCCESS;
 
+        if (TURTLE_ATOMIC_LOAD(&(*stepper)->clones) > 0) {
+                return TURTLE_ERROR_MESSAGE(TURTLE_RETURN_BAD_ADDRESS,
+                    "the stepper has living clones");
+        }
+
         struct turtle_stepper_data * data;
         while ((data = turtle_list_pop_(&(*stepper)->data)) != NULL) {
                 if (data->clean != NULL) {
@@ -590,9 +904,15 @@ enum turtle_return turtle_stepper_destroy(struct turtle_stepper ** stepper)
         struct turtle_stepper_layer * layer;
         while ((layer = turtle_list_pop_(&(*stepper)->layers)) != NULL) {
                 turtle_list_clear_(&layer->meta);
+                free(layer->index);
                 free(layer);
         }
 
+        if ((*stepper)->parent != NULL) {
+                TURTLE_ATOMIC_ADD(&(*stepper)->parent->clones, -1);
+                free((*stepper)->table);
+        }
+
         free(*stepper);
         *stepper = NULL;
 
@@ -604,13 +924,14 @@ static void reset_history(struct turtle_stepper * stepper)
         stepper->last.position[0] = DBL_MAX;
         stepper->last.position[1] = DBL_MAX;
         stepper->last.position[2] = DBL_MAX;
+        stepper->generation = new_generation();
 
-        struct turtle_stepper_data * data;
-        for (data = stepper->data.head; data != NULL;
-             data = data->element.next) {
-                data->transform->reference_ecef[0] = DBL_MAX;
-                data->transform->reference_ecef[1] = DBL_MAX;
-                data->transform->reference_ecef[2] = DBL_MAX;
+        struct turtle_stepper_transform * transform;
+        for (transform = stepper->transforms.head; transform != NULL;
+             transform = transform->element.next) {
+                transform->reference_ecef[0] = DBL_MAX;
+                transform->reference_ecef[1] = DBL_MAX;
+                transform->reference_ecef[2] = DBL_MAX;
         }
 }
 
@@ -619,6 +940,7 @@ void turtle_stepper_geoid_set(
 {
         /* Set the geoid model */
         stepper->geoid = geoid;
+        stepper->geoid_cell.map = NULL;
 
         /* Reset the stepping history */
         reset_history(stepper);
@@ -671,6 +993,66 @@ void turtle_stepper_resolution_set(
         stepper->resolution_factor = resolution;
 }
 
+double turtle_stepper_precision_get(const struct turtle_stepper * stepper)
+{
+        return stepper->precision;
+}
+
+void turtle_stepper_precision_set(
+    struct turtle_stepper * stepper, double precision)
+{
+        stepper->precision = precision;
+}
+
+enum turtle_stepper_refinement turtle_stepper_refinement_get(
+    const struct turtle_stepper * stepper)
+{
+        return stepper->refinement;
+}
+
+void turtle_stepper_refinement_set(struct turtle_stepper * stepper,
+    enum turtle_stepper_refinement refinement)
+{
+        stepper->refinement = refinement;
+}
+
+enum turtle_return turtle_stepper_pyramid_set(
+    struct turtle_stepper * stepper, int enable)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_stepper_pyramid_set);
+
+        if (check_configurable(stepper, error_) != TURTLE_RETURN_SUCCESS)
+                return TURTLE_ERROR_RAISE();
+        stepper->pyramid = enable ? 1 : 0;
+        if (!enable) return TURTLE_RETURN_SUCCESS;
+
+        /* Build the elevation bounds of maps. Stack tiles get theirs when
+         * loaded
+         */
+        struct turtle_stepper_data * data;
+        for (data = stepper->data.head; data != NULL;
+            data = data->element.next) {
+                if (data->step == &stepper_step_map) {
+                        if (turtle_map_pyramid_build_(data->a.map) !=
+                            EXIT_SUCCESS)
+                                return TURTLE_ERROR_MEMORY();
+                } else if (data->step == &stepper_step_stack) {
+                        data->a.stack->map_options |=
+                            TURTLE_MAP_LOAD_PYRAMID;
+                } else if (data->step == &stepper_step_client) {
+                        data->a.client->stack->map_options |=
+                            TURTLE_MAP_LOAD_PYRAMID;
+                }
+        }
+
+        return TURTLE_RETURN_SUCCESS;
+}
+
+int turtle_stepper_pyramid_get(const struct turtle_stepper * stepper)
+{
+        return stepper->pyramid;
+}
+
 static void reset_data_and_transforms(struct turtle_stepper * stepper)
 {
         struct turtle_stepper_transform * transform;
@@ -700,11 +1082,336 @@ static int check_layer(struct turtle_stepper * stepper,
         }
 }
 
+/* Get the layers of a stepper, which are shared with its clones */
+static inline const struct turtle_list * stepper_layers(
+    const struct turtle_stepper * stepper)
+{
+        return (stepper->parent != NULL) ? &stepper->parent->layers :
+                                           &stepper->layers;
+}
+
+/* Get the stepper's own data for some meta-data */
+static inline struct turtle_stepper_data * meta_data(
+    struct turtle_stepper * stepper, const struct turtle_stepper_meta * meta)
+{
+        return (stepper->table != NULL) ? stepper->table[meta->data->index] :
+                                          meta->data;
+}
+
+/* Minimum number of data in a layer for building a spatial index */
+#define INDEX_MIN_SIZE 8
+
+/* Maximum number of bins of a spatial index, per dimension */
+#define INDEX_MAX_BINS 64
+
+/* Get the range of bins overlapping an interval */
+static void index_range(double min, double max, double origin, double delta,
+    int n, int * i0, int * i1)
+{
+        const double u0 = floor((min - origin) / delta);
+        const double u1 = floor((max - origin) / delta);
+        *i0 = (u0 < 0.) ? 0 : ((u0 >= n) ? n - 1 : (int)u0);
+        *i1 = (u1 < 0.) ? 0 : ((u1 >= n) ? n - 1 : (int)u1);
+}
+
+/* Build the spatial index of a layer, if it has many data. On failure, the
+ * layer is searched linearly
+ */
+static void layer_index_build(struct turtle_stepper_layer * layer)
+{
+        layer->indexed = 1;
+        const int n = layer->meta.size;
+        if (n < INDEX_MIN_SIZE) return;
+
+        /* Get the union of bounding boxes */
+        double box[4] = { 90., -90., 180., -180. };
+        const struct turtle_stepper_meta * meta;
+        for (meta = layer->meta.tail; meta != NULL;
+             meta = meta->element.previous) {
+                const double * b = meta->data->box;
+                if (b[0] < box[0]) box[0] = b[0];
+                if (b[1] > box[1]) box[1] = b[1];
+                if (b[2] < box[2]) box[2] = b[2];
+                if (b[3] > box[3]) box[3] = b[3];
+        }
+        if (box[0] < -90.) box[0] = -90.;
+        if (box[1] > 90.) box[1] = 90.;
+        if (box[2] < -180.) box[2] = -180.;
+        if (box[3] > 180.) box[3] = 180.;
+        if ((box[0] > box[1]) || (box[2] > box[3])) return;
+
+        int bins = (int)ceil(sqrt(n));
+        if (bins > INDEX_MAX_BINS) bins = INDEX_MAX_BINS;
+        const double dlat = (box[1] > box[0]) ? (box[1] - box[0]) / bins : 1.;
+        const double dlon = (box[3] > box[2]) ? (box[3] - box[2]) / bins : 1.;
+        const int n_bins = bins * bins;
+
+        /* Count the data per bin */
+        int * counts = calloc(n_bins, sizeof(*counts));
+        if (counts == NULL) return;
+        int total = 0;
+        for (meta = layer->meta.tail; meta != NULL;
+             meta = meta->element.previous) {
+                const double * b = meta->data->box;
+                int i0, i1, j0, j1, i, j;
+                index_range(b[0], b[1], box[0], dlat, bins, &i0, &i1);
+                index_range(b[2], b[3], box[2], dlon, bins, &j0, &j1);
+                for (i = i0; i <= i1; i++) {
+                        for (j = j0; j <= j1; j++) counts[i * bins + j]++;
+                }
+                total += (i1 - i0 + 1) * (j1 - j0 + 1);
+        }
+
+        /* Allocate and fill the index */
+        struct turtle_stepper_index * index = malloc(sizeof(*index) +
+            (n_bins + 1 + total) * sizeof(int) + n * sizeof(meta));
+        if (index == NULL) {
+                free(counts);
+                return;
+        }
+        index->latitude_0 = box[0];
+        index->latitude_delta = dlat;
+        index->latitude_n = bins;
+        index->longitude_0 = box[2];
+        index->longitude_delta = dlon;
+        index->longitude_n = bins;
+        index->meta = (struct turtle_stepper_meta **)index->data;
+        index->offsets = (int *)(index->meta + n);
+        index->ranks = index->offsets + n_bins + 1;
+        int i;
+        index->offsets[0] = 0;
+        for (i = 0; i < n_bins; i++) {
+                index->offsets[i + 1] = index->offsets[i] + counts[i];
+                counts[i] = index->offsets[i];
+        }
+        int rank;
+        for (meta = layer->meta.tail, rank = 0; meta != NULL;
+             meta = meta->element.previous, rank++) {
+                index->meta[rank] = (struct turtle_stepper_meta *)meta;
+                const double * b = meta->data->box;
+                int i0, i1, j0, j1, j;
+                index_range(b[0], b[1], box[0], dlat, bins, &i0, &i1);
+                index_range(b[2], b[3], box[2], dlon, bins, &j0, &j1);
+                for (i = i0; i <= i1; i++) {
+                        for (j = j0; j <= j1; j++)
+                                index->ranks[counts[i * bins + j]++] = rank;
+                }
+        }
+        free(counts);
+        layer->index = index;
+}
+
+/* Build the spatial indices of layers, if not already done. Clones share
+ * the indices of their parent, that are built when cloning
+ */
+static void stepper_index(struct turtle_stepper * stepper)
+{
+        if (stepper->parent != NULL) return;
+        struct turtle_stepper_layer * layer;
+        for (layer = stepper->layers.head; layer != NULL;
+             layer = layer->element.next) {
+                if (!layer->indexed) layer_index_build(layer);
+        }
+}
+
+/* Cursor over the data of a layer which might cover a geodetic location, in
+ * priority order. Locations outside of the spatial index, if any, are
+ * searched linearly
+ */
+struct layer_cursor {
+        const struct turtle_stepper_index * index;
+        const struct turtle_stepper_meta * meta;
+        const int * ranks;
+        int i, n;
+};
+
+static void layer_cursor_initialise(struct layer_cursor * cursor,
+    const struct turtle_stepper_layer * layer, double latitude,
+    double longitude)
+{
+        cursor->index = layer->index;
+        cursor->meta = layer->meta.tail;
+        cursor->i = 0;
+        cursor->n = 0;
+        const struct turtle_stepper_index * index = layer->index;
+        if (index == NULL) return;
+
+        const double u = (latitude - index->latitude_0) /
+            index->latitude_delta;
+        const double v = (longitude - index->longitude_0) /
+            index->longitude_delta;
+        if ((u < 0.) || (u > index->latitude_n) || (v < 0.) ||
+            (v > index->longitude_n)) {
+                cursor->index = NULL;
+                return;
+        }
+        const int iu = (u < index->latitude_n) ? (int)u :
+                                                 index->latitude_n - 1;
+        const int iv = (v < index->longitude_n) ? (int)v :
+                                                  index->longitude_n - 1;
+        const int bin = iu * index->longitude_n + iv;
+        cursor->ranks = index->ranks + index->offsets[bin];
+        cursor->n = index->offsets[bin + 1] - index->offsets[bin];
+}
+
+/* Get the next candidate meta data and its rank in the layer, or `NULL` */
+static const struct turtle_stepper_meta * layer_cursor_next(
+    struct layer_cursor * cursor, int * rank)
+{
+        if (cursor->index == NULL) {
+                const struct turtle_stepper_meta * meta = cursor->meta;
+                if (meta != NULL) {
+                        cursor->meta = meta->element.previous;
+                        *rank = cursor->i++;
+                }
+                return meta;
+        } else if (cursor->i < cursor->n) {
+                *rank = cursor->ranks[cursor->i++];
+                return cursor->index->meta[*rank];
+        } else {
+                return NULL;
+        }
+}
+
+/* Check if a geodetic location is within the bounding box of a data set */
+static inline int data_covers(const struct turtle_stepper_data * data,
+    double latitude, double longitude)
+{
+        return (latitude >= data->box[0]) && (latitude <= data->box[1]) &&
+            (longitude >= data->box[2]) && (longitude <= data->box[3]);
+}
+
+/* Get elevation bounds of a layer over a box of geodetic coordinates. The
+ * top priority data must fully cover the box, otherwise `0` is returned.
+ * Projected maps are not supported. For stacks, only the tile of the
+ * current position is considered
+ */
+static int layer_bounds(struct turtle_stepper * stepper,
+    const struct turtle_stepper_layer * layer, double latitude,
+    double longitude, const double * box, double * zmin, double * zmax)
+{
+        const struct turtle_stepper_meta * meta = layer->meta.tail;
+        if (meta == NULL) return 0;
+        struct turtle_stepper_data * data = meta_data(stepper, meta);
+
+        struct turtle_map * map = NULL;
+        if (data->step == &stepper_step_flat) {
+                *zmin = *zmax = meta->offset;
+                return 1;
+        } else if (data->step == &stepper_step_map) {
+                if (turtle_map_projection(data->a.map) != NULL) return 0;
+                map = data->a.map;
+        } else if (data->step == &stepper_step_stack) {
+                const struct turtle_stack * stack = data->a.stack;
+                const int index =
+                    turtle_stack_index_(stack, latitude, longitude);
+                if (index < 0) return 0;
+                map = stack->grid[index];
+        } else if (data->step == &stepper_step_client) {
+                map = data->a.client->map;
+        }
+        if (map == NULL) return 0;
+
+        /* Rebuild the pyramid if the map was modified since */
+        turtle_map_pyramid_refresh_(map);
+        if (!turtle_map_bounds_(map, box[2], box[3], box[0], box[1], zmin,
+            zmax))
+                return 0;
+        *zmin += meta->offset;
+        *zmax += meta->offset;
+        return 1;
+}
+
+/* Check that a straight step of length `length` stays within the current
+ * medium, using elevation bounds over a box enclosing all positions
+ * reachable by the step. Since the geodetic height is convex along a
+ * straight line, it is bounded below by its tangent, i.e. by `cos_theta`
+ * times the length, where theta is the angle of the step w.r.t. the
+ * vertical. It varies by at most the length. The geoid undulation adds a
+ * small slope
+ */
+static int check_step(struct turtle_stepper * stepper, double length,
+    double cos_theta)
+{
+        const double deg = 180. / M_PI;
+        const double latitude = stepper->last.geographic[0];
+        const double longitude = stepper->last.geographic[1];
+        const double altitude = stepper->last.geographic[2];
+        const double margin = 1E-06 + ((stepper->geoid != NULL) ?
+            1E-03 * length : 0.);
+
+        /* Enclosing box, using the minimum curvature radii */
+        const double dlat = length * 1.001 / 6335439. * deg;
+        const double abslat = fabs(latitude) + dlat;
+        if (abslat >= 89.) return 0;
+        const double dlon = length * 1.001 /
+            (6378137. * cos(abslat / deg)) * deg;
+        const double box[4] = { latitude - dlat, latitude + dlat,
+                longitude - dlon, longitude + dlon };
+
+        /* Check the layers below and the one above the current medium */
+        const double zlow = altitude + length * ((cos_theta < 0.) ?
+            cos_theta : 0.) - margin;
+        const double zhigh = altitude + length + margin;
+        const int medium = stepper->last.index[0];
+        const struct turtle_stepper_layer * layer;
+        int i;
+        for (layer = stepper_layers(stepper)->head, i = 0;
+            (layer != NULL) && (i <= medium);
+            layer = layer->element.next, i++) {
+                double zmin, zmax;
+                if (!layer_bounds(stepper, layer, latitude, longitude, box,
+                    &zmin, &zmax))
+                        return 0;
+                if ((i < medium) && (zmax >= zlow))
+                        return 0;
+                else if ((i == medium) && (zhigh >= zmin))
+                        return 0;
+        }
+        return 1;
+}
+
+/* Get a safe step length, by doubling the heuristic one while it stays
+ * within the current medium. Returns `0` if no longer step was found
+ */
+static double safe_step(struct turtle_stepper * stepper,
+    const double * direction, double ds)
+{
+        /* Get the norm of the direction and its vertical component */
+        const double * const g = stepper->last.geographic;
+        double norm = 1., cos_theta = -1.;
+        if (direction != NULL) {
+                norm = sqrt(direction[0] * direction[0] +
+                    direction[1] * direction[1] +
+                    direction[2] * direction[2]);
+                if (norm <= 0.) return 0.;
+                const double deg = M_PI / 180.;
+                const double c = cos(g[0] * deg);
+                const double n[3] = { c * cos(g[1] * deg),
+                        c * sin(g[1] * deg), sin(g[0] * deg) };
+                cos_theta = (direction[0] * n[0] + direction[1] * n[1] +
+                    direction[2] * n[2]) / norm;
+        }
+
+        double safe = 0.;
+        int i;
+        for (i = 0; i < 20; i++) {
+                ds *= 2.;
+                const double length = ds * norm;
+                if ((length > 1E+05) || !check_step(stepper, length,
+                    cos_theta))
+                        break;
+                safe = ds;
+        }
+        return safe;
+}
+
 static enum turtle_return stepper_sample(struct turtle_stepper * stepper,
     const double * position, struct turtle_stepper_sample * sample,
     int check_bounds, struct turtle_error_context * error_)
 {
         /* 1st let us check the history */
+        stepper->stats.samples++;
         if ((position[0] != stepper->last.position[0]) ||
             (position[1] != stepper->last.position[1]) ||
             (position[2] != stepper->last.position[2])) {
@@ -715,24 +1422,53 @@ static enum turtle_return stepper_sample(struct turtle_stepper * stepper,
                 sample->elevation[0] = -DBL_MAX;
                 sample->elevation[1] = DBL_MAX;
                 int index[2], has_geodetic = 0;
+                stepper_index(stepper);
                 struct turtle_stepper_layer * layer;
-                for (layer = stepper->layers.head, index[0] = 0; layer != NULL;
-                    layer = layer->element.next, index[0]++) {
-                        struct turtle_stepper_meta * meta;
-                        for (meta = layer->meta.tail, index[1] = 0;
-                            meta != NULL; meta = meta->element.previous,
-                            index[1]++) {
+                for (layer = stepper_layers(stepper)->head, index[0] = 0;
+                    layer != NULL; layer = layer->element.next, index[0]++) {
+                        if (layer->meta.size == 0) continue;
+                        if (!has_geodetic) {
+                                /* The geodetic coordinates are needed first,
+                                 * for culling data by their bounding box
+                                 */
+                                enum turtle_return rc = transform_geographic(
+                                    stepper, stepper->geodetic, NULL,
+                                    position, 0, 3, &compute_geodetic,
+                                    sample->geographic);
+                                if (rc != TURTLE_RETURN_SUCCESS) {
+                                        if (sample == &stepper->last) {
+                                                memcpy(stepper->last.position,
+                                                    position, sizeof(
+                                                    stepper->last.position));
+                                        }
+                                        return rc;
+                                }
+                                has_geodetic = 1;
+                        }
+
+                        struct layer_cursor cursor;
+                        layer_cursor_initialise(&cursor, layer,
+                            sample->geographic[0], sample->geographic[1]);
+                        const struct turtle_stepper_meta * meta;
+                        while ((meta = layer_cursor_next(&cursor, index + 1))
+                            != NULL) {
+                                struct turtle_stepper_data * data =
+                                    meta_data(stepper, meta);
+                                if (!data_covers(data, sample->geographic[0],
+                                    sample->geographic[1])) {
+                                        stepper->stats.culls++;
+                                        continue;
+                                }
                                 int inside;
                                 double elevation;
-                                enum turtle_return rc = stepper_step(
-                                    stepper, meta->data, position, has_geodetic,
+                                enum turtle_return rc = stepper_step(stepper,
+                                    data, position, has_geodetic,
                                     sample->geographic, &elevation, &inside);
                                 if (sample == &stepper->last) {
                                         memcpy(stepper->last.position, position,
                                             sizeof(stepper->last.position));
                                 }
                                 if (rc != TURTLE_RETURN_SUCCESS) return rc;
-                                has_geodetic = 1;
                                 if (inside) {
                                         elevation += meta->offset;
                                         if (check_layer(stepper, sample, index,
@@ -742,7 +1478,12 @@ static enum turtle_return stepper_sample(struct turtle_stepper * stepper,
                                 }
                         }
                 }
+                if (has_geodetic && (sample == &stepper->last)) {
+                        memcpy(stepper->last.position, position,
+                            sizeof(stepper->last.position));
+                }
         } else {
+                stepper->stats.repeats++;
                 if (sample != &stepper->last)
                         memcpy(sample, &stepper->last, sizeof(*sample));
                 return TURTLE_RETURN_SUCCESS;
@@ -777,17 +1518,15 @@ static void sample_publish(struct turtle_stepper * stepper, double * latitude,
         }
 }
 
-enum turtle_return turtle_stepper_step(struct turtle_stepper * stepper,
+static enum turtle_return stepper_advance(struct turtle_stepper * stepper,
     double * position, const double * direction, double * latitude,
     double * longitude, double * altitude, double * elevation,
-    double * step_length, int * index)
+    double * step_length, int * index, struct turtle_error_context * error_)
 {
-        TURTLE_ERROR_INITIALISE(&turtle_stepper_step);
-
         /* Compute the initial geodetic coordinates, or fetch the last ones */
-        if (stepper_sample(stepper, position, &stepper->last, index
-            != NULL, error_) != TURTLE_RETURN_SUCCESS)
-                return TURTLE_ERROR_RAISE();
+        enum turtle_return rc = stepper_sample(
+            stepper, position, &stepper->last, index != NULL, error_);
+        if (rc != TURTLE_RETURN_SUCCESS) return rc;
         if (stepper->last.index[0] < 0) {
                 sample_publish(stepper, latitude, longitude, altitude,
                     elevation, index);
@@ -802,7 +1541,7 @@ enum turtle_return turtle_stepper_step(struct turtle_stepper * stepper,
                 if ((stepper->last.index[0] == 0) && (i == 0))
                         continue;
                 else if ((stepper->last.index[0] ==
-                    stepper->layers.size) && (i == 1))
+                    stepper_layers(stepper)->size) && (i == 1))
                         break;
 
                 const double dsi = fabs(stepper->last.geographic[2] -
@@ -812,6 +1551,15 @@ enum turtle_return turtle_stepper_step(struct turtle_stepper * stepper,
         ds *= stepper->slope_factor;
         if (ds < stepper->resolution_factor) ds = stepper->resolution_factor;
 
+        /* Lengthen the step using the elevation bounds, if enabled */
+        if (stepper->pyramid) {
+                const double safe = safe_step(stepper, direction, ds);
+                if (safe > ds) {
+                        ds = safe;
+                        stepper->stats.skips++;
+                }
+        }
+
         /* Return the results if no stepping is requested */
         if (direction == NULL) {
                 sample_publish(stepper, latitude, longitude, altitude,
@@ -824,30 +1572,62 @@ enum turtle_return turtle_stepper_step(struct turtle_stepper * stepper,
         for (i = 0; i < 3; i++) position[i] += direction[i] * ds;
 
         const int medium0 = stepper->last.index[0];
-        if (stepper_sample(stepper, position, &stepper->last, 1, error_) !=
-            TURTLE_RETURN_SUCCESS)
-                return TURTLE_ERROR_RAISE();
+        const double height0[2] = {
+                stepper->last.geographic[2] - stepper->last.elevation[0],
+                stepper->last.geographic[2] - stepper->last.elevation[1] };
+        rc = stepper_sample(stepper, position, &stepper->last, 1, error_);
+        if (rc != TURTLE_RETURN_SUCCESS) return rc;
         int medium1 = stepper->last.index[0];
 
         if (medium0 != medium1) {
-                /* A change of medium occured. Let us locate the
-                 * change of medium by dichotomy.
+                /* A change of medium occured. Let us locate the change of
+                 * medium by dichotomy, or by regula falsi on the height
+                 * above the crossed surface if a single one was crossed
                  */
-                double ds0 = -ds, ds1 = 0.;
+                const double precision = stepper->precision;
+                double ds0 = -ds, ds1 = 0., g0 = 0., g1 = 0.;
+                int side = 0;
+                int interpolate = (stepper->refinement ==
+                    TURTLE_STEPPER_REFINEMENT_REGULA_FALSI) &&
+                    (medium1 >= 0) && (abs(medium1 - medium0) == 1);
+                const int up = (medium1 > medium0);
+                if (interpolate) {
+                        g0 = up ? height0[1] : height0[0];
+                        g1 = stepper->last.geographic[2] -
+                            stepper->last.elevation[up ? 0 : 1];
+                        if (!(g0 * g1 < 0.)) interpolate = 0;
+                }
                 struct turtle_stepper_sample sample2;
                 memcpy(&sample2, &stepper->last, sizeof(sample2));
-                while (ds1 - ds0 > 1E-08) {
-                        const double ds2 = 0.5 * (ds0 + ds1);
+                stepper->stats.crossings++;
+                while (ds1 - ds0 > precision) {
+                        stepper->stats.bisections++;
+                        double ds2;
+                        if (interpolate) {
+                                ds2 = ds0 - g0 * (ds1 - ds0) / (g1 - g0);
+                                const double margin = 0.5 * precision;
+                                if (ds2 < ds0 + margin) ds2 = ds0 + margin;
+                                else if (ds2 > ds1 - margin)
+                                        ds2 = ds1 - margin;
+                        } else {
+                                ds2 = 0.5 * (ds0 + ds1);
+                        }
                         double position2[3] = {
                                 position[0] + direction[0] * ds2,
                                 position[1] + direction[1] * ds2,
                                 position[2] + direction[2] * ds2 };
-                        if (stepper_sample(stepper, position2, &sample2, 1,
-                            error_) != TURTLE_RETURN_SUCCESS)
-                                return TURTLE_ERROR_RAISE();
+                        rc = stepper_sample(
+                            stepper, position2, &sample2, 1, error_);
+                        if (rc != TURTLE_RETURN_SUCCESS) return rc;
                         const int medium2 = sample2.index[0];
                         if (medium2 == medium0) {
                                 ds0 = ds2;
+                                if (interpolate) {
+                                        g0 = sample2.geographic[2] -
+                                            sample2.elevation[up ? 1 : 0];
+                                        if (side < 0) g1 *= 0.5;
+                                        side = -1;
+                                }
                         } else {
                                 medium1 = medium2; /* In case that a 3rd medium
                                                       was hit in between */
@@ -856,7 +1636,17 @@ enum turtle_return turtle_stepper_step(struct turtle_stepper * stepper,
                                     sizeof(sample2.position));
                                 memcpy(&stepper->last, &sample2,
                                     sizeof(stepper->last));
+                                if (interpolate) {
+                                        g1 = sample2.geographic[2] -
+                                            sample2.elevation[up ? 0 : 1];
+                                        if (side > 0) g0 *= 0.5;
+                                        side = 1;
+                                }
                         }
+                        if (interpolate && ((medium1 < 0) ||
+                            (abs(medium1 - medium0) != 1) ||
+                            !(g0 * g1 < 0.)))
+                                interpolate = 0;
                 }
                 ds += ds1;
                 for (i = 0; i < 3; i++)
@@ -874,43 +1664,209 @@ enum turtle_return turtle_stepper_step(struct turtle_stepper * stepper,
         return TURTLE_RETURN_SUCCESS;
 }
 
+/* Get the runtime statistics of the stepper */
+void turtle_stepper_stats(const struct turtle_stepper * stepper,
+    struct turtle_stepper_stats * stats)
+{
+        memcpy(stats, &stepper->stats, sizeof(*stats));
+}
+
+void turtle_stepper_stats_reset(struct turtle_stepper * stepper)
+{
+        memset(&stepper->stats, 0x0, sizeof(stepper->stats));
+}
+
+enum turtle_return turtle_stepper_step(struct turtle_stepper * stepper,
+    double * position, const double * direction, double * latitude,
+    double * longitude, double * altitude, double * elevation,
+    double * step_length, int * index)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_stepper_step);
+
+        stepper_advance(stepper, position, direction, latitude, longitude,
+            altitude, elevation, step_length, index, error_);
+        return TURTLE_ERROR_RAISE();
+}
+
+/* Create a new stepping state, initially unbound */
+enum turtle_return turtle_stepper_state_create(
+    struct turtle_stepper_state ** state)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_stepper_state_create);
+
+        *state = malloc(sizeof(**state));
+        if (*state == NULL) return TURTLE_ERROR_MEMORY();
+        (*state)->generation = 0;
+        (*state)->size = 0;
+        (*state)->transforms = NULL;
+
+        return TURTLE_RETURN_SUCCESS;
+}
+
+void turtle_stepper_state_destroy(struct turtle_stepper_state ** state)
+{
+        if ((state == NULL) || (*state == NULL)) return;
+        free((*state)->transforms);
+        free(*state);
+        *state = NULL;
+}
+
+/* Restore the stepping history of a particle, or reset it if the state was
+ * not saved by the current stepper configuration
+ */
+static enum turtle_return state_restore(struct turtle_stepper * stepper,
+    struct turtle_stepper_state * state, struct turtle_error_context * error_)
+{
+        struct turtle_stepper_transform * transform;
+        int i;
+        if (state->generation != stepper->generation) {
+                const int size = stepper->transforms.size;
+                if (size > state->size) {
+                        struct turtle_stepper_local * transforms = realloc(
+                            state->transforms, size * sizeof(*transforms));
+                        if (transforms == NULL) return TURTLE_ERROR_MEMORY();
+                        state->transforms = transforms;
+                        state->size = size;
+                }
+                state->generation = stepper->generation;
+                state->last.index[0] = -1;
+                state->last.index[1] = -1;
+                state->last.elevation[0] = 0;
+                state->last.elevation[1] = 0;
+                state->last.position[0] = DBL_MAX;
+                state->last.position[1] = DBL_MAX;
+                state->last.position[2] = DBL_MAX;
+                for (i = 0; i < size; i++) {
+                        double * r = state->transforms[i].reference_ecef;
+                        r[0] = r[1] = r[2] = DBL_MAX;
+                }
+        }
+
+        memcpy(&stepper->last, &state->last, sizeof(stepper->last));
+        for (transform = stepper->transforms.head, i = 0; transform != NULL;
+             transform = transform->element.next, i++) {
+                const struct turtle_stepper_local * local =
+                    state->transforms + i;
+                memcpy(transform->reference_ecef, local->reference_ecef,
+                    sizeof(local->reference_ecef));
+                memcpy(transform->reference_geographic,
+                    local->reference_geographic,
+                    sizeof(local->reference_geographic));
+                memcpy(transform->data, local->data, sizeof(local->data));
+        }
+        return TURTLE_RETURN_SUCCESS;
+}
+
+/* Save the stepping history of a particle */
+static void state_save(const struct turtle_stepper * stepper,
+    struct turtle_stepper_state * state)
+{
+        memcpy(&state->last, &stepper->last, sizeof(state->last));
+        const struct turtle_stepper_transform * transform;
+        int i;
+        for (transform = stepper->transforms.head, i = 0; transform != NULL;
+             transform = transform->element.next, i++) {
+                struct turtle_stepper_local * local = state->transforms + i;
+                memcpy(local->reference_ecef, transform->reference_ecef,
+                    sizeof(local->reference_ecef));
+                memcpy(local->reference_geographic,
+                    transform->reference_geographic,
+                    sizeof(local->reference_geographic));
+                memcpy(local->data, transform->data, sizeof(local->data));
+        }
+}
+
+enum turtle_return turtle_stepper_step_state(struct turtle_stepper * stepper,
+    struct turtle_stepper_state * state, double * position,
+    const double * direction, double * latitude, double * longitude,
+    double * altitude, double * elevation, double * step_length, int * index)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_stepper_step_state);
+
+        if (state_restore(stepper, state, error_) != TURTLE_RETURN_SUCCESS)
+                return TURTLE_ERROR_RAISE();
+        stepper_advance(stepper, position, direction, latitude, longitude,
+            altitude, elevation, step_length, index, error_);
+        state_save(stepper, state);
+        return TURTLE_ERROR_RAISE();
+}
+
+enum turtle_return turtle_stepper_step_n(struct turtle_stepper * stepper,
+    int n, struct turtle_stepper_state ** states, double * position,
+    const double * direction, double * latitude, double * longitude,
+    double * altitude, double * elevation, double * step_length, int * index)
+{
+        TURTLE_ERROR_INITIALISE(&turtle_stepper_step_n);
+        if ((n > 0) && (states == NULL))
+                return TURTLE_ERROR_MESSAGE(
+                    TURTLE_RETURN_BAD_ADDRESS, "missing stepping states");
+
+        /* Loop over particles, sharing the error context. Each particle
+         * steps with its own history, as with `turtle_stepper_step_state`
+         */
+        int i;
+        for (i = 0; i < n; i++) {
+                if (state_restore(stepper, states[i], error_) !=
+                    TURTLE_RETURN_SUCCESS)
+                        break;
+                const enum turtle_return rc = stepper_advance(stepper,
+                    position + 3 * i,
+                    (direction != NULL) ? direction + 3 * i : NULL,
+                    (latitude != NULL) ? latitude + i : NULL,
+                    (longitude != NULL) ? longitude + i : NULL,
+                    (altitude != NULL) ? altitude + i : NULL,
+                    (elevation != NULL) ? elevation + 2 * i : NULL,
+                    (step_length != NULL) ? step_length + i : NULL,
+                    (index != NULL) ? index + 2 * i : NULL, error_);
+                state_save(stepper, states[i]);
+                if (rc != TURTLE_RETURN_SUCCESS) break;
+        }
+
+        return TURTLE_ERROR_RAISE();
+}
+
 enum turtle_return turtle_stepper_position(struct turtle_stepper * stepper,
     double latitude, double longitude, double height, int layer_index,
     double * position, int * data_index)
 {
         TURTLE_ERROR_INITIALISE(&turtle_stepper_position);
 
-        if ((layer_index < 0) || (layer_index >= stepper->layers.size)) {
+        if ((layer_index < 0) ||
+            (layer_index >= stepper_layers(stepper)->size)) {
                 return TURTLE_ERROR_MESSAGE(
                     TURTLE_RETURN_DOMAIN_ERROR, "no valid data");
         }
 
         struct turtle_stepper_layer * layer;
-        for (layer = stepper->layers.head; layer_index > 0; layer_index--,
-            layer = layer->element.next) ;
+        for (layer = stepper_layers(stepper)->head; layer_index > 0;
+            layer_index--, layer = layer->element.next) ;
 
         /* Loop over data and locate the proper set */
         reset_data_and_transforms(stepper);
+        stepper_index(stepper);
         int index;
         double elevation = 0.;
-        struct turtle_stepper_meta * meta;
-        for (meta = layer->meta.tail, index = 0; meta != NULL;
-            meta = meta->element.previous, index++) {
+        struct layer_cursor cursor;
+        layer_cursor_initialise(&cursor, layer, latitude, longitude);
+        const struct turtle_stepper_meta * meta;
+        while ((meta = layer_cursor_next(&cursor, &index)) != NULL) {
+                struct turtle_stepper_data * data = meta_data(stepper, meta);
+                if (!data_covers(data, latitude, longitude)) {
+                        stepper->stats.culls++;
+                        continue;
+                }
                 int inside;
-                stepper_elevation(stepper, meta->data, latitude, longitude,
+                stepper_elevation(stepper, data, latitude, longitude,
                     &elevation, &inside);
                 if (inside) {
                         elevation += meta->offset;
 
                         if (stepper->geoid != NULL) {
                                 /* Correct from the geoid */
-                                int inside_;
                                 double undulation;
-                                const double lo = (longitude >= 0) ?
-                                    longitude : longitude + 360.;
-                                turtle_map_elevation(stepper->geoid, lo,
-                                    latitude, &undulation, &inside_);
-                                if (inside_) elevation += undulation;
+                                if (geoid_undulation(stepper, latitude,
+                                    longitude, &undulation))
+                                        elevation += undulation;
                         }
 
                         /* Compute the ECEF position */
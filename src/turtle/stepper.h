@@ -69,6 +69,10 @@ struct turtle_stepper_data {
                 struct turtle_map * map;
         } a;
         struct turtle_stepper_transform * transform;
+        int index;
+
+        /* Geodetic bounding box, as latitude and longitude ranges */
+        double box[4];
 
         struct {
                 int updated;
@@ -85,9 +89,26 @@ struct turtle_stepper_meta {
         double offset;
 };
 
+/* Spatial index of the data of a layer, over a grid of geodetic bins. Bins
+ * list the ranks of the overlapping data, in priority order
+ */
+struct turtle_stepper_index {
+        double latitude_0, latitude_delta;
+        double longitude_0, longitude_delta;
+        int latitude_n, longitude_n;
+        int * offsets;
+        int * ranks;
+        struct turtle_stepper_meta ** meta;
+        char data[]; /* Placeholder for data */
+};
+
 struct turtle_stepper_layer {
         struct turtle_list_element element;
         struct turtle_list meta;
+
+        /* Spatial index, built on demand for layers with many data */
+        int indexed;
+        struct turtle_stepper_index * index;
 };
 
 struct turtle_stepper_sample {
@@ -97,16 +118,60 @@ struct turtle_stepper_sample {
         int index[2];
 };
 
+/* Parameters of a local transform, as saved by a stepping state */
+struct turtle_stepper_local {
+        double reference_ecef[3];
+        double reference_geographic[5];
+        double data[5][3];
+};
+
+/* Stepping state of a particle, i.e. its last sample and local transforms.
+ * The state is valid for the stepper configuration of the given generation
+ */
+struct turtle_stepper_state {
+        unsigned long generation;
+        int size;
+        struct turtle_stepper_sample last;
+        struct turtle_stepper_local * transforms;
+};
+
 /* Container for an ECEF stepper */
 struct turtle_stepper {
         struct turtle_list data;
         struct turtle_list transforms;
         struct turtle_list layers;
+        struct turtle_stepper_transform * geodetic;
         struct turtle_map * geoid;
         double local_range;
         double slope_factor;
         double resolution_factor;
+        double precision;
+        enum turtle_stepper_refinement refinement;
+        int pyramid;
         struct turtle_stepper_sample last;
+
+        /* Unique identifier of the stepping history, renewed whenever it is
+         * reset or when a transform is added
+         */
+        unsigned long generation;
+
+        /* Interpolation nodes of the last geoid cell */
+        struct {
+                const struct turtle_map * map;
+                unsigned long serial;
+                int ix, iy;
+                double z00, z10, z01, z11;
+        } geoid_cell;
+
+        /* Runtime statistics */
+        struct turtle_stepper_stats stats;
+
+        /* Cloning status. A clone shares the layers of its parent and maps
+         * the parent's data to its own ones through the table
+         */
+        struct turtle_stepper * parent;
+        struct turtle_stepper_data ** table;
+        int clones;
 };
 
 #endif
@@ -22,6 +22,11 @@
  * Unit tests for the Turtle C library
  */
 
+/* POSIX shared memory and processes, for shared tiles */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 /* C89 standard library */
 #include <float.h>
 #include <math.h>
@@ -35,6 +40,17 @@
 #include "check.h"
 /* Endianess utilities */
 #include <arpa/inet.h>
+/* POSIX directories */
+#include <sys/stat.h>
+#include <unistd.h>
+/* POSIX shared memory and processes */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#ifndef TURTLE_NO_PTHREAD
+/* POSIX threads */
+#include <pthread.h>
+#endif
 #ifndef TURTLE_NO_TIFF
 /* TIFF library */
 #include <tiffio.h>
@@ -42,7 +58,10 @@
 /* The TURTLE library */
 #include "turtle.h"
 /* Opaque TURTLE data */
+#include "../src/turtle/client.h"
+#include "../src/turtle/error.h"
 #include "../src/turtle/list.h"
+#include "../src/turtle/map.h"
 #include "../src/turtle/stack.h"
 #include "../src/turtle/stepper.h"
 
@@ -400,6 +419,71 @@ START_TEST (test_stepper_layer)
             altitude - resolution, values[0][1] + 0.25, 1E-05);
         ck_assert_double_eq_tol(step, resolution, 1E-05);
 
+        /* Check the culling of data by their bounding box, for a layer with
+         * many local maps over a flat ground
+         */
+        {
+                struct turtle_stepper * culled;
+                turtle_stepper_create(&culled);
+                turtle_stepper_add_flat(culled, 0.);
+                struct turtle_map * tiles[16];
+                for (i = 0; i < 16; i++) {
+                        const double y0 = 45. + 0.1 * (i / 4);
+                        const double x0 = 2. + 0.1 * (i % 4);
+                        struct turtle_map_info info = { 11, 11,
+                                { x0, x0 + 0.1 }, { y0, y0 + 0.1 },
+                                { 0., 100. } };
+                        turtle_map_create(tiles + i, &info, NULL);
+                        int ix, iy;
+                        for (ix = 0; ix < 11; ix++) {
+                                for (iy = 0; iy < 11; iy++) {
+                                        turtle_map_fill(
+                                            tiles[i], ix, iy, 10. + i);
+                                }
+                        }
+                        turtle_stepper_add_map(culled, tiles[i], 0.);
+                }
+                turtle_stepper_add_map(culled, map, 0.);
+
+                for (i = 0; i < 16; i++) {
+                        const double latitude = 45.05 + 0.1 * (i / 4);
+                        const double longitude = 2.05 + 0.1 * (i % 4);
+                        double p[3];
+                        int data_index;
+                        turtle_stepper_position(culled, latitude, longitude,
+                            -1., 0, p, &data_index);
+                        ck_assert_int_eq(data_index, 16 - i);
+                        double e[2];
+                        turtle_stepper_step(culled, p, NULL, NULL, NULL, NULL,
+                            e, NULL, index);
+                        ck_assert_int_eq(index[0], 0);
+                        ck_assert_int_eq(index[1], 16 - i);
+                        ck_assert_double_eq_tol(e[1], 10. + i, 1E-02);
+                }
+                struct turtle_stepper_layer * layer = culled->layers.tail;
+                ck_assert_ptr_nonnull(layer->index);
+
+                int data_index;
+                turtle_stepper_position(culled, latitude0, longitude0, 0., 0,
+                    position, &data_index);
+                ck_assert_int_eq(data_index, 0);
+                turtle_stepper_position(culled, 46.5, 3.5, 1., 0, position,
+                    &data_index);
+                ck_assert_int_eq(data_index, 17);
+                turtle_stepper_step(culled, position, NULL, NULL, NULL,
+                    &altitude, NULL, NULL, index);
+                ck_assert_int_eq(index[0], 1);
+                ck_assert_double_eq_tol(altitude, 1., 1E-06);
+
+                struct turtle_stepper_stats stats;
+                turtle_stepper_stats(culled, &stats);
+                ck_assert(stats.culls > 0);
+                ck_assert(stats.evaluations <= 16 * 2 + 1);
+
+                turtle_stepper_destroy(&culled);
+                for (i = 0; i < 16; i++) turtle_map_destroy(tiles + i);
+        }
+
         /* Clean and exit */
         turtle_stepper_destroy(&stepper);
         turtle_stack_destroy(&stack);
@@ -468,8 +552,304 @@ START_TEST (test_map)
                         turtle_map_fill(map, ix, iy, z);
                 }
         }
+
+        /* Check the batched interpolation against the single one */
+        {
+                const double x[5] = { x0, x0 + 0.5, x0 - 1000.5, x0 + 123.4,
+                        NAN };
+                const double y[5] = { y0, y0 + 0.5, y0, y0 - 567.8, y0 };
+                double zv[5];
+                int iv[5];
+                turtle_map_elevation_v(map, 5, x, y, zv, iv);
+                for (i = 0; i < 5; i++) {
+                        turtle_map_elevation(map, x[i], y[i], &z, &inside);
+                        ck_assert_int_eq(iv[i], inside);
+                        if (inside) ck_assert_double_eq(zv[i], z);
+                        else ck_assert_double_eq(zv[i], 0.);
+                }
+        }
+
+        /* Check the normalisation of the data layout */
+        {
+                double xv[9], yv[9], zv[9], gxv[9], gyv[9];
+                for (i = 0; i < 9; i++) {
+                        xv[i] = x0 - 1000. + 250. * i;
+                        yv[i] = y0 + 1000. - 200. * i;
+                        turtle_map_elevation(map, xv[i], yv[i], zv + i, NULL);
+                        turtle_map_gradient(
+                            map, xv[i], yv[i], gxv + i, gyv + i, NULL);
+                }
+                ck_assert_int_eq(map->meta.layout, TURTLE_MAP_LAYOUT_RAW);
+                for (i = 0; i < 9; i++) {
+                        double gx, gy;
+                        turtle_map_elevation_gradient(
+                            map, xv[i], yv[i], &z, &gx, &gy, NULL);
+                        ck_assert_double_eq(z, zv[i]);
+                        ck_assert_double_eq(gx, gxv[i]);
+                        ck_assert_double_eq(gy, gyv[i]);
+                }
+                ck_assert_int_eq(
+                    turtle_map_normalise(map), TURTLE_RETURN_SUCCESS);
+                ck_assert_int_eq(map->meta.layout, TURTLE_MAP_LAYOUT_LINEAR);
+                for (i = 0; i < 9; i++) {
+                        double gx, gy;
+                        turtle_map_elevation(map, xv[i], yv[i], &z, NULL);
+                        ck_assert_double_eq(z, zv[i]);
+                        turtle_map_gradient(map, xv[i], yv[i], &gx, &gy, NULL);
+                        ck_assert_double_eq(gx, gxv[i]);
+                        ck_assert_double_eq(gy, gyv[i]);
+                        turtle_map_elevation_gradient(
+                            map, xv[i], yv[i], &z, &gx, &gy, NULL);
+                        ck_assert_double_eq(z, zv[i]);
+                        ck_assert_double_eq(gx, gxv[i]);
+                        ck_assert_double_eq(gy, gyv[i]);
+                }
+                for (i = 0; i < nx; i += 7) {
+                        int j;
+                        for (j = 0; j < ny; j += 5) {
+                                double x, y, zn;
+                                turtle_map_node(map, i, j, &x, &y, &zn);
+                                turtle_map_elevation(map, x, y, &z, NULL);
+                                ck_assert_double_eq_tol(zn, z, 1E-06);
+                        }
+                }
+
+                /* Check the blocked layout */
+                ck_assert_int_eq(turtle_map_block(&map), TURTLE_RETURN_SUCCESS);
+                ck_assert_int_eq(
+                    map->meta.layout, TURTLE_MAP_LAYOUT_LINEAR_BLOCKED);
+                for (i = 0; i < 9; i++) {
+                        double gx, gy;
+                        turtle_map_elevation(map, xv[i], yv[i], &z, NULL);
+                        ck_assert_double_eq(z, zv[i]);
+                        turtle_map_gradient(map, xv[i], yv[i], &gx, &gy, NULL);
+                        ck_assert_double_eq(gx, gxv[i]);
+                        ck_assert_double_eq(gy, gyv[i]);
+                        turtle_map_elevation_v(map, 1, xv + i, yv + i, &z,
+                            NULL);
+                        ck_assert_double_eq(z, zv[i]);
+                }
+                turtle_map_fill(map, 3, 2, 500.);
+                turtle_map_node(map, 3, 2, NULL, NULL, &z);
+                ck_assert_double_eq_tol(z, 500., 1E-02);
+        }
+
+        /* Check the gradient of a plane, including along the map edges */
+        {
+                struct turtle_map * plane;
+                struct turtle_map_info info = { 5, 4, { 0., 4. }, { 0., 3. },
+                        { 0., 20. } };
+                turtle_map_create(&plane, &info, NULL);
+                int j;
+                for (i = 0; i < 5; i++) {
+                        for (j = 0; j < 4; j++)
+                                turtle_map_fill(plane, i, j, 2. * i + 3. * j);
+                }
+                for (i = 0; i < 9; i++) {
+                        for (j = 0; j < 7; j++) {
+                                const double x = 0.5 * i, y = 0.5 * j;
+                                double gx, gy;
+                                turtle_map_elevation_gradient(
+                                    plane, x, y, &z, &gx, &gy, NULL);
+                                ck_assert_double_eq_tol(
+                                    z, 2. * x + 3. * y, 1E-03);
+                                ck_assert_double_eq_tol(gx, 2., 1E-03);
+                                ck_assert_double_eq_tol(gy, 3., 1E-03);
+                        }
+                }
+                turtle_map_destroy(&plane);
+        }
+
+        /* Check the intersection of rays with a ridge */
+        {
+                struct turtle_map * ridge;
+                struct turtle_map_info info = { 21, 3, { 0., 20. },
+                        { 0., 2. }, { 0., 100. } };
+                turtle_map_create(&ridge, &info, NULL);
+                int j;
+                for (i = 0; i < 21; i++) {
+                        for (j = 0; j < 3; j++) {
+                                turtle_map_fill(ridge, i, j,
+                                    100. - (i - 10) * (i - 10));
+                        }
+                }
+
+                double zn[21];
+                for (i = 0; i < 21; i++)
+                        turtle_map_node(ridge, i, 1, NULL, NULL, zn + i);
+                const double r0[3] = { 0., 1., 50. };
+                const double u0[3] = { 1., 0., 0. };
+                double distance[4];
+                int count;
+                ck_assert_int_eq(turtle_map_intersect(ridge, r0, u0, 30., 4,
+                    distance, &count), TURTLE_RETURN_SUCCESS);
+                ck_assert_int_eq(count, 2);
+                ck_assert_double_eq_tol(distance[0],
+                    2. + (50. - zn[2]) / (zn[3] - zn[2]), 1E-09);
+                ck_assert_double_eq_tol(distance[1],
+                    17. + (50. - zn[17]) / (zn[18] - zn[17]), 1E-09);
+                turtle_map_intersect(ridge, r0, u0, 30., 1, distance, &count);
+                ck_assert_int_eq(count, 1);
+                turtle_map_intersect(ridge, r0, u0, 5., 4, distance, &count);
+                ck_assert_int_eq(count, 1);
+
+                /* Oblique rays, starting outside of the map */
+                int total = 0;
+                for (i = 0; i < 10; i++) {
+                        const double r1[3] = { -2., -0.5, 20. + 5. * i };
+                        const double u1[3] = { 0.8, 0.1, 0.02 * (i - 5) };
+                        turtle_map_intersect(
+                            ridge, r1, u1, 100., 4, distance, &count);
+                        total += count;
+                        for (j = 0; j < count; j++) {
+                                const double t = distance[j];
+                                if (j > 0) ck_assert(t > distance[j - 1]);
+                                turtle_map_elevation(ridge, r1[0] + u1[0] * t,
+                                    r1[1] + u1[1] * t, &z, NULL);
+                                ck_assert_double_eq_tol(
+                                    z, r1[2] + u1[2] * t, 1E-06);
+                        }
+                }
+                ck_assert(total > 5);
+
+                /* Check a vertical ray */
+                const double r2[3] = { 10.5, 0.5, 200. };
+                const double u2[3] = { 0., 0., -1. };
+                turtle_map_intersect(ridge, r2, u2, 1000., 4, distance, &count);
+                ck_assert_int_eq(count, 1);
+                turtle_map_elevation(ridge, 10.5, 0.5, &z, NULL);
+                ck_assert_double_eq_tol(distance[0], 200. - z, 1E-09);
+
+                turtle_error_handler_t * handler = turtle_error_handler_get();
+                turtle_error_handler_set(&catch_error);
+                const double r3[3] = { 0., NAN, 0. };
+                ck_assert_int_eq(turtle_map_intersect(ridge, r3, u0, 30., 4,
+                    distance, &count), TURTLE_RETURN_DOMAIN_ERROR);
+                ck_assert_int_eq(count, 0);
+                turtle_error_handler_set(handler);
+                turtle_map_destroy(&ridge);
+        }
         turtle_map_destroy(&map);
 
+        {
+                /* Check the batched interpolation with the default encoding */
+                struct turtle_map_info info = { 11, 11, { 0, 10 }, { 0, 10 },
+                        { -1, 1 } };
+                turtle_map_create(&map, &info, NULL);
+                for (ix = 0; ix < 11; ix++) {
+                        int iy;
+                        for (iy = 0; iy < 11; iy++)
+                                turtle_map_fill(
+                                    map, ix, iy, 0.01 * ix - 0.02 * iy);
+                }
+                double x[100], y[100], zv[100];
+                for (i = 0; i < 100; i++) {
+                        x[i] = 0.1 * i;
+                        y[i] = 10. - 0.1 * i;
+                }
+                ck_assert_int_eq(turtle_map_elevation_v(map, 100, x, y, zv,
+                                     NULL),
+                    TURTLE_RETURN_SUCCESS);
+                for (i = 0; i < 100; i++) {
+                        turtle_map_elevation(map, x[i], y[i], &z, NULL);
+                        ck_assert_double_eq(zv[i], z);
+                }
+                turtle_map_destroy(&map);
+        }
+
+        {
+                /* Check the reprojection of a UTM plane */
+                struct turtle_map * utm, * geodetic, * parallel;
+                struct turtle_map_info info = { 51, 41,
+                        { 500000., 505000. }, { 5000000., 5004000. },
+                        { 0., 1000. } };
+                turtle_map_create(&utm, &info, "UTM 31N");
+                for (ix = 0; ix < 51; ix++) {
+                        int iy;
+                        for (iy = 0; iy < 41; iy++)
+                                turtle_map_fill(
+                                    utm, ix, iy, 400. + 2. * ix - 3. * iy);
+                }
+                ck_assert_int_eq(turtle_map_reproject(&geodetic, utm, 0., 1),
+                    TURTLE_RETURN_SUCCESS);
+                ck_assert_ptr_null(turtle_map_projection(geodetic));
+                struct turtle_map_info ginfo;
+                turtle_map_meta(geodetic, &ginfo, NULL);
+                ck_assert(abs(ginfo.nx - 51) <= 2);
+                ck_assert(abs(ginfo.ny - 41) <= 2);
+                const struct turtle_projection * p =
+                    turtle_map_projection(utm);
+                for (ix = 0; ix < ginfo.nx; ix += 3) {
+                        int iy;
+                        for (iy = 0; iy < ginfo.ny; iy += 3) {
+                                double longitude, latitude, x, y;
+                                turtle_map_node(geodetic, ix, iy, &longitude,
+                                    &latitude, &z);
+                                turtle_projection_project(
+                                    p, latitude, longitude, &x, &y);
+                                ck_assert(x >= info.x[0] - 1E-06);
+                                ck_assert(x <= info.x[1] + 1E-06);
+                                ck_assert(y >= info.y[0] - 1E-06);
+                                ck_assert(y <= info.y[1] + 1E-06);
+                                const double zu = 400. +
+                                    2E-02 * (x - info.x[0]) -
+                                    3E-02 * (y - info.y[0]);
+                                ck_assert_double_eq_tol(z, zu, 2E-02);
+                        }
+                }
+
+                /* Check the parallel resampling and the resolution */
+                ck_assert_int_eq(turtle_map_reproject(&parallel, utm, 0., 3),
+                    TURTLE_RETURN_SUCCESS);
+                ck_assert_int_eq(memcmp(geodetic->data, parallel->data,
+                                     geodetic->data_size),
+                    0);
+                turtle_map_destroy(&parallel);
+                ck_assert_int_eq(
+                    turtle_map_reproject(&parallel, utm, 1E-03, 2),
+                    TURTLE_RETURN_SUCCESS);
+                turtle_map_meta(parallel, &info, NULL);
+                ck_assert_double_eq_tol(
+                    (info.x[1] - info.x[0]) / (info.nx - 1), 1E-03, 1E-12);
+                const double gdx = (ginfo.x[1] - ginfo.x[0]) / (ginfo.nx - 1);
+                const double gdy = (ginfo.y[1] - ginfo.y[0]) / (ginfo.ny - 1);
+                ck_assert(fabs(info.x[0] - ginfo.x[0]) <= gdx);
+                ck_assert(fabs(info.y[0] - ginfo.y[0]) <= gdy);
+
+                /* Check that the boundary nodes project inside of the map */
+                for (ix = 0; ix < info.nx; ix++) {
+                        int iy;
+                        for (iy = 0; iy < info.ny; iy++) {
+                                if ((ix > 0) && (ix < info.nx - 1) &&
+                                    (iy > 0) && (iy < info.ny - 1))
+                                        continue;
+                                double longitude, latitude, x, y;
+                                turtle_map_node(parallel, ix, iy, &longitude,
+                                    &latitude, &z);
+                                turtle_projection_project(
+                                    p, latitude, longitude, &x, &y);
+                                ck_assert(x >= 500000.);
+                                ck_assert(x <= 505000.);
+                                ck_assert(y >= 5000000.);
+                                ck_assert(y <= 5004000.);
+                        }
+                }
+                turtle_map_destroy(&parallel);
+
+                /* Check the errors */
+                turtle_error_handler_t * handler = turtle_error_handler_get();
+                turtle_error_handler_set(&catch_error);
+                ck_assert_int_eq(
+                    turtle_map_reproject(&parallel, geodetic, 0., 1),
+                    TURTLE_RETURN_BAD_PROJECTION);
+                ck_assert_ptr_null(parallel);
+                ck_assert_int_eq(turtle_map_reproject(&parallel, utm, 1., 1),
+                    TURTLE_RETURN_DOMAIN_ERROR);
+                turtle_error_handler_set(handler);
+                turtle_map_destroy(&geodetic);
+                turtle_map_destroy(&utm);
+        }
+
         /* Catch errors and try loading some wrong maps */
         turtle_error_handler_t * handler = turtle_error_handler_get();
         turtle_error_handler_set(&catch_error);
@@ -553,6 +933,26 @@ START_TEST (test_projection)
                 turtle_projection_unproject(projection, x, y, &la, &lo);
                 ck_assert_double_eq_tol(la, latitude, 1E-08);
                 ck_assert_double_eq_tol(lo, longitude, 1E-08);
+
+                /* Check the vectorized versions against the scalar ones */
+                const double lat_v[3] = { latitude, 44.1, 47.3 };
+                const double lon_v[3] = { longitude, 1.2, 4.9 };
+                double x_v[3], y_v[3], la_v[3], lo_v[3];
+                turtle_projection_project_v(
+                    projection, 3, lat_v, lon_v, x_v, y_v);
+                turtle_projection_unproject_v(
+                    projection, 3, x_v, y_v, la_v, lo_v);
+                int j;
+                for (j = 0; j < 3; j++) {
+                        turtle_projection_project(
+                            projection, lat_v[j], lon_v[j], &x, &y);
+                        ck_assert_double_eq(x_v[j], x);
+                        ck_assert_double_eq(y_v[j], y);
+                        turtle_projection_unproject(
+                            projection, x, y, &la, &lo);
+                        ck_assert_double_eq(la_v[j], la);
+                        ck_assert_double_eq(lo_v[j], lo);
+                }
         }
 
         /* Clean the memory */
@@ -573,6 +973,13 @@ START_TEST (test_projection)
         ck_assert_int_eq(regexec(&regex, error_buffer, 0, NULL, 0), 0);
         regfree(&regex);
 
+        double x_v, y_v;
+        const double lat_v = 45.5, lon_v = 3.5;
+        rc = turtle_projection_project_v(NULL, 1, &lat_v, &lon_v, &x_v, &y_v);
+        ck_assert_int_eq(rc, TURTLE_RETURN_BAD_ADDRESS);
+        ck_assert_double_eq(x_v, 0.);
+        ck_assert_double_eq(y_v, 0.);
+
         /* Restore the error handler */
         turtle_error_handler_set(handler);
 }
@@ -621,10 +1028,89 @@ START_TEST (test_ecef)
         ck_assert_double_eq(lla[0], 0);
         ck_assert_double_eq(lla[1], 90);
         ck_assert_double_eq(lla[2], altitude);
+
+        /* Check the vectorized versions against the scalar ones */
+        const double lat_v[4] = { 45.5, 90., -90., -12.3 };
+        const double lon_v[4] = { 3.5, 0., 0., -160.2 };
+        const double alt_v[4] = { 1000., -5000., 20000., 99000. };
+        const double az_v[4] = { 60., 0., -170., 300. };
+        const double el_v[4] = { 30., 90., -45., 0. };
+        double position_v[12], direction_v[12], lla_v[3][4], angle_v[2][4];
+        turtle_ecef_from_geodetic_v(4, lat_v, lon_v, alt_v, position_v);
+        turtle_ecef_from_horizontal_v(
+            4, lat_v, lon_v, az_v, el_v, direction_v);
+        turtle_ecef_to_geodetic_v(
+            4, position_v, lla_v[0], lla_v[1], lla_v[2]);
+        turtle_ecef_to_horizontal_v(
+            4, lat_v, lon_v, direction_v, angle_v[0], angle_v[1]);
+        int i;
+        for (i = 0; i < 4; i++) {
+                turtle_ecef_from_geodetic(
+                    lat_v[i], lon_v[i], alt_v[i], position);
+                turtle_ecef_from_horizontal(
+                    lat_v[i], lon_v[i], az_v[i], el_v[i], direction);
+                int j;
+                for (j = 0; j < 3; j++) {
+                        ck_assert_double_eq(position_v[3 * i + j], position[j]);
+                        ck_assert_double_eq(
+                            direction_v[3 * i + j], direction[j]);
+                }
+
+                turtle_ecef_to_geodetic(position, lla, lla + 1, lla + 2);
+                ck_assert_double_eq_tol(lla_v[0][i], lla[0], 1E-08);
+                ck_assert_double_eq_tol(lla_v[1][i], lla[1], 1E-08);
+                ck_assert_double_eq_tol(lla_v[2][i], lla[2], 1E-06);
+                ck_assert_double_eq_tol(lla_v[0][i], lat_v[i], 1E-08);
+                ck_assert_double_eq_tol(lla_v[2][i], alt_v[i], 1E-06);
+
+                turtle_ecef_to_horizontal(
+                    lat_v[i], lon_v[i], direction, angle, angle + 1);
+                ck_assert_double_eq(angle_v[0][i], angle[0]);
+                ck_assert_double_eq(angle_v[1][i], angle[1]);
+        }
 }
 END_TEST
 
 
+/* Stack hook counting the load and evict events */
+struct hook_counter {
+        int events[N_TURTLE_STACK_EVENTS];
+        int paths;
+};
+
+static void count_events(void * context, enum turtle_stack_event event,
+    const struct turtle_map * map, const char * path)
+{
+        struct hook_counter * counter = context;
+        counter->events[event]++;
+        if ((map == NULL) || (path == NULL) ||
+            (strncmp(path, STACK_PATH, strlen(STACK_PATH)) != 0))
+                counter->paths = 0;
+}
+
+/* Tiles source copying files from a local directory */
+static int fetch_count = 0;
+
+static int fetch_copy(void * context, const char * name, const char * path)
+{
+        TURTLE_ATOMIC_ADD(&fetch_count, 1);
+        char source[1024];
+        sprintf(source, "%s/%s", (const char *)context, name);
+        FILE * in = fopen(source, "rb");
+        if (in == NULL) return -1;
+        FILE * out = fopen(path, "wb");
+        if (out == NULL) {
+                fclose(in);
+                return -1;
+        }
+        char buffer[4096];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+                fwrite(buffer, 1, n, out);
+        fclose(in);
+        return (fclose(out) != 0);
+}
+
 START_TEST (test_stack)
 {
         /* Create the stack */
@@ -652,6 +1138,32 @@ START_TEST (test_stack)
         ck_assert_int_eq(inside, 0);
         ck_assert_int_eq(stack->tiles.size, 2);
 
+        double glat = 1., glon = 1.;
+        turtle_stack_gradient(stack, 45.5, 3.5, &glat, &glon, NULL);
+        ck_assert_double_eq(glat, 0.);
+        ck_assert_double_eq(glon, 0.);
+        z = glat = glon = 1.;
+        turtle_stack_elevation_gradient(
+            stack, 45.5, 3.5, &z, &glat, &glon, NULL);
+        ck_assert_double_eq(z, 0.);
+        ck_assert_double_eq(glat, 0.);
+        ck_assert_double_eq(glon, 0.);
+        turtle_stack_elevation_gradient(
+            stack, 45.5, 4.5, &z, &glat, &glon, &inside);
+        ck_assert_int_eq(inside, 0);
+        ck_assert_int_eq(stack->tiles.size, 2);
+
+        /* Check the grid of loaded tiles */
+        int index = turtle_stack_index_(stack, 45.0, 3.5);
+        ck_assert_int_eq(index, 1);
+        ck_assert_int_eq(turtle_stack_missing_(stack, index), 0);
+        ck_assert_ptr_eq(stack->grid[index], stack->tiles.head);
+        ck_assert_int_eq(stack->grid[index]->index, index);
+        ck_assert_ptr_null(stack->grid[turtle_stack_index_(stack, 45.5, 2.5)]);
+        index = turtle_stack_index_(stack, 45.5, 4.5);
+        ck_assert_int_eq(index, -1);
+        ck_assert_int_ne(turtle_stack_missing_(stack, index), 0);
+
         turtle_stack_elevation(stack, 45.5, 2.5, &z, NULL);
         ck_assert_double_eq(z, 0);
         ck_assert_int_eq(stack->tiles.size, 3);
@@ -662,6 +1174,8 @@ START_TEST (test_stack)
         /* Check the clear and load functions */
         turtle_stack_clear(stack);
         ck_assert_int_eq(stack->tiles.size, 0);
+        for (index = 0; index < 4; index++)
+                ck_assert_ptr_null(stack->grid[index]);
 
         turtle_stack_elevation(stack, 45.5, 2.5, &z, NULL);
         ck_assert_double_eq(z, 0);
@@ -684,6 +1198,510 @@ START_TEST (test_stack)
         turtle_stack_load(stack);
         ck_assert_int_eq(stack->tiles.size, 4);
 
+        /* Check the parallel preloading */
+        turtle_stack_clear(stack);
+        turtle_stack_stats_reset(stack);
+        enum turtle_return rc =
+            turtle_stack_preload(stack, 45.2, 45.8, 2.2, 3.8, 4);
+        ck_assert_int_eq(rc, TURTLE_RETURN_SUCCESS);
+        ck_assert_int_eq(stack->tiles.size, 2);
+        ck_assert_ptr_nonnull(stack->grid[0]);
+        ck_assert_ptr_nonnull(stack->grid[1]);
+        ck_assert_int_eq(stack->grid[1]->index, 1);
+        ck_assert_int_eq(stack->counters.loads, 2);
+
+        rc = turtle_stack_preload(stack, 0., 90., -180., 180., 8);
+        ck_assert_int_eq(rc, TURTLE_RETURN_SUCCESS);
+        ck_assert_int_eq(stack->tiles.size, 4);
+        ck_assert_int_eq(stack->counters.loads, 4);
+        for (index = 0; index < 4; index++) {
+                ck_assert_ptr_nonnull(stack->grid[index]);
+                ck_assert_ptr_eq(stack->grid[index]->stack, stack);
+        }
+        turtle_stack_elevation(stack, 46.5, 3.5, &z, NULL);
+        ck_assert_double_eq(z, 0);
+
+        turtle_stack_clear(stack);
+        rc = turtle_stack_preload(stack, 10., 20., 2., 3., 4);
+        ck_assert_int_eq(rc, TURTLE_RETURN_SUCCESS);
+        ck_assert_int_eq(stack->tiles.size, 0);
+        rc = turtle_stack_preload(stack, 46.5, 46.5, 2.5, 2.5, 1);
+        ck_assert_int_eq(rc, TURTLE_RETURN_SUCCESS);
+        ck_assert_int_eq(stack->tiles.size, 1);
+        ck_assert_ptr_nonnull(stack->grid[2]);
+        {
+                turtle_error_handler_t * handler = turtle_error_handler_get();
+                turtle_error_handler_set(&catch_error);
+                rc = turtle_stack_preload(stack, 46., 45., 2., 3., 4);
+                ck_assert_int_eq(rc, TURTLE_RETURN_DOMAIN_ERROR);
+                turtle_error_handler_set(handler);
+        }
+
+        /* Check the batched elevation */
+        {
+                const double latitude[6] = { 45.5, 45.6, 46.5, 45.5, 45.5,
+                        45.0 };
+                const double longitude[6] = { 2.5, 2.6, 2.5, 4.5, 3.5, 3.0 };
+                double zv[6];
+                int iv[6];
+                turtle_stack_elevation_v(stack, 6, latitude, longitude, zv, iv);
+                int i;
+                for (i = 0; i < 6; i++) {
+                        turtle_stack_elevation(
+                            stack, latitude[i], longitude[i], &z, &inside);
+                        ck_assert_int_eq(iv[i], inside);
+                        ck_assert_double_eq(zv[i], z);
+                }
+                ck_assert_int_eq(iv[3], 0);
+        }
+
+        /* Check the prefetching of tiles */
+        double position[3], direction[3];
+        turtle_ecef_from_geodetic(45.5, 2.5, 0., position);
+        turtle_ecef_from_horizontal(45.5, 2.5, 90., 0., direction);
+        turtle_stack_clear(stack);
+        turtle_stack_prefetch(stack, position, NULL, 0.);
+        ck_assert_int_eq(stack->tiles.size, 1);
+        turtle_stack_prefetch(stack, position, direction, 1E+05);
+        ck_assert_int_eq(stack->tiles.size, 2);
+        const int index_east = turtle_stack_index_(stack, 45.5, 3.5);
+        ck_assert_ptr_nonnull(stack->grid[index_east]);
+        turtle_stack_prefetch(stack, position, NULL, 1E+05);
+        ck_assert_int_eq(stack->tiles.size, 4);
+        ck_assert_int_eq(turtle_stack_prefetch_async_get(stack), 0);
+
+        /* Check that the scan is bounded for large distances */
+        turtle_stack_clear(stack);
+        ck_assert_int_eq(
+            turtle_stack_prefetch(stack, position, direction, 1E+300),
+            TURTLE_RETURN_SUCCESS);
+        ck_assert_int_eq(stack->tiles.size, 2);
+        ck_assert_ptr_nonnull(stack->grid[index_east]);
+        turtle_stack_destroy(&stack);
+
+        turtle_stack_create(&stack, STACK_PATH, 2, NULL, NULL);
+        turtle_stack_prefetch(stack, position, NULL, 1E+05);
+        ck_assert_int_eq(stack->tiles.size, 2);
+
+        /* Check the tiles index */
+        {
+                const char * index_path = STACK_PATH "/.turtle-index";
+                remove(index_path);
+                ck_assert_int_eq(turtle_stack_index_dump(stack),
+                    TURTLE_RETURN_SUCCESS);
+                struct turtle_stack * indexed;
+                turtle_stack_create(&indexed, STACK_PATH, 0, NULL, NULL);
+                ck_assert_int_eq(indexed->latitude_n, stack->latitude_n);
+                ck_assert_int_eq(indexed->longitude_n, stack->longitude_n);
+                ck_assert_double_eq(indexed->latitude_0, stack->latitude_0);
+                ck_assert_double_eq(
+                    indexed->longitude_delta, stack->longitude_delta);
+                int i;
+                for (i = 0; i < 4; i++)
+                        ck_assert_str_eq(indexed->path[i], stack->path[i]);
+                turtle_stack_elevation(indexed, 46.5, 3.5, &z, NULL);
+                ck_assert_double_eq(z, 0);
+                turtle_stack_destroy(&indexed);
+
+                /* Alter the index, keeping it up to date */
+                FILE * stream = fopen(index_path, "r+");
+                char line[256];
+                fgets(line, sizeof(line), stream);
+                fgets(line, sizeof(line), stream);
+                fgets(line, sizeof(line), stream);
+                const long offset = ftell(stream);
+                fseek(stream, offset - 2, SEEK_SET);
+                fputc('1', stream);
+                fclose(stream);
+                turtle_stack_create(&indexed, STACK_PATH, 0, NULL, NULL);
+                ck_assert_ptr_nonnull(indexed->path[0]);
+                ck_assert_ptr_null(indexed->path[3]);
+                turtle_stack_destroy(&indexed);
+
+                /* Check that an outdated index is ignored */
+                stream = fopen(STACK_PATH "/dummy.txt", "w");
+                fclose(stream);
+                remove(STACK_PATH "/dummy.txt");
+                turtle_stack_create(&indexed, STACK_PATH, 0, NULL, NULL);
+                for (i = 0; i < 4; i++)
+                        ck_assert_str_eq(indexed->path[i], stack->path[i]);
+                turtle_stack_destroy(&indexed);
+
+                /* Check that tiles modified in place are checked again,
+                 * without modifying the directory
+                 */
+                ck_assert_int_eq(turtle_stack_index_dump(stack),
+                    TURTLE_RETURN_SUCCESS);
+                const char * backup = "tests/tile.bak";
+                ck_assert_int_eq(fetch_copy(".", stack->path[3], backup), 0);
+                ck_assert_int_eq(fetch_copy(".", backup, stack->path[3]), 0);
+                turtle_stack_create(&indexed, STACK_PATH, 0, NULL, NULL);
+                ck_assert_str_eq(indexed->path[3], stack->path[3]);
+                turtle_stack_destroy(&indexed);
+                ck_assert_int_eq(
+                    fetch_copy(".", stack->path[0], stack->path[3]), 0);
+                turtle_stack_create(&indexed, STACK_PATH, 0, NULL, NULL);
+                ck_assert_ptr_null(indexed->path[3]);
+                turtle_stack_destroy(&indexed);
+                ck_assert_int_eq(fetch_copy(".", backup, stack->path[3]), 0);
+                remove(backup);
+
+                /* Check a remote stack, cached locally */
+                ck_assert_int_eq(turtle_stack_index_dump(stack),
+                    TURTLE_RETURN_SUCCESS);
+                const char * cache = STACK_PATH "/cache";
+                mkdir(cache, 0755);
+                fetch_count = 0;
+                struct turtle_stack * remote;
+                ck_assert_int_eq(turtle_stack_create_remote(&remote, cache, 0,
+                                     &fetch_copy, STACK_PATH, NULL, NULL),
+                    TURTLE_RETURN_SUCCESS);
+                ck_assert_int_eq(fetch_count, 1);
+                ck_assert_int_eq(remote->latitude_n, stack->latitude_n);
+                turtle_stack_elevation(remote, 46.5, 3.5, &z, NULL);
+                ck_assert_double_eq(z, 0);
+                turtle_stack_elevation(remote, 46.6, 3.6, &z, NULL);
+                ck_assert_int_eq(fetch_count, 2);
+                ck_assert_ptr_nonnull(strstr(remote->path[3], cache));
+                ck_assert_int_eq(turtle_stack_preload(remote, 45., 47., 2.,
+                                     4., 2),
+                    TURTLE_RETURN_SUCCESS);
+                ck_assert_int_eq(fetch_count, 5);
+                turtle_stack_destroy(&remote);
+
+                /* Cached objects are not fetched again */
+                ck_assert_int_eq(turtle_stack_create_remote(&remote, cache, 0,
+                                     &fetch_copy, STACK_PATH, NULL, NULL),
+                    TURTLE_RETURN_SUCCESS);
+                turtle_stack_elevation(remote, 45.5, 2.5, &z, NULL);
+                ck_assert_int_eq(fetch_count, 5);
+                for (i = 0; i < 4; i++) remove(remote->path[i]);
+                turtle_stack_destroy(&remote);
+                char cached_index[256];
+                sprintf(cached_index, "%s/.turtle-index", cache);
+                remove(cached_index);
+                rmdir(cache);
+
+                /* Check a failing source */
+                turtle_error_handler_t * handler = turtle_error_handler_get();
+                turtle_error_handler_set(&catch_error);
+                ck_assert_int_eq(turtle_stack_create_remote(&remote, cache, 0,
+                                     &fetch_copy, STACK_PATH, NULL, NULL),
+                    TURTLE_RETURN_PATH_ERROR);
+                ck_assert_ptr_null(remote);
+                ck_assert_int_eq(turtle_stack_create_remote(&remote, cache, 0,
+                                     NULL, NULL, NULL, NULL),
+                    TURTLE_RETURN_BAD_ADDRESS);
+                turtle_error_handler_set(handler);
+                remove(index_path);
+        }
+
+        /* Check the normalisation of tiles */
+        ck_assert_int_eq(turtle_stack_normalise_get(stack), 0);
+        turtle_stack_normalise_set(stack, 1);
+        ck_assert_int_eq(turtle_stack_normalise_get(stack), 1);
+        turtle_stack_clear(stack);
+        turtle_stack_elevation(stack, 45.5, 2.5, &z, NULL);
+        ck_assert_double_eq(z, 0);
+        struct turtle_map * map = stack->tiles.head;
+        ck_assert_int_eq(map->meta.layout, TURTLE_MAP_LAYOUT_LINEAR);
+        turtle_stack_normalise_set(stack, 0);
+        ck_assert_int_eq(turtle_stack_normalise_get(stack), 0);
+
+        /* Check the blocked layout of tiles */
+        ck_assert_int_eq(turtle_stack_block_get(stack), 0);
+        turtle_stack_block_set(stack, 1);
+        ck_assert_int_eq(turtle_stack_block_get(stack), 1);
+        turtle_stack_clear(stack);
+        turtle_stack_elevation(stack, 45.5, 2.5, &z, NULL);
+        ck_assert_double_eq(z, 0);
+        map = stack->tiles.head;
+        ck_assert_int_eq(map->meta.layout, TURTLE_MAP_LAYOUT_LINEAR_BLOCKED);
+        {
+                turtle_error_handler_t * handler = turtle_error_handler_get();
+                turtle_error_handler_set(&catch_error);
+                ck_assert_int_eq(
+                    turtle_map_block(&map), TURTLE_RETURN_DOMAIN_ERROR);
+                ck_assert_int_eq(
+                    turtle_map_normalise(map), TURTLE_RETURN_DOMAIN_ERROR);
+                ck_assert_int_eq(
+                    turtle_map_normalise(NULL), TURTLE_RETURN_MEMORY_ERROR);
+                turtle_error_handler_set(handler);
+        }
+        turtle_stack_block_set(stack, 0);
+        ck_assert_int_eq(turtle_stack_block_get(stack), 0);
+
+        /* Check the sharing of tiles, with copy on write */
+        {
+                ck_assert_int_eq(turtle_stack_shared_get(stack), 0);
+                turtle_stack_shared_set(stack, 1);
+                ck_assert_int_eq(turtle_stack_shared_get(stack), 1);
+                turtle_stack_shared_unlink(stack);
+                turtle_stack_clear(stack);
+                turtle_stack_elevation(stack, 45.5, 2.5, &z, NULL);
+                map = stack->tiles.head;
+                ck_assert_ptr_nonnull(map->mapping);
+                ck_assert_int_eq(map->meta.layout, TURTLE_MAP_LAYOUT_LINEAR);
+                const uint16_t d0 = map->data[0];
+                map->data[0] = d0 + 1;
+
+                struct turtle_stack * other;
+                turtle_stack_create(&other, STACK_PATH, 0, NULL, NULL);
+                turtle_stack_shared_set(other, 1);
+                double z_other;
+                turtle_stack_elevation(other, 45.5, 2.5, &z_other, NULL);
+                ck_assert_double_eq(z_other, 0);
+                struct turtle_map * shared = other->tiles.head;
+                ck_assert_ptr_nonnull(shared->mapping);
+                ck_assert_ptr_ne(shared->data, map->data);
+                ck_assert_int_eq(shared->data[0], d0);
+                ck_assert_int_eq(shared->data_size, map->data_size);
+
+                /* Check the count of users of the segment, which is removed
+                 * once unused, when the stack is cleared
+                 */
+                ck_assert_ptr_nonnull(shared->segment);
+                ck_assert_int_eq(shared->segment->users, 2);
+                char name[32];
+                const char * tile = stack->path[map->index];
+                ck_assert_int_eq(turtle_map_segment_name_(tile, 0, name),
+                    EXIT_SUCCESS);
+                turtle_stack_destroy(&other);
+                ck_assert_int_eq(map->segment->users, 1);
+                int fd = shm_open(name, O_RDONLY, 0);
+                ck_assert_int_ge(fd, 0);
+                close(fd);
+                turtle_stack_clear(stack);
+                ck_assert_int_lt(shm_open(name, O_RDONLY, 0), 0);
+
+                /* Check that a segment left pending by a dead publisher is
+                 * taken over
+                 */
+                const pid_t child = fork();
+                if (child == 0) _exit(0);
+                waitpid(child, NULL, 0);
+                struct stat st;
+                stat(tile, &st);
+                fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+                ck_assert_int_ge(fd, 0);
+                struct turtle_map_segment header;
+                memset(&header, 0x0, sizeof(header));
+                strcpy(header.tag, TURTLE_MAP_SEGMENT_TAG);
+                strcpy(header.name, name);
+                header.owner = child;
+                header.size = st.st_size;
+                header.mtime = st.st_mtime;
+                ck_assert_int_eq(write(fd, &header, sizeof(header)),
+                    sizeof(header));
+                ck_assert_int_eq(ftruncate(fd, 4096), 0);
+                close(fd);
+                const unsigned long long t0 = turtle_stack_clock_();
+                turtle_stack_elevation(stack, 45.5, 2.5, &z, NULL);
+                ck_assert(turtle_stack_clock_() - t0 < 1000000000ULL);
+                map = stack->tiles.head;
+                ck_assert_ptr_nonnull(map->segment);
+                ck_assert_int_eq(map->segment->status, 1);
+                ck_assert_int_eq(map->segment->owner, getpid());
+                ck_assert_int_eq(map->segment->users, 1);
+
+                /* Check that an unused segment is kept for reuse, within
+                 * the stack capacity
+                 */
+                const long long inode = map->segment->inode;
+                turtle_map_destroy(&map);
+                ck_assert_int_eq(stack->released.size, 1);
+                fd = shm_open(name, O_RDONLY, 0);
+                ck_assert_int_ge(fd, 0);
+                close(fd);
+                turtle_stack_elevation(stack, 45.5, 2.5, &z, NULL);
+                map = stack->tiles.head;
+                ck_assert_int_eq(map->segment->inode, inode);
+                ck_assert_int_eq(map->segment->users, 1);
+                ck_assert_int_eq(stack->released.size, 0);
+
+                /* Check that a segment of a former version of the tile is
+                 * replaced
+                 */
+                turtle_stack_destroy(&other);
+                turtle_stack_create(&other, STACK_PATH, 0, NULL, NULL);
+                turtle_stack_shared_set(other, 1);
+                map->segment->mtime--;
+                turtle_stack_elevation(other, 45.5, 2.5, &z_other, NULL);
+                shared = other->tiles.head;
+                ck_assert_ptr_nonnull(shared->segment);
+                ck_assert(shared->segment->inode != map->segment->inode);
+                ck_assert_int_eq(shared->segment->users, 1);
+                ck_assert_int_eq(map->segment->users, 1);
+
+                turtle_stack_shared_unlink(other);
+                turtle_stack_destroy(&other);
+                turtle_stack_clear(stack);
+                ck_assert_int_lt(shm_open(name, O_RDONLY, 0), 0);
+                turtle_stack_shared_set(stack, 0);
+                ck_assert_int_eq(turtle_stack_shared_get(stack), 0);
+        }
+
+        /* Check the memory budget */
+        turtle_stack_destroy(&stack);
+        turtle_stack_create(&stack, STACK_PATH, 0, NULL, NULL);
+        ck_assert_int_eq(turtle_stack_budget_get(stack), 0);
+        turtle_stack_elevation(stack, 45.5, 2.5, &z, NULL);
+        const size_t tile_bytes = turtle_map_bytes_(stack->tiles.head);
+        ck_assert_int_eq(stack->bytes, tile_bytes);
+        turtle_stack_clear(stack);
+        ck_assert_int_eq(stack->bytes, 0);
+
+        turtle_stack_budget_set(stack, 2 * tile_bytes);
+        ck_assert_int_eq(turtle_stack_budget_get(stack), 2 * tile_bytes);
+        turtle_stack_load(stack);
+        ck_assert_int_eq(stack->tiles.size, 2);
+        ck_assert_int_eq(stack->bytes, 2 * tile_bytes);
+
+        /* Check that a preload is bounded by the budget left */
+        turtle_stack_clear(stack);
+        turtle_stack_elevation(stack, 45.5, 2.5, &z, NULL);
+        turtle_stack_stats_reset(stack);
+        struct turtle_stats stats;
+        ck_assert_int_eq(
+            turtle_stack_preload(stack, 45., 47., 2., 4., 4),
+            TURTLE_RETURN_SUCCESS);
+        ck_assert_int_eq(stack->tiles.size, 2);
+        ck_assert_int_eq(stack->bytes, 2 * tile_bytes);
+        ck_assert_ptr_nonnull(stack->grid[turtle_stack_index_(
+            stack, 45.5, 2.5)]);
+        turtle_stack_stats(stack, &stats);
+        ck_assert_int_eq(stats.evictions, 0);
+        ck_assert_int_eq(stats.truncations, 2);
+
+        int threads;
+        for (threads = 1; threads <= 4; threads += 3) {
+                /* Without any tile loaded, the budget is checked while
+                 * decoding
+                 */
+                turtle_stack_clear(stack);
+                turtle_stack_stats_reset(stack);
+                ck_assert_int_eq(
+                    turtle_stack_preload(stack, 45., 47., 2., 4., threads),
+                    TURTLE_RETURN_SUCCESS);
+                ck_assert_int_eq(stack->tiles.size, 2);
+                ck_assert(stack->bytes <= 2 * tile_bytes);
+                turtle_stack_stats(stack, &stats);
+                ck_assert_int_eq(stats.evictions, 0);
+                ck_assert_int_eq(stats.truncations, 2);
+        }
+
+        /* Check that a preload does not evict its own tiles, whatever the
+         * policy, while it evicts unused older ones
+         */
+        turtle_stack_destroy(&stack);
+        turtle_stack_create(&stack, STACK_PATH, 2, NULL, NULL);
+        turtle_stack_policy_set(stack, TURTLE_STACK_POLICY_LFU);
+        int i;
+        for (i = 0; i < 10; i++)
+                turtle_stack_elevation(stack, 46.5, 3.5, &z, NULL);
+        ck_assert_int_eq(
+            turtle_stack_preload(stack, 45., 45.9, 2., 4., 4),
+            TURTLE_RETURN_SUCCESS);
+        ck_assert_int_eq(stack->tiles.size, 2);
+        ck_assert_ptr_nonnull(
+            stack->grid[turtle_stack_index_(stack, 45.5, 2.5)]);
+        ck_assert_ptr_nonnull(
+            stack->grid[turtle_stack_index_(stack, 45.5, 3.5)]);
+        ck_assert_ptr_null(
+            stack->grid[turtle_stack_index_(stack, 46.5, 3.5)]);
+
+        /* Tiles in use by a client reduce the room left */
+        struct turtle_map * used =
+            stack->grid[turtle_stack_index_(stack, 45.5, 2.5)];
+        used->clients++; /* Emulate a client access */
+        turtle_stack_stats_reset(stack);
+        ck_assert_int_eq(
+            turtle_stack_preload(stack, 46., 46.9, 2., 4., 4),
+            TURTLE_RETURN_SUCCESS);
+        ck_assert_int_eq(stack->tiles.size, 2);
+        ck_assert_ptr_nonnull(
+            stack->grid[turtle_stack_index_(stack, 45.5, 2.5)]);
+        turtle_stack_stats(stack, &stats);
+        ck_assert_int_eq(stats.truncations, 1);
+        used->clients--;
+        turtle_stack_destroy(&stack);
+        turtle_stack_create(&stack, STACK_PATH, 0, NULL, NULL);
+        turtle_stack_budget_set(stack, 2 * tile_bytes);
+
+        /* Check the eviction policies */
+        const int index_a = turtle_stack_index_(stack, 45.5, 2.5);
+        const int index_b = turtle_stack_index_(stack, 46.5, 3.5);
+        const int index_c = turtle_stack_index_(stack, 45.5, 3.5);
+
+        ck_assert_int_eq(turtle_stack_policy_get(stack),
+            TURTLE_STACK_POLICY_LRU);
+        turtle_stack_clear(stack);
+        turtle_stack_elevation(stack, 45.5, 2.5, &z, NULL);
+        turtle_stack_elevation(stack, 46.5, 3.5, &z, NULL);
+        turtle_stack_elevation(stack, 45.5, 2.5, &z, NULL);
+        turtle_stack_elevation(stack, 45.5, 3.5, &z, NULL);
+        ck_assert_ptr_nonnull(stack->grid[index_a]);
+        ck_assert_ptr_null(stack->grid[index_b]);
+        ck_assert_ptr_nonnull(stack->grid[index_c]);
+
+        turtle_stack_policy_set(stack, TURTLE_STACK_POLICY_LFU);
+        ck_assert_int_eq(turtle_stack_policy_get(stack),
+            TURTLE_STACK_POLICY_LFU);
+        turtle_stack_clear(stack);
+        turtle_stack_elevation(stack, 46.5, 3.5, &z, NULL);
+        turtle_stack_elevation(stack, 45.5, 2.5, &z, NULL);
+        turtle_stack_elevation(stack, 46.5, 3.5, &z, NULL);
+        turtle_stack_elevation(stack, 46.5, 3.6, &z, NULL);
+        turtle_stack_elevation(stack, 45.5, 2.5, &z, NULL);
+        ck_assert_int_eq(stack->grid[index_a]->hits, 2);
+        ck_assert_int_eq(stack->grid[index_b]->hits, 2);
+        stack->grid[index_b]->hits++; /* Emulate a client access */
+        turtle_stack_elevation(stack, 45.5, 3.5, &z, NULL);
+        ck_assert_ptr_null(stack->grid[index_a]);
+        ck_assert_ptr_nonnull(stack->grid[index_b]);
+
+        turtle_stack_policy_set(stack, TURTLE_STACK_POLICY_DISTANCE);
+        turtle_stack_clear(stack);
+        turtle_stack_elevation(stack, 46.5, 3.5, &z, NULL);
+        turtle_stack_elevation(stack, 45.5, 2.5, &z, NULL);
+        turtle_stack_elevation(stack, 46.5, 3.5, &z, NULL);
+        turtle_stack_elevation(stack, 45.5, 3.5, &z, NULL);
+        ck_assert_ptr_nonnull(stack->grid[index_a]);
+        ck_assert_ptr_null(stack->grid[index_b]);
+        ck_assert_ptr_nonnull(stack->grid[index_c]);
+
+        /* Check the runtime statistics and the hook */
+        turtle_stack_destroy(&stack);
+        turtle_stack_create(&stack, STACK_PATH, 0, NULL, NULL);
+        struct hook_counter hooks = { { 0, 0 }, 1 };
+        turtle_stack_hook_set(stack, &count_events, &hooks);
+        turtle_stack_elevation(stack, 45.5, 2.5, &z, NULL);
+        turtle_stack_elevation(stack, 45.6, 2.6, &z, NULL);
+        turtle_stack_elevation(stack, 46.5, 3.5, &z, NULL);
+        turtle_stack_elevation(stack, 45.5, 2.5, &z, NULL);
+        turtle_stack_clear(stack);
+        ck_assert_int_eq(hooks.events[TURTLE_STACK_EVENT_LOAD], 2);
+        ck_assert_int_eq(hooks.events[TURTLE_STACK_EVENT_EVICT], 2);
+        ck_assert_int_eq(hooks.paths, 1);
+
+        turtle_stack_stats(stack, &stats);
+        ck_assert_int_eq(stats.head_hits, 1);
+        ck_assert_int_eq(stats.grid_hits, 1);
+        ck_assert_int_eq(stats.misses, 2);
+        ck_assert_int_eq(stats.loads, 2);
+        ck_assert_int_eq(stats.load_bytes, 2 * tile_bytes);
+        ck_assert(stats.load_time > 0.);
+        ck_assert_int_eq(stats.evictions, 2);
+        ck_assert_int_eq(stats.locks, 0);
+        turtle_stack_stats_reset(stack);
+        turtle_stack_stats(stack, &stats);
+        ck_assert_int_eq(stats.loads, 0);
+        ck_assert_int_eq(stats.evictions, 0);
+
+        turtle_stack_hook_set(stack, NULL, NULL);
+        turtle_stack_elevation(stack, 45.5, 2.5, &z, NULL);
+        ck_assert_int_eq(hooks.events[TURTLE_STACK_EVENT_LOAD], 2);
+
         /* Clean the memory */
         turtle_stack_destroy(&stack);
 }
@@ -693,6 +1711,33 @@ END_TEST
 /* Dummy lock / unlock emulation */
 static int nothing(void) { return 0; }
 
+/* Lock / unlock emulation with a context, counting the calls */
+struct lock_counter {
+        int exclusive;
+        int shared;
+};
+
+static int count_exclusive(void * context)
+{
+        ((struct lock_counter *)context)->exclusive++;
+        return 0;
+}
+
+static int count_shared(void * context)
+{
+        ((struct lock_counter *)context)->shared++;
+        return 0;
+}
+
+#ifndef TURTLE_NO_PTHREAD
+/* Actual lock / unlock, for concurrent accesses */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int mutex_lock(void) { return pthread_mutex_lock(&mutex); }
+
+static int mutex_unlock(void) { return pthread_mutex_unlock(&mutex); }
+#endif
+
 
 START_TEST (test_client)
 {
@@ -725,6 +1770,114 @@ START_TEST (test_client)
         turtle_client_elevation(client, 46.5, 2.5, &z, NULL);
         ck_assert_double_eq(z, 0);
 
+        /* Check the gradient */
+        double glat = 1., glon = 1.;
+        turtle_client_gradient(client, 46.5, 2.5, &glat, &glon, NULL);
+        ck_assert_double_eq(glat, 0.);
+        ck_assert_double_eq(glon, 0.);
+        z = glat = glon = 1.;
+        turtle_client_elevation_gradient(
+            client, 45.5, 3.5, &z, &glat, &glon, NULL);
+        ck_assert_double_eq(z, 0.);
+        ck_assert_double_eq(glat, 0.);
+        ck_assert_double_eq(glon, 0.);
+        turtle_client_elevation_gradient(
+            client, 45.5, 4.5, &z, &glat, &glon, &inside);
+        ck_assert_int_eq(inside, 0);
+
+        /* Check the error handlers of the calling thread. Quiet errors do
+         * not reach the library handler, which would exit
+         */
+        ck_assert_ptr_eq(
+            turtle_error_thread_handler_get(), turtle_error_handler_get());
+        turtle_error_thread_handler_set(NULL);
+        ck_assert_ptr_null(turtle_error_thread_handler_get());
+        error_buffer[0] = 0x0;
+        ck_assert_int_eq(turtle_client_elevation(client, 45.5, 4.5, &z, NULL),
+            TURTLE_RETURN_PATH_ERROR);
+        ck_assert_int_eq(turtle_client_elevation(client, 45.5, 4.5, &z, NULL),
+            TURTLE_RETURN_PATH_ERROR);
+        ck_assert_str_eq(error_buffer, "");
+        turtle_error_thread_handler_set(&catch_error);
+        ck_assert_int_eq(turtle_client_elevation(client, 45.5, 4.5, &z, NULL),
+            TURTLE_RETURN_PATH_ERROR);
+        ck_assert_ptr_nonnull(strstr(error_buffer, "missing elevation data"));
+        turtle_error_thread_handler_clear();
+        ck_assert_ptr_eq(
+            turtle_error_thread_handler_get(), turtle_error_handler_get());
+
+        /* Check the batched elevation */
+        {
+                const double latitude[5] = { 45.5, 45.6, 45.5, 46.5, 46.6 };
+                const double longitude[5] = { 2.5, 2.6, 4.5, 3.5, 3.6 };
+                double zv[5];
+                int iv[5];
+                turtle_client_elevation_v(
+                    client, 5, latitude, longitude, zv, iv);
+                int i;
+                for (i = 0; i < 5; i++) {
+                        ck_assert_int_eq(iv[i], (i == 2) ? 0 : 1);
+                        ck_assert_double_eq(zv[i], 0);
+                }
+                ck_assert_ptr_nonnull(client->map);
+        }
+
+        /* Check the batch of unordered locations. Each tile is loaded once,
+         * although the stack holds a single tile
+         */
+        turtle_client_destroy(&client);
+        turtle_stack_destroy(&stack);
+        turtle_stack_create(&stack, STACK_PATH, 1, &nothing, &nothing);
+        turtle_client_create(&client, stack);
+        {
+                double latitude[41], longitude[41], zv[41];
+                int i, iv[41];
+                for (i = 0; i < 40; i++) {
+                        latitude[i] = (i % 2) ? 46.5 : 45.5 + 0.01 * i;
+                        longitude[i] = (i % 2) ? 3.5 - 0.01 * i : 2.5;
+                        zv[i] = 1.;
+                }
+                latitude[40] = 45.5;
+                longitude[40] = 4.5;
+                ck_assert_int_eq(turtle_client_elevation_batch(client, 41,
+                                     latitude, longitude, zv, iv, 1),
+                    TURTLE_RETURN_SUCCESS);
+                for (i = 0; i < 41; i++) {
+                        ck_assert_int_eq(iv[i], (i == 40) ? 0 : 1);
+                        ck_assert_double_eq(zv[i], 0.);
+                }
+                struct turtle_stats stats;
+                turtle_client_stats(client, &stats);
+                ck_assert_int_eq(stats.loads, 2);
+
+                turtle_error_handler_t * handler = turtle_error_handler_get();
+                turtle_error_handler_set(&catch_error);
+                ck_assert_int_eq(turtle_client_elevation_batch(client, 41,
+                                     latitude, longitude, zv, NULL, 1),
+                    TURTLE_RETURN_PATH_ERROR);
+                turtle_error_handler_set(handler);
+
+#ifndef TURTLE_NO_PTHREAD
+                struct turtle_stack * shared;
+                struct turtle_client * master;
+                turtle_stack_create(
+                    &shared, STACK_PATH, 1, &mutex_lock, &mutex_unlock);
+                turtle_client_create(&master, shared);
+                ck_assert_int_eq(turtle_client_elevation_batch(master, 41,
+                                     latitude, longitude, zv, iv, 3),
+                    TURTLE_RETURN_SUCCESS);
+                for (i = 0; i < 41; i++)
+                        ck_assert_int_eq(iv[i], (i == 40) ? 0 : 1);
+                turtle_client_stats(master, &stats);
+                ck_assert_int_eq(stats.loads, 2);
+                turtle_client_destroy(&master);
+                ck_assert_int_eq(shared->tiles.size, 1);
+                struct turtle_map * head = shared->tiles.head;
+                ck_assert_int_eq(head->clients, 0);
+                turtle_stack_destroy(&shared);
+#endif
+        }
+
         /* Check the clear function */
         turtle_client_clear(client);
         turtle_client_elevation(client, 45.5, 3.5, &z, NULL);
@@ -734,6 +1887,133 @@ START_TEST (test_client)
         turtle_client_destroy(&client);
         turtle_stack_destroy(&stack);
 
+        /* Check the shared access to already loaded maps */
+        struct lock_counter counter = { 0, 0 };
+        turtle_stack_create(&stack, STACK_PATH, 0, NULL, NULL);
+        ck_assert_int_eq(turtle_stack_lock_set(stack, &count_exclusive,
+                             &count_exclusive, &count_shared, &count_shared,
+                             &counter),
+            TURTLE_RETURN_SUCCESS);
+        turtle_client_create(&client, stack);
+        struct turtle_client * other;
+        turtle_client_create(&other, stack);
+
+        /* The exclusive lock is released while the tile is read */
+        turtle_client_elevation(client, 45.5, 3.5, &z, NULL);
+        ck_assert_double_eq(z, 0);
+        ck_assert_int_eq(counter.exclusive, 4);
+        ck_assert_int_eq(counter.shared, 2);
+        struct turtle_map * map = stack->tiles.head;
+        ck_assert_int_eq(map->clients, 1);
+
+        counter.exclusive = counter.shared = 0;
+        turtle_client_elevation(other, 45.5, 3.5, &z, NULL);
+        ck_assert_double_eq(z, 0);
+        ck_assert_int_eq(counter.exclusive, 0);
+        ck_assert_int_eq(counter.shared, 2);
+        ck_assert_int_eq(map->clients, 2);
+
+        struct turtle_stats stats;
+        turtle_client_stats(client, &stats);
+        ck_assert_int_eq(stats.misses, 1);
+        ck_assert_int_eq(stats.loads, 1);
+        ck_assert_int_eq(stats.locks, 3);
+        turtle_client_stats(other, &stats);
+        ck_assert_int_eq(stats.misses, 0);
+        ck_assert_int_eq(stats.grid_hits, 1);
+        ck_assert_int_eq(stats.locks, 1);
+        turtle_stack_stats(stack, &stats);
+        ck_assert_int_eq(stats.loads, 1);
+        ck_assert_int_eq(stats.locks, 4);
+        turtle_client_stats_reset(other);
+        turtle_client_stats(other, &stats);
+        ck_assert_int_eq(stats.grid_hits, 0);
+
+        turtle_client_elevation(client, 46.5, 3.5, &z, NULL);
+        turtle_client_elevation(other, 46.5, 3.5, &z, NULL);
+        ck_assert_int_eq(stack->tiles.size, 2);
+        ck_assert_int_eq(map->clients, 0);
+        ck_assert_ptr_ne(stack->tiles.head, map);
+        map = stack->tiles.head;
+        ck_assert_int_eq(map->clients, 2);
+
+        turtle_client_destroy(&other);
+        turtle_client_destroy(&client);
+        ck_assert_int_eq(map->clients, 0);
+        turtle_stack_destroy(&stack);
+
+        /* Check the working set of pinned tiles, across a tile edge */
+        counter.exclusive = counter.shared = 0;
+        turtle_stack_create(&stack, STACK_PATH, 0, NULL, NULL);
+        turtle_stack_lock_set(stack, &count_exclusive, &count_exclusive,
+            &count_shared, &count_shared, &counter);
+        turtle_client_create(&client, stack);
+        ck_assert_int_eq(turtle_client_tiles_get(client), 1);
+        ck_assert_int_eq(turtle_client_tiles_set(client, 4),
+            TURTLE_RETURN_SUCCESS);
+        ck_assert_int_eq(turtle_client_tiles_get(client), 4);
+        turtle_client_elevation(client, 45.5, 2.5, &z, NULL);
+        map = stack->tiles.head;
+        turtle_client_elevation(client, 45.5, 3.5, &z, NULL);
+        ck_assert_int_eq(stack->tiles.size, 2);
+        struct turtle_map * head = stack->tiles.head;
+        ck_assert_ptr_ne(head, map);
+        ck_assert_int_eq(map->clients, 1);
+        ck_assert_int_eq(head->clients, 1);
+
+        counter.exclusive = counter.shared = 0;
+        turtle_client_stats_reset(client);
+        int i;
+        for (i = 0; i < 10; i++) {
+                turtle_client_elevation(client, 45.5, 2.9, &z, NULL);
+                turtle_client_elevation(client, 45.5, 3.1, &z, NULL);
+        }
+        ck_assert_int_eq(counter.exclusive, 0);
+        ck_assert_int_eq(counter.shared, 0);
+        turtle_client_stats(client, &stats);
+        ck_assert_int_eq(stats.set_hits, 20);
+        ck_assert_int_eq(stats.locks, 0);
+
+        {
+                turtle_error_handler_t * handler = turtle_error_handler_get();
+                turtle_error_handler_set(&catch_error);
+                ck_assert_int_eq(turtle_client_tiles_set(client, 0),
+                    TURTLE_RETURN_DOMAIN_ERROR);
+                ck_assert_int_eq(turtle_client_tiles_set(client, 17),
+                    TURTLE_RETURN_DOMAIN_ERROR);
+                turtle_error_handler_set(handler);
+        }
+
+        /* Shrinking the set releases the least recently used tiles */
+        ck_assert_int_eq(turtle_client_tiles_set(client, 1),
+            TURTLE_RETURN_SUCCESS);
+        ck_assert_int_eq(map->clients, 0);
+        ck_assert_int_eq(head->clients, 1);
+        turtle_client_destroy(&client);
+        ck_assert_int_eq(head->clients, 0);
+        turtle_stack_destroy(&stack);
+
+#ifndef TURTLE_NO_PTHREAD
+        /* Check the background loading of prefetched tiles */
+        turtle_stack_create(&stack, STACK_PATH, 0, &nothing, &nothing);
+        ck_assert_int_eq(turtle_stack_prefetch_async_set(stack, 1),
+            TURTLE_RETURN_SUCCESS);
+        ck_assert_int_eq(turtle_stack_prefetch_async_get(stack), 1);
+        double position[3];
+        turtle_ecef_from_geodetic(45.5, 2.5, 0., position);
+        turtle_stack_prefetch(stack, position, NULL, 1E+05);
+        turtle_stack_prefetch_async_set(stack, 0);
+        ck_assert_int_eq(turtle_stack_prefetch_async_get(stack), 0);
+        ck_assert_int_eq(stack->tiles.size, 4);
+        turtle_client_create(&client, stack);
+        turtle_client_elevation(client, 46.5, 3.5, &z, NULL);
+        ck_assert_double_eq(z, 0);
+        ck_assert_int_eq(stack->tiles.size, 4);
+        turtle_client_destroy(&client);
+        turtle_stack_prefetch_async_set(stack, 1);
+        turtle_stack_destroy(&stack);
+#endif
+
         /* Catch errors and try some false cases */
         turtle_error_handler_t * handler = turtle_error_handler_get();
         turtle_error_handler_set(&catch_error);
@@ -757,6 +2037,19 @@ START_TEST (test_client)
         regfree(&regex);
         turtle_stack_destroy(&stack);
 
+        turtle_stack_create(&stack, STACK_PATH, 0, NULL, NULL);
+        rc = turtle_stack_lock_set(
+            stack, &count_exclusive, NULL, NULL, NULL, &counter);
+        ck_assert_int_eq(rc, TURTLE_RETURN_BAD_ADDRESS);
+        rc = turtle_stack_lock_set(
+            stack, NULL, NULL, &count_shared, &count_shared, &counter);
+        ck_assert_int_eq(rc, TURTLE_RETURN_BAD_ADDRESS);
+#ifndef TURTLE_NO_PTHREAD
+        rc = turtle_stack_prefetch_async_set(stack, 1);
+        ck_assert_int_eq(rc, TURTLE_RETURN_BAD_ADDRESS);
+#endif
+        turtle_stack_destroy(&stack);
+
         turtle_stack_create(&stack, STACK_PATH, 1, &nothing, &nothing);
         turtle_client_create(&client, stack);
         rc = turtle_client_elevation(client, 45.5, 4.5, &z, NULL);
@@ -810,36 +2103,39 @@ START_TEST (test_stepper)
                 const double azimuth = 0, elevation = 0;
                 const double height = -0.5, altitude_max = 1.5E+03;
                 double position[3], direction[3];
-                int layer;
+                int layer[2];
                 turtle_stepper_position(
-                    stepper, latitude, longitude, height, 0, position, &layer);
+                    stepper, latitude, longitude, height, 0, position, layer);
                 turtle_ecef_from_horizontal(
                     latitude, longitude, azimuth, elevation, direction);
 
                 /* Do some dummy stepping */
                 for (;;) {
                         /* Update the step data */
-                        double altitude, ground_elevation, la, lo;
+                        double altitude, ground_elevation[2], la, lo;
                         turtle_stepper_step(stepper, position, NULL, &la, &lo,
-                            &altitude, &ground_elevation, NULL, &layer);
+                            &altitude, ground_elevation, NULL, layer);
                         if (altitude >= altitude_max) break;
 
-                        double altitude1, ground_elevation1, la1, lo1;
+                        double altitude1, ground_elevation1[2], la1, lo1;
                         double step_length;
-                        int layer1;
+                        int layer1[2];
                         turtle_stepper_step(stepper, position, NULL, &la1, &lo1,
-                            &altitude1, &ground_elevation1, &step_length,
-                            &layer1);
+                            &altitude1, ground_elevation1, &step_length,
+                            layer1);
                         ck_assert_double_eq(altitude1, altitude);
                         ck_assert_double_eq(
-                            ground_elevation1, ground_elevation);
+                            ground_elevation1[0], ground_elevation[0]);
+                        ck_assert_double_eq(
+                            ground_elevation1[1], ground_elevation[1]);
                         ck_assert_double_eq(la1, la);
                         ck_assert_double_eq(lo1, lo);
-                        ck_assert_double_eq(layer1, layer);
+                        ck_assert_int_eq(layer1[0], layer[0]);
+                        ck_assert_int_eq(layer1[1], layer[1]);
 
                         /* Update the position */
                         turtle_stepper_step(stepper, position, direction, &la,
-                            &lo, &altitude, &ground_elevation, NULL, &layer);
+                            &lo, &altitude, ground_elevation, NULL, layer);
                         if (altitude >= altitude_max) break;
                 }
         }
@@ -872,16 +2168,155 @@ START_TEST (test_stepper)
         /* Step out of the map */
         const int nmax = 100000;
         for (i = 0; i < nmax; i++) {
-                double altitude, ground_elevation, la, lo;
+                double altitude, ground_elevation[2], la, lo;
                 double step_length;
                 int index[2];
 
                 turtle_stepper_step(stepper, position, direction, &la,
-                    &lo, &altitude, &ground_elevation, &step_length, index);
+                    &lo, &altitude, ground_elevation, &step_length, index);
                 if (index[0] < 0) break;
         }
         ck_assert_int_lt(i, nmax);
 
+        /* Check the batch stepping against particles stepped alone, with
+         * local transforms
+         */
+        turtle_stepper_range_set(stepper, 1.);
+        double position_n[9], direction_n[9];
+        {
+                struct turtle_stepper * alone[3];
+                struct turtle_stepper_state * states[3];
+                for (i = 0; i < 3; i++) {
+                        turtle_stepper_clone(alone + i, stepper);
+                        turtle_stepper_state_create(states + i);
+                        turtle_stepper_position(stepper, latitude + 0.1 * i,
+                            longitude, height, 0, position_n + 3 * i, &layer);
+                        turtle_ecef_from_horizontal(latitude + 0.1 * i,
+                            longitude, 120. * i, 30. * (i - 1),
+                            direction_n + 3 * i);
+                }
+                double position_1[9];
+                memcpy(position_1, position_n, sizeof(position_1));
+                turtle_stepper_stats_reset(stepper);
+                int k;
+                for (k = 0; k < 10; k++) {
+                        double altitude_n[3], elevation_n[6], step_n[3];
+                        int index_n[6];
+                        ck_assert_int_eq(turtle_stepper_step_n(stepper, 3,
+                                             states, position_n, direction_n,
+                                             NULL, NULL, altitude_n,
+                                             elevation_n, step_n, index_n),
+                            TURTLE_RETURN_SUCCESS);
+                        for (i = 0; i < 3; i++) {
+                                double altitude, ground_elevation[2];
+                                double step_length;
+                                int index[2];
+                                turtle_stepper_step(alone[i],
+                                    position_1 + 3 * i, direction_n + 3 * i,
+                                    NULL, NULL, &altitude, ground_elevation,
+                                    &step_length, index);
+                                int j;
+                                for (j = 0; j < 3; j++) {
+                                        ck_assert_double_eq(
+                                            position_n[3 * i + j],
+                                            position_1[3 * i + j]);
+                                }
+                                ck_assert_double_eq(altitude_n[i], altitude);
+                                ck_assert_double_eq(elevation_n[2 * i],
+                                    ground_elevation[0]);
+                                ck_assert_double_eq(elevation_n[2 * i + 1],
+                                    ground_elevation[1]);
+                                ck_assert_double_eq(step_n[i], step_length);
+                                ck_assert_int_eq(index_n[2 * i], index[0]);
+                                ck_assert_int_eq(
+                                    index_n[2 * i + 1], index[1]);
+                        }
+                }
+
+                /* Local transforms are rebuilt as for lone particles */
+                struct turtle_stepper_stats stats, stats_a;
+                turtle_stepper_stats(stepper, &stats);
+                unsigned long rebuilds = 0;
+                for (i = 0; i < 3; i++) {
+                        turtle_stepper_stats(alone[i], &stats_a);
+                        rebuilds += stats_a.transform_rebuilds;
+                        turtle_stepper_destroy(alone + i);
+                        turtle_stepper_state_destroy(states + i);
+                }
+                ck_assert_int_eq(stats.transform_rebuilds, rebuilds);
+
+                /* States are mandatory */
+                turtle_error_handler_t * handler = turtle_error_handler_get();
+                turtle_error_handler_set(&catch_error);
+                ck_assert_int_eq(turtle_stepper_step_n(stepper, 3, NULL,
+                                     position_n, direction_n, NULL, NULL,
+                                     NULL, NULL, NULL, NULL),
+                    TURTLE_RETURN_BAD_ADDRESS);
+                turtle_error_handler_set(handler);
+        }
+
+        /* Check that interleaved particles with their own stepping states
+         * behave as if they were stepped alone
+         */
+        turtle_stepper_range_set(stepper, 1.);
+        {
+                struct turtle_stepper * alone[2];
+                struct turtle_stepper_state * state[2];
+                double position_a[6], position_s[6];
+                for (i = 0; i < 2; i++) {
+                        turtle_stepper_clone(alone + i, stepper);
+                        ck_assert_int_eq(turtle_stepper_state_create(
+                                             state + i),
+                            TURTLE_RETURN_SUCCESS);
+                        turtle_stepper_position(stepper, latitude + 0.1 * i,
+                            longitude, height, 0, position_a + 3 * i, &layer);
+                        turtle_ecef_from_horizontal(latitude + 0.1 * i,
+                            longitude, 90. * i, 1., direction_n + 3 * i);
+                }
+                memcpy(position_s, position_a, sizeof(position_s));
+                turtle_stepper_stats_reset(stepper);
+                int k;
+                for (k = 0; k < 20; k++) {
+                        for (i = 0; i < 2; i++) {
+                                double altitude_a, altitude_s;
+                                turtle_stepper_step(alone[i],
+                                    position_a + 3 * i, direction_n + 3 * i,
+                                    NULL, NULL, &altitude_a, NULL, NULL,
+                                    NULL);
+                                ck_assert_int_eq(
+                                    turtle_stepper_step_state(stepper,
+                                        state[i], position_s + 3 * i,
+                                        direction_n + 3 * i, NULL, NULL,
+                                        &altitude_s, NULL, NULL, NULL),
+                                    TURTLE_RETURN_SUCCESS);
+                                ck_assert_double_eq(altitude_s, altitude_a);
+                        }
+                }
+                for (i = 0; i < 6; i++)
+                        ck_assert_double_eq(position_s[i], position_a[i]);
+
+                struct turtle_stepper_stats stats, stats_a;
+                turtle_stepper_stats(stepper, &stats);
+                unsigned long rebuilds = 0;
+                for (i = 0; i < 2; i++) {
+                        turtle_stepper_stats(alone[i], &stats_a);
+                        rebuilds += stats_a.transform_rebuilds;
+                        turtle_stepper_destroy(alone + i);
+                }
+                ck_assert_int_eq(stats.transform_rebuilds, rebuilds);
+                ck_assert(stats.transform_hits > 0);
+
+                /* A state is reset with the stepper history */
+                turtle_stepper_reset(stepper);
+                ck_assert_int_ne(state[0]->generation, stepper->generation);
+                turtle_stepper_step_state(stepper, state[0], position_s,
+                    NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+                ck_assert_int_eq(state[0]->generation, stepper->generation);
+                turtle_stepper_state_destroy(state);
+                turtle_stepper_state_destroy(state + 1);
+                ck_assert_ptr_null(state[0]);
+        }
+
         /* Check other geometries */
         turtle_stepper_destroy(&stepper);
         turtle_stepper_create(&stepper);
@@ -912,6 +2347,41 @@ START_TEST (test_stepper)
         ck_assert_int_eq(index[0], 0);
         ck_assert_int_eq(index[1], 0);
 
+        /* Check the runtime statistics */
+        struct turtle_stepper_stats stats;
+        turtle_stepper_stats_reset(stepper);
+        turtle_stepper_step(stepper, position, NULL, &la, &lo, &altitude,
+            ground_elevation, NULL, index);
+        turtle_stepper_stats(stepper, &stats);
+        ck_assert_int_eq(stats.samples, 1);
+        ck_assert_int_eq(stats.repeats, 1);
+        ck_assert_int_eq(stats.evaluations, 0);
+        turtle_stepper_reset(stepper);
+        turtle_stepper_step(stepper, position, NULL, &la, &lo, &altitude,
+            ground_elevation, NULL, index);
+        turtle_stepper_stats(stepper, &stats);
+        ck_assert_int_eq(stats.samples, 2);
+        ck_assert_int_eq(stats.evaluations, 1);
+        ck_assert_int_eq(stats.computations + stats.transform_hits, 1);
+        ck_assert_int_eq(stats.crossings, 0);
+
+        double start[3];
+        memcpy(start, position, sizeof(start));
+        turtle_ecef_from_horizontal(latitude, longitude, 0, -90, direction);
+        for (i = 0; i < 100; i++) {
+                turtle_stepper_step(stepper, position, direction, NULL, NULL,
+                    &altitude, ground_elevation, NULL, index);
+                if (index[0] != 0) break;
+        }
+        turtle_stepper_stats(stepper, &stats);
+        ck_assert_int_eq(stats.crossings, 1);
+        ck_assert(stats.bisections > 0);
+        ck_assert(stats.transform_rebuilds > 0);
+        turtle_stepper_stats_reset(stepper);
+        turtle_stepper_stats(stepper, &stats);
+        ck_assert_int_eq(stats.samples, 0);
+        memcpy(position, start, sizeof(start));
+
         turtle_stepper_destroy(&stepper);
         turtle_stepper_create(&stepper);
         turtle_stepper_add_stack(stepper, stack, 0.);
@@ -973,8 +2443,243 @@ START_TEST (test_stepper)
         ck_assert_int_eq(index[0], 0);
         ck_assert_int_eq(index[1], 0);
 
+        /* Check a clone of the stepper */
+        struct turtle_stepper * clone;
+        turtle_stepper_clone(&clone, stepper);
+        ck_assert_int_eq(clone->layers.size, 0);
+        ck_assert_int_eq(clone->data.size, stepper->data.size);
+        ck_assert_ptr_eq(clone->parent, stepper);
+        ck_assert_int_eq(stepper->clones, 1);
+        struct turtle_stepper_data * data = clone->data.head;
+        struct turtle_stepper_data * data0 = stepper->data.head;
+        ck_assert_ptr_ne(data->a.client, data0->a.client);
+        ck_assert_ptr_eq(data->a.client->stack, stack);
+        ck_assert_ptr_ne(data->transform, data0->transform);
+        ck_assert_double_eq(turtle_stepper_range_get(clone), 100);
+
+        turtle_stepper_reset(stepper);
+        turtle_stepper_step(stepper, position, NULL, &la, &lo, &altitude,
+            ground_elevation, NULL, index);
+        turtle_stepper_step(clone, position, NULL, &la1, &lo1, &altitude1,
+            ground_elevation1, NULL, index1);
+        ck_assert_double_eq(altitude1, altitude);
+        ck_assert_double_eq(ground_elevation1[0], ground_elevation[0]);
+        ck_assert_double_eq(ground_elevation1[1], ground_elevation[1]);
+        ck_assert_double_eq(la1, la);
+        ck_assert_double_eq(lo1, lo);
+        ck_assert_int_eq(index1[0], index[0]);
+        ck_assert_int_eq(index1[1], index[1]);
+
+        turtle_error_handler_t * handler = turtle_error_handler_get();
+        turtle_error_handler_set(&catch_error);
+        ck_assert_int_eq(turtle_stepper_add_flat(clone, 0.),
+            TURTLE_RETURN_BAD_ADDRESS);
+        ck_assert_int_eq(turtle_stepper_add_flat(stepper, 0.),
+            TURTLE_RETURN_BAD_ADDRESS);
+        ck_assert_int_eq(turtle_stepper_destroy(&stepper),
+            TURTLE_RETURN_BAD_ADDRESS);
+        ck_assert_ptr_nonnull(stepper);
+        turtle_error_handler_set(handler);
+
+        struct turtle_stepper * clone1;
+        turtle_stepper_clone(&clone1, clone);
+        ck_assert_ptr_eq(clone1->parent, stepper);
+        ck_assert_int_eq(stepper->clones, 2);
+        turtle_stepper_destroy(&clone1);
+        turtle_stepper_destroy(&clone);
+        ck_assert_ptr_null(clone);
+        ck_assert_int_eq(stepper->clones, 0);
+        ck_assert_int_eq(turtle_stepper_add_flat(stepper, 0.),
+            TURTLE_RETURN_SUCCESS);
+
+        /* Check the cached geoid undulations against the map ones */
+        {
+                struct turtle_map * wavy;
+                struct turtle_map_info info = { 361, 181, { 0., 360. },
+                        { -90., 90. }, { -100., 100. } };
+                turtle_map_create(&wavy, &info, NULL);
+                for (i = 0; i < 361; i++) {
+                        int j;
+                        for (j = 0; j < 181; j++) {
+                                turtle_map_fill(wavy, i, j, 80. *
+                                    sin(0.1 * i) * cos(0.13 * j));
+                        }
+                }
+                turtle_stepper_destroy(&stepper);
+                turtle_stepper_create(&stepper);
+                turtle_stepper_add_flat(stepper, 0.);
+                turtle_stepper_geoid_set(stepper, wavy);
+                turtle_stepper_range_set(stepper, 0.);
+                for (i = 0; i < 50; i++) {
+                        const double la = -60. + 2.4 * i;
+                        const double lo = -170. + 6.9 * i;
+                        const double h = 100. * (i % 7);
+                        const double x = (lo >= 0.) ? lo : lo + 360.;
+                        double undulation;
+                        turtle_map_elevation(wavy, x, la, &undulation, NULL);
+
+                        turtle_stepper_position(
+                            stepper, la, lo, h, 0, position, &layer);
+                        double altitude0;
+                        turtle_ecef_to_geodetic(
+                            position, NULL, NULL, &altitude0);
+                        ck_assert_double_eq_tol(
+                            altitude0, h + undulation, 1E-06);
+
+                        turtle_stepper_step(stepper, position, NULL, NULL,
+                            NULL, &altitude, NULL, NULL, NULL);
+                        ck_assert_double_eq_tol(
+                            altitude, altitude0 - undulation, 1E-06);
+                }
+
+                /* Check that a refill of the geoid invalidates the cache */
+                double altitude0, undulation;
+                turtle_stepper_position(
+                    stepper, 10.5, 20.5, 0., 0, position, &layer);
+                turtle_map_fill(wavy, 20, 100, 50.);
+                turtle_map_fill(wavy, 21, 100, 50.);
+                turtle_map_fill(wavy, 20, 101, 50.);
+                turtle_map_fill(wavy, 21, 101, 50.);
+                turtle_stepper_position(
+                    stepper, 10.5, 20.5, 0., 0, position, &layer);
+                turtle_ecef_to_geodetic(position, NULL, NULL, &altitude0);
+                turtle_map_elevation(wavy, 20.5, 10.5, &undulation, NULL);
+                ck_assert_double_eq_tol(undulation, 50., 1E-02);
+                ck_assert_double_eq_tol(altitude0, undulation, 1E-06);
+                turtle_map_destroy(&wavy);
+        }
+
+        /* Check the skipping of empty space, over a bump and over stack
+         * data. The crossings must not be altered
+         */
+        struct turtle_map * bump;
+        struct turtle_map_info bump_info = { 201, 201, { 2., 3. },
+                { 45., 46. }, { 0., 2000. } };
+        turtle_map_create(&bump, &bump_info, NULL);
+        for (i = 0; i < 201; i++) {
+                int j;
+                for (j = 0; j < 201; j++) {
+                        const double r2 = ((i - 100) * (i - 100) +
+                            (j - 100) * (j - 100)) / 400.;
+                        turtle_map_fill(bump, i, j, 1500. * exp(-r2));
+                }
+        }
+        double crossing[2][3];
+        unsigned long samples[2], skips[2];
+        int k;
+        for (k = 0; k < 4; k++) {
+                turtle_stepper_destroy(&stepper);
+                turtle_stepper_create(&stepper);
+                if (k < 2) {
+                        turtle_stepper_add_map(stepper, bump, 0.);
+                } else {
+                        turtle_stack_destroy(&stack);
+                        turtle_stack_create(
+                            &stack, STACK_PATH, 1, &nothing, &nothing);
+                        turtle_stepper_add_stack(stepper, stack, 0.);
+                }
+                ck_assert_int_eq(turtle_stepper_pyramid_get(stepper), 0);
+                ck_assert_int_eq(turtle_stepper_pyramid_set(stepper, k % 2),
+                    TURTLE_RETURN_SUCCESS);
+                ck_assert_int_eq(turtle_stepper_pyramid_get(stepper), k % 2);
+                if (k == 1) ck_assert_ptr_nonnull(bump->pyramid);
+
+                turtle_stepper_position(
+                    stepper, 45.5, 2.45, 5000., 0, position, &layer);
+                turtle_ecef_from_horizontal(45.5, 2.45, 90., -30., direction);
+                for (i = 0; i < 100000; i++) {
+                        turtle_stepper_step(stepper, position, direction, NULL,
+                            NULL, &altitude, ground_elevation, NULL, index);
+                        if (index[0] != 1) break;
+                }
+                ck_assert_int_eq(index[0], 0);
+                turtle_stepper_stats(stepper, &stats);
+                samples[k % 2] = stats.samples;
+                skips[k % 2] = stats.skips;
+                memcpy(crossing[k % 2], position, sizeof(crossing[0]));
+                if (k % 2) {
+                        ck_assert_int_eq(skips[0], 0);
+                        ck_assert(skips[1] > 0);
+                        ck_assert(samples[1] < samples[0]);
+                        int j;
+                        for (j = 0; j < 3; j++) {
+                                ck_assert_double_eq_tol(
+                                    crossing[1][j], crossing[0][j], 1E-06);
+                        }
+                }
+        }
+
+        /* Check the refinement of crossings */
+        unsigned long bisections[2];
+        for (k = 0; k < 6; k++) {
+                turtle_stepper_destroy(&stepper);
+                turtle_stepper_create(&stepper);
+                turtle_stepper_add_map(stepper, bump, 0.);
+                ck_assert_double_eq(turtle_stepper_precision_get(stepper),
+                    1E-08);
+                ck_assert_int_eq(turtle_stepper_refinement_get(stepper),
+                    TURTLE_STEPPER_REFINEMENT_BISECTION);
+                const double precision = (k < 4) ? 1E-08 : 1E-03;
+                turtle_stepper_precision_set(stepper, precision);
+                ck_assert_double_eq(turtle_stepper_precision_get(stepper),
+                    precision);
+                const enum turtle_stepper_refinement refinement = (k % 2) ?
+                    TURTLE_STEPPER_REFINEMENT_REGULA_FALSI :
+                    TURTLE_STEPPER_REFINEMENT_BISECTION;
+                turtle_stepper_refinement_set(stepper, refinement);
+                ck_assert_int_eq(
+                    turtle_stepper_refinement_get(stepper), refinement);
+
+                /* Go down into the bump, along two azimuths */
+                const double azimuth = (k / 2 == 1) ? 90. : 0.;
+                turtle_stepper_position(
+                    stepper, 45.5, 2.45, 3000., 0, position, &layer);
+                turtle_ecef_from_horizontal(
+                    45.5, 2.45, azimuth, -30., direction);
+                for (i = 0; i < 100000; i++) {
+                        turtle_stepper_step(stepper, position, direction, NULL,
+                            NULL, &altitude, ground_elevation, NULL, index);
+                        if (index[0] != 1) break;
+                }
+                ck_assert_int_eq(index[0], 0);
+                turtle_stepper_stats(stepper, &stats);
+                bisections[k % 2] = stats.bisections;
+                memcpy(crossing[k % 2], position, sizeof(crossing[0]));
+                if (k % 2) {
+                        ck_assert(bisections[1] < bisections[0]);
+                        int j;
+                        for (j = 0; j < 3; j++) {
+                                ck_assert_double_eq_tol(crossing[1][j],
+                                    crossing[0][j], 2. * precision);
+                        }
+                }
+        }
+
+        /* A modified map has no valid bounds anymore, until the stepper
+         * rebuilds them on its next access
+         */
+        turtle_stepper_destroy(&stepper);
+        turtle_stepper_create(&stepper);
+        turtle_stepper_add_map(stepper, bump, 0.);
+        turtle_stepper_pyramid_set(stepper, 1);
+        turtle_map_fill(bump, 0, 0, 0.);
+        ck_assert_int_eq(bump->pyramid->valid, TURTLE_MAP_PYRAMID_STALE);
+        turtle_stepper_position(
+            stepper, 45.5, 2.45, 5000., 0, position, &layer);
+        turtle_ecef_from_horizontal(45.5, 2.45, 90., -30., direction);
+        for (i = 0; i < 100000; i++) {
+                turtle_stepper_step(stepper, position, direction, NULL,
+                    NULL, &altitude, ground_elevation, NULL, index);
+                if (index[0] != 1) break;
+        }
+        ck_assert_int_eq(index[0], 0);
+        ck_assert_int_eq(bump->pyramid->valid, TURTLE_MAP_PYRAMID_VALID);
+        turtle_stepper_stats(stepper, &stats);
+        ck_assert(stats.skips > 0);
+
         /* Clean the memory */
         turtle_stepper_destroy(&stepper);
+        turtle_map_destroy(&bump);
         turtle_map_destroy(&geoid);
         turtle_map_destroy(&map);
         turtle_stack_destroy(&stack);
@@ -1032,6 +2737,34 @@ START_TEST (test_io_grd)
                 }
         }
 
+        /* Check the parsing of long lines */
+        fid = fopen("tests/geoid.grd", "w+");
+        fprintf(fid, "-90 90 0 360 15 30\n");
+        for (i = 0; i < 13; i++) {
+                const double latitude = i * 15 - 90;
+                const double c = cos(latitude * deg);
+                int j;
+                for (j = 0; j < 13; j++) {
+                        const double longitude = j * 30;
+                        fprintf(fid, " %.17g", 100 * c * cos(longitude * deg));
+                }
+        }
+        fputs("\n", fid);
+        fclose(fid);
+
+        struct turtle_map * other;
+        turtle_map_load(&other, "tests/geoid.grd");
+        for (i = 0; i < 13; i++) {
+                int j;
+                for (j = 0; j < 13; j++) {
+                        double x0, y0, z0, x1, y1, z1;
+                        turtle_map_node(geoid, j, i, &x0, &y0, &z0);
+                        turtle_map_node(other, j, i, &x1, &y1, &z1);
+                        ck_assert_double_eq_tol(z1, z0, 1E-02);
+                }
+        }
+        turtle_map_destroy(&other);
+
         /* Check the writing to a GRD map */
         turtle_map_fill(geoid, 0, 0, 1);
         double undulation;
@@ -1082,9 +2815,60 @@ START_TEST (test_io_hgt)
         double z;
         turtle_map_elevation(map, 3, 45, &z, NULL);
         ck_assert_double_eq_tol(z, 10, 1E-02);
+        turtle_map_destroy(&map);
 
-        /* Clean the memory */
+        /* Check the normalisation of the HGT map */
+        turtle_map_load(&map, "tests/N45E003.hgt");
+        ck_assert_int_eq(turtle_map_normalise(map), TURTLE_RETURN_SUCCESS);
+        ck_assert_int_eq(map->meta.layout, TURTLE_MAP_LAYOUT_INT16);
+        for (i = 0, k = 0; i < 3601; i++) {
+                int j;
+                for (j = 0; j < 3601; j++, k++) {
+                        if (((k % 100) == 0) || ((k % 101) == 0)) {
+                                double x, y, z;
+                                turtle_map_node(map, j, i, &x, &y, &z);
+                                const double z1 = ((k % 2) == 0) ? -1 : 1;
+                                ck_assert_double_eq(z, z1);
+                        }
+                }
+        }
+        turtle_map_fill(map, 0, 0, 10);
+        turtle_map_elevation(map, 3, 45, &z, NULL);
+        ck_assert_double_eq(z, 10);
+        turtle_map_destroy(&map);
+
+#ifndef TURTLE_NO_MMAP
+        /* Check the memory mapping of the HGT map */
+        struct turtle_error_context error_ = { .code = TURTLE_RETURN_SUCCESS };
+        ck_assert_int_eq(turtle_map_load_(&map, "tests/N45E003.hgt",
+                             TURTLE_MAP_LOAD_MMAP, &error_),
+            TURTLE_RETURN_SUCCESS);
+        ck_assert_ptr_ne(map->mapping, NULL);
+        ck_assert_ptr_ne(map->data, map->storage);
+
+        for (i = 0, k = 0; i < 3601; i++) {
+                int j;
+                for (j = 0; j < 3601; j++, k++) {
+                        if (((k % 100) == 0) || ((k % 101) == 0)) {
+                                double x, y, z;
+                                turtle_map_node(map, j, i, &x, &y, &z);
+                                const double z1 = ((k % 2) == 0) ? -1 : 1;
+                                ck_assert_double_eq_tol(z, z1, 1E-02);
+                        }
+                }
+        }
+
+        /* Check that modifications do not propagate to the file */
+        turtle_map_fill(map, 0, 0, 10);
+        turtle_map_elevation(map, 3, 45, &z, NULL);
+        ck_assert_double_eq_tol(z, 10, 1E-02);
         turtle_map_destroy(&map);
+
+        turtle_map_load(&map, "tests/N45E003.hgt");
+        turtle_map_elevation(map, 3, 45, &z, NULL);
+        ck_assert_double_eq_tol(z, -1, 1E-02);
+        turtle_map_destroy(&map);
+#endif
 }
 END_TEST
 #endif
@@ -1213,6 +2997,222 @@ END_TEST
 #endif
 
 
+#ifndef TURTLE_NO_TBC
+/* Row source reading a map, failing beyond a given row if any */
+struct map_source {
+        const struct turtle_map * map;
+        int rows;
+        int fail;
+};
+
+static int map_source(void * context, int iy, double * elevation)
+{
+        struct map_source * source = context;
+        if ((iy != source->rows) || (iy == source->fail)) return -1;
+        int ix;
+        for (ix = 0; ix < source->map->meta.nx; ix++) {
+                turtle_map_node(
+                    source->map, ix, iy, NULL, NULL, elevation + ix);
+        }
+        source->rows++;
+        return 0;
+}
+
+START_TEST (test_io_tbc)
+{
+        /* Create a map with a smooth relief and some noise, over partial
+         * blocks
+         */
+        const int nx = 201, ny = 157;
+        struct turtle_map * map;
+        struct turtle_map_info info = { nx, ny, { 3., 4. }, { 45., 46. },
+                { 0., 65535. } };
+        ck_assert_int_eq(turtle_map_create(&map, &info, NULL),
+            TURTLE_RETURN_SUCCESS);
+        int i, j;
+        for (i = 0; i < ny; i++) {
+                for (j = 0; j < nx; j++) {
+                        const double z = 1500. + 1000. * sin(0.05 * j) *
+                            cos(0.07 * i) + 0.1 * ((i * 31 + j * 17) % 7);
+                        turtle_map_fill(map, j, i, z);
+                }
+        }
+        turtle_map_fill(map, 0, 0, 0.);
+        turtle_map_fill(map, 1, 0, 65535.);
+        ck_assert_int_eq(turtle_map_dump(map, "tests/map.tbc"),
+            TURTLE_RETURN_SUCCESS);
+
+        /* Read back the map and check that it is lossless */
+        struct turtle_map * tbc;
+        ck_assert_int_eq(turtle_map_load(&tbc, "tests/map.tbc"),
+            TURTLE_RETURN_SUCCESS);
+        ck_assert_str_eq(tbc->meta.encoding, "tbc");
+        ck_assert_int_eq(tbc->meta.nx, nx);
+        ck_assert_int_eq(tbc->meta.ny, ny);
+        ck_assert(turtle_map_bytes_(tbc) < turtle_map_bytes_(map) / 2);
+        for (i = 0; i < ny; i++) {
+                for (j = 0; j < nx; j++) {
+                        double x0, y0, z0, x1, y1, z1;
+                        turtle_map_node(map, j, i, &x0, &y0, &z0);
+                        turtle_map_node(tbc, j, i, &x1, &y1, &z1);
+                        ck_assert_double_eq(x1, x0);
+                        ck_assert_double_eq(y1, y0);
+                        ck_assert_double_eq(z1, z0);
+                }
+        }
+        for (i = 0; i < 100; i++) {
+                const double x = 3. + 0.0101 * i, y = 45. + 0.0097 * i;
+                double z0, z1;
+                turtle_map_elevation(map, x, y, &z0, NULL);
+                turtle_map_elevation(tbc, x, y, &z1, NULL);
+                ck_assert_double_eq(z1, z0);
+        }
+
+        /* Check that the compressed map is read only and left raw */
+        ck_assert_int_eq(turtle_map_normalise(tbc), TURTLE_RETURN_SUCCESS);
+        ck_assert_int_eq(tbc->meta.layout, TURTLE_MAP_LAYOUT_RAW);
+        {
+                turtle_error_handler_t * handler = turtle_error_handler_get();
+                turtle_error_handler_set(&catch_error);
+                ck_assert_int_eq(turtle_map_fill(tbc, 0, 0, 10.),
+                    TURTLE_RETURN_BAD_FORMAT);
+                turtle_error_handler_set(handler);
+        }
+        turtle_map_destroy(&tbc);
+
+        /* Check that a smooth slope is compressed with the planar
+         * predictor, with null residuals
+         */
+        {
+                struct turtle_map * slope;
+                struct turtle_map_info slope_info = { nx, ny, { 3., 4. },
+                        { 45., 46. }, { 0., 65535. } };
+                ck_assert_int_eq(turtle_map_create(&slope, &slope_info, NULL),
+                    TURTLE_RETURN_SUCCESS);
+                for (i = 0; i < ny; i++) {
+                        for (j = 0; j < nx; j++)
+                                turtle_map_fill(slope, j, i, 7. * i + 3. * j);
+                }
+                ck_assert_int_eq(turtle_map_dump(slope, "tests/slope.tbc"),
+                    TURTLE_RETURN_SUCCESS);
+                ck_assert_int_eq(turtle_map_load(&tbc, "tests/slope.tbc"),
+                    TURTLE_RETURN_SUCCESS);
+                ck_assert(
+                    turtle_map_bytes_(tbc) < turtle_map_bytes_(slope) / 8);
+                for (i = 0; i < ny; i++) {
+                        for (j = 0; j < nx; j++) {
+                                double z;
+                                turtle_map_node(tbc, j, i, NULL, NULL, &z);
+                                ck_assert_double_eq(z, 7. * i + 3. * j);
+                        }
+                }
+                turtle_map_destroy(&tbc);
+                turtle_map_destroy(&slope);
+                remove("tests/slope.tbc");
+        }
+
+#ifndef TURTLE_NO_MMAP
+        /* Check the memory mapping of the compressed map */
+        struct turtle_error_context error_ = { .code = TURTLE_RETURN_SUCCESS };
+        ck_assert_int_eq(turtle_map_load_(&tbc, "tests/map.tbc",
+                             TURTLE_MAP_LOAD_MMAP, &error_),
+            TURTLE_RETURN_SUCCESS);
+        ck_assert_ptr_ne(tbc->mapping, NULL);
+        for (i = 0; i < ny; i += 3) {
+                for (j = 0; j < nx; j += 5) {
+                        double z0, z1;
+                        turtle_map_node(map, j, i, NULL, NULL, &z0);
+                        turtle_map_node(tbc, j, i, NULL, NULL, &z1);
+                        ck_assert_double_eq(z1, z0);
+                }
+        }
+        turtle_map_destroy(&tbc);
+#endif
+
+        /* Check the streaming of a map, row by row */
+        struct map_source source = { map, 0, -1 };
+        ck_assert_int_eq(turtle_map_write("tests/stream.tbc", &info, NULL,
+                             &map_source, &source),
+            TURTLE_RETURN_SUCCESS);
+        ck_assert_int_eq(source.rows, ny);
+        ck_assert_int_eq(turtle_map_open(&tbc, "tests/stream.tbc"),
+            TURTLE_RETURN_SUCCESS);
+#ifndef TURTLE_NO_MMAP
+        ck_assert_ptr_ne(tbc->mapping, NULL);
+#endif
+        ck_assert_int_eq(tbc->meta.nx, nx);
+        ck_assert_int_eq(tbc->meta.ny, ny);
+
+        /* Convert the opened map, and check the result */
+        ck_assert_int_eq(turtle_map_dump(tbc, "tests/convert.tbc"),
+            TURTLE_RETURN_SUCCESS);
+        struct turtle_map * converted;
+        ck_assert_int_eq(turtle_map_open(&converted, "tests/convert.tbc"),
+            TURTLE_RETURN_SUCCESS);
+        for (i = 0; i < ny; i++) {
+                for (j = 0; j < nx; j++) {
+                        double x0, y0, z0, x1, y1, z1, z2;
+                        turtle_map_node(map, j, i, &x0, &y0, &z0);
+                        turtle_map_node(tbc, j, i, &x1, &y1, &z1);
+                        turtle_map_node(converted, j, i, NULL, NULL, &z2);
+                        ck_assert_double_eq_tol(x1, x0, 1E-12);
+                        ck_assert_double_eq_tol(y1, y0, 1E-12);
+                        ck_assert_double_eq(z1, z0);
+                        ck_assert_double_eq(z2, z0);
+                }
+        }
+        turtle_map_destroy(&converted);
+        turtle_map_destroy(&tbc);
+        remove("tests/convert.tbc");
+
+        /* Check the errors */
+        {
+                turtle_error_handler_t * handler = turtle_error_handler_get();
+                turtle_error_handler_set(&catch_error);
+#if !defined(TURTLE_NO_MMAP) && !defined(TURTLE_NO_PNG)
+                ck_assert_int_eq(turtle_map_dump(map, "tests/stream.png"),
+                    TURTLE_RETURN_SUCCESS);
+                ck_assert_int_eq(turtle_map_open(&tbc, "tests/stream.png"),
+                    TURTLE_RETURN_BAD_FORMAT);
+                ck_assert_ptr_null(tbc);
+                remove("tests/stream.png");
+#endif
+                source.rows = 0;
+                ck_assert_int_eq(turtle_map_write("tests/stream.png", &info,
+                                     NULL, &map_source, &source),
+                    TURTLE_RETURN_BAD_FORMAT);
+                ck_assert_int_eq(source.rows, 0);
+                source.fail = 100;
+                ck_assert_int_eq(turtle_map_write("tests/stream.tbc", &info,
+                                     NULL, &map_source, &source),
+                    TURTLE_RETURN_PATH_ERROR);
+                ck_assert_int_eq(source.rows, 100);
+                ck_assert_ptr_null(fopen("tests/stream.tbc", "rb"));
+                turtle_error_handler_set(handler);
+        }
+
+        /* Check the loading of a truncated file */
+        char header[40];
+        FILE * fid = fopen("tests/map.tbc", "rb");
+        ck_assert_int_eq(fread(header, 1, sizeof(header), fid), 40);
+        fclose(fid);
+        fid = fopen("tests/map.tbc", "wb");
+        fwrite(header, 1, sizeof(header), fid);
+        fclose(fid);
+        {
+                turtle_error_handler_t * handler = turtle_error_handler_get();
+                turtle_error_handler_set(&catch_error);
+                ck_assert_int_eq(turtle_map_load(&tbc, "tests/map.tbc"),
+                    TURTLE_RETURN_BAD_FORMAT);
+                turtle_error_handler_set(handler);
+        }
+
+        turtle_map_destroy(&map);
+}
+END_TEST
+#endif
+
+
 START_TEST (test_strfunc)
 {
 #define CHECK_API(FUNCTION)                                                    \
@@ -1223,51 +3223,116 @@ START_TEST (test_strfunc)
         CHECK_API(turtle_client_create);
         CHECK_API(turtle_client_destroy);
         CHECK_API(turtle_client_elevation);
+        CHECK_API(turtle_client_elevation_batch);
+        CHECK_API(turtle_client_elevation_gradient);
+        CHECK_API(turtle_client_elevation_v);
+        CHECK_API(turtle_client_gradient);
+        CHECK_API(turtle_client_stats);
+        CHECK_API(turtle_client_stats_reset);
+        CHECK_API(turtle_client_tiles_get);
+        CHECK_API(turtle_client_tiles_set);
 
         CHECK_API(turtle_ecef_from_geodetic);
+        CHECK_API(turtle_ecef_from_geodetic_v);
         CHECK_API(turtle_ecef_from_horizontal);
+        CHECK_API(turtle_ecef_from_horizontal_v);
         CHECK_API(turtle_ecef_to_geodetic);
+        CHECK_API(turtle_ecef_to_geodetic_v);
         CHECK_API(turtle_ecef_to_horizontal);
+        CHECK_API(turtle_ecef_to_horizontal_v);
 
         CHECK_API(turtle_error_function);
         CHECK_API(turtle_error_handler_get);
         CHECK_API(turtle_error_handler_set);
+        CHECK_API(turtle_error_thread_handler_clear);
+        CHECK_API(turtle_error_thread_handler_get);
+        CHECK_API(turtle_error_thread_handler_set);
 
+        CHECK_API(turtle_map_block);
         CHECK_API(turtle_map_create);
         CHECK_API(turtle_map_destroy);
         CHECK_API(turtle_map_dump);
         CHECK_API(turtle_map_elevation);
+        CHECK_API(turtle_map_elevation_gradient);
+        CHECK_API(turtle_map_elevation_v);
         CHECK_API(turtle_map_fill);
+        CHECK_API(turtle_map_gradient);
+        CHECK_API(turtle_map_intersect);
         CHECK_API(turtle_map_load);
         CHECK_API(turtle_map_meta);
         CHECK_API(turtle_map_node);
+        CHECK_API(turtle_map_normalise);
+        CHECK_API(turtle_map_open);
         CHECK_API(turtle_map_projection);
+        CHECK_API(turtle_map_reproject);
+        CHECK_API(turtle_map_write);
 
         CHECK_API(turtle_projection_configure);
         CHECK_API(turtle_projection_create);
         CHECK_API(turtle_projection_destroy);
         CHECK_API(turtle_projection_name);
         CHECK_API(turtle_projection_project);
+        CHECK_API(turtle_projection_project_v);
         CHECK_API(turtle_projection_unproject);
+        CHECK_API(turtle_projection_unproject_v);
 
+        CHECK_API(turtle_stack_block_get);
+        CHECK_API(turtle_stack_block_set);
+        CHECK_API(turtle_stack_budget_get);
+        CHECK_API(turtle_stack_budget_set);
         CHECK_API(turtle_stack_clear);
         CHECK_API(turtle_stack_create);
+        CHECK_API(turtle_stack_create_remote);
         CHECK_API(turtle_stack_destroy);
         CHECK_API(turtle_stack_elevation);
+        CHECK_API(turtle_stack_elevation_gradient);
+        CHECK_API(turtle_stack_elevation_v);
+        CHECK_API(turtle_stack_gradient);
+        CHECK_API(turtle_stack_hook_set);
+        CHECK_API(turtle_stack_index_dump);
         CHECK_API(turtle_stack_load);
+        CHECK_API(turtle_stack_lock_set);
+        CHECK_API(turtle_stack_mmap_get);
+        CHECK_API(turtle_stack_mmap_set);
+        CHECK_API(turtle_stack_normalise_get);
+        CHECK_API(turtle_stack_normalise_set);
+        CHECK_API(turtle_stack_policy_get);
+        CHECK_API(turtle_stack_policy_set);
+        CHECK_API(turtle_stack_prefetch);
+        CHECK_API(turtle_stack_prefetch_async_get);
+        CHECK_API(turtle_stack_prefetch_async_set);
+        CHECK_API(turtle_stack_preload);
+        CHECK_API(turtle_stack_shared_get);
+        CHECK_API(turtle_stack_shared_set);
+        CHECK_API(turtle_stack_shared_unlink);
+        CHECK_API(turtle_stack_stats);
+        CHECK_API(turtle_stack_stats_reset);
 
         CHECK_API(turtle_stepper_add_flat);
         CHECK_API(turtle_stepper_add_layer);
         CHECK_API(turtle_stepper_add_map);
         CHECK_API(turtle_stepper_add_stack);
+        CHECK_API(turtle_stepper_clone);
         CHECK_API(turtle_stepper_create);
         CHECK_API(turtle_stepper_destroy);
         CHECK_API(turtle_stepper_geoid_get);
         CHECK_API(turtle_stepper_geoid_set);
+        CHECK_API(turtle_stepper_pyramid_get);
+        CHECK_API(turtle_stepper_pyramid_set);
         CHECK_API(turtle_stepper_range_get);
         CHECK_API(turtle_stepper_range_set);
+        CHECK_API(turtle_stepper_refinement_get);
+        CHECK_API(turtle_stepper_refinement_set);
         CHECK_API(turtle_stepper_position);
+        CHECK_API(turtle_stepper_precision_get);
+        CHECK_API(turtle_stepper_precision_set);
+        CHECK_API(turtle_stepper_state_create);
+        CHECK_API(turtle_stepper_state_destroy);
         CHECK_API(turtle_stepper_step);
+        CHECK_API(turtle_stepper_step_n);
+        CHECK_API(turtle_stepper_step_state);
+        CHECK_API(turtle_stepper_stats);
+        CHECK_API(turtle_stepper_stats_reset);
 
         const char * s =
             turtle_error_function((turtle_function_t *)&nothing);
@@ -1319,6 +3384,9 @@ Suite * create_suite(void)
 #ifndef TURTLE_NO_ASC
         tcase_add_test(tc_io, test_io_asc);
 #endif
+#ifndef TURTLE_NO_TBC
+        tcase_add_test(tc_io, test_io_tbc);
+#endif
 
         return suite;
 }